@@ -1,6 +1,7 @@
 /*
 
-This is an implementation of the AES algorithm, specifically ECB, CTR and CBC mode.
+This is an implementation of the AES algorithm, specifically ECB, CTR and CBC mode,
+and the OCB authenticated encryption mode.
 Block size can be chosen in aes.h - available choices are AES128, AES192, AES256.
 
 The implementation is verified against the test vectors in:
@@ -62,6 +63,14 @@ NOTE:   String length must be evenly divisible by 16byte (str_len % 16 == 0)
   #define MULTIPLY_AS_A_FUNCTION 0
 #endif
 
+// SBOX_CIRCUIT replaces the sbox/rsbox lookup tables by a Boyar-Peralta style
+// logic circuit evaluated on bit planes. That makes SubBytes() constant-time
+// and drops the 512 bytes of tables, at some cost in speed.
+// AES_ECB_encrypt_ct() uses the circuit either way.
+#ifndef SBOX_CIRCUIT
+  #define SBOX_CIRCUIT 0
+#endif
+
 
 
 
@@ -76,6 +85,7 @@ typedef uint8_t state_t[4][4];
 // The lookup-tables are marked const so they can be placed in read-only storage instead of RAM
 // The numbers below can be computed dynamically trading ROM for RAM - 
 // This can be useful in (embedded) bootloader applications, where ROM is often limited.
+#if !(defined(SBOX_CIRCUIT) && (SBOX_CIRCUIT == 1))
 static const uint8_t sbox[256] = {
   //0     1    2      3     4    5     6     7      8    9     A      B    C     D     E     F
   0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
@@ -112,6 +122,7 @@ static const uint8_t rsbox[256] = {
   0x60, 0x51, 0x7f, 0xa9, 0x19, 0xb5, 0x4a, 0x0d, 0x2d, 0xe5, 0x7a, 0x9f, 0x93, 0xc9, 0x9c, 0xef,
   0xa0, 0xe0, 0x3b, 0x4d, 0xae, 0x2a, 0xf5, 0xb0, 0xc8, 0xeb, 0xbb, 0x3c, 0x83, 0x53, 0x99, 0x61,
   0x17, 0x2b, 0x04, 0x7e, 0xba, 0x77, 0xd6, 0x26, 0xe1, 0x69, 0x14, 0x63, 0x55, 0x21, 0x0c, 0x7d };
+#endif // #if !(defined(SBOX_CIRCUIT) && (SBOX_CIRCUIT == 1))
 
 // The round constant word array, Rcon[i], contains the values given by 
 // x to the power (i-1) being powers of x (x is denoted as {02}) in the field GF(2^8)
@@ -128,10 +139,430 @@ static const uint8_t Rcon[11] = {
  *  up to rcon[8] for AES-192, up to rcon[7] for AES-256. rcon[0] is not used in AES algorithm."
  */
 
+#if defined(SECDED) && (SECDED == 1)
+// Tables for the SEC-DED protected engine, see SecdedCorrect() below.
+// A column's code has six Hamming check bits over its 32 data bits, which sit
+// at the non-power-of-two positions 3..38 (data bit 8r+b is bit b of row r),
+// plus an overall parity bit as bit 6. The code is linear, so the code of a
+// column is the XOR of the per-row entries of its four bytes.
+// secded_row[r][x]: code of a column that holds byte x in row r and zeros elsewhere.
+static const uint8_t secded_row[4][256] = {
+  {
+    0x00, 0x43, 0x45, 0x06, 0x46, 0x05, 0x03, 0x40, 0x07, 0x44, 0x42, 0x01, 0x41, 0x02, 0x04, 0x47,
+    0x49, 0x0a, 0x0c, 0x4f, 0x0f, 0x4c, 0x4a, 0x09, 0x4e, 0x0d, 0x0b, 0x48, 0x08, 0x4b, 0x4d, 0x0e,
+    0x4a, 0x09, 0x0f, 0x4c, 0x0c, 0x4f, 0x49, 0x0a, 0x4d, 0x0e, 0x08, 0x4b, 0x0b, 0x48, 0x4e, 0x0d,
+    0x03, 0x40, 0x46, 0x05, 0x45, 0x06, 0x00, 0x43, 0x04, 0x47, 0x41, 0x02, 0x42, 0x01, 0x07, 0x44,
+    0x0b, 0x48, 0x4e, 0x0d, 0x4d, 0x0e, 0x08, 0x4b, 0x0c, 0x4f, 0x49, 0x0a, 0x4a, 0x09, 0x0f, 0x4c,
+    0x42, 0x01, 0x07, 0x44, 0x04, 0x47, 0x41, 0x02, 0x45, 0x06, 0x00, 0x43, 0x03, 0x40, 0x46, 0x05,
+    0x41, 0x02, 0x04, 0x47, 0x07, 0x44, 0x42, 0x01, 0x46, 0x05, 0x03, 0x40, 0x00, 0x43, 0x45, 0x06,
+    0x08, 0x4b, 0x4d, 0x0e, 0x4e, 0x0d, 0x0b, 0x48, 0x0f, 0x4c, 0x4a, 0x09, 0x49, 0x0a, 0x0c, 0x4f,
+    0x4c, 0x0f, 0x09, 0x4a, 0x0a, 0x49, 0x4f, 0x0c, 0x4b, 0x08, 0x0e, 0x4d, 0x0d, 0x4e, 0x48, 0x0b,
+    0x05, 0x46, 0x40, 0x03, 0x43, 0x00, 0x06, 0x45, 0x02, 0x41, 0x47, 0x04, 0x44, 0x07, 0x01, 0x42,
+    0x06, 0x45, 0x43, 0x00, 0x40, 0x03, 0x05, 0x46, 0x01, 0x42, 0x44, 0x07, 0x47, 0x04, 0x02, 0x41,
+    0x4f, 0x0c, 0x0a, 0x49, 0x09, 0x4a, 0x4c, 0x0f, 0x48, 0x0b, 0x0d, 0x4e, 0x0e, 0x4d, 0x4b, 0x08,
+    0x47, 0x04, 0x02, 0x41, 0x01, 0x42, 0x44, 0x07, 0x40, 0x03, 0x05, 0x46, 0x06, 0x45, 0x43, 0x00,
+    0x0e, 0x4d, 0x4b, 0x08, 0x48, 0x0b, 0x0d, 0x4e, 0x09, 0x4a, 0x4c, 0x0f, 0x4f, 0x0c, 0x0a, 0x49,
+    0x0d, 0x4e, 0x48, 0x0b, 0x4b, 0x08, 0x0e, 0x4d, 0x0a, 0x49, 0x4f, 0x0c, 0x4c, 0x0f, 0x09, 0x4a,
+    0x44, 0x07, 0x01, 0x42, 0x02, 0x41, 0x47, 0x04, 0x43, 0x00, 0x06, 0x45, 0x05, 0x46, 0x40, 0x03
+  },
+  {
+    0x00, 0x0d, 0x0e, 0x03, 0x4f, 0x42, 0x41, 0x4c, 0x51, 0x5c, 0x5f, 0x52, 0x1e, 0x13, 0x10, 0x1d,
+    0x52, 0x5f, 0x5c, 0x51, 0x1d, 0x10, 0x13, 0x1e, 0x03, 0x0e, 0x0d, 0x00, 0x4c, 0x41, 0x42, 0x4f,
+    0x13, 0x1e, 0x1d, 0x10, 0x5c, 0x51, 0x52, 0x5f, 0x42, 0x4f, 0x4c, 0x41, 0x0d, 0x00, 0x03, 0x0e,
+    0x41, 0x4c, 0x4f, 0x42, 0x0e, 0x03, 0x00, 0x0d, 0x10, 0x1d, 0x1e, 0x13, 0x5f, 0x52, 0x51, 0x5c,
+    0x54, 0x59, 0x5a, 0x57, 0x1b, 0x16, 0x15, 0x18, 0x05, 0x08, 0x0b, 0x06, 0x4a, 0x47, 0x44, 0x49,
+    0x06, 0x0b, 0x08, 0x05, 0x49, 0x44, 0x47, 0x4a, 0x57, 0x5a, 0x59, 0x54, 0x18, 0x15, 0x16, 0x1b,
+    0x47, 0x4a, 0x49, 0x44, 0x08, 0x05, 0x06, 0x0b, 0x16, 0x1b, 0x18, 0x15, 0x59, 0x54, 0x57, 0x5a,
+    0x15, 0x18, 0x1b, 0x16, 0x5a, 0x57, 0x54, 0x59, 0x44, 0x49, 0x4a, 0x47, 0x0b, 0x06, 0x05, 0x08,
+    0x15, 0x18, 0x1b, 0x16, 0x5a, 0x57, 0x54, 0x59, 0x44, 0x49, 0x4a, 0x47, 0x0b, 0x06, 0x05, 0x08,
+    0x47, 0x4a, 0x49, 0x44, 0x08, 0x05, 0x06, 0x0b, 0x16, 0x1b, 0x18, 0x15, 0x59, 0x54, 0x57, 0x5a,
+    0x06, 0x0b, 0x08, 0x05, 0x49, 0x44, 0x47, 0x4a, 0x57, 0x5a, 0x59, 0x54, 0x18, 0x15, 0x16, 0x1b,
+    0x54, 0x59, 0x5a, 0x57, 0x1b, 0x16, 0x15, 0x18, 0x05, 0x08, 0x0b, 0x06, 0x4a, 0x47, 0x44, 0x49,
+    0x41, 0x4c, 0x4f, 0x42, 0x0e, 0x03, 0x00, 0x0d, 0x10, 0x1d, 0x1e, 0x13, 0x5f, 0x52, 0x51, 0x5c,
+    0x13, 0x1e, 0x1d, 0x10, 0x5c, 0x51, 0x52, 0x5f, 0x42, 0x4f, 0x4c, 0x41, 0x0d, 0x00, 0x03, 0x0e,
+    0x52, 0x5f, 0x5c, 0x51, 0x1d, 0x10, 0x13, 0x1e, 0x03, 0x0e, 0x0d, 0x00, 0x4c, 0x41, 0x42, 0x4f,
+    0x00, 0x0d, 0x0e, 0x03, 0x4f, 0x42, 0x41, 0x4c, 0x51, 0x5c, 0x5f, 0x52, 0x1e, 0x13, 0x10, 0x1d
+  },
+  {
+    0x00, 0x16, 0x57, 0x41, 0x58, 0x4e, 0x0f, 0x19, 0x19, 0x0f, 0x4e, 0x58, 0x41, 0x57, 0x16, 0x00,
+    0x1a, 0x0c, 0x4d, 0x5b, 0x42, 0x54, 0x15, 0x03, 0x03, 0x15, 0x54, 0x42, 0x5b, 0x4d, 0x0c, 0x1a,
+    0x5b, 0x4d, 0x0c, 0x1a, 0x03, 0x15, 0x54, 0x42, 0x42, 0x54, 0x15, 0x03, 0x1a, 0x0c, 0x4d, 0x5b,
+    0x41, 0x57, 0x16, 0x00, 0x19, 0x0f, 0x4e, 0x58, 0x58, 0x4e, 0x0f, 0x19, 0x00, 0x16, 0x57, 0x41,
+    0x1c, 0x0a, 0x4b, 0x5d, 0x44, 0x52, 0x13, 0x05, 0x05, 0x13, 0x52, 0x44, 0x5d, 0x4b, 0x0a, 0x1c,
+    0x06, 0x10, 0x51, 0x47, 0x5e, 0x48, 0x09, 0x1f, 0x1f, 0x09, 0x48, 0x5e, 0x47, 0x51, 0x10, 0x06,
+    0x47, 0x51, 0x10, 0x06, 0x1f, 0x09, 0x48, 0x5e, 0x5e, 0x48, 0x09, 0x1f, 0x06, 0x10, 0x51, 0x47,
+    0x5d, 0x4b, 0x0a, 0x1c, 0x05, 0x13, 0x52, 0x44, 0x44, 0x52, 0x13, 0x05, 0x1c, 0x0a, 0x4b, 0x5d,
+    0x5d, 0x4b, 0x0a, 0x1c, 0x05, 0x13, 0x52, 0x44, 0x44, 0x52, 0x13, 0x05, 0x1c, 0x0a, 0x4b, 0x5d,
+    0x47, 0x51, 0x10, 0x06, 0x1f, 0x09, 0x48, 0x5e, 0x5e, 0x48, 0x09, 0x1f, 0x06, 0x10, 0x51, 0x47,
+    0x06, 0x10, 0x51, 0x47, 0x5e, 0x48, 0x09, 0x1f, 0x1f, 0x09, 0x48, 0x5e, 0x47, 0x51, 0x10, 0x06,
+    0x1c, 0x0a, 0x4b, 0x5d, 0x44, 0x52, 0x13, 0x05, 0x05, 0x13, 0x52, 0x44, 0x5d, 0x4b, 0x0a, 0x1c,
+    0x41, 0x57, 0x16, 0x00, 0x19, 0x0f, 0x4e, 0x58, 0x58, 0x4e, 0x0f, 0x19, 0x00, 0x16, 0x57, 0x41,
+    0x5b, 0x4d, 0x0c, 0x1a, 0x03, 0x15, 0x54, 0x42, 0x42, 0x54, 0x15, 0x03, 0x1a, 0x0c, 0x4d, 0x5b,
+    0x1a, 0x0c, 0x4d, 0x5b, 0x42, 0x54, 0x15, 0x03, 0x03, 0x15, 0x54, 0x42, 0x5b, 0x4d, 0x0c, 0x1a,
+    0x00, 0x16, 0x57, 0x41, 0x58, 0x4e, 0x0f, 0x19, 0x19, 0x0f, 0x4e, 0x58, 0x41, 0x57, 0x16, 0x00
+  },
+  {
+    0x00, 0x5e, 0x1f, 0x41, 0x61, 0x3f, 0x7e, 0x20, 0x62, 0x3c, 0x7d, 0x23, 0x03, 0x5d, 0x1c, 0x42,
+    0x23, 0x7d, 0x3c, 0x62, 0x42, 0x1c, 0x5d, 0x03, 0x41, 0x1f, 0x5e, 0x00, 0x20, 0x7e, 0x3f, 0x61,
+    0x64, 0x3a, 0x7b, 0x25, 0x05, 0x5b, 0x1a, 0x44, 0x06, 0x58, 0x19, 0x47, 0x67, 0x39, 0x78, 0x26,
+    0x47, 0x19, 0x58, 0x06, 0x26, 0x78, 0x39, 0x67, 0x25, 0x7b, 0x3a, 0x64, 0x44, 0x1a, 0x5b, 0x05,
+    0x25, 0x7b, 0x3a, 0x64, 0x44, 0x1a, 0x5b, 0x05, 0x47, 0x19, 0x58, 0x06, 0x26, 0x78, 0x39, 0x67,
+    0x06, 0x58, 0x19, 0x47, 0x67, 0x39, 0x78, 0x26, 0x64, 0x3a, 0x7b, 0x25, 0x05, 0x5b, 0x1a, 0x44,
+    0x41, 0x1f, 0x5e, 0x00, 0x20, 0x7e, 0x3f, 0x61, 0x23, 0x7d, 0x3c, 0x62, 0x42, 0x1c, 0x5d, 0x03,
+    0x62, 0x3c, 0x7d, 0x23, 0x03, 0x5d, 0x1c, 0x42, 0x00, 0x5e, 0x1f, 0x41, 0x61, 0x3f, 0x7e, 0x20,
+    0x26, 0x78, 0x39, 0x67, 0x47, 0x19, 0x58, 0x06, 0x44, 0x1a, 0x5b, 0x05, 0x25, 0x7b, 0x3a, 0x64,
+    0x05, 0x5b, 0x1a, 0x44, 0x64, 0x3a, 0x7b, 0x25, 0x67, 0x39, 0x78, 0x26, 0x06, 0x58, 0x19, 0x47,
+    0x42, 0x1c, 0x5d, 0x03, 0x23, 0x7d, 0x3c, 0x62, 0x20, 0x7e, 0x3f, 0x61, 0x41, 0x1f, 0x5e, 0x00,
+    0x61, 0x3f, 0x7e, 0x20, 0x00, 0x5e, 0x1f, 0x41, 0x03, 0x5d, 0x1c, 0x42, 0x62, 0x3c, 0x7d, 0x23,
+    0x03, 0x5d, 0x1c, 0x42, 0x62, 0x3c, 0x7d, 0x23, 0x61, 0x3f, 0x7e, 0x20, 0x00, 0x5e, 0x1f, 0x41,
+    0x20, 0x7e, 0x3f, 0x61, 0x41, 0x1f, 0x5e, 0x00, 0x42, 0x1c, 0x5d, 0x03, 0x23, 0x7d, 0x3c, 0x62,
+    0x67, 0x39, 0x78, 0x26, 0x06, 0x58, 0x19, 0x47, 0x05, 0x5b, 0x1a, 0x44, 0x64, 0x3a, 0x7b, 0x25,
+    0x44, 0x1a, 0x5b, 0x05, 0x25, 0x7b, 0x3a, 0x64, 0x26, 0x78, 0x39, 0x67, 0x47, 0x19, 0x58, 0x06
+  }
+};
+
+// secded_round[r][x]: contribution of input byte x in row r to the code of its
+// output column after SubBytes and MixColumns.
+static const uint8_t secded_round[4][256] = {
+  {
+    0x7b, 0x13, 0x2d, 0x7e, 0x07, 0x3b, 0x28, 0x2d, 0x47, 0x1f, 0x68, 0x3c, 0x54, 0x09, 0x1a, 0x32,
+    0x00, 0x47, 0x7e, 0x0c, 0x47, 0x1d, 0x6a, 0x66, 0x68, 0x77, 0x45, 0x09, 0x30, 0x37, 0x21, 0x21,
+    0x0c, 0x2a, 0x1d, 0x70, 0x35, 0x6a, 0x0b, 0x72, 0x54, 0x28, 0x2f, 0x79, 0x5f, 0x24, 0x58, 0x49,
+    0x13, 0x4c, 0x7c, 0x5f, 0x05, 0x11, 0x0c, 0x42, 0x6d, 0x24, 0x26, 0x42, 0x1d, 0x6f, 0x00, 0x4c,
+    0x5f, 0x58, 0x51, 0x64, 0x7b, 0x37, 0x63, 0x24, 0x23, 0x79, 0x16, 0x1f, 0x5d, 0x5d, 0x2f, 0x35,
+    0x3c, 0x7b, 0x00, 0x6f, 0x02, 0x35, 0x7e, 0x7c, 0x24, 0x1f, 0x53, 0x18, 0x26, 0x54, 0x02, 0x0c,
+    0x64, 0x0e, 0x05, 0x58, 0x79, 0x4b, 0x39, 0x2a, 0x0b, 0x39, 0x61, 0x6d, 0x42, 0x14, 0x4e, 0x64,
+    0x5d, 0x5a, 0x07, 0x0b, 0x02, 0x2f, 0x07, 0x6a, 0x32, 0x13, 0x45, 0x1d, 0x45, 0x4b, 0x18, 0x05,
+    0x6d, 0x53, 0x3b, 0x70, 0x6f, 0x0e, 0x14, 0x28, 0x32, 0x49, 0x72, 0x0b, 0x16, 0x0e, 0x1a, 0x3e,
+    0x05, 0x39, 0x2a, 0x37, 0x63, 0x23, 0x63, 0x66, 0x75, 0x11, 0x21, 0x56, 0x56, 0x70, 0x3e, 0x5a,
+    0x23, 0x26, 0x66, 0x21, 0x58, 0x72, 0x11, 0x11, 0x40, 0x1a, 0x77, 0x64, 0x7c, 0x6f, 0x30, 0x1f,
+    0x4e, 0x61, 0x2a, 0x49, 0x6a, 0x68, 0x35, 0x7b, 0x56, 0x30, 0x75, 0x02, 0x09, 0x61, 0x16, 0x40,
+    0x40, 0x00, 0x0e, 0x30, 0x16, 0x56, 0x72, 0x53, 0x63, 0x28, 0x53, 0x68, 0x39, 0x2d, 0x18, 0x07,
+    0x40, 0x75, 0x6d, 0x77, 0x47, 0x7e, 0x14, 0x32, 0x1a, 0x4b, 0x2f, 0x3e, 0x54, 0x3e, 0x09, 0x51,
+    0x3c, 0x26, 0x23, 0x5a, 0x5a, 0x3b, 0x14, 0x70, 0x5d, 0x77, 0x4b, 0x7c, 0x13, 0x4e, 0x42, 0x49,
+    0x75, 0x3b, 0x79, 0x4c, 0x4c, 0x51, 0x66, 0x45, 0x18, 0x3c, 0x4e, 0x2d, 0x61, 0x51, 0x5f, 0x37
+  },
+  {
+    0x05, 0x26, 0x05, 0x4b, 0x13, 0x62, 0x4b, 0x7d, 0x03, 0x40, 0x2c, 0x09, 0x5d, 0x50, 0x76, 0x45,
+    0x77, 0x7b, 0x33, 0x66, 0x74, 0x65, 0x06, 0x17, 0x5b, 0x14, 0x51, 0x5f, 0x18, 0x7c, 0x6c, 0x14,
+    0x11, 0x19, 0x12, 0x07, 0x2e, 0x09, 0x7a, 0x5a, 0x2a, 0x3c, 0x57, 0x57, 0x28, 0x5a, 0x43, 0x40,
+    0x29, 0x79, 0x6e, 0x50, 0x4e, 0x7b, 0x69, 0x35, 0x6d, 0x2d, 0x7f, 0x3a, 0x1d, 0x47, 0x78, 0x01,
+    0x27, 0x3b, 0x64, 0x4a, 0x0a, 0x0b, 0x21, 0x55, 0x46, 0x20, 0x10, 0x38, 0x0d, 0x7a, 0x20, 0x56,
+    0x06, 0x7d, 0x00, 0x30, 0x2a, 0x59, 0x3c, 0x61, 0x22, 0x37, 0x36, 0x24, 0x08, 0x25, 0x25, 0x1e,
+    0x3d, 0x34, 0x36, 0x34, 0x2f, 0x65, 0x47, 0x16, 0x02, 0x30, 0x04, 0x62, 0x42, 0x4d, 0x5c, 0x32,
+    0x02, 0x11, 0x6b, 0x75, 0x52, 0x58, 0x64, 0x7e, 0x32, 0x51, 0x5e, 0x6a, 0x29, 0x1d, 0x53, 0x39,
+    0x1a, 0x4e, 0x6d, 0x70, 0x48, 0x3b, 0x42, 0x44, 0x3d, 0x38, 0x22, 0x0d, 0x68, 0x4c, 0x0e, 0x2c,
+    0x41, 0x3f, 0x61, 0x73, 0x2e, 0x49, 0x56, 0x18, 0x46, 0x74, 0x1b, 0x00, 0x77, 0x08, 0x23, 0x1e,
+    0x3e, 0x07, 0x60, 0x63, 0x4c, 0x2d, 0x03, 0x0c, 0x10, 0x79, 0x1b, 0x45, 0x16, 0x3f, 0x17, 0x4f,
+    0x53, 0x73, 0x6e, 0x4f, 0x71, 0x54, 0x21, 0x72, 0x0f, 0x6f, 0x3e, 0x5d, 0x28, 0x0b, 0x1f, 0x67,
+    0x1f, 0x0f, 0x43, 0x60, 0x67, 0x78, 0x55, 0x39, 0x59, 0x33, 0x41, 0x23, 0x48, 0x72, 0x5c, 0x1c,
+    0x68, 0x49, 0x15, 0x6c, 0x0c, 0x44, 0x3a, 0x4a, 0x01, 0x6a, 0x2f, 0x5b, 0x52, 0x54, 0x27, 0x1c,
+    0x7e, 0x70, 0x31, 0x69, 0x66, 0x1a, 0x35, 0x7f, 0x75, 0x63, 0x12, 0x19, 0x5e, 0x2b, 0x4d, 0x37,
+    0x31, 0x15, 0x58, 0x0e, 0x76, 0x13, 0x6f, 0x26, 0x2b, 0x71, 0x24, 0x0a, 0x7c, 0x6b, 0x5f, 0x04
+  },
+  {
+    0x4d, 0x6b, 0x1d, 0x41, 0x49, 0x31, 0x11, 0x66, 0x05, 0x49, 0x6d, 0x03, 0x15, 0x55, 0x3e, 0x54,
+    0x30, 0x7e, 0x3a, 0x22, 0x35, 0x77, 0x18, 0x0a, 0x5d, 0x5f, 0x0b, 0x1e, 0x11, 0x68, 0x74, 0x0f,
+    0x12, 0x1f, 0x47, 0x16, 0x66, 0x53, 0x20, 0x53, 0x25, 0x21, 0x13, 0x43, 0x7e, 0x03, 0x4c, 0x19,
+    0x20, 0x25, 0x7f, 0x05, 0x0c, 0x2e, 0x69, 0x72, 0x2a, 0x33, 0x3d, 0x39, 0x0c, 0x5f, 0x7b, 0x5e,
+    0x35, 0x37, 0x29, 0x4f, 0x06, 0x58, 0x7d, 0x48, 0x01, 0x73, 0x1c, 0x32, 0x40, 0x70, 0x23, 0x1d,
+    0x48, 0x36, 0x00, 0x6f, 0x75, 0x56, 0x71, 0x34, 0x78, 0x79, 0x27, 0x30, 0x0d, 0x6e, 0x3e, 0x59,
+    0x7f, 0x2c, 0x77, 0x7c, 0x38, 0x27, 0x0f, 0x54, 0x5b, 0x3f, 0x43, 0x61, 0x42, 0x59, 0x1b, 0x34,
+    0x0b, 0x42, 0x32, 0x6b, 0x0e, 0x58, 0x79, 0x63, 0x64, 0x5b, 0x40, 0x3c, 0x70, 0x5c, 0x00, 0x3c,
+    0x1a, 0x5c, 0x7a, 0x26, 0x14, 0x67, 0x12, 0x5a, 0x2f, 0x62, 0x28, 0x10, 0x67, 0x57, 0x45, 0x3d,
+    0x47, 0x74, 0x64, 0x23, 0x36, 0x4a, 0x4d, 0x41, 0x51, 0x65, 0x44, 0x50, 0x60, 0x5d, 0x76, 0x09,
+    0x7a, 0x46, 0x3a, 0x3f, 0x07, 0x63, 0x55, 0x1e, 0x4c, 0x75, 0x14, 0x04, 0x04, 0x24, 0x5a, 0x02,
+    0x50, 0x73, 0x2f, 0x52, 0x28, 0x16, 0x2d, 0x7d, 0x1b, 0x21, 0x2a, 0x45, 0x2e, 0x08, 0x57, 0x7c,
+    0x07, 0x4b, 0x1c, 0x6a, 0x2c, 0x2b, 0x18, 0x6c, 0x06, 0x6a, 0x17, 0x26, 0x44, 0x2d, 0x4b, 0x02,
+    0x37, 0x1a, 0x51, 0x24, 0x4e, 0x0a, 0x69, 0x1f, 0x0e, 0x6c, 0x68, 0x0d, 0x5e, 0x46, 0x65, 0x52,
+    0x33, 0x76, 0x31, 0x39, 0x72, 0x4a, 0x22, 0x6d, 0x3b, 0x6f, 0x17, 0x4f, 0x10, 0x2b, 0x09, 0x29,
+    0x61, 0x01, 0x08, 0x15, 0x6e, 0x19, 0x71, 0x3b, 0x7b, 0x78, 0x60, 0x56, 0x38, 0x62, 0x4e, 0x13
+  },
+  {
+    0x36, 0x61, 0x22, 0x7e, 0x5e, 0x40, 0x6a, 0x44, 0x05, 0x10, 0x1c, 0x78, 0x02, 0x5f, 0x3e, 0x32,
+    0x2d, 0x63, 0x18, 0x71, 0x28, 0x60, 0x27, 0x7b, 0x31, 0x6a, 0x58, 0x14, 0x24, 0x57, 0x18, 0x7e,
+    0x5c, 0x37, 0x4d, 0x34, 0x0a, 0x6c, 0x64, 0x22, 0x2f, 0x47, 0x7f, 0x6b, 0x2d, 0x36, 0x15, 0x04,
+    0x2a, 0x61, 0x0e, 0x4b, 0x48, 0x77, 0x3a, 0x2b, 0x1f, 0x1b, 0x46, 0x60, 0x06, 0x24, 0x66, 0x07,
+    0x66, 0x73, 0x67, 0x6d, 0x7d, 0x7a, 0x55, 0x7d, 0x23, 0x46, 0x4f, 0x76, 0x5d, 0x70, 0x52, 0x6c,
+    0x33, 0x50, 0x00, 0x09, 0x3b, 0x27, 0x53, 0x45, 0x50, 0x3d, 0x3a, 0x63, 0x6b, 0x64, 0x70, 0x17,
+    0x40, 0x2c, 0x2e, 0x38, 0x0d, 0x74, 0x30, 0x7c, 0x02, 0x1d, 0x25, 0x54, 0x06, 0x59, 0x11, 0x0b,
+    0x16, 0x48, 0x38, 0x2f, 0x5d, 0x34, 0x73, 0x41, 0x1f, 0x4c, 0x13, 0x2b, 0x3e, 0x12, 0x4e, 0x65,
+    0x32, 0x5c, 0x0b, 0x19, 0x6f, 0x67, 0x12, 0x21, 0x54, 0x62, 0x44, 0x49, 0x29, 0x4a, 0x58, 0x08,
+    0x03, 0x56, 0x51, 0x1c, 0x1e, 0x68, 0x78, 0x30, 0x37, 0x3c, 0x35, 0x14, 0x39, 0x7f, 0x43, 0x03,
+    0x45, 0x20, 0x56, 0x53, 0x5e, 0x0f, 0x11, 0x5a, 0x5b, 0x75, 0x21, 0x26, 0x68, 0x42, 0x6f, 0x5b,
+    0x5a, 0x08, 0x1a, 0x4f, 0x0a, 0x7a, 0x41, 0x1b, 0x5f, 0x09, 0x51, 0x16, 0x39, 0x6e, 0x04, 0x76,
+    0x10, 0x4b, 0x01, 0x42, 0x62, 0x72, 0x69, 0x71, 0x33, 0x0c, 0x17, 0x57, 0x7b, 0x0f, 0x05, 0x15,
+    0x3d, 0x7c, 0x79, 0x0c, 0x4e, 0x35, 0x74, 0x79, 0x13, 0x3f, 0x19, 0x25, 0x49, 0x6e, 0x72, 0x01,
+    0x55, 0x0d, 0x0e, 0x2e, 0x65, 0x26, 0x3f, 0x52, 0x3b, 0x47, 0x59, 0x23, 0x07, 0x3c, 0x4d, 0x29,
+    0x1a, 0x6d, 0x20, 0x4c, 0x2a, 0x4a, 0x1d, 0x75, 0x28, 0x1e, 0x77, 0x69, 0x43, 0x2c, 0x00, 0x31
+  }
+};
+
+// secded_bit[s]: data bit flagged by syndrome s, 0xfe if s points at a check bit,
+// 0xff if s cannot come from a single flip.
+static const uint8_t secded_bit[64] = {
+  0xfe, 0xfe, 0xfe, 0x00, 0xfe, 0x01, 0x02, 0x03, 0xfe, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a,
+  0xfe, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19,
+  0xfe, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+#endif // #if defined(SECDED) && (SECDED == 1)
+
 
 /*****************************************************************************/
 /* Private functions:                                                        */
 /*****************************************************************************/
+// The S-box circuit works on bit planes: q[k] holds bit k of every byte it
+// substitutes, so each logic operation below evaluates all of them at once
+// (SWAR). For a whole state, bit k of the byte in column c, row r sits at
+// bit 8r + c of q[k], which is what 4 masked shifts of the column words give.
+//
+// SboxCircuit() is the 113 gate circuit of Boyar and Peralta for
+// S(x) = A * x^-1 + 0x63. The inverse S-box reuses it, as
+// S^-1(x) = A^-1 * (S(A^-1 * (x + 0x63)) + 0x63), which only adds two inverse
+// affine maps. There are no table lookups and no branches on data, so the
+// running time does not depend on the data or the key.
+#if (defined(SBOX_CIRCUIT) && (SBOX_CIRCUIT == 1)) || (defined(ECB) && (ECB == 1))
+static void SboxCircuit(uint32_t* q)
+{
+  uint32_t x0, x1, x2, x3, x4, x5, x6, x7;
+  uint32_t y1, y2, y3, y4, y5, y6, y7, y8, y9;
+  uint32_t y10, y11, y12, y13, y14, y15, y16, y17, y18, y19;
+  uint32_t y20, y21;
+  uint32_t z0, z1, z2, z3, z4, z5, z6, z7, z8, z9;
+  uint32_t z10, z11, z12, z13, z14, z15, z16, z17;
+  uint32_t t0, t1, t2, t3, t4, t5, t6, t7, t8, t9;
+  uint32_t t10, t11, t12, t13, t14, t15, t16, t17, t18, t19;
+  uint32_t t20, t21, t22, t23, t24, t25, t26, t27, t28, t29;
+  uint32_t t30, t31, t32, t33, t34, t35, t36, t37, t38, t39;
+  uint32_t t40, t41, t42, t43, t44, t45, t46, t47, t48, t49;
+  uint32_t t50, t51, t52, t53, t54, t55, t56, t57, t58, t59;
+  uint32_t t60, t61, t62, t63, t64, t65, t66, t67;
+  uint32_t s0, s1, s2, s3, s4, s5, s6, s7;
+
+  // The circuit numbers bits from the most significant one.
+  x0 = q[7]; x1 = q[6]; x2 = q[5]; x3 = q[4];
+  x4 = q[3]; x5 = q[2]; x6 = q[1]; x7 = q[0];
+
+  // Top linear transformation.
+  y14 = x3 ^ x5;
+  y13 = x0 ^ x6;
+  y9 = x0 ^ x3;
+  y8 = x0 ^ x5;
+  t0 = x1 ^ x2;
+  y1 = t0 ^ x7;
+  y4 = y1 ^ x3;
+  y12 = y13 ^ y14;
+  y2 = y1 ^ x0;
+  y5 = y1 ^ x6;
+  y3 = y5 ^ y8;
+  t1 = x4 ^ y12;
+  y15 = t1 ^ x5;
+  y20 = t1 ^ x1;
+  y6 = y15 ^ x7;
+  y10 = y15 ^ t0;
+  y11 = y20 ^ y9;
+  y7 = x7 ^ y11;
+  y17 = y10 ^ y11;
+  y19 = y10 ^ y8;
+  y16 = t0 ^ y11;
+  y21 = y13 ^ y16;
+  y18 = x0 ^ y16;
+
+  // Non-linear section: inversion in GF(2^8) through GF(2^4).
+  t2 = y12 & y15;
+  t3 = y3 & y6;
+  t4 = t3 ^ t2;
+  t5 = y4 & x7;
+  t6 = t5 ^ t2;
+  t7 = y13 & y16;
+  t8 = y5 & y1;
+  t9 = t8 ^ t7;
+  t10 = y2 & y7;
+  t11 = t10 ^ t7;
+  t12 = y9 & y11;
+  t13 = y14 & y17;
+  t14 = t13 ^ t12;
+  t15 = y8 & y10;
+  t16 = t15 ^ t12;
+  t17 = t4 ^ t14;
+  t18 = t6 ^ t16;
+  t19 = t9 ^ t14;
+  t20 = t11 ^ t16;
+  t21 = t17 ^ y20;
+  t22 = t18 ^ y19;
+  t23 = t19 ^ y21;
+  t24 = t20 ^ y18;
+
+  t25 = t21 ^ t22;
+  t26 = t21 & t23;
+  t27 = t24 ^ t26;
+  t28 = t25 & t27;
+  t29 = t28 ^ t22;
+  t30 = t23 ^ t24;
+  t31 = t22 ^ t26;
+  t32 = t31 & t30;
+  t33 = t32 ^ t24;
+  t34 = t23 ^ t33;
+  t35 = t27 ^ t33;
+  t36 = t24 & t35;
+  t37 = t36 ^ t34;
+  t38 = t27 ^ t36;
+  t39 = t29 & t38;
+  t40 = t25 ^ t39;
+
+  t41 = t40 ^ t37;
+  t42 = t29 ^ t33;
+  t43 = t29 ^ t40;
+  t44 = t33 ^ t37;
+  t45 = t42 ^ t41;
+  z0 = t44 & y15;
+  z1 = t37 & y6;
+  z2 = t33 & x7;
+  z3 = t43 & y16;
+  z4 = t40 & y1;
+  z5 = t29 & y7;
+  z6 = t42 & y11;
+  z7 = t45 & y17;
+  z8 = t41 & y10;
+  z9 = t44 & y12;
+  z10 = t37 & y3;
+  z11 = t33 & y4;
+  z12 = t43 & y13;
+  z13 = t40 & y5;
+  z14 = t29 & y2;
+  z15 = t42 & y9;
+  z16 = t45 & y14;
+  z17 = t41 & y8;
+
+  // Bottom linear transformation.
+  t46 = z15 ^ z16;
+  t47 = z10 ^ z11;
+  t48 = z5 ^ z13;
+  t49 = z9 ^ z10;
+  t50 = z2 ^ z12;
+  t51 = z2 ^ z5;
+  t52 = z7 ^ z8;
+  t53 = z0 ^ z3;
+  t54 = z6 ^ z7;
+  t55 = z16 ^ z17;
+  t56 = z12 ^ t48;
+  t57 = t50 ^ t53;
+  t58 = z4 ^ t46;
+  t59 = z3 ^ t54;
+  t60 = t46 ^ t57;
+  t61 = z14 ^ t57;
+  t62 = t52 ^ t58;
+  t63 = t49 ^ t58;
+  t64 = z4 ^ t59;
+  t65 = t61 ^ t62;
+  t66 = z1 ^ t63;
+  s0 = t59 ^ t63;
+  s6 = t56 ^ ~t62;
+  s7 = t48 ^ ~t60;
+  t67 = t64 ^ t65;
+  s3 = t53 ^ t66;
+  s4 = t51 ^ t66;
+  s5 = t47 ^ t65;
+  s1 = t64 ^ ~s3;
+  s2 = t55 ^ ~t67;
+
+  q[7] = s0; q[6] = s1; q[5] = s2; q[4] = s3;
+  q[3] = s4; q[2] = s5; q[1] = s6; q[0] = s7;
+}
+
+static void StateToPlanes(const state_t* state, uint32_t* q)
+{
+  uint32_t w;
+  uint8_t c, k;
+  for (k = 0; k < 8; ++k)
+  {
+    q[k] = 0;
+  }
+  for (c = 0; c < 4; ++c)
+  {
+    w = (uint32_t)(*state)[c][0] | ((uint32_t)(*state)[c][1] << 8) | ((uint32_t)(*state)[c][2] << 16) | ((uint32_t)(*state)[c][3] << 24);
+    for (k = 0; k < 8; ++k)
+    {
+      q[k] |= ((w >> k) & 0x01010101) << c;
+    }
+  }
+}
+
+static void PlanesToState(const uint32_t* q, state_t* state)
+{
+  uint32_t w;
+  uint8_t c, k;
+  for (c = 0; c < 4; ++c)
+  {
+    w = 0;
+    for (k = 0; k < 8; ++k)
+    {
+      w |= ((q[k] >> c) & 0x01010101) << k;
+    }
+    (*state)[c][0] = (uint8_t)w;
+    (*state)[c][1] = (uint8_t)(w >> 8);
+    (*state)[c][2] = (uint8_t)(w >> 16);
+    (*state)[c][3] = (uint8_t)(w >> 24);
+  }
+}
+
+static void SubBytesCircuit(state_t* state)
+{
+  uint32_t q[8];
+  StateToPlanes(state, q);
+  SboxCircuit(q);
+  PlanesToState(q, state);
+}
+
+#if (defined(SBOX_CIRCUIT) && (SBOX_CIRCUIT == 1) && ((defined(CBC) && (CBC == 1)) || (defined(OCB) && (OCB == 1)))) || (defined(ECB) && (ECB == 1))
+// x -> A^-1 * (x + 0x63) on bit planes.
+static void InvAffinePlanes(uint32_t* q)
+{
+  uint32_t t[8];
+  uint8_t k;
+  memcpy(t, q, sizeof(t));
+  for (k = 0; k < 8; ++k)
+  {
+    q[k] = t[(k + 2) & 7] ^ t[(k + 5) & 7] ^ t[(k + 7) & 7];
+  }
+  q[0] = ~q[0];
+  q[2] = ~q[2];
+}
+
+static void InvSubBytesCircuit(state_t* state)
+{
+  uint32_t q[8];
+  StateToPlanes(state, q);
+  InvAffinePlanes(q);
+  SboxCircuit(q);
+  InvAffinePlanes(q);
+  PlanesToState(q, state);
+}
+#endif
+#endif // #if (defined(SBOX_CIRCUIT) && (SBOX_CIRCUIT == 1)) || (defined(ECB) && (ECB == 1))
+
+#if (defined(SBOX_CIRCUIT) && (SBOX_CIRCUIT == 1)) || (defined(ECB) && (ECB == 1))
+// Single bytes, for KeyExpansion() and the SEC-DED engine.
+static uint8_t SboxCircuitValue(uint8_t num)
+{
+  uint32_t q[8];
+  uint8_t k, out = 0;
+  for (k = 0; k < 8; ++k)
+  {
+    q[k] = (num >> k) & 1;
+  }
+  SboxCircuit(q);
+  for (k = 0; k < 8; ++k)
+  {
+    out |= (uint8_t)((q[k] & 1) << k);
+  }
+  return out;
+}
+#endif
+
+#if defined(SBOX_CIRCUIT) && (SBOX_CIRCUIT == 1)
+#define getSBoxValue(num) (SboxCircuitValue(num))
+#else
 /*
 static uint8_t getSBoxValue(uint8_t num)
 {
@@ -146,9 +577,24 @@ static uint8_t getSBoxInvert(uint8_t num)
 }
 */
 #define getSBoxInvert(num) (rsbox[(num)])
+#endif // #if defined(SBOX_CIRCUIT) && (SBOX_CIRCUIT == 1)
+
+// SubWord() for KeyExpansion(). With ct set the key bytes go through the
+// circuit even where the table S-box is the default, for AES_init_ctx_ct().
+static uint8_t KeySBoxValue(uint8_t num, int ct)
+{
+#if !(defined(SBOX_CIRCUIT) && (SBOX_CIRCUIT == 1)) && defined(ECB) && (ECB == 1)
+  if (ct)
+  {
+    return SboxCircuitValue(num);
+  }
+#endif
+  (void)ct;
+  return getSBoxValue(num);
+}
 
 // This function produces Nb(Nr+1) round keys. The round keys are used in each round to decrypt the states. 
-static void KeyExpansion(uint8_t* RoundKey, const uint8_t* Key)
+static void KeyExpansion(uint8_t* RoundKey, const uint8_t* Key, int ct)
 {
   unsigned i, j, k;
   uint8_t tempa[4]; // Used for the column/row operations
@@ -193,10 +639,10 @@ static void KeyExpansion(uint8_t* RoundKey, const uint8_t* Key)
 
       // Function Subword()
       {
-        tempa[0] = getSBoxValue(tempa[0]);
-        tempa[1] = getSBoxValue(tempa[1]);
-        tempa[2] = getSBoxValue(tempa[2]);
-        tempa[3] = getSBoxValue(tempa[3]);
+        tempa[0] = KeySBoxValue(tempa[0], ct);
+        tempa[1] = KeySBoxValue(tempa[1], ct);
+        tempa[2] = KeySBoxValue(tempa[2], ct);
+        tempa[3] = KeySBoxValue(tempa[3], ct);
       }
 
       tempa[0] = tempa[0] ^ Rcon[i/Nk];
@@ -206,10 +652,10 @@ static void KeyExpansion(uint8_t* RoundKey, const uint8_t* Key)
     {
       // Function Subword()
       {
-        tempa[0] = getSBoxValue(tempa[0]);
-        tempa[1] = getSBoxValue(tempa[1]);
-        tempa[2] = getSBoxValue(tempa[2]);
-        tempa[3] = getSBoxValue(tempa[3]);
+        tempa[0] = KeySBoxValue(tempa[0], ct);
+        tempa[1] = KeySBoxValue(tempa[1], ct);
+        tempa[2] = KeySBoxValue(tempa[2], ct);
+        tempa[3] = KeySBoxValue(tempa[3], ct);
       }
     }
 #endif
@@ -223,12 +669,18 @@ static void KeyExpansion(uint8_t* RoundKey, const uint8_t* Key)
 
 void AES_init_ctx(struct AES_ctx* ctx, const uint8_t* key)
 {
-  KeyExpansion(ctx->RoundKey, key);
+  KeyExpansion(ctx->RoundKey, key, 0);
+}
+#if defined(ECB) && (ECB == 1)
+void AES_init_ctx_ct(struct AES_ctx* ctx, const uint8_t* key)
+{
+  KeyExpansion(ctx->RoundKey, key, 1);
 }
+#endif
 #if (defined(CBC) && (CBC == 1)) || (defined(CTR) && (CTR == 1))
 void AES_init_ctx_iv(struct AES_ctx* ctx, const uint8_t* key, const uint8_t* iv)
 {
-  KeyExpansion(ctx->RoundKey, key);
+  KeyExpansion(ctx->RoundKey, key, 0);
   memcpy (ctx->Iv, iv, AES_BLOCKLEN);
 }
 void AES_ctx_set_iv(struct AES_ctx* ctx, const uint8_t* iv)
@@ -255,6 +707,9 @@ static void AddRoundKey(uint8_t round, state_t* state, const uint8_t* RoundKey)
 // state matrix with values in an S-box.
 static void SubBytes(state_t* state)
 {
+#if defined(SBOX_CIRCUIT) && (SBOX_CIRCUIT == 1)
+  SubBytesCircuit(state);
+#else
   uint8_t i, j;
   for (i = 0; i < 4; ++i)
   {
@@ -263,6 +718,7 @@ static void SubBytes(state_t* state)
       (*state)[j][i] = getSBoxValue((*state)[j][i]);
     }
   }
+#endif
 }
 
 // The ShiftRows() function shifts the rows in the state to the left.
@@ -340,7 +796,7 @@ static uint8_t Multiply(uint8_t x, uint8_t y)
 
 #endif
 
-#if (defined(CBC) && CBC == 1) || (defined(ECB) && ECB == 1)
+#if (defined(CBC) && CBC == 1) || (defined(ECB) && ECB == 1) || (defined(OCB) && OCB == 1)
 // MixColumns function mixes the columns of the state matrix.
 // The method used to multiply may be difficult to understand for the inexperienced.
 // Please use the references to gain more information.
@@ -367,6 +823,9 @@ static void InvMixColumns(state_t* state)
 // state matrix with values in an S-box.
 static void InvSubBytes(state_t* state)
 {
+#if defined(SBOX_CIRCUIT) && (SBOX_CIRCUIT == 1)
+  InvSubBytesCircuit(state);
+#else
   uint8_t i, j;
   for (i = 0; i < 4; ++i)
   {
@@ -375,6 +834,7 @@ static void InvSubBytes(state_t* state)
       (*state)[j][i] = getSBoxInvert((*state)[j][i]);
     }
   }
+#endif
 }
 
 static void InvShiftRows(state_t* state)
@@ -404,8 +864,9 @@ static void InvShiftRows(state_t* state)
   (*state)[2][3] = (*state)[3][3];
   (*state)[3][3] = temp;
 }
-#endif // #if (defined(CBC) && CBC == 1) || (defined(ECB) && ECB == 1)
+#endif // #if (defined(CBC) && CBC == 1) || (defined(ECB) && ECB == 1) || (defined(OCB) && OCB == 1)
 
+#if (defined(CBC) && CBC == 1) || (defined(ECB) && ECB == 1) || (defined(OCB) && OCB == 1) || (defined(SIV) && SIV == 1) || (defined(GCM) && GCM == 1) || (defined(PMAC) && PMAC == 1) || (defined(FPE) && FPE == 1)
 // Cipher is the main function that encrypts the PlainText.
 static void Cipher(state_t* state, const uint8_t* RoundKey)
 {
@@ -431,6 +892,7 @@ static void Cipher(state_t* state, const uint8_t* RoundKey)
   // Add round key to last round
   AddRoundKey(Nr, state, RoundKey);
 }
+#endif // #if (defined(CBC) && CBC == 1) || (defined(ECB) && ECB == 1) || (defined(OCB) && OCB == 1) || (defined(SIV) && SIV == 1) || (defined(GCM) && GCM == 1) || (defined(PMAC) && PMAC == 1) || (defined(FPE) && FPE == 1)
 
 #if (defined(CBC) && CBC == 1) || (defined(ECB) && ECB == 1)
 static void InvCipher(state_t* state, const uint8_t* RoundKey)
@@ -458,6 +920,334 @@ static void InvCipher(state_t* state, const uint8_t* RoundKey)
 }
 #endif // #if (defined(CBC) && CBC == 1) || (defined(ECB) && ECB == 1)
 
+#if (defined(ECB) && ECB == 1) || (defined(OCB) && OCB == 1) || (defined(SIV) && SIV == 1) || (defined(GCM) && GCM == 1) || (defined(PMAC) && PMAC == 1) || (defined(FPE) && FPE == 1) || (defined(CTR) && CTR == 1)
+// Multi-block engines: Cipher() and InvCipher() on n independent blocks at
+// once, round by round across all of them rather than block after block.
+// The round key for a round is loaded once for the whole batch, and the
+// blocks have no data dependency on each other, so the compiler and the CPU
+// can overlap them. Callers pass batches of up to AES_BATCH blocks.
+#define AES_BATCH 8
+
+// Block b is enciphered under RoundKey[b], so one batch can mix keys.
+static void CipherBlocksKeyed(state_t* state, uint32_t n, const uint8_t* const* RoundKey)
+{
+  uint8_t round = 0;
+  uint32_t b;
+
+  for (b = 0; b < n; ++b)
+  {
+    AddRoundKey(0, &state[b], RoundKey[b]);
+  }
+  for (round = 1; ; ++round)
+  {
+    for (b = 0; b < n; ++b)
+    {
+      SubBytes(&state[b]);
+      ShiftRows(&state[b]);
+      if (round != Nr)
+      {
+        MixColumns(&state[b]);
+      }
+      AddRoundKey(round, &state[b], RoundKey[b]);
+    }
+    if (round == Nr) {
+      break;
+    }
+  }
+}
+
+#if (defined(ECB) && ECB == 1) || (defined(OCB) && OCB == 1) || (defined(GCM) && GCM == 1) || (defined(PMAC) && PMAC == 1) || (defined(FPE) && FPE == 1) || (defined(CTR) && CTR == 1)
+static void CipherBlocks(state_t* state, uint32_t n, const uint8_t* RoundKey)
+{
+  const uint8_t* keys[AES_BATCH];
+  uint32_t b;
+  for (b = 0; b < n; ++b)
+  {
+    keys[b] = RoundKey;
+  }
+  CipherBlocksKeyed(state, n, keys);
+}
+#endif // #if (defined(ECB) && ECB == 1) || (defined(OCB) && OCB == 1) || (defined(GCM) && GCM == 1) || (defined(PMAC) && PMAC == 1) || (defined(FPE) && FPE == 1) || (defined(CTR) && CTR == 1)
+
+#if (defined(ECB) && ECB == 1) || (defined(OCB) && OCB == 1)
+static void InvCipherBlocksKeyed(state_t* state, uint32_t n, const uint8_t* const* RoundKey)
+{
+  uint8_t round = 0;
+  uint32_t b;
+
+  for (b = 0; b < n; ++b)
+  {
+    AddRoundKey(Nr, &state[b], RoundKey[b]);
+  }
+  for (round = (Nr - 1); ; --round)
+  {
+    for (b = 0; b < n; ++b)
+    {
+      InvShiftRows(&state[b]);
+      InvSubBytes(&state[b]);
+      AddRoundKey(round, &state[b], RoundKey[b]);
+      if (round != 0)
+      {
+        InvMixColumns(&state[b]);
+      }
+    }
+    if (round == 0) {
+      break;
+    }
+  }
+}
+
+static void InvCipherBlocks(state_t* state, uint32_t n, const uint8_t* RoundKey)
+{
+  const uint8_t* keys[AES_BATCH];
+  uint32_t b;
+  for (b = 0; b < n; ++b)
+  {
+    keys[b] = RoundKey;
+  }
+  InvCipherBlocksKeyed(state, n, keys);
+}
+#endif // #if (defined(ECB) && ECB == 1) || (defined(OCB) && OCB == 1)
+#endif // #if (defined(ECB) && ECB == 1) || (defined(OCB) && OCB == 1) || (defined(SIV) && SIV == 1) || (defined(GCM) && GCM == 1) || (defined(PMAC) && PMAC == 1) || (defined(FPE) && FPE == 1) || (defined(CTR) && CTR == 1)
+
+#if defined(ECB) && (ECB == 1) && !(defined(SBOX_CIRCUIT) && (SBOX_CIRCUIT == 1))
+// Cipher() and InvCipher() with the S-box circuit, for AES_ECB_encrypt_ct()
+// and AES_ECB_decrypt_ct() when the table S-box is the default.
+static void CipherCircuit(state_t* state, const uint8_t* RoundKey)
+{
+  uint8_t round = 0;
+
+  AddRoundKey(0, state, RoundKey);
+  for (round = 1; ; ++round)
+  {
+    SubBytesCircuit(state);
+    ShiftRows(state);
+    if (round == Nr) {
+      break;
+    }
+    MixColumns(state);
+    AddRoundKey(round, state, RoundKey);
+  }
+  AddRoundKey(Nr, state, RoundKey);
+}
+
+static void InvCipherCircuit(state_t* state, const uint8_t* RoundKey)
+{
+  uint8_t round = 0;
+
+  AddRoundKey(Nr, state, RoundKey);
+  for (round = (Nr - 1); ; --round)
+  {
+    InvShiftRows(state);
+    InvSubBytesCircuit(state);
+    AddRoundKey(round, state, RoundKey);
+    if (round == 0) {
+      break;
+    }
+    InvMixColumns(state);
+  }
+}
+#endif
+
+#if defined(SECDED) && (SECDED == 1)
+// Hook for fault injection tests, see aes.h.
+void (*AES_secded_fault)(uint8_t round, uint8_t* state) = NULL;
+
+static uint8_t SecdedCode(const uint8_t* column)
+{
+  return secded_row[0][column[0]] ^ secded_row[1][column[1]] ^ secded_row[2][column[2]] ^ secded_row[3][column[3]];
+}
+
+// Checks every state column against its code and repairs single-bit errors.
+// A nonzero syndrome with odd overall parity is a single flip, either in a
+// data bit, which gets corrected, or in the check bits themselves. Even
+// parity means two flips in the column, which can only be detected.
+// Returns the number of corrected columns, or -1 on an uncorrectable error.
+static int SecdedCorrect(state_t* state, const uint8_t* check)
+{
+  int corrected = 0;
+  uint8_t i, s, p, bit;
+
+  for (i = 0; i < 4; ++i)
+  {
+    s = SecdedCode((*state)[i]) ^ check[i];
+    if (s == 0)
+    {
+      continue;
+    }
+    p = s ^ (s >> 4);
+    p ^= p >> 2;
+    p ^= p >> 1;
+    bit = secded_bit[s & 0x3f];
+    if (((p & 1) == 0) || (bit == 0xff))
+    {
+      return -1;
+    }
+    if (bit != 0xfe)
+    {
+      (*state)[i][bit >> 3] ^= (uint8_t)(1 << (bit & 7));
+    }
+    ++corrected;
+  }
+  return corrected;
+}
+
+// Cipher() with a SEC-DED code carried alongside each state column.
+// At the start of every round the state is checked against the codes and
+// repaired, then the codes of the round's output are predicted from that
+// verified input: SubBytes, ShiftRows and MixColumns are folded into one
+// lookup per byte (secded_round), and AddRoundKey, being linear, just XORs
+// in the code of the round key column. Faults that hit the state while a
+// round is computed, or while it sits between rounds, show up as a mismatch
+// with the prediction at the next check.
+static int SecdedCipher(state_t* state, const uint8_t* RoundKey)
+{
+  uint8_t check[4], next[4];
+  uint8_t round, i, j, x;
+  int corrected = 0, n;
+
+  AddRoundKey(0, state, RoundKey);
+  for (i = 0; i < 4; ++i)
+  {
+    check[i] = SecdedCode((*state)[i]);
+  }
+
+  for (round = 1; ; ++round)
+  {
+    if (AES_secded_fault != NULL)
+    {
+      AES_secded_fault(round, (uint8_t*)state);
+    }
+    if ((n = SecdedCorrect(state, check)) < 0)
+    {
+      return -1;
+    }
+    corrected += n;
+
+    // After ShiftRows, column i holds row j of column i + j.
+    for (i = 0; i < 4; ++i)
+    {
+      next[i] = SecdedCode(RoundKey + (round * Nb * 4) + (i * Nb));
+      for (j = 0; j < 4; ++j)
+      {
+        x = (*state)[(i + j) % 4][j];
+        next[i] ^= (round == Nr) ? secded_row[j][getSBoxValue(x)] : secded_round[j][x];
+      }
+    }
+
+    SubBytes(state);
+    ShiftRows(state);
+    if (round != Nr)
+    {
+      MixColumns(state);
+    }
+    AddRoundKey(round, state, RoundKey);
+    memcpy(check, next, sizeof(check));
+    if (round == Nr) {
+      break;
+    }
+  }
+
+  if (AES_secded_fault != NULL)
+  {
+    AES_secded_fault(Nr + 1, (uint8_t*)state);
+  }
+  if ((n = SecdedCorrect(state, check)) < 0)
+  {
+    return -1;
+  }
+  return corrected + n;
+}
+#endif // #if defined(SECDED) && (SECDED == 1)
+
+#if defined(RESO) && (RESO == 1) && defined(ECB) && (ECB == 1)
+// Hook for fault injection tests, see aes.h.
+void (*AES_reso_fault)(uint8_t run, uint8_t* block) = NULL;
+
+// The relabeling of the second run: the byte in column c, row r moves to
+// column c + turn, row r + 2. ShiftRows shifts row r + 2 two places further
+// than row r, so the column turn of the state changes by 2 with every round:
+// with the plaintext turned by 1, round key i is turned by 1 + 2i, and an
+// even number of rounds ends on a turn of 1 again.
+static void ResoTurn(state_t* out, const state_t* in, uint8_t turn)
+{
+  uint8_t c, r;
+  for (c = 0; c < 4; ++c)
+  {
+    for (r = 0; r < 4; ++r)
+    {
+      (*out)[(c + turn) & 3][(r + 2) & 3] = (*in)[c][r];
+    }
+  }
+}
+
+static void ResoKeys(uint8_t* out, const uint8_t* RoundKey)
+{
+  uint8_t round;
+  for (round = 0; round <= Nr; ++round)
+  {
+    ResoTurn((state_t*)(out + round * AES_BLOCKLEN), (const state_t*)(RoundKey + round * AES_BLOCKLEN), (uint8_t)(1 + 2 * round));
+  }
+}
+
+static void ResoFault(state_t* state, uint32_t n)
+{
+  uint32_t b;
+  if (AES_reso_fault != NULL)
+  {
+    for (b = 0; b < 2 * n; ++b)
+    {
+      AES_reso_fault((uint8_t)(b >= n), (uint8_t*)&state[b]);
+    }
+  }
+}
+
+// Runs the blocks as is in the first half of a batch and relabeled in the
+// second, under the relabeled schedule, then turns the second half back
+// (by 3, the inverse of 1) and compares.
+static int ResoBlocks(const struct AES_ctx* ctx, uint8_t* buf, uint32_t nblocks, int decrypt)
+{
+  uint8_t RoundKey[AES_keyExpSize];
+  const uint8_t* keys[AES_BATCH];
+  state_t state[AES_BATCH];
+  state_t back;
+  uint32_t n, b;
+  int bad = 0;
+
+  ResoKeys(RoundKey, ctx->RoundKey);
+  for (; nblocks > 0; nblocks -= n, buf += n * AES_BLOCKLEN)
+  {
+    n = (nblocks < AES_BATCH / 2) ? nblocks : AES_BATCH / 2;
+    for (b = 0; b < n; ++b)
+    {
+      memcpy(&state[b], buf + b * AES_BLOCKLEN, AES_BLOCKLEN);
+      ResoTurn(&state[n + b], &state[b], 1);
+      keys[b] = ctx->RoundKey;
+      keys[n + b] = RoundKey;
+    }
+    ResoFault(state, n);
+    if (decrypt)
+    {
+      InvCipherBlocksKeyed(state, 2 * n, keys);
+    }
+    else
+    {
+      CipherBlocksKeyed(state, 2 * n, keys);
+    }
+    ResoFault(state, n);
+    for (b = 0; b < n; ++b)
+    {
+      ResoTurn(&back, &state[n + b], 3);
+      bad |= (memcmp(&back, &state[b], AES_BLOCKLEN) != 0);
+      memcpy(buf + b * AES_BLOCKLEN, &state[b], AES_BLOCKLEN);
+    }
+  }
+  memset(RoundKey, 0, sizeof(RoundKey));
+  return bad ? -1 : 0;
+}
+#endif // #if defined(RESO) && (RESO == 1) && defined(ECB) && (ECB == 1)
+
+
 /*****************************************************************************/
 /* Public functions:                                                         */
 /*****************************************************************************/
@@ -476,6 +1266,44 @@ void AES_ECB_decrypt(const struct AES_ctx* ctx, uint8_t* buf)
   InvCipher((state_t*)buf, ctx->RoundKey);
 }
 
+void AES_ECB_encrypt_blocks(const struct AES_ctx* ctx, uint8_t* buf, uint32_t nblocks)
+{
+  uint32_t n;
+  for (; nblocks > 0; nblocks -= n, buf += n * AES_BLOCKLEN)
+  {
+    n = (nblocks < AES_BATCH) ? nblocks : AES_BATCH;
+    CipherBlocks((state_t*)buf, n, ctx->RoundKey);
+  }
+}
+
+void AES_ECB_decrypt_blocks(const struct AES_ctx* ctx, uint8_t* buf, uint32_t nblocks)
+{
+  uint32_t n;
+  for (; nblocks > 0; nblocks -= n, buf += n * AES_BLOCKLEN)
+  {
+    n = (nblocks < AES_BATCH) ? nblocks : AES_BATCH;
+    InvCipherBlocks((state_t*)buf, n, ctx->RoundKey);
+  }
+}
+
+void AES_ECB_encrypt_ct(const struct AES_ctx* ctx, uint8_t* buf)
+{
+#if defined(SBOX_CIRCUIT) && (SBOX_CIRCUIT == 1)
+  Cipher((state_t*)buf, ctx->RoundKey);
+#else
+  CipherCircuit((state_t*)buf, ctx->RoundKey);
+#endif
+}
+
+void AES_ECB_decrypt_ct(const struct AES_ctx* ctx, uint8_t* buf)
+{
+#if defined(SBOX_CIRCUIT) && (SBOX_CIRCUIT == 1)
+  InvCipher((state_t*)buf, ctx->RoundKey);
+#else
+  InvCipherCircuit((state_t*)buf, ctx->RoundKey);
+#endif
+}
+
 
 #endif // #if defined(ECB) && (ECB == 1)
 
@@ -531,40 +1359,1629 @@ void AES_CBC_decrypt_buffer(struct AES_ctx* ctx, uint8_t* buf,  uint32_t length)
 
 #if defined(CTR) && (CTR == 1)
 
-/* Symmetrical operation: same function for encrypting as for decrypting. Note any IV/nonce should never be reused with the same key */
-void AES_CTR_xcrypt_buffer(struct AES_ctx* ctx, uint8_t* buf, uint32_t length)
+static uint64_t CtrLoad64(const uint8_t* p)
+{
+  uint64_t v = 0;
+  uint8_t i;
+  for (i = 0; i < 8; ++i)
+  {
+    v = (v << 8) | p[i];
+  }
+  return v;
+}
+
+static void CtrStore64(uint8_t* p, uint64_t v)
+{
+  uint8_t i;
+  for (i = 8; i > 0; --i)
+  {
+    p[i - 1] = (uint8_t)v;
+    v >>= 8;
+  }
+}
+
+void AES_CTR_xcrypt_buffer_width(struct AES_ctx* ctx, uint8_t* buf, uint32_t length, uint8_t counter_bits)
+{
+  uint8_t blocks[AES_BATCH][AES_BLOCKLEN];
+  uint64_t hi, lo, mask_hi, mask_lo, fixed_hi, fixed_lo;
+  uint32_t n, b, i, m;
+
+  // The Iv is held as two native 64-bit halves. Only the counter_bits low
+  // bits take part in the increment; the bits above them (the nonce) are
+  // put back unchanged, so the counter wraps within its field.
+  if ((counter_bits == 0) || (counter_bits > 128))
+  {
+    counter_bits = 128;
+  }
+  mask_lo = (counter_bits >= 64) ? ~(uint64_t)0 : (((uint64_t)1 << counter_bits) - 1);
+  mask_hi = (counter_bits == 128) ? ~(uint64_t)0 : (counter_bits > 64) ? (((uint64_t)1 << (counter_bits - 64)) - 1) : 0;
+  hi = CtrLoad64(ctx->Iv);
+  lo = CtrLoad64(ctx->Iv + 8);
+  fixed_hi = hi & ~mask_hi;
+  fixed_lo = lo & ~mask_lo;
+
+  while (length > 0)
+  {
+    // A batch of counter blocks, then one pass of the multi-block engine.
+    n = (length + AES_BLOCKLEN - 1) / AES_BLOCKLEN;
+    n = (n < AES_BATCH) ? n : AES_BATCH;
+    for (b = 0; b < n; ++b)
+    {
+      CtrStore64(blocks[b], hi);
+      CtrStore64(blocks[b] + 8, lo);
+      lo = fixed_lo | ((lo + 1) & mask_lo);
+      hi = fixed_hi | ((hi + ((lo & mask_lo) == 0)) & mask_hi);
+    }
+    CipherBlocks((state_t*)blocks, n, ctx->RoundKey);
+    for (b = 0; b < n; ++b)
+    {
+      m = (length < AES_BLOCKLEN) ? length : AES_BLOCKLEN;
+      for (i = 0; i < m; ++i)
+      {
+        buf[i] ^= blocks[b][i];
+      }
+      buf += m;
+      length -= m;
+    }
+  }
+  CtrStore64(ctx->Iv, hi);
+  CtrStore64(ctx->Iv + 8, lo);
+}
+
+/* Symmetrical operation: same function for encrypting as for decrypting. Note any IV/nonce should never be reused with the same key */
+void AES_CTR_xcrypt_buffer(struct AES_ctx* ctx, uint8_t* buf, uint32_t length)
+{
+  AES_CTR_xcrypt_buffer_width(ctx, buf, length, 128);
+}
+
+#endif // #if defined(CTR) && (CTR == 1)
+
+
+#if defined(SECDED) && (SECDED == 1)
+
+int AES_ECB_encrypt_secded(const struct AES_ctx* ctx, uint8_t* buf)
+{
+  return SecdedCipher((state_t*)buf, ctx->RoundKey);
+}
+
+#endif // #if defined(SECDED) && (SECDED == 1)
+
+
+#if defined(RESO) && (RESO == 1) && defined(ECB) && (ECB == 1)
+
+int AES_ECB_encrypt_blocks_reso(const struct AES_ctx* ctx, uint8_t* buf, uint32_t nblocks)
+{
+  return ResoBlocks(ctx, buf, nblocks, 0);
+}
+
+int AES_ECB_decrypt_blocks_reso(const struct AES_ctx* ctx, uint8_t* buf, uint32_t nblocks)
+{
+  return ResoBlocks(ctx, buf, nblocks, 1);
+}
+
+#endif // #if defined(RESO) && (RESO == 1) && defined(ECB) && (ECB == 1)
+
+
+
+#if (defined(OCB) && (OCB == 1)) || (defined(PMAC) && (PMAC == 1))
+// Number of trailing zero bits, which picks the L_i for block i in the
+// Gray code offset sequences of OCB and PMAC.
+static uint8_t Ntz(uint32_t i)
+{
+  uint8_t n = 0;
+  for (; (i & 1) == 0; i >>= 1)
+  {
+    ++n;
+  }
+  return n;
+}
+#endif // #if (defined(OCB) && (OCB == 1)) || (defined(PMAC) && (PMAC == 1))
+
+#if (defined(OCB) && (OCB == 1)) || (defined(SIV) && (SIV == 1)) || (defined(PMAC) && (PMAC == 1))
+// Multiplication by x in GF(2^128), in the big-endian
+// convention of the CMAC and OCB specifications (RFC 4493, RFC 7253).
+static void GfDouble(uint8_t* out, const uint8_t* in)
+{
+  const uint8_t carry = in[0] >> 7;
+  uint8_t i;
+  for (i = 0; i < AES_BLOCKLEN - 1; ++i)
+  {
+    out[i] = (uint8_t)((in[i] << 1) | (in[i + 1] >> 7));
+  }
+  out[AES_BLOCKLEN - 1] = (uint8_t)((in[AES_BLOCKLEN - 1] << 1) ^ (carry * 0x87));
+}
+#endif // #if (defined(OCB) && (OCB == 1)) || (defined(SIV) && (SIV == 1)) || (defined(PMAC) && (PMAC == 1))
+
+#if (defined(OCB) && (OCB == 1)) || (defined(SIV) && (SIV == 1)) || (defined(GCM) && (GCM == 1)) || (defined(PMAC) && (PMAC == 1))
+static void XorBlock(uint8_t* buf, const uint8_t* x)
+{
+  uint8_t i;
+  for (i = 0; i < AES_BLOCKLEN; ++i)
+  {
+    buf[i] ^= x[i];
+  }
+}
+#endif // #if (defined(OCB) && (OCB == 1)) || (defined(SIV) && (SIV == 1)) || (defined(GCM) && (GCM == 1)) || (defined(PMAC) && (PMAC == 1))
+
+#if defined(OCB) && (OCB == 1)
+
+/*****************************************************************************/
+/* OCB (RFC 7253):                                                           */
+/*****************************************************************************/
+void AES_OCB_init_ctx(struct AES_ocb_ctx* ctx, const uint8_t* key)
+{
+  uint8_t i;
+
+  AES_init_ctx(&ctx->aes, key);
+  memset(ctx->L_star, 0, AES_BLOCKLEN);
+  Cipher((state_t*)ctx->L_star, ctx->aes.RoundKey);
+  GfDouble(ctx->L_dollar, ctx->L_star);
+  GfDouble(ctx->L[0], ctx->L_dollar);
+  for (i = 1; i < AES_OCB_LMAX; ++i)
+  {
+    GfDouble(ctx->L[i], ctx->L[i - 1]);
+  }
+}
+
+// Offset_0 from the nonce: the top 122 bits of the formatted nonce are
+// enciphered into Ktop, and the low 6 bits select a 128-bit window of
+// Stretch = Ktop || (Ktop[1..64] xor Ktop[9..72]).
+static void OcbInitialOffset(const struct AES_ocb_ctx* ctx, const uint8_t* nonce, uint8_t nonce_len, uint8_t tag_len, uint8_t* offset)
+{
+  uint8_t stretch[AES_BLOCKLEN + 8];
+  uint8_t bottom, shift, i;
+
+  memset(stretch, 0, AES_BLOCKLEN);
+  stretch[0] = (uint8_t)(((tag_len * 8) % 128) << 1);
+  stretch[AES_BLOCKLEN - 1 - nonce_len] |= 1;
+  memcpy(stretch + AES_BLOCKLEN - nonce_len, nonce, nonce_len);
+  bottom = stretch[AES_BLOCKLEN - 1] & 0x3f;
+  stretch[AES_BLOCKLEN - 1] &= 0xc0;
+
+  Cipher((state_t*)stretch, ctx->aes.RoundKey);
+  for (i = 0; i < 8; ++i)
+  {
+    stretch[AES_BLOCKLEN + i] = stretch[i] ^ stretch[i + 1];
+  }
+
+  shift = bottom % 8;
+  for (i = 0; i < AES_BLOCKLEN; ++i)
+  {
+    offset[i] = (uint8_t)((stretch[i + bottom / 8] << shift) | (stretch[i + bottom / 8 + 1] >> (8 - shift)));
+  }
+}
+
+// HASH(K, A): the associated data goes through the same offset sequence as
+// the message, AES_BATCH blocks per cipher call, and the results are summed.
+static void OcbHash(const struct AES_ocb_ctx* ctx, const uint8_t* ad, uint32_t ad_len, uint8_t* sum)
+{
+  uint8_t blocks[AES_BATCH][AES_BLOCKLEN];
+  uint8_t offset[AES_BLOCKLEN];
+  uint32_t i = 0, n, j;
+
+  memset(sum, 0, AES_BLOCKLEN);
+  memset(offset, 0, AES_BLOCKLEN);
+  for (; ad_len >= AES_BLOCKLEN; ad_len -= n * AES_BLOCKLEN)
+  {
+    n = ad_len / AES_BLOCKLEN;
+    n = (n < AES_BATCH) ? n : AES_BATCH;
+    for (j = 0; j < n; ++j, ad += AES_BLOCKLEN)
+    {
+      XorBlock(offset, ctx->L[Ntz(++i)]);
+      memcpy(blocks[j], ad, AES_BLOCKLEN);
+      XorBlock(blocks[j], offset);
+    }
+    CipherBlocks((state_t*)blocks, n, ctx->aes.RoundKey);
+    for (j = 0; j < n; ++j)
+    {
+      XorBlock(sum, blocks[j]);
+    }
+  }
+  if (ad_len > 0)
+  {
+    XorBlock(offset, ctx->L_star);
+    memset(blocks[0], 0, AES_BLOCKLEN);
+    memcpy(blocks[0], ad, ad_len);
+    blocks[0][ad_len] = 0x80;
+    XorBlock(blocks[0], offset);
+    Cipher((state_t*)blocks[0], ctx->aes.RoundKey);
+    XorBlock(sum, blocks[0]);
+  }
+}
+
+// The message pass shared by encryption and decryption. Full blocks go
+// AES_BATCH at a time: their offsets are computed first, then all of them
+// are whitened, run through the multi-block engine and whitened again.
+// The checksum is taken over the plaintext, before encryption or after
+// decryption. On return tag holds Checksum xor Offset_final xor L_$,
+// enciphered, xor HASH(K, A).
+static void OcbCrypt(const struct AES_ocb_ctx* ctx, const uint8_t* nonce, uint8_t nonce_len, const uint8_t* ad, uint32_t ad_len,
+                     uint8_t* buf, uint32_t length, uint8_t tag_len, int decrypt, uint8_t* tag)
+{
+  uint8_t offsets[AES_BATCH][AES_BLOCKLEN];
+  uint8_t offset[AES_BLOCKLEN], checksum[AES_BLOCKLEN], pad[AES_BLOCKLEN], sum[AES_BLOCKLEN];
+  uint32_t i = 0, n, j;
+
+  OcbInitialOffset(ctx, nonce, nonce_len, tag_len, offset);
+  memset(checksum, 0, AES_BLOCKLEN);
+
+  for (; length >= AES_BLOCKLEN; length -= n * AES_BLOCKLEN, buf += n * AES_BLOCKLEN)
+  {
+    n = length / AES_BLOCKLEN;
+    n = (n < AES_BATCH) ? n : AES_BATCH;
+    for (j = 0; j < n; ++j)
+    {
+      XorBlock(offset, ctx->L[Ntz(++i)]);
+      memcpy(offsets[j], offset, AES_BLOCKLEN);
+      if (!decrypt)
+      {
+        XorBlock(checksum, buf + j * AES_BLOCKLEN);
+      }
+      XorBlock(buf + j * AES_BLOCKLEN, offsets[j]);
+    }
+    if (decrypt)
+    {
+      InvCipherBlocks((state_t*)buf, n, ctx->aes.RoundKey);
+    }
+    else
+    {
+      CipherBlocks((state_t*)buf, n, ctx->aes.RoundKey);
+    }
+    for (j = 0; j < n; ++j)
+    {
+      XorBlock(buf + j * AES_BLOCKLEN, offsets[j]);
+      if (decrypt)
+      {
+        XorBlock(checksum, buf + j * AES_BLOCKLEN);
+      }
+    }
+  }
+
+  if (length > 0)
+  {
+    XorBlock(offset, ctx->L_star);
+    memcpy(pad, offset, AES_BLOCKLEN);
+    Cipher((state_t*)pad, ctx->aes.RoundKey);
+    for (j = 0; j < length; ++j)
+    {
+      if (!decrypt)
+      {
+        checksum[j] ^= buf[j];
+      }
+      buf[j] ^= pad[j];
+      if (decrypt)
+      {
+        checksum[j] ^= buf[j];
+      }
+    }
+    checksum[length] ^= 0x80;
+  }
+
+  XorBlock(checksum, offset);
+  XorBlock(checksum, ctx->L_dollar);
+  Cipher((state_t*)checksum, ctx->aes.RoundKey);
+  OcbHash(ctx, ad, ad_len, sum);
+  XorBlock(checksum, sum);
+  memcpy(tag, checksum, AES_BLOCKLEN);
+}
+
+// RFC 7253 nonces are 1..15 bytes (OcbInitialOffset() formats them into one
+// block with a separator bit) and tags 1..16 bytes.
+static int OcbLengthsValid(uint8_t nonce_len, uint8_t tag_len)
+{
+  return (nonce_len >= 1) && (nonce_len < AES_BLOCKLEN) && (tag_len >= 1) && (tag_len <= AES_BLOCKLEN);
+}
+
+int AES_OCB_encrypt(const struct AES_ocb_ctx* ctx, const uint8_t* nonce, uint8_t nonce_len, const uint8_t* ad, uint32_t ad_len,
+                    uint8_t* buf, uint32_t length, uint8_t* tag, uint8_t tag_len)
+{
+  uint8_t full[AES_BLOCKLEN];
+
+  if (!OcbLengthsValid(nonce_len, tag_len))
+  {
+    return -1;
+  }
+  OcbCrypt(ctx, nonce, nonce_len, ad, ad_len, buf, length, tag_len, 0, full);
+  memcpy(tag, full, tag_len);
+  return 0;
+}
+
+int AES_OCB_decrypt(const struct AES_ocb_ctx* ctx, const uint8_t* nonce, uint8_t nonce_len, const uint8_t* ad, uint32_t ad_len,
+                    uint8_t* buf, uint32_t length, const uint8_t* tag, uint8_t tag_len)
+{
+  uint8_t full[AES_BLOCKLEN];
+  uint8_t diff = 0, i;
+
+  if (!OcbLengthsValid(nonce_len, tag_len))
+  {
+    return -1;
+  }
+  OcbCrypt(ctx, nonce, nonce_len, ad, ad_len, buf, length, tag_len, 1, full);
+  // Compare in constant time, and do not release unauthenticated plaintext.
+  for (i = 0; i < tag_len; ++i)
+  {
+    diff |= full[i] ^ tag[i];
+  }
+  if (diff != 0)
+  {
+    memset(buf, 0, length);
+    return -1;
+  }
+  return 0;
+}
+
+#endif // #if defined(OCB) && (OCB == 1)
+
+
+
+#if defined(SIV) && (SIV == 1)
+
+/*****************************************************************************/
+/* CMAC (RFC 4493) and SIV (RFC 5297):                                       */
+/*****************************************************************************/
+static void CmacSubkeys(const struct AES_ctx* ctx, uint8_t* sub1, uint8_t* sub2)
+{
+  uint8_t l[AES_BLOCKLEN];
+  memset(l, 0, AES_BLOCKLEN);
+  Cipher((state_t*)l, ctx->RoundKey);
+  GfDouble(sub1, l);
+  GfDouble(sub2, sub1);
+}
+
+static void Cmac(const struct AES_ctx* ctx, const uint8_t* sub1, const uint8_t* sub2, const uint8_t* msg, uint32_t length, uint8_t* mac)
+{
+  uint8_t last[AES_BLOCKLEN];
+
+  memset(mac, 0, AES_BLOCKLEN);
+  for (; length > AES_BLOCKLEN; length -= AES_BLOCKLEN, msg += AES_BLOCKLEN)
+  {
+    XorBlock(mac, msg);
+    Cipher((state_t*)mac, ctx->RoundKey);
+  }
+  // The last block is xored with the first subkey if it is complete, and
+  // padded with 10* and xored with the second one if not.
+  memset(last, 0, AES_BLOCKLEN);
+  memcpy(last, msg, length);
+  if (length == AES_BLOCKLEN)
+  {
+    XorBlock(last, sub1);
+  }
+  else
+  {
+    last[length] = 0x80;
+    XorBlock(last, sub2);
+  }
+  XorBlock(mac, last);
+  Cipher((state_t*)mac, ctx->RoundKey);
+}
+
+void AES_CMAC(const struct AES_ctx* ctx, const uint8_t* msg, uint32_t length, uint8_t* mac)
+{
+  uint8_t sub1[AES_BLOCKLEN], sub2[AES_BLOCKLEN];
+  CmacSubkeys(ctx, sub1, sub2);
+  Cmac(ctx, sub1, sub2, msg, length, mac);
+}
+
+void AES_SIV_init_ctx(struct AES_siv_ctx* ctx, const uint8_t* key)
+{
+  uint8_t zero[AES_BLOCKLEN];
+
+  AES_init_ctx(&ctx->mac, key);
+  AES_init_ctx(&ctx->ctr, key + AES_KEYLEN);
+  CmacSubkeys(&ctx->mac, ctx->sub1, ctx->sub2);
+  memset(zero, 0, AES_BLOCKLEN);
+  Cmac(&ctx->mac, ctx->sub1, ctx->sub2, zero, AES_BLOCKLEN, ctx->d0);
+}
+
+// S2V over the associated data strings: D = CMAC(<zero>), then
+// D = dbl(D) xor CMAC(S_i) for each of them. The plaintext, which is always
+// the last string, is left to the lanes below.
+static void SivHeader(const struct AES_siv_ctx* ctx, const uint8_t* const* ad, const uint32_t* ad_len, uint32_t count, uint8_t* d)
+{
+  uint8_t mac[AES_BLOCKLEN];
+  uint32_t i;
+
+  memcpy(d, ctx->d0, AES_BLOCKLEN);
+  for (i = 0; i < count; ++i)
+  {
+    GfDouble(d, d);
+    Cmac(&ctx->mac, ctx->sub1, ctx->sub2, ad[i], ad_len[i], mac);
+    XorBlock(d, mac);
+  }
+}
+
+// The chunk engine keeps up to SIV_LANES chunks in flight. A chunk goes
+// through two phases, S2V then CTR when encrypting and CTR then S2V when
+// decrypting. The CMAC chain of S2V is serial, so a lane in that phase can
+// contribute only one block per batch; the CTR blocks of the other lanes fill
+// up the rest. Every batch then goes through the multi-block engine under
+// both keys at once, so the serial CMAC chains of one chunk overlap the
+// parallel CTR work of the previous chunks.
+#define SIV_LANES 4
+
+enum { SIV_IDLE, SIV_MAC, SIV_CTR };
+
+struct SivLane
+{
+  struct AES_siv_chunk* chunk;
+  uint8_t phase;
+  uint32_t block;             // next block of the current phase
+  uint32_t blocks;            // blocks in the current phase
+  uint8_t d[AES_BLOCKLEN];    // S2V: D to xor onto the end of the message, or dbl(D) if it is short
+  uint8_t x[AES_BLOCKLEN];    // S2V: CMAC chaining value
+  uint8_t ctr[AES_BLOCKLEN];  // CTR: next counter block
+};
+
+static void SivStartMac(const struct AES_siv_ctx* ctx, struct SivLane* lane, const uint8_t* header)
+{
+  struct AES_siv_chunk* chunk = lane->chunk;
+  uint8_t d[AES_BLOCKLEN];
+
+  if (header == NULL)
+  {
+    SivHeader(ctx, &chunk->ad, &chunk->ad_len, (chunk->ad != NULL), d);
+    header = d;
+  }
+  if (chunk->length < AES_BLOCKLEN)
+  {
+    GfDouble(lane->d, header);
+    lane->blocks = 1;
+  }
+  else
+  {
+    memcpy(lane->d, header, AES_BLOCKLEN);
+    lane->blocks = (chunk->length + AES_BLOCKLEN - 1) / AES_BLOCKLEN;
+  }
+  memset(lane->x, 0, AES_BLOCKLEN);
+  lane->block = 0;
+  lane->phase = SIV_MAC;
+}
+
+static void SivStartCtr(struct SivLane* lane)
+{
+  // Q = V with the top bit of each of the two low 32-bit words cleared.
+  memcpy(lane->ctr, lane->chunk->siv, AES_BLOCKLEN);
+  lane->ctr[8] &= 0x7f;
+  lane->ctr[12] &= 0x7f;
+  lane->blocks = (lane->chunk->length + AES_BLOCKLEN - 1) / AES_BLOCKLEN;
+  lane->block = 0;
+  lane->phase = SIV_CTR;
+}
+
+// Moves a lane on once its phase has run out of blocks; returns 1 for a
+// failed decryption.
+static int SivAdvance(const struct AES_siv_ctx* ctx, struct SivLane* lane, int decrypt, const uint8_t* header)
+{
+  uint8_t diff = 0, i;
+
+  while ((lane->phase != SIV_IDLE) && (lane->block == lane->blocks))
+  {
+    if ((lane->phase == SIV_MAC) && !decrypt)
+    {
+      memcpy(lane->chunk->siv, lane->x, AES_BLOCKLEN);
+      SivStartCtr(lane);
+    }
+    else if (lane->phase == SIV_MAC)
+    {
+      for (i = 0; i < AES_BLOCKLEN; ++i)
+      {
+        diff |= lane->x[i] ^ lane->chunk->siv[i];
+      }
+      lane->chunk->status = (diff != 0) ? -1 : 0;
+      if (diff != 0)
+      {
+        memset(lane->chunk->buf, 0, lane->chunk->length);
+      }
+      lane->phase = SIV_IDLE;
+    }
+    else if (decrypt)
+    {
+      SivStartMac(ctx, lane, header);
+    }
+    else
+    {
+      lane->chunk->status = 0;
+      lane->phase = SIV_IDLE;
+    }
+  }
+  return diff != 0;
+}
+
+// Block lane->block of T, the last S2V string, xored into the CMAC chain:
+// T = Sn xorend D for messages of a block or more, dbl(D) xor pad(Sn) else.
+static void SivMacInput(const struct AES_siv_ctx* ctx, const struct SivLane* lane, uint8_t* in)
+{
+  const uint8_t* msg = lane->chunk->buf;
+  const uint32_t length = lane->chunk->length;
+  const uint32_t end = length - AES_BLOCKLEN;
+  uint32_t p = lane->block * AES_BLOCKLEN;
+  uint8_t j;
+
+  if (length < AES_BLOCKLEN)
+  {
+    memset(in, 0, AES_BLOCKLEN);
+    memcpy(in, msg, length);
+    in[length] = 0x80;
+    XorBlock(in, lane->d);
+    XorBlock(in, ctx->sub1);
+  }
+  else if (p + AES_BLOCKLEN <= end)
+  {
+    memcpy(in, msg + p, AES_BLOCKLEN);
+  }
+  else
+  {
+    for (j = 0; j < AES_BLOCKLEN; ++j, ++p)
+    {
+      in[j] = (p < length) ? msg[p] : ((p == length) ? 0x80 : 0);
+      if ((p >= end) && (p < length))
+      {
+        in[j] ^= lane->d[p - end];
+      }
+    }
+    if (lane->block == lane->blocks - 1)
+    {
+      XorBlock(in, ((length % AES_BLOCKLEN) == 0) ? ctx->sub1 : ctx->sub2);
+    }
+  }
+  XorBlock(in, lane->x);
+}
+
+static void SivIncrement(uint8_t* ctr)
 {
-  uint8_t buffer[AES_BLOCKLEN];
-  
-  unsigned i;
   int bi;
-  for (i = 0, bi = AES_BLOCKLEN; i < length; ++i, ++bi)
+  for (bi = AES_BLOCKLEN - 1; (bi >= 0) && (++ctr[bi] == 0); --bi)
+    ;
+}
+
+// Runs n chunks through the lanes. header, if not NULL, replaces the S2V
+// header of every chunk. Returns the number of chunks that failed to decrypt.
+static uint32_t SivRun(const struct AES_siv_ctx* ctx, struct AES_siv_chunk* chunks, uint32_t n, int decrypt, const uint8_t* header)
+{
+  struct SivLane lanes[SIV_LANES];
+  uint8_t batch[AES_BATCH][AES_BLOCKLEN];
+  const uint8_t* keys[AES_BATCH];
+  uint8_t slot_lane[AES_BATCH];
+  uint32_t slot_block[AES_BATCH];
+  uint32_t next = 0, failed = 0, m, k, off, len;
+  uint8_t l, progress;
+
+  for (l = 0; l < SIV_LANES; ++l)
+  {
+    lanes[l].phase = SIV_IDLE;
+  }
+
+  for (;;)
   {
-    if (bi == AES_BLOCKLEN) /* we need to regen xor compliment in buffer */
+    for (l = 0; l < SIV_LANES; ++l)
     {
-      
-      memcpy(buffer, ctx->Iv, AES_BLOCKLEN);
-      Cipher((state_t*)buffer,ctx->RoundKey);
+      while ((lanes[l].phase == SIV_IDLE) && (next < n))
+      {
+        lanes[l].chunk = &chunks[next++];
+        if (decrypt)
+        {
+          SivStartCtr(&lanes[l]);
+        }
+        else
+        {
+          SivStartMac(ctx, &lanes[l], header);
+        }
+        failed += SivAdvance(ctx, &lanes[l], decrypt, header);
+      }
+    }
 
-      /* Increment Iv and handle overflow */
-      for (bi = (AES_BLOCKLEN - 1); bi >= 0; --bi)
+    // Gather: the next CMAC block of every lane in S2V first, then CTR
+    // blocks round-robin until the batch is full.
+    m = 0;
+    for (l = 0; l < SIV_LANES; ++l)
+    {
+      if (lanes[l].phase == SIV_MAC)
+      {
+        SivMacInput(ctx, &lanes[l], batch[m]);
+        keys[m] = ctx->mac.RoundKey;
+        slot_lane[m] = l;
+        slot_block[m++] = lanes[l].block++;
+      }
+    }
+    do
+    {
+      progress = 0;
+      for (l = 0; (l < SIV_LANES) && (m < AES_BATCH); ++l)
       {
-      	/* inc will overflow */
-        if (ctx->Iv[bi] == 255)
-      	{
-          ctx->Iv[bi] = 0;
-          continue;
-        } 
-        ctx->Iv[bi] += 1;
-        break;   
+        if ((lanes[l].phase == SIV_CTR) && (lanes[l].block < lanes[l].blocks))
+        {
+          memcpy(batch[m], lanes[l].ctr, AES_BLOCKLEN);
+          SivIncrement(lanes[l].ctr);
+          keys[m] = ctx->ctr.RoundKey;
+          slot_lane[m] = l;
+          slot_block[m++] = lanes[l].block++;
+          progress = 1;
+        }
       }
+    } while (progress && (m < AES_BATCH));
 
-      bi = 0;
-    }//end of first if
+    if (m == 0)
+    {
+      break;
+    }
+    CipherBlocksKeyed((state_t*)batch, m, keys);
 
-    buf[i] = (buf[i] ^ buffer[bi]);
-  }//end of for loop
+    // Scatter: chaining values back to their lanes, keystream onto the data.
+    for (k = 0; k < m; ++k)
+    {
+      struct SivLane* lane = &lanes[slot_lane[k]];
+      if (lane->phase == SIV_MAC)
+      {
+        memcpy(lane->x, batch[k], AES_BLOCKLEN);
+        continue;
+      }
+      off = slot_block[k] * AES_BLOCKLEN;
+      len = lane->chunk->length - off;
+      len = (len < AES_BLOCKLEN) ? len : AES_BLOCKLEN;
+      for (l = 0; l < len; ++l)
+      {
+        lane->chunk->buf[off + l] ^= batch[k][l];
+      }
+    }
+    for (l = 0; l < SIV_LANES; ++l)
+    {
+      failed += SivAdvance(ctx, &lanes[l], decrypt, header);
+    }
+  }
+  return failed;
 }
 
-#endif // #if defined(CTR) && (CTR == 1)
+void AES_SIV_encrypt(const struct AES_siv_ctx* ctx, const uint8_t* const* ad, const uint32_t* ad_len, uint32_t ad_count,
+                     uint8_t* buf, uint32_t length, uint8_t* siv)
+{
+  struct AES_siv_chunk chunk;
+  uint8_t header[AES_BLOCKLEN];
+
+  SivHeader(ctx, ad, ad_len, ad_count, header);
+  chunk.buf = buf;
+  chunk.length = length;
+  chunk.ad = NULL;
+  chunk.ad_len = 0;
+  SivRun(ctx, &chunk, 1, 0, header);
+  memcpy(siv, chunk.siv, AES_BLOCKLEN);
+}
+
+int AES_SIV_decrypt(const struct AES_siv_ctx* ctx, const uint8_t* const* ad, const uint32_t* ad_len, uint32_t ad_count,
+                    uint8_t* buf, uint32_t length, const uint8_t* siv)
+{
+  struct AES_siv_chunk chunk;
+  uint8_t header[AES_BLOCKLEN];
+
+  SivHeader(ctx, ad, ad_len, ad_count, header);
+  chunk.buf = buf;
+  chunk.length = length;
+  chunk.ad = NULL;
+  chunk.ad_len = 0;
+  memcpy(chunk.siv, siv, AES_BLOCKLEN);
+  return SivRun(ctx, &chunk, 1, 1, header) ? -1 : 0;
+}
+
+void AES_SIV_encrypt_chunks(const struct AES_siv_ctx* ctx, struct AES_siv_chunk* chunks, uint32_t n)
+{
+  SivRun(ctx, chunks, n, 0, NULL);
+}
+
+uint32_t AES_SIV_decrypt_chunks(const struct AES_siv_ctx* ctx, struct AES_siv_chunk* chunks, uint32_t n)
+{
+  return SivRun(ctx, chunks, n, 1, NULL);
+}
+
+#endif // #if defined(SIV) && (SIV == 1)
+
+
+
+
+#if defined(GCM) && (GCM == 1)
+
+/*****************************************************************************/
+/* GCM (NIST SP 800-38D):                                                    */
+/*****************************************************************************/
+// Field elements are blocks in GCM's reflected bit order: bit 0 of the
+// element is the most significant bit of byte 0. For table lookups a block is
+// held as two big-endian 64-bit halves.
+
+static uint64_t GcmLoad64(const uint8_t* p)
+{
+  uint64_t v = 0;
+  uint8_t i;
+  for (i = 0; i < 8; ++i)
+  {
+    v = (v << 8) | p[i];
+  }
+  return v;
+}
+
+static void GcmStore64(uint8_t* p, uint64_t v)
+{
+  uint8_t i;
+  for (i = 8; i > 0; --i)
+  {
+    p[i - 1] = (uint8_t)v;
+    v >>= 8;
+  }
+}
+
+// x = x * y, bit by bit (Algorithm 1 of SP 800-38D). Only used off the bulk
+// path, on H and its powers.
+static void GcmMul(uint8_t* x, const uint8_t* y)
+{
+  uint8_t z[AES_BLOCKLEN], v[AES_BLOCKLEN];
+  uint8_t i, j, bit, lsb;
+
+  memset(z, 0, AES_BLOCKLEN);
+  memcpy(v, y, AES_BLOCKLEN);
+  for (i = 0; i < 128; ++i)
+  {
+    bit = (uint8_t)-((x[i >> 3] >> (7 - (i & 7))) & 1);
+    for (j = 0; j < AES_BLOCKLEN; ++j)
+    {
+      z[j] ^= v[j] & bit;
+    }
+    lsb = (uint8_t)-(v[AES_BLOCKLEN - 1] & 1);
+    for (j = AES_BLOCKLEN - 1; j > 0; --j)
+    {
+      v[j] = (uint8_t)((v[j] >> 1) | (v[j - 1] << 7));
+    }
+    v[0] = (uint8_t)((v[0] >> 1) ^ (0xe1 & lsb));
+  }
+  memcpy(x, z, AES_BLOCKLEN);
+}
+
+// Reduction constants for the four bits shifted out of the low end.
+static const uint16_t gcm_last4[16] =
+{
+  0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+  0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0
+};
+
+// x = x * H, with the 4-bit table (Shoup's method).
+static void GcmMulH(const struct AES_gcm_ctx* ctx, uint8_t* x)
+{
+  uint64_t zh, zl;
+  uint8_t lo, hi, rem;
+  int i;
+
+  lo = x[15] & 0x0f;
+  zh = ctx->HH[lo];
+  zl = ctx->HL[lo];
+  for (i = 15; i >= 0; --i)
+  {
+    lo = x[i] & 0x0f;
+    hi = (x[i] >> 4) & 0x0f;
+    if (i != 15)
+    {
+      rem = (uint8_t)(zl & 0x0f);
+      zl = (zh << 60) | (zl >> 4);
+      zh = (zh >> 4) ^ ((uint64_t)gcm_last4[rem] << 48);
+      zh ^= ctx->HH[lo];
+      zl ^= ctx->HL[lo];
+    }
+    rem = (uint8_t)(zl & 0x0f);
+    zl = (zh << 60) | (zl >> 4);
+    zh = (zh >> 4) ^ ((uint64_t)gcm_last4[rem] << 48);
+    zh ^= ctx->HH[hi];
+    zl ^= ctx->HL[hi];
+  }
+  GcmStore64(x, zh);
+  GcmStore64(x + 8, zl);
+}
+
+// y = (y xor data) * H for each block of data, the last one zero-padded.
+static void Ghash(const struct AES_gcm_ctx* ctx, uint8_t* y, const uint8_t* data, uint32_t length)
+{
+  uint32_t i;
+  while (length > 0)
+  {
+    const uint32_t n = (length < AES_BLOCKLEN) ? length : AES_BLOCKLEN;
+    for (i = 0; i < n; ++i)
+    {
+      y[i] ^= data[i];
+    }
+    GcmMulH(ctx, y);
+    data += n;
+    length -= n;
+  }
+}
+
+void AES_GCM_init_ctx(struct AES_gcm_ctx* ctx, const uint8_t* key)
+{
+  uint8_t h[AES_BLOCKLEN];
+  uint64_t vh, vl;
+  uint32_t i, j;
+
+  AES_init_ctx(&ctx->aes, key);
+  memset(h, 0, AES_BLOCKLEN);
+  Cipher((state_t*)h, ctx->aes.RoundKey);
+
+  // HH/HL[i] = H * i, for i read as a 4-bit element: entry 8 is H itself,
+  // 4, 2 and 1 are H shifted by one more bit each, the rest are sums.
+  vh = GcmLoad64(h);
+  vl = GcmLoad64(h + 8);
+  ctx->HH[0] = 0;
+  ctx->HL[0] = 0;
+  ctx->HH[8] = vh;
+  ctx->HL[8] = vl;
+  for (i = 4; i > 0; i >>= 1)
+  {
+    const uint64_t t = (vl & 1) * 0xe100000000000000ULL;
+    vl = (vh << 63) | (vl >> 1);
+    vh = (vh >> 1) ^ t;
+    ctx->HH[i] = vh;
+    ctx->HL[i] = vl;
+  }
+  for (i = 2; i <= 8; i *= 2)
+  {
+    for (j = 1; j < i; ++j)
+    {
+      ctx->HH[i + j] = ctx->HH[i] ^ ctx->HH[j];
+      ctx->HL[i + j] = ctx->HL[i] ^ ctx->HL[j];
+    }
+  }
+
+  memcpy(ctx->Hpow[0], h, AES_BLOCKLEN);
+  for (i = 1; i < AES_GCM_POWERS; ++i)
+  {
+    memcpy(ctx->Hpow[i], ctx->Hpow[i - 1], AES_BLOCKLEN);
+    GcmMul(ctx->Hpow[i], ctx->Hpow[i - 1]);
+  }
+}
+
+void AES_GCM_start(const struct AES_gcm_ctx* ctx, struct AES_gcm_op* op, const uint8_t* iv, uint32_t iv_len,
+                   const uint8_t* ad, uint32_t ad_len)
+{
+  uint8_t lens[AES_BLOCKLEN];
+
+  memset(op->j0, 0, AES_BLOCKLEN);
+  if (iv_len == 12)
+  {
+    memcpy(op->j0, iv, 12);
+    op->j0[AES_BLOCKLEN - 1] = 1;
+  }
+  else
+  {
+    Ghash(ctx, op->j0, iv, iv_len);
+    memset(lens, 0, AES_BLOCKLEN);
+    GcmStore64(lens + 8, (uint64_t)iv_len * 8);
+    Ghash(ctx, op->j0, lens, AES_BLOCKLEN);
+  }
+  memset(op->y, 0, AES_BLOCKLEN);
+  Ghash(ctx, op->y, ad, ad_len);
+  op->ad_len = ad_len;
+  op->length = 0;
+}
+
+// Counter blocks for the piece are inc32(J0) advanced by offset / 16: only
+// the low 32 bits count, as the standard requires.
+void AES_GCM_piece(const struct AES_gcm_ctx* ctx, const struct AES_gcm_op* op, uint32_t offset, uint8_t* buf, uint32_t length,
+                   int decrypt, uint8_t* partial)
+{
+  uint8_t ks[AES_BATCH][AES_BLOCKLEN];
+  uint32_t ctr = (uint32_t)GcmLoad64(op->j0 + 8) + 1 + offset / AES_BLOCKLEN;
+  uint32_t nb, b, i;
+
+  memset(partial, 0, AES_BLOCKLEN);
+  while (length > 0)
+  {
+    nb = (length + AES_BLOCKLEN - 1) / AES_BLOCKLEN;
+    nb = (nb < AES_BATCH) ? nb : AES_BATCH;
+    for (b = 0; b < nb; ++b)
+    {
+      memcpy(ks[b], op->j0, 12);
+      ks[b][12] = (uint8_t)(ctr >> 24);
+      ks[b][13] = (uint8_t)(ctr >> 16);
+      ks[b][14] = (uint8_t)(ctr >> 8);
+      ks[b][15] = (uint8_t)ctr;
+      ++ctr;
+    }
+    CipherBlocks((state_t*)ks, nb, ctx->aes.RoundKey);
+    for (b = 0; b < nb; ++b)
+    {
+      const uint32_t n = (length < AES_BLOCKLEN) ? length : AES_BLOCKLEN;
+      if (decrypt)
+      {
+        Ghash(ctx, partial, buf, n);
+      }
+      for (i = 0; i < n; ++i)
+      {
+        buf[i] ^= ks[b][i];
+      }
+      if (!decrypt)
+      {
+        Ghash(ctx, partial, buf, n);
+      }
+      buf += n;
+      length -= n;
+    }
+  }
+}
+
+// y = y * H^n xor partial, where n is the piece's block count: this shifts
+// the chain over the piece as if its blocks had been hashed in line.
+void AES_GCM_combine(const struct AES_gcm_ctx* ctx, struct AES_gcm_op* op, const uint8_t* partial, uint32_t length)
+{
+  const uint32_t n = (length + AES_BLOCKLEN - 1) / AES_BLOCKLEN;
+  uint8_t i;
+
+  for (i = 0; i < AES_GCM_POWERS; ++i)
+  {
+    if ((n >> i) & 1)
+    {
+      GcmMul(op->y, ctx->Hpow[i]);
+    }
+  }
+  XorBlock(op->y, partial);
+  op->length += length;
+}
+
+void AES_GCM_finish(const struct AES_gcm_ctx* ctx, const struct AES_gcm_op* op, uint8_t* tag)
+{
+  uint8_t lens[AES_BLOCKLEN], y[AES_BLOCKLEN];
+
+  memcpy(y, op->y, AES_BLOCKLEN);
+  GcmStore64(lens, op->ad_len * 8);
+  GcmStore64(lens + 8, op->length * 8);
+  Ghash(ctx, y, lens, AES_BLOCKLEN);
+  memcpy(tag, op->j0, AES_BLOCKLEN);
+  Cipher((state_t*)tag, ctx->aes.RoundKey);
+  XorBlock(tag, y);
+}
+
+// The IV may be any nonzero length (anything but 12 bytes is hashed into
+// J0) and tags are 1..16 bytes.
+int AES_GCM_lengths_valid(uint32_t iv_len, uint8_t tag_len)
+{
+  return (iv_len >= 1) && (tag_len >= 1) && (tag_len <= AES_BLOCKLEN);
+}
+
+int AES_GCM_encrypt(const struct AES_gcm_ctx* ctx, const uint8_t* iv, uint32_t iv_len, const uint8_t* ad, uint32_t ad_len,
+                    uint8_t* buf, uint32_t length, uint8_t* tag, uint8_t tag_len)
+{
+  struct AES_gcm_op op;
+  uint8_t partial[AES_BLOCKLEN], full[AES_BLOCKLEN];
+
+  if (!AES_GCM_lengths_valid(iv_len, tag_len))
+  {
+    return -1;
+  }
+  AES_GCM_start(ctx, &op, iv, iv_len, ad, ad_len);
+  AES_GCM_piece(ctx, &op, 0, buf, length, 0, partial);
+  AES_GCM_combine(ctx, &op, partial, length);
+  AES_GCM_finish(ctx, &op, full);
+  memcpy(tag, full, tag_len);
+  return 0;
+}
+
+int AES_GCM_decrypt(const struct AES_gcm_ctx* ctx, const uint8_t* iv, uint32_t iv_len, const uint8_t* ad, uint32_t ad_len,
+                    uint8_t* buf, uint32_t length, const uint8_t* tag, uint8_t tag_len)
+{
+  struct AES_gcm_op op;
+  uint8_t partial[AES_BLOCKLEN], full[AES_BLOCKLEN];
+  uint8_t diff = 0, i;
+
+  if (!AES_GCM_lengths_valid(iv_len, tag_len))
+  {
+    return -1;
+  }
+  AES_GCM_start(ctx, &op, iv, iv_len, ad, ad_len);
+  AES_GCM_piece(ctx, &op, 0, buf, length, 1, partial);
+  AES_GCM_combine(ctx, &op, partial, length);
+  AES_GCM_finish(ctx, &op, full);
+  for (i = 0; i < tag_len; ++i)
+  {
+    diff |= full[i] ^ tag[i];
+  }
+  if (diff != 0)
+  {
+    memset(buf, 0, length);
+    return -1;
+  }
+  return 0;
+}
+
+#endif // #if defined(GCM) && (GCM == 1)
+
+
+
+#if defined(PMAC) && (PMAC == 1)
+
+/*****************************************************************************/
+/* PMAC1:                                                                    */
+/*****************************************************************************/
+void AES_PMAC_init_ctx(struct AES_pmac_ctx* ctx, const uint8_t* key)
+{
+  uint8_t* l = ctx->L[0];
+  uint8_t carry, i;
+
+  AES_init_ctx(&ctx->aes, key);
+  memset(l, 0, AES_BLOCKLEN);
+  Cipher((state_t*)l, ctx->aes.RoundKey);
+  for (i = 1; i < AES_PMAC_LMAX; ++i)
+  {
+    GfDouble(ctx->L[i], ctx->L[i - 1]);
+  }
+
+  // L * x^-1: shift right, and fold the low bit back in with the reduction
+  // polynomial x^128 + x^7 + x^2 + x + 1 divided by x.
+  carry = l[AES_BLOCKLEN - 1] & 1;
+  for (i = AES_BLOCKLEN - 1; i > 0; --i)
+  {
+    ctx->L_inv[i] = (uint8_t)((l[i] >> 1) | (l[i - 1] << 7));
+  }
+  ctx->L_inv[0] = (uint8_t)((l[0] >> 1) ^ (carry * 0x80));
+  ctx->L_inv[AES_BLOCKLEN - 1] ^= (uint8_t)(carry * 0x43);
+}
+
+void AES_PMAC_sum(const struct AES_pmac_ctx* ctx, uint32_t block, const uint8_t* msg, uint32_t nblocks, uint8_t* sum)
+{
+  uint8_t blocks[AES_BATCH][AES_BLOCKLEN], offset[AES_BLOCKLEN];
+  const uint32_t gray = block ^ (block >> 1);
+  uint32_t n, j;
+
+  // The offset of block i (counting from 1) is the XOR of L(j) over the set
+  // bits j of the Gray code of i, so a piece can start anywhere: take the
+  // offset of the block before it, then step with L(ntz(i)) as usual.
+  memset(offset, 0, AES_BLOCKLEN);
+  for (j = 0; j < AES_PMAC_LMAX; ++j)
+  {
+    if ((gray >> j) & 1)
+    {
+      XorBlock(offset, ctx->L[j]);
+    }
+  }
+
+  memset(sum, 0, AES_BLOCKLEN);
+  for (; nblocks > 0; nblocks -= n)
+  {
+    n = (nblocks < AES_BATCH) ? nblocks : AES_BATCH;
+    for (j = 0; j < n; ++j)
+    {
+      XorBlock(offset, ctx->L[Ntz(++block)]);
+      memcpy(blocks[j], msg, AES_BLOCKLEN);
+      XorBlock(blocks[j], offset);
+      msg += AES_BLOCKLEN;
+    }
+    CipherBlocks((state_t*)blocks, n, ctx->aes.RoundKey);
+    for (j = 0; j < n; ++j)
+    {
+      XorBlock(sum, blocks[j]);
+    }
+  }
+}
+
+void AES_PMAC_finish(const struct AES_pmac_ctx* ctx, const uint8_t* sum, const uint8_t* last, uint32_t last_len, uint8_t* mac)
+{
+  uint32_t i;
+
+  memcpy(mac, sum, AES_BLOCKLEN);
+  for (i = 0; i < last_len; ++i)
+  {
+    mac[i] ^= last[i];
+  }
+  if (last_len == AES_BLOCKLEN)
+  {
+    XorBlock(mac, ctx->L_inv);
+  }
+  else
+  {
+    mac[last_len] ^= 0x80;
+  }
+  Cipher((state_t*)mac, ctx->aes.RoundKey);
+}
+
+void AES_PMAC(const struct AES_pmac_ctx* ctx, const uint8_t* msg, uint32_t length, uint8_t* mac)
+{
+  // Every block but the last one goes through the cipher with its offset.
+  const uint32_t m = (length == 0) ? 0 : (length - 1) / AES_BLOCKLEN;
+  uint8_t sum[AES_BLOCKLEN];
+
+  AES_PMAC_sum(ctx, 0, msg, m, sum);
+  AES_PMAC_finish(ctx, sum, msg + m * AES_BLOCKLEN, length - m * AES_BLOCKLEN, mac);
+}
+
+#endif // #if defined(PMAC) && (PMAC == 1)
+
+
+
+#if defined(FPE) && (FPE == 1)
+
+/*****************************************************************************/
+/* FF1 and FF3-1 (NIST SP 800-38G):                                          */
+/*****************************************************************************/
+// Numeral strings go through small fixed-size integers, little-endian 32-bit
+// limbs. Neither mode needs more than 128 bits: FF3-1 halves fit in 96 bits
+// by definition, FF1 halves are limited to 96 bits below, and the round
+// function output is at most one block. One limb of headroom is left over.
+#define FPE_LIMBS 5
+
+typedef uint32_t fpe_num[FPE_LIMBS];
+
+// x = x * mul + add
+static void FpeMulAdd(uint32_t* x, uint32_t mul, uint32_t add)
+{
+  uint64_t carry = add;
+  uint8_t i;
+  for (i = 0; i < FPE_LIMBS; ++i)
+  {
+    carry += (uint64_t)x[i] * mul;
+    x[i] = (uint32_t)carry;
+    carry >>= 32;
+  }
+}
+
+// x = x / div, returns x % div. div <= 2^16.
+static uint32_t FpeDivMod(uint32_t* x, uint32_t div)
+{
+  uint64_t rem = 0;
+  uint8_t i;
+  // Leading zero limbs stay zero; most values are far below 128 bits.
+  for (i = FPE_LIMBS; (i > 0) && (x[i - 1] == 0); --i)
+    ;
+  for (; i > 0; --i)
+  {
+    rem = (rem << 32) | x[i - 1];
+    x[i - 1] = (uint32_t)(rem / div);
+    rem %= div;
+  }
+  return (uint32_t)rem;
+}
+
+// Big-endian byte string of len (<= 16) bytes to and from a number.
+static void FpeFromBytes(uint32_t* x, const uint8_t* p, uint8_t len)
+{
+  uint8_t i;
+  memset(x, 0, sizeof(fpe_num));
+  for (i = 0; i < len; ++i)
+  {
+    FpeMulAdd(x, 256, p[i]);
+  }
+}
+
+static void FpeToBytes(const uint32_t* x, uint8_t* p, uint8_t len)
+{
+  uint8_t i;
+  for (i = 0; i < len; ++i)
+  {
+    p[len - 1 - i] = (uint8_t)(x[i / 4] >> (8 * (i % 4)));
+  }
+}
+
+// NUM_radix of m numerals. FF1 stores them most significant first; FF3-1
+// works on reversed strings throughout, so there the first numeral is the
+// least significant one.
+static void FpeFromNumerals(uint32_t* x, const uint16_t* a, uint32_t m, uint32_t radix, int lsb_first)
+{
+  uint32_t j;
+  memset(x, 0, sizeof(fpe_num));
+  for (j = 0; j < m; ++j)
+  {
+    FpeMulAdd(x, radix, a[lsb_first ? m - 1 - j : j]);
+  }
+}
+
+// a = (a + y) mod radix^m, or (a - y) mod radix^m when decrypting. y is
+// consumed: its low m radix digits are taken off one by one, which is all of
+// y that matters modulo radix^m.
+static void FpeAddNumerals(uint16_t* a, uint32_t m, uint32_t* y, uint32_t radix, int decrypt, int lsb_first)
+{
+  uint32_t carry = 0, j, idx, d, s;
+  for (j = 0; j < m; ++j)
+  {
+    idx = lsb_first ? j : m - 1 - j;
+    d = FpeDivMod(y, radix) + carry;
+    if (decrypt)
+    {
+      carry = (a[idx] < d);
+      a[idx] = (uint16_t)(a[idx] + carry * radix - d);
+    }
+    else
+    {
+      s = a[idx] + d;
+      carry = (s >= radix);
+      a[idx] = (uint16_t)(s - carry * radix);
+    }
+  }
+}
+
+// Number of bits in radix^e - 1, i.e. ceil(e * log2(radix)), or 255 if
+// radix^e does not fit in 128 bits.
+static uint8_t FpePowBits(uint32_t radix, uint32_t e)
+{
+  fpe_num x;
+  uint8_t i, bits = 0;
+
+  memset(x, 0, sizeof(x));
+  x[0] = 1;
+  for (; e > 0; --e)
+  {
+    FpeMulAdd(x, radix, 0);
+    if (x[FPE_LIMBS - 1] != 0)
+    {
+      return 255;
+    }
+  }
+  for (i = 0; (i < FPE_LIMBS) && (x[i]-- == 0); ++i)
+    ;
+  for (i = FPE_LIMBS; i > 0; --i)
+  {
+    if (x[i - 1] != 0)
+    {
+      for (bits = (uint8_t)(32 * i); (x[i - 1] >> ((bits - 1) % 32)) == 0; --bits)
+        ;
+      break;
+    }
+  }
+  return bits;
+}
+
+// Domain checks shared by both modes: radix 2..2^16, radix^n >= 10^6 as
+// SP 800-38G Rev. 1 requires, and every numeral below radix.
+static int FpeCheck(const uint16_t* x, uint32_t n, uint32_t radix)
+{
+  uint64_t size = 1;
+  uint32_t j;
+
+  if ((radix < 2) || (radix > 65536) || (n < 2) || (n > AES_FPE_MAXLEN))
+  {
+    return -1;
+  }
+  for (j = 0; (j < n) && (size < 1000000); ++j)
+  {
+    size *= radix;
+  }
+  if (size < 1000000)
+  {
+    return -1;
+  }
+  for (j = 0; j < n; ++j)
+  {
+    if (x[j] >= radix)
+    {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// The batch engine runs up to AES_BATCH values in lockstep, one Feistel
+// round at a time, so the round's AES calls for all of them go through the
+// multi-block engine together.
+struct FpeLane
+{
+  uint16_t* a;
+  uint16_t* b;
+  uint32_t la;
+  uint32_t lb;
+  const uint8_t* base;    // FF1: CBC-MAC state before the last block of P || Q
+  uint8_t bytes;          // FF1: b, the byte length of NUM(B)
+};
+
+struct FpeParams
+{
+  const struct AES_ctx* aes;
+  uint32_t radix;
+  int ff3;
+  int decrypt;
+  const uint8_t* tweak;
+  uint32_t tweak_len;
+  uint8_t ff1_base[AES_FPE_MAXLEN + 1][AES_BLOCKLEN];  // FF1, per length
+  uint8_t ff1_bytes[AES_FPE_MAXLEN + 1];               // FF1, per length; 0 = not computed yet
+};
+
+// FF1 steps 1-5 and the part of the PRF that does not change between
+// rounds: P and the leading blocks of Q (tweak and padding) are the same for
+// every value of length n, so the CBC-MAC over them is done once per length.
+// Returns -1 if the larger half exceeds 96 bits, which would need more than
+// one AES output per round.
+static int Ff1Setup(struct FpeParams* prm, uint32_t n)
+{
+  const uint32_t u = n / 2, v = n - u, t = prm->tweak_len;
+  uint8_t* base = prm->ff1_base[n];
+  uint8_t b, k, bits;
+  uint32_t qlen, s;
+
+  if (prm->ff1_bytes[n] != 0)
+  {
+    return 0;
+  }
+  bits = FpePowBits(prm->radix, v);
+  if (bits > 96)
+  {
+    return -1;
+  }
+  b = (uint8_t)((bits + 7) / 8);
+
+  base[0] = 1;
+  base[1] = 2;
+  base[2] = 1;
+  base[3] = (uint8_t)(prm->radix >> 16);
+  base[4] = (uint8_t)(prm->radix >> 8);
+  base[5] = (uint8_t)prm->radix;
+  base[6] = 10;
+  base[7] = (uint8_t)u;
+  base[8] = (uint8_t)(n >> 24);
+  base[9] = (uint8_t)(n >> 16);
+  base[10] = (uint8_t)(n >> 8);
+  base[11] = (uint8_t)n;
+  base[12] = (uint8_t)(t >> 24);
+  base[13] = (uint8_t)(t >> 16);
+  base[14] = (uint8_t)(t >> 8);
+  base[15] = (uint8_t)t;
+  Cipher((state_t*)base, prm->aes->RoundKey);
+
+  // Q = T || 0^pad || [i] || [NUM(B)]b, a whole number of blocks.
+  qlen = t + 1 + b;
+  qlen += (AES_BLOCKLEN - qlen % AES_BLOCKLEN) % AES_BLOCKLEN;
+  for (s = 0; s < qlen; s += AES_BLOCKLEN)
+  {
+    for (k = 0; k < AES_BLOCKLEN; ++k)
+    {
+      base[k] ^= (s + k < t) ? prm->tweak[s + k] : 0;
+    }
+    if (s + AES_BLOCKLEN < qlen)
+    {
+      Cipher((state_t*)base, prm->aes->RoundKey);
+    }
+  }
+  prm->ff1_bytes[n] = b;
+  return 0;
+}
+
+static void FpeRound(struct FpeParams* prm, struct FpeLane* lanes, uint32_t nlanes, uint8_t i)
+{
+  uint8_t blocks[AES_BATCH][AES_BLOCKLEN];
+  uint8_t num[AES_BLOCKLEN];
+  fpe_num x;
+  uint32_t l;
+  uint8_t k;
+
+  for (l = 0; l < nlanes; ++l)
+  {
+    struct FpeLane* lane = &lanes[l];
+    // Encryption feeds B to the round function and updates A; decryption
+    // runs the rounds backwards, feeding A and updating B.
+    const uint16_t* src = prm->decrypt ? lane->a : lane->b;
+    const uint32_t lsrc = prm->decrypt ? lane->la : lane->lb;
+
+    FpeFromNumerals(x, src, lsrc, prm->radix, prm->ff3);
+    if (prm->ff3)
+    {
+      // P = (W xor [i]4) || [NUM(REV(B))]12, fed to the cipher byte-reversed.
+      const uint8_t* t = prm->tweak;
+      uint8_t w[4];
+      if (i & 1)
+      {
+        w[0] = t[0];
+        w[1] = t[1];
+        w[2] = t[2];
+        w[3] = t[3] & 0xf0;
+      }
+      else
+      {
+        w[0] = t[4];
+        w[1] = t[5];
+        w[2] = t[6];
+        w[3] = (uint8_t)(t[3] << 4);
+      }
+      w[3] ^= i;
+      FpeToBytes(x, num, 12);
+      for (k = 0; k < 4; ++k)
+      {
+        blocks[l][15 - k] = w[k];
+      }
+      for (k = 0; k < 12; ++k)
+      {
+        blocks[l][11 - k] = num[k];
+      }
+    }
+    else
+    {
+      memcpy(blocks[l], lane->base, AES_BLOCKLEN);
+      blocks[l][AES_BLOCKLEN - 1 - lane->bytes] ^= i;
+      FpeToBytes(x, num, lane->bytes);
+      for (k = 0; k < lane->bytes; ++k)
+      {
+        blocks[l][AES_BLOCKLEN - lane->bytes + k] ^= num[k];
+      }
+    }
+  }
+
+  CipherBlocks((state_t*)blocks, nlanes, prm->aes->RoundKey);
+
+  for (l = 0; l < nlanes; ++l)
+  {
+    struct FpeLane* lane = &lanes[l];
+    uint16_t* dst = prm->decrypt ? lane->b : lane->a;
+    const uint32_t m = prm->decrypt ? lane->lb : lane->la;
+    uint16_t* p;
+    uint32_t lp;
+
+    if (prm->ff3)
+    {
+      // y = NUM(REVB(output))
+      for (k = 0; k < AES_BLOCKLEN; ++k)
+      {
+        num[k] = blocks[l][AES_BLOCKLEN - 1 - k];
+      }
+      FpeFromBytes(x, num, AES_BLOCKLEN);
+    }
+    else
+    {
+      // y = NUM(first d bytes of R), d = 4 * ceil(b / 4) + 4 <= 16
+      FpeFromBytes(x, blocks[l], (uint8_t)(4 * ((lane->bytes + 3) / 4) + 4));
+    }
+    FpeAddNumerals(dst, m, x, prm->radix, prm->decrypt, prm->ff3);
+
+    // The updated half becomes the other one for the next round.
+    p = lane->a;
+    lane->a = lane->b;
+    lane->b = p;
+    lp = lane->la;
+    lane->la = lane->lb;
+    lane->lb = lp;
+  }
+}
+
+static uint32_t FpeRun(struct FpeParams* prm, struct AES_fpe_value* values, uint32_t count)
+{
+  struct FpeLane lanes[AES_BATCH];
+  const uint8_t rounds = prm->ff3 ? 8 : 10;
+  uint32_t nlanes = 0, failed = 0, v, n, u;
+  uint8_t r;
+
+  memset(prm->ff1_bytes, 0, sizeof(prm->ff1_bytes));
+  for (v = 0; v <= count; ++v)
+  {
+    if (v < count)
+    {
+      struct FpeLane* lane = &lanes[nlanes];
+      n = values[v].length;
+      values[v].status = FpeCheck(values[v].x, n, prm->radix);
+      if ((values[v].status == 0) && prm->ff3 && (FpePowBits(prm->radix, (n + 1) / 2) > 96))
+      {
+        values[v].status = -1;
+      }
+      if ((values[v].status == 0) && !prm->ff3)
+      {
+        values[v].status = Ff1Setup(prm, n);
+      }
+      if (values[v].status != 0)
+      {
+        ++failed;
+        continue;
+      }
+      // FF1 splits at u = floor(n / 2), FF3-1 at u = ceil(n / 2).
+      u = prm->ff3 ? (n + 1) / 2 : n / 2;
+      lane->a = values[v].x;
+      lane->la = u;
+      lane->b = values[v].x + u;
+      lane->lb = n - u;
+      lane->base = prm->ff1_base[n];
+      lane->bytes = prm->ff1_bytes[n];
+      if (++nlanes < AES_BATCH)
+      {
+        continue;
+      }
+    }
+    if (nlanes > 0)
+    {
+      for (r = 0; r < rounds; ++r)
+      {
+        FpeRound(prm, lanes, nlanes, (uint8_t)(prm->decrypt ? rounds - 1 - r : r));
+      }
+      nlanes = 0;
+    }
+  }
+  return failed;
+}
+
+void AES_FF1_init_ctx(struct AES_ff1_ctx* ctx, const uint8_t* key, uint32_t radix)
+{
+  AES_init_ctx(&ctx->aes, key);
+  ctx->radix = radix;
+}
+
+uint32_t AES_FF1_encrypt_batch(const struct AES_ff1_ctx* ctx, const uint8_t* tweak, uint32_t tweak_len,
+                               struct AES_fpe_value* values, uint32_t count)
+{
+  struct FpeParams prm;
+  prm.aes = &ctx->aes;
+  prm.radix = ctx->radix;
+  prm.ff3 = 0;
+  prm.decrypt = 0;
+  prm.tweak = tweak;
+  prm.tweak_len = tweak_len;
+  return FpeRun(&prm, values, count);
+}
+
+uint32_t AES_FF1_decrypt_batch(const struct AES_ff1_ctx* ctx, const uint8_t* tweak, uint32_t tweak_len,
+                               struct AES_fpe_value* values, uint32_t count)
+{
+  struct FpeParams prm;
+  prm.aes = &ctx->aes;
+  prm.radix = ctx->radix;
+  prm.ff3 = 0;
+  prm.decrypt = 1;
+  prm.tweak = tweak;
+  prm.tweak_len = tweak_len;
+  return FpeRun(&prm, values, count);
+}
+
+int AES_FF1_encrypt(const struct AES_ff1_ctx* ctx, const uint8_t* tweak, uint32_t tweak_len, uint16_t* x, uint32_t n)
+{
+  struct AES_fpe_value value;
+  value.x = x;
+  value.length = n;
+  AES_FF1_encrypt_batch(ctx, tweak, tweak_len, &value, 1);
+  return value.status;
+}
+
+int AES_FF1_decrypt(const struct AES_ff1_ctx* ctx, const uint8_t* tweak, uint32_t tweak_len, uint16_t* x, uint32_t n)
+{
+  struct AES_fpe_value value;
+  value.x = x;
+  value.length = n;
+  AES_FF1_decrypt_batch(ctx, tweak, tweak_len, &value, 1);
+  return value.status;
+}
+
+void AES_FF3_init_ctx(struct AES_ff3_ctx* ctx, const uint8_t* key, uint32_t radix)
+{
+  // FF3-1 keys the cipher with the byte-reversed key.
+  uint8_t rev[AES_KEYLEN];
+  uint8_t i;
+  for (i = 0; i < AES_KEYLEN; ++i)
+  {
+    rev[i] = key[AES_KEYLEN - 1 - i];
+  }
+  AES_init_ctx(&ctx->aes, rev);
+  ctx->radix = radix;
+}
+
+uint32_t AES_FF3_encrypt_batch(const struct AES_ff3_ctx* ctx, const uint8_t* tweak, struct AES_fpe_value* values, uint32_t count)
+{
+  struct FpeParams prm;
+  prm.aes = &ctx->aes;
+  prm.radix = ctx->radix;
+  prm.ff3 = 1;
+  prm.decrypt = 0;
+  prm.tweak = tweak;
+  prm.tweak_len = AES_FF3_TWEAKLEN;
+  return FpeRun(&prm, values, count);
+}
+
+uint32_t AES_FF3_decrypt_batch(const struct AES_ff3_ctx* ctx, const uint8_t* tweak, struct AES_fpe_value* values, uint32_t count)
+{
+  struct FpeParams prm;
+  prm.aes = &ctx->aes;
+  prm.radix = ctx->radix;
+  prm.ff3 = 1;
+  prm.decrypt = 1;
+  prm.tweak = tweak;
+  prm.tweak_len = AES_FF3_TWEAKLEN;
+  return FpeRun(&prm, values, count);
+}
+
+int AES_FF3_encrypt(const struct AES_ff3_ctx* ctx, const uint8_t* tweak, uint16_t* x, uint32_t n)
+{
+  struct AES_fpe_value value;
+  value.x = x;
+  value.length = n;
+  AES_FF3_encrypt_batch(ctx, tweak, &value, 1);
+  return value.status;
+}
+
+int AES_FF3_decrypt(const struct AES_ff3_ctx* ctx, const uint8_t* tweak, uint16_t* x, uint32_t n)
+{
+  struct AES_fpe_value value;
+  value.x = x;
+  value.length = n;
+  AES_FF3_decrypt_batch(ctx, tweak, &value, 1);
+  return value.status;
+}
 
+#endif // #if defined(FPE) && (FPE == 1)
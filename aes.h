@@ -8,6 +8,19 @@
 // CBC enables AES encryption in CBC-mode of operation.
 // CTR enables encryption in counter-mode.
 // ECB enables the basic ECB 16-byte block algorithm. All can be enabled simultaneously.
+// OCB enables the OCB3 authenticated encryption mode of RFC 7253.
+// SIV enables AES-CMAC (RFC 4493) and the deterministic AES-SIV mode (RFC 5297).
+// GCM enables the Galois/Counter mode of NIST SP 800-38D.
+// PMAC enables the parallelizable message authentication code PMAC1.
+// FPE enables the format-preserving encryption modes FF1 and FF3-1 of
+// NIST SP 800-38G.
+// SECDED enables a block encryption engine that carries Hamming SEC-DED check bits
+// with the state through the rounds.
+// RESO enables ECB functions that recompute every block on rotated operands
+// and compare, against permanent faults (needs ECB).
+// CBC, CTR and ECB are on by default; the others are off, to keep the default
+// build small, and are turned on with -DOCB=1 and so on (the Makefile does so
+// for the tools that use them).
 
 // The #ifndef-guard allows it to be configured before #include'ing or at compile time.
 #ifndef CBC
@@ -22,6 +35,34 @@
   #define CTR 1
 #endif
 
+#ifndef OCB
+  #define OCB 0
+#endif
+
+#ifndef SIV
+  #define SIV 0
+#endif
+
+#ifndef GCM
+  #define GCM 0
+#endif
+
+#ifndef PMAC
+  #define PMAC 0
+#endif
+
+#ifndef FPE
+  #define FPE 0
+#endif
+
+#ifndef SECDED
+  #define SECDED 0
+#endif
+
+#ifndef RESO
+  #define RESO 0
+#endif
+
 #define AES128 1
 //#define AES192 1
 //#define AES256 1
@@ -60,6 +101,21 @@ void AES_ctx_set_iv(struct AES_ctx* ctx, const uint8_t* iv);
 void AES_ECB_encrypt(const struct AES_ctx* ctx, uint8_t* buf);
 void AES_ECB_decrypt(const struct AES_ctx* ctx, uint8_t* buf);
 
+// The same on nblocks consecutive blocks, which are processed in batches of
+// 8 through the rounds together; faster than a loop over the above.
+void AES_ECB_encrypt_blocks(const struct AES_ctx* ctx, uint8_t* buf, uint32_t nblocks);
+void AES_ECB_decrypt_blocks(const struct AES_ctx* ctx, uint8_t* buf, uint32_t nblocks);
+
+// Same as above, but always with the constant-time S-box circuit instead of
+// table lookups (see SBOX_CIRCUIT in aes.c), for keys that need to be safe
+// against cache timing. Slower than the table engine. AES_init_ctx() looks
+// key bytes up in the S-box table unless built with SBOX_CIRCUIT=1; set up
+// contexts for these functions with AES_init_ctx_ct(), which expands the key
+// through the circuit into the same schedule.
+void AES_init_ctx_ct(struct AES_ctx* ctx, const uint8_t* key);
+void AES_ECB_encrypt_ct(const struct AES_ctx* ctx, uint8_t* buf);
+void AES_ECB_decrypt_ct(const struct AES_ctx* ctx, uint8_t* buf);
+
 #endif // #if defined(ECB) && (ECB == !)
 
 
@@ -83,7 +139,295 @@ void AES_CBC_decrypt_buffer(struct AES_ctx* ctx, uint8_t* buf, uint32_t length);
 //        no IV should ever be reused with the same key 
 void AES_CTR_xcrypt_buffer(struct AES_ctx* ctx, uint8_t* buf, uint32_t length);
 
+// As above, but only the low counter_bits bits of the IV (big-endian) are a
+// counter; they wrap to zero without carrying into the bits above, which
+// stay fixed. 32 gives the GCM-style inc32 layout, 64 a 64-bit nonce with a
+// 64-bit counter, 128 (or 0) is the same as AES_CTR_xcrypt_buffer().
+void AES_CTR_xcrypt_buffer_width(struct AES_ctx* ctx, uint8_t* buf, uint32_t length, uint8_t counter_bits);
+
 #endif // #if defined(CTR) && (CTR == 1)
 
 
+#if defined(OCB) && (OCB == 1)
+
+// OCB3 needs L_i = L_* * x^(i+2) for block numbers with i trailing zeros;
+// 32 of them cover any length that fits the uint32_t length argument.
+#define AES_OCB_LMAX 32
+
+struct AES_ocb_ctx
+{
+  struct AES_ctx aes;
+  uint8_t L_star[AES_BLOCKLEN];
+  uint8_t L_dollar[AES_BLOCKLEN];
+  uint8_t L[AES_OCB_LMAX][AES_BLOCKLEN];
+};
+
+void AES_OCB_init_ctx(struct AES_ocb_ctx* ctx, const uint8_t* key);
+
+// One-pass authenticated encryption: buf (any length) is encrypted in place
+// and tag_len (1..16) bytes of tag are written to tag. The nonce is 1..15
+// bytes and must never repeat for a key. ad is authenticated, not encrypted.
+// The IV in ctx->aes is not used. Returns 0, or -1 without touching buf if
+// nonce_len or tag_len is out of range.
+int AES_OCB_encrypt(const struct AES_ocb_ctx* ctx, const uint8_t* nonce, uint8_t nonce_len, const uint8_t* ad, uint32_t ad_len,
+                    uint8_t* buf, uint32_t length, uint8_t* tag, uint8_t tag_len);
+
+// Decrypts buf in place and checks the tag. Returns 0, or -1 if the tag does
+// not match, in which case buf is zeroed, or if nonce_len or tag_len is out
+// of range, in which case buf is left alone.
+int AES_OCB_decrypt(const struct AES_ocb_ctx* ctx, const uint8_t* nonce, uint8_t nonce_len, const uint8_t* ad, uint32_t ad_len,
+                    uint8_t* buf, uint32_t length, const uint8_t* tag, uint8_t tag_len);
+
+#endif // #if defined(OCB) && (OCB == 1)
+
+
+#if defined(SIV) && (SIV == 1)
+
+// One-shot CMAC of msg under ctx's key; writes AES_BLOCKLEN bytes to mac.
+void AES_CMAC(const struct AES_ctx* ctx, const uint8_t* msg, uint32_t length, uint8_t* mac);
+
+// AES-SIV takes a double-length key: the first half keys S2V (CMAC), the
+// second half keys CTR.
+#define AES_SIV_KEYLEN (2 * AES_KEYLEN)
+
+struct AES_siv_ctx
+{
+  struct AES_ctx mac;
+  struct AES_ctx ctr;
+  uint8_t sub1[AES_BLOCKLEN];  // CMAC subkeys
+  uint8_t sub2[AES_BLOCKLEN];
+  uint8_t d0[AES_BLOCKLEN];    // CMAC(<zero>), where S2V starts
+};
+
+void AES_SIV_init_ctx(struct AES_siv_ctx* ctx, const uint8_t* key);
+
+// Deterministic authenticated encryption: identical inputs give identical
+// outputs. buf (any length) is encrypted in place and the synthetic IV,
+// which doubles as the tag, is written to siv. ad holds ad_count associated
+// data strings; for nonce-based use, pass the nonce as the last one.
+void AES_SIV_encrypt(const struct AES_siv_ctx* ctx, const uint8_t* const* ad, const uint32_t* ad_len, uint32_t ad_count,
+                     uint8_t* buf, uint32_t length, uint8_t* siv);
+
+// Decrypts buf in place and checks siv. Returns 0, or -1 if it does not
+// match, in which case buf is zeroed.
+int AES_SIV_decrypt(const struct AES_siv_ctx* ctx, const uint8_t* const* ad, const uint32_t* ad_len, uint32_t ad_count,
+                    uint8_t* buf, uint32_t length, const uint8_t* siv);
+
+// Batch interface for many independent chunks, for example the chunks of a
+// deduplicated store. The S2V pass of some chunks is interleaved with the
+// CTR pass of others, so it is faster than a loop over the above.
+struct AES_siv_chunk
+{
+  uint8_t* buf;
+  uint32_t length;
+  const uint8_t* ad;           // one associated data string, or NULL for none
+  uint32_t ad_len;
+  uint8_t siv[AES_BLOCKLEN];   // written by encryption, checked by decryption
+  int status;                  // 0, or -1 if decryption failed (buf is zeroed)
+};
+
+void AES_SIV_encrypt_chunks(const struct AES_siv_ctx* ctx, struct AES_siv_chunk* chunks, uint32_t n);
+
+// Returns the number of chunks that failed to authenticate.
+uint32_t AES_SIV_decrypt_chunks(const struct AES_siv_ctx* ctx, struct AES_siv_chunk* chunks, uint32_t n);
+
+#endif // #if defined(SIV) && (SIV == 1)
+
+
+#if defined(GCM) && (GCM == 1)
+
+// GHASH is a Horner chain, so hashing a message piecewise needs the chain to
+// be advanced over each piece: that takes H^n for the piece's block count n,
+// which is assembled from the powers H^(2^i) kept here.
+#define AES_GCM_POWERS 32
+
+struct AES_gcm_ctx
+{
+  struct AES_ctx aes;
+  uint64_t HL[16];             // 4-bit multiplication table for H
+  uint64_t HH[16];
+  uint8_t Hpow[AES_GCM_POWERS][AES_BLOCKLEN];  // H^(2^i)
+};
+
+void AES_GCM_init_ctx(struct AES_gcm_ctx* ctx, const uint8_t* key);
+
+// Authenticated encryption: buf (any length) is encrypted in place and
+// tag_len (1..16) bytes of tag are written to tag. A 12-byte IV is the
+// recommended size; other lengths (>= 1) are hashed into the counter block.
+// The IV must never repeat for a key. The IV in ctx->aes is not used.
+// Returns 0, or -1 without touching buf if iv_len or tag_len is out of range.
+int AES_GCM_encrypt(const struct AES_gcm_ctx* ctx, const uint8_t* iv, uint32_t iv_len, const uint8_t* ad, uint32_t ad_len,
+                    uint8_t* buf, uint32_t length, uint8_t* tag, uint8_t tag_len);
+
+// Decrypts buf in place and checks the tag. Returns 0, or -1 if the tag does
+// not match, in which case buf is zeroed, or if iv_len or tag_len is out of
+// range, in which case buf is left alone.
+int AES_GCM_decrypt(const struct AES_gcm_ctx* ctx, const uint8_t* iv, uint32_t iv_len, const uint8_t* ad, uint32_t ad_len,
+                    uint8_t* buf, uint32_t length, const uint8_t* tag, uint8_t tag_len);
+
+// Split interface, for drivers that process one message in pieces (see
+// aes_mt.h). AES_GCM_start() sets up op and hashes the associated data.
+// AES_GCM_piece() en/decrypts the piece at byte offset of the message and
+// writes its partial GHASH, computed as if the piece were a message of its
+// own; pieces are independent of each other and may run concurrently.
+// Every piece but the last must be a multiple of AES_BLOCKLEN long. The
+// partials are then folded in message order by AES_GCM_combine(), and
+// AES_GCM_finish() writes the full 16-byte tag. The result is identical to
+// the one-shot functions above.
+struct AES_gcm_op
+{
+  uint8_t j0[AES_BLOCKLEN];    // pre-counter block
+  uint8_t y[AES_BLOCKLEN];     // GHASH accumulator
+  uint64_t ad_len;
+  uint64_t length;             // text bytes combined so far
+};
+
+void AES_GCM_start(const struct AES_gcm_ctx* ctx, struct AES_gcm_op* op, const uint8_t* iv, uint32_t iv_len,
+                   const uint8_t* ad, uint32_t ad_len);
+void AES_GCM_piece(const struct AES_gcm_ctx* ctx, const struct AES_gcm_op* op, uint32_t offset, uint8_t* buf, uint32_t length,
+                   int decrypt, uint8_t* partial);
+void AES_GCM_combine(const struct AES_gcm_ctx* ctx, struct AES_gcm_op* op, const uint8_t* partial, uint32_t length);
+void AES_GCM_finish(const struct AES_gcm_ctx* ctx, const struct AES_gcm_op* op, uint8_t* tag);
+
+// Nonzero if iv_len and tag_len are acceptable to the functions above.
+int AES_GCM_lengths_valid(uint32_t iv_len, uint8_t tag_len);
+
+#endif // #if defined(GCM) && (GCM == 1)
+
+
+#if defined(PMAC) && (PMAC == 1)
+
+// PMAC1 needs L(i) = L * x^i for block numbers with i trailing zeros;
+// 32 of them cover any length that fits the uint32_t length argument.
+#define AES_PMAC_LMAX 32
+
+struct AES_pmac_ctx
+{
+  struct AES_ctx aes;
+  uint8_t L[AES_PMAC_LMAX][AES_BLOCKLEN];
+  uint8_t L_inv[AES_BLOCKLEN];  // L * x^-1, for a full final block
+};
+
+void AES_PMAC_init_ctx(struct AES_pmac_ctx* ctx, const uint8_t* key);
+
+// One-shot PMAC1 of msg; writes AES_BLOCKLEN bytes to mac, which may be
+// truncated by the caller. Unlike CMAC, the block cipher calls do not depend
+// on each other, so they run through the multi-block engine.
+void AES_PMAC(const struct AES_pmac_ctx* ctx, const uint8_t* msg, uint32_t length, uint8_t* mac);
+
+// Split interface, for drivers that MAC one message in pieces (see
+// aes_mt.h). AES_PMAC_sum() covers nblocks full blocks of the message
+// starting at block number block (0 for the first block of the message) and
+// writes their share of the checksum to sum. Shares combine by XOR, in any
+// order. Every block but the last one of the message (which may be partial
+// or empty) goes through AES_PMAC_sum(); AES_PMAC_finish() takes the
+// combined sum and the last block and writes the MAC.
+void AES_PMAC_sum(const struct AES_pmac_ctx* ctx, uint32_t block, const uint8_t* msg, uint32_t nblocks, uint8_t* sum);
+void AES_PMAC_finish(const struct AES_pmac_ctx* ctx, const uint8_t* sum, const uint8_t* last, uint32_t last_len, uint8_t* mac);
+
+#endif // #if defined(PMAC) && (PMAC == 1)
+
+
+#if defined(FPE) && (FPE == 1)
+
+// Values are strings of numerals in radix 2..65536, for example the digits of
+// a card number in radix 10. Each value must have radix^length >= 10^6 and
+// at most AES_FPE_MAXLEN numerals. FF3-1 limits each half of a value to 96
+// bits (28 decimal digits, 56 in total); FF1 is held to the same limit here,
+// so that one AES call covers its round function.
+#define AES_FPE_MAXLEN 64
+#define AES_FF3_TWEAKLEN 7
+
+struct AES_ff1_ctx
+{
+  struct AES_ctx aes;
+  uint32_t radix;
+};
+
+struct AES_ff3_ctx
+{
+  struct AES_ctx aes;          // keyed with the byte-reversed key
+  uint32_t radix;
+};
+
+// One value of a batch, encrypted or decrypted in place.
+struct AES_fpe_value
+{
+  uint16_t* x;                 // numerals, most significant first
+  uint32_t length;
+  int status;                  // 0, or -1 if the value is out of the domain (left unchanged)
+};
+
+void AES_FF1_init_ctx(struct AES_ff1_ctx* ctx, const uint8_t* key, uint32_t radix);
+void AES_FF3_init_ctx(struct AES_ff3_ctx* ctx, const uint8_t* key, uint32_t radix);
+
+// Single values. They return 0, or -1 if x is out of the domain.
+int AES_FF1_encrypt(const struct AES_ff1_ctx* ctx, const uint8_t* tweak, uint32_t tweak_len, uint16_t* x, uint32_t n);
+int AES_FF1_decrypt(const struct AES_ff1_ctx* ctx, const uint8_t* tweak, uint32_t tweak_len, uint16_t* x, uint32_t n);
+int AES_FF3_encrypt(const struct AES_ff3_ctx* ctx, const uint8_t* tweak, uint16_t* x, uint32_t n);
+int AES_FF3_decrypt(const struct AES_ff3_ctx* ctx, const uint8_t* tweak, uint16_t* x, uint32_t n);
+
+// Batches of values under one tweak, of any mix of lengths. The Feistel
+// rounds of AES_BATCH values run in lockstep, so their AES calls go through
+// the multi-block engine together. This is a convenience, not a speedup:
+// the block cipher dominates either way, and ./bench fpe measures batches
+// no faster than single calls.
+// Returns the number of values rejected.
+uint32_t AES_FF1_encrypt_batch(const struct AES_ff1_ctx* ctx, const uint8_t* tweak, uint32_t tweak_len,
+                               struct AES_fpe_value* values, uint32_t count);
+uint32_t AES_FF1_decrypt_batch(const struct AES_ff1_ctx* ctx, const uint8_t* tweak, uint32_t tweak_len,
+                               struct AES_fpe_value* values, uint32_t count);
+uint32_t AES_FF3_encrypt_batch(const struct AES_ff3_ctx* ctx, const uint8_t* tweak, struct AES_fpe_value* values, uint32_t count);
+uint32_t AES_FF3_decrypt_batch(const struct AES_ff3_ctx* ctx, const uint8_t* tweak, struct AES_fpe_value* values, uint32_t count);
+
+#endif // #if defined(FPE) && (FPE == 1)
+
+
+#if defined(SECDED) && (SECDED == 1)
+
+// Encrypts one block like AES_ECB_encrypt(), but every state column carries a
+// 7-bit SEC-DED code that is checked and repaired before each round and at
+// the end, so a single-bit upset of the state is corrected mid-cipher.
+// Returns the number of corrections made, or -1 if a column took a double
+// error; buf is not to be trusted then.
+int AES_ECB_encrypt_secded(const struct AES_ctx* ctx, uint8_t* buf);
+
+// Fault injection hook for tests: when set, it is called with the state at
+// rest before each check, for round 1 .. Nr + 1 (the last one being the
+// final output). Leave it NULL in production.
+extern void (*AES_secded_fault)(uint8_t round, uint8_t* state);
+
+#endif // #if defined(SECDED) && (SECDED == 1)
+
+
+#if defined(RESO) && (RESO == 1) && defined(ECB) && (ECB == 1)
+
+// Recomputation with rotated operands (RESO). Duplication runs the same
+// bytes through the same lanes twice, so a stuck-at bit in a register, an
+// ALU lane or a memory cell hits both runs alike and they agree on the
+// wrong result. These functions work like AES_ECB_encrypt_blocks() and
+// AES_ECB_decrypt_blocks(), but every block is computed a second time on
+// a relabeled state: rows turned by 2 and columns by 1, under a round key
+// schedule relabeled to match (the column turn alternates between 1 and 3
+// from round to round, because ShiftRows moves a turned row by a different
+// amount). SubBytes, ShiftRows, MixColumns and AddRoundKey all commute with
+// that relabeling, so the second run yields the relabeled result, which is
+// turned back and compared. In every round each byte of the second run sits
+// in another row and another column, that is another byte of another
+// column word, than in the first. Both runs go through the multi-block
+// engine in the same batches.
+// Returns 0, or -1 if the runs of some block disagreed; buf is not to be
+// trusted then. The S-box table is read at the same entries by both runs,
+// so faults there are left to design diversity (aes_lockstep.h).
+int AES_ECB_encrypt_blocks_reso(const struct AES_ctx* ctx, uint8_t* buf, uint32_t nblocks);
+int AES_ECB_decrypt_blocks_reso(const struct AES_ctx* ctx, uint8_t* buf, uint32_t nblocks);
+
+// Fault injection hook for tests: when set, it is called with every block
+// of run 0 (as is) and run 1 (relabeled), where the engine keeps it, before
+// and after it is computed. Leave it NULL in production.
+extern void (*AES_reso_fault)(uint8_t run, uint8_t* block);
+
+#endif // #if defined(RESO) && (RESO == 1) && defined(ECB) && (ECB == 1)
+
+
 #endif // _AES_H_
@@ -0,0 +1,751 @@
+/*
+
+Backend registry and selection. See aes_backend.h for the interface.
+
+The portable backends wrap the engines of aes.c. The AES-NI backend is
+compiled with a per-function target attribute, so the rest of the library
+keeps building for the baseline instruction set, and it is only called
+after a CPUID check.
+
+*/
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "aes_backend.h"
+
+#if defined(ECB) && (ECB == 1) && defined(CTR) && (CTR == 1)
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+  #include <immintrin.h>
+  #define HAVE_AESNI 1
+  #define AESNI_TARGET __attribute__((target("aes,sse2")))
+#endif
+
+#define ROUNDS (AES_keyExpSize / AES_BLOCKLEN - 1)
+
+// Counter blocks per step of the CTR loops.
+#define CTR_STEP 8
+
+static int always(void)
+{
+  return 1;
+}
+
+static uint64_t load_be64(const uint8_t* p)
+{
+  uint64_t v = 0;
+  int i;
+  for (i = 0; i < 8; ++i)
+  {
+    v = (v << 8) | p[i];
+  }
+  return v;
+}
+
+static void store_be64(uint8_t* p, uint64_t v)
+{
+  int i;
+  for (i = 7; i >= 0; --i)
+  {
+    p[i] = (uint8_t)v;
+    v >>= 8;
+  }
+}
+
+// CTR on top of a backend's ECB function: a step of counter blocks is
+// encrypted in one call, then XORed into the buffer. The counter is held as
+// two native 64-bit halves, as in AES_CTR_xcrypt_buffer(), and the carry
+// into the high half is an addition rather than a branch, so the increment
+// takes as long whatever the counter holds.
+static void ctr_over_ecb(void (*ecb)(const struct AES_ctx*, uint8_t*, uint32_t), struct AES_ctx* ctx, uint8_t* buf, uint32_t length)
+{
+  uint8_t ks[CTR_STEP * AES_BLOCKLEN];
+  uint64_t hi = load_be64(ctx->Iv), lo = load_be64(ctx->Iv + 8);
+  uint32_t n, b, i, m;
+
+  while (length > 0)
+  {
+    n = (length + AES_BLOCKLEN - 1) / AES_BLOCKLEN;
+    n = (n < CTR_STEP) ? n : CTR_STEP;
+    for (b = 0; b < n; ++b)
+    {
+      store_be64(ks + b * AES_BLOCKLEN, hi);
+      store_be64(ks + b * AES_BLOCKLEN + 8, lo);
+      ++lo;
+      hi += (lo == 0);
+    }
+    ecb(ctx, ks, n);
+    m = (length < n * AES_BLOCKLEN) ? length : n * AES_BLOCKLEN;
+    for (i = 0; i < m; ++i)
+    {
+      buf[i] ^= ks[i];
+    }
+    buf += m;
+    length -= m;
+  }
+  store_be64(ctx->Iv, hi);
+  store_be64(ctx->Iv + 8, lo);
+}
+
+/*****************************************************************************/
+/* Portable backends:                                                        */
+/*****************************************************************************/
+// "table": one block at a time through Cipher(), the reference engine.
+static void table_encrypt(const struct AES_ctx* ctx, uint8_t* buf, uint32_t nblocks)
+{
+  for (; nblocks > 0; --nblocks, buf += AES_BLOCKLEN)
+  {
+    AES_ECB_encrypt(ctx, buf);
+  }
+}
+
+static void table_decrypt(const struct AES_ctx* ctx, uint8_t* buf, uint32_t nblocks)
+{
+  for (; nblocks > 0; --nblocks, buf += AES_BLOCKLEN)
+  {
+    AES_ECB_decrypt(ctx, buf);
+  }
+}
+
+static void table_ctr(struct AES_ctx* ctx, uint8_t* buf, uint32_t length)
+{
+  ctr_over_ecb(table_encrypt, ctx, buf, length);
+}
+
+// "batch": the multi-block engine, 8 blocks round by round.
+static void batch_ctr(struct AES_ctx* ctx, uint8_t* buf, uint32_t length)
+{
+  AES_CTR_xcrypt_buffer(ctx, buf, length);
+}
+
+// "ct": the table-free S-box circuit.
+static void ct_encrypt(const struct AES_ctx* ctx, uint8_t* buf, uint32_t nblocks)
+{
+  for (; nblocks > 0; --nblocks, buf += AES_BLOCKLEN)
+  {
+    AES_ECB_encrypt_ct(ctx, buf);
+  }
+}
+
+static void ct_decrypt(const struct AES_ctx* ctx, uint8_t* buf, uint32_t nblocks)
+{
+  for (; nblocks > 0; --nblocks, buf += AES_BLOCKLEN)
+  {
+    AES_ECB_decrypt_ct(ctx, buf);
+  }
+}
+
+static void ct_ctr(struct AES_ctx* ctx, uint8_t* buf, uint32_t length)
+{
+  ctr_over_ecb(ct_encrypt, ctx, buf, length);
+}
+
+/*****************************************************************************/
+/* AES-NI backend:                                                           */
+/*****************************************************************************/
+#if defined(HAVE_AESNI)
+
+static int aesni_available(void)
+{
+  return __builtin_cpu_supports("aes");
+}
+
+// Up to four blocks are kept in flight, so the latency of one aesenc is
+// hidden behind the others.
+AESNI_TARGET static void aesni_encrypt(const struct AES_ctx* ctx, uint8_t* buf, uint32_t nblocks)
+{
+  __m128i rk[ROUNDS + 1], x0, x1, x2, x3;
+  int r;
+
+  for (r = 0; r <= ROUNDS; ++r)
+  {
+    rk[r] = _mm_loadu_si128((const __m128i*)(ctx->RoundKey + r * AES_BLOCKLEN));
+  }
+  for (; nblocks >= 4; nblocks -= 4, buf += 4 * AES_BLOCKLEN)
+  {
+    x0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)buf), rk[0]);
+    x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(buf + 16)), rk[0]);
+    x2 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(buf + 32)), rk[0]);
+    x3 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(buf + 48)), rk[0]);
+    for (r = 1; r < ROUNDS; ++r)
+    {
+      x0 = _mm_aesenc_si128(x0, rk[r]);
+      x1 = _mm_aesenc_si128(x1, rk[r]);
+      x2 = _mm_aesenc_si128(x2, rk[r]);
+      x3 = _mm_aesenc_si128(x3, rk[r]);
+    }
+    _mm_storeu_si128((__m128i*)buf, _mm_aesenclast_si128(x0, rk[ROUNDS]));
+    _mm_storeu_si128((__m128i*)(buf + 16), _mm_aesenclast_si128(x1, rk[ROUNDS]));
+    _mm_storeu_si128((__m128i*)(buf + 32), _mm_aesenclast_si128(x2, rk[ROUNDS]));
+    _mm_storeu_si128((__m128i*)(buf + 48), _mm_aesenclast_si128(x3, rk[ROUNDS]));
+  }
+  for (; nblocks > 0; --nblocks, buf += AES_BLOCKLEN)
+  {
+    x0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)buf), rk[0]);
+    for (r = 1; r < ROUNDS; ++r)
+    {
+      x0 = _mm_aesenc_si128(x0, rk[r]);
+    }
+    _mm_storeu_si128((__m128i*)buf, _mm_aesenclast_si128(x0, rk[ROUNDS]));
+  }
+}
+
+// aesdec wants the decryption round keys of the equivalent inverse cipher:
+// the encryption keys in reverse order, the inner ones through aesimc.
+AESNI_TARGET static void aesni_decrypt(const struct AES_ctx* ctx, uint8_t* buf, uint32_t nblocks)
+{
+  __m128i dk[ROUNDS + 1], x0, x1, x2, x3;
+  int r;
+
+  dk[0] = _mm_loadu_si128((const __m128i*)(ctx->RoundKey + ROUNDS * AES_BLOCKLEN));
+  for (r = 1; r < ROUNDS; ++r)
+  {
+    dk[r] = _mm_aesimc_si128(_mm_loadu_si128((const __m128i*)(ctx->RoundKey + (ROUNDS - r) * AES_BLOCKLEN)));
+  }
+  dk[ROUNDS] = _mm_loadu_si128((const __m128i*)ctx->RoundKey);
+  for (; nblocks >= 4; nblocks -= 4, buf += 4 * AES_BLOCKLEN)
+  {
+    x0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)buf), dk[0]);
+    x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(buf + 16)), dk[0]);
+    x2 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(buf + 32)), dk[0]);
+    x3 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(buf + 48)), dk[0]);
+    for (r = 1; r < ROUNDS; ++r)
+    {
+      x0 = _mm_aesdec_si128(x0, dk[r]);
+      x1 = _mm_aesdec_si128(x1, dk[r]);
+      x2 = _mm_aesdec_si128(x2, dk[r]);
+      x3 = _mm_aesdec_si128(x3, dk[r]);
+    }
+    _mm_storeu_si128((__m128i*)buf, _mm_aesdeclast_si128(x0, dk[ROUNDS]));
+    _mm_storeu_si128((__m128i*)(buf + 16), _mm_aesdeclast_si128(x1, dk[ROUNDS]));
+    _mm_storeu_si128((__m128i*)(buf + 32), _mm_aesdeclast_si128(x2, dk[ROUNDS]));
+    _mm_storeu_si128((__m128i*)(buf + 48), _mm_aesdeclast_si128(x3, dk[ROUNDS]));
+  }
+  for (; nblocks > 0; --nblocks, buf += AES_BLOCKLEN)
+  {
+    x0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)buf), dk[0]);
+    for (r = 1; r < ROUNDS; ++r)
+    {
+      x0 = _mm_aesdec_si128(x0, dk[r]);
+    }
+    _mm_storeu_si128((__m128i*)buf, _mm_aesdeclast_si128(x0, dk[ROUNDS]));
+  }
+}
+
+static void aesni_ctr(struct AES_ctx* ctx, uint8_t* buf, uint32_t length)
+{
+  ctr_over_ecb(aesni_encrypt, ctx, buf, length);
+}
+
+#endif // #if defined(HAVE_AESNI)
+
+/*****************************************************************************/
+/* Registry:                                                                 */
+/*****************************************************************************/
+static const struct aes_backend backends[] =
+{
+#if defined(HAVE_AESNI)
+  { "aesni", aesni_available, aesni_encrypt, aesni_decrypt, aesni_ctr },
+#endif
+  { "batch", always, AES_ECB_encrypt_blocks, AES_ECB_decrypt_blocks, batch_ctr },
+  { "table", always, table_encrypt, table_decrypt, table_ctr },
+  { "ct", always, ct_encrypt, ct_decrypt, ct_ctr },
+};
+
+#define NBACKENDS (sizeof(backends) / sizeof(backends[0]))
+
+static const char* const class_names[AES_BACKEND_CLASSES] = { "small", "medium", "large" };
+
+// Buffer size the microbenchmark uses for each class.
+static const uint32_t class_bytes[AES_BACKEND_CLASSES] = { 64, 4096, 65536 };
+
+static _Atomic(const struct aes_backend*) selected[AES_BACKEND_CLASSES];
+static _Atomic int forced;                 // selection set by name, not tuned
+static _Atomic uint32_t stream_threshold;
+static _Atomic int stream_measured;        // threshold from the cache or the caller
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+unsigned aes_backend_count(void)
+{
+  return NBACKENDS;
+}
+
+const struct aes_backend* aes_backend_get(unsigned index)
+{
+  return (index < NBACKENDS) ? &backends[index] : NULL;
+}
+
+const struct aes_backend* aes_backend_find(const char* name)
+{
+  unsigned i;
+  for (i = 0; i < NBACKENDS; ++i)
+  {
+    if (strcmp(backends[i].name, name) == 0)
+    {
+      return &backends[i];
+    }
+  }
+  return NULL;
+}
+
+static int class_of(uint32_t length)
+{
+  return (length <= AES_BACKEND_SMALL_MAX) ? AES_BACKEND_SMALL : (length <= AES_BACKEND_MEDIUM_MAX) ? AES_BACKEND_MEDIUM : AES_BACKEND_LARGE;
+}
+
+/*****************************************************************************/
+/* Cache file:                                                               */
+/*****************************************************************************/
+// The cache is only trusted on the CPU model it was written on.
+static void cpu_model(char* out, size_t size)
+{
+  FILE* f = fopen("/proc/cpuinfo", "r");
+  char line[256];
+
+  snprintf(out, size, "unknown");
+  if (f == NULL)
+  {
+    return;
+  }
+  while (fgets(line, sizeof(line), f) != NULL)
+  {
+    char* p = strchr(line, ':');
+    if ((strncmp(line, "model name", 10) == 0) && (p != NULL))
+    {
+      for (++p; *p == ' '; ++p)
+        ;
+      p[strcspn(p, "\n")] = '\0';
+      snprintf(out, size, "%s", p);
+      break;
+    }
+  }
+  fclose(f);
+}
+
+// Nor for another build: the key size sets the number of rounds, and the
+// compiler and its optimization decide how fast the software engines are.
+static void build_id(char* out, size_t size)
+{
+#if defined(__VERSION__)
+  const char* cc = __VERSION__;
+#else
+  const char* cc = "unknown";
+#endif
+#if defined(__OPTIMIZE__)
+  const int optimized = 1;
+#else
+  const int optimized = 0;
+#endif
+  snprintf(out, size, "aes%d nr%d cc %s%s", AES_KEYLEN * 8, AES_KEYLEN / 4 + 6, cc, optimized ? " optimized" : "");
+}
+
+static int cache_path(char* out, size_t size)
+{
+  const char* path = getenv("AES_BACKEND_CACHE");
+  const char* home = getenv("HOME");
+
+  if (path != NULL)
+  {
+    return (*path == '\0') ? -1 : ((snprintf(out, size, "%s", path) < (int)size) ? 0 : -1);
+  }
+  if (home == NULL)
+  {
+    return -1;
+  }
+  return (snprintf(out, size, "%s/.cache/aes-backend", home) < (int)size) ? 0 : -1;
+}
+
+static int cache_read(void)
+{
+  const struct aes_backend* pick[AES_BACKEND_CLASSES] = { NULL };
+  char path[512], cpu[256], build[256], line[320], name[64];
+  unsigned long stream;
+  FILE* f;
+  int c, ok = 0;
+
+  if ((cache_path(path, sizeof(path)) < 0) || ((f = fopen(path, "r")) == NULL))
+  {
+    return -1;
+  }
+  cpu_model(cpu, sizeof(cpu));
+  build_id(build, sizeof(build));
+  if ((fgets(line, sizeof(line), f) != NULL) && (strcmp(line, "aes-backend 2\n") == 0)
+      && (fgets(line, sizeof(line), f) != NULL) && (strncmp(line, "cpu ", 4) == 0))
+  {
+    line[strcspn(line, "\n")] = '\0';
+    ok = (strcmp(line + 4, cpu) == 0);
+  }
+  if (ok && (fgets(line, sizeof(line), f) != NULL) && (strncmp(line, "build ", 6) == 0))
+  {
+    line[strcspn(line, "\n")] = '\0';
+    ok = (strcmp(line + 6, build) == 0);
+  }
+  else
+  {
+    ok = 0;
+  }
+  while (ok && (fgets(line, sizeof(line), f) != NULL))
+  {
+    if (sscanf(line, "stream %lu", &stream) == 1)
+    {
+      atomic_store(&stream_threshold, (stream < UINT32_MAX) ? (uint32_t)stream : UINT32_MAX);
+      atomic_store(&stream_measured, 1);
+    }
+    for (c = 0; c < AES_BACKEND_CLASSES; ++c)
+    {
+      const size_t k = strlen(class_names[c]);
+      if ((strncmp(line, class_names[c], k) == 0) && (line[k] == ' ') && (sscanf(line + k + 1, "%63s", name) == 1))
+      {
+        pick[c] = aes_backend_find(name);
+      }
+    }
+  }
+  fclose(f);
+
+  // A backend that has since gone (or is unusable) voids the whole file.
+  for (c = 0; ok && (c < AES_BACKEND_CLASSES); ++c)
+  {
+    ok = (pick[c] != NULL) && pick[c]->available();
+  }
+  if (!ok)
+  {
+    return -1;
+  }
+  for (c = 0; c < AES_BACKEND_CLASSES; ++c)
+  {
+    atomic_store(&selected[c], pick[c]);
+  }
+  return 0;
+}
+
+// Written to a temporary file and renamed, so concurrent readers never see
+// a partial file. Failure to write is not an error: the next process tunes.
+static void cache_write(void)
+{
+  char path[512], tmp[540], cpu[256], build[256];
+  FILE* f;
+  int c;
+
+  if (cache_path(path, sizeof(path)) < 0)
+  {
+    return;
+  }
+  snprintf(tmp, sizeof(tmp), "%s.%ld", path, (long)getpid());
+  if ((f = fopen(tmp, "w")) == NULL)
+  {
+    return;
+  }
+  cpu_model(cpu, sizeof(cpu));
+  build_id(build, sizeof(build));
+  fprintf(f, "aes-backend 2\ncpu %s\nbuild %s\n", cpu, build);
+  for (c = 0; c < AES_BACKEND_CLASSES; ++c)
+  {
+    fprintf(f, "%s %s\n", class_names[c], atomic_load(&selected[c])->name);
+  }
+  if (atomic_load(&stream_measured))
+  {
+    fprintf(f, "stream %lu\n", (unsigned long)atomic_load(&stream_threshold));
+  }
+  if ((fclose(f) != 0) || (rename(tmp, path) != 0))
+  {
+    remove(tmp);
+  }
+}
+
+/*****************************************************************************/
+/* Selection:                                                                */
+/*****************************************************************************/
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// Bytes per second of CTR on bytes-sized buffers: the best of three runs of
+// at least a millisecond each. A backend at less than half of to_beat after
+// a run cannot win, and is not run again: a slow engine on the large class
+// can take several milliseconds for a single buffer.
+static double measure(const struct aes_backend* be, struct AES_ctx* ctx, uint8_t* buf, uint32_t bytes, double to_beat)
+{
+  double best = 0, t0, t;
+  uint64_t done;
+  int trial;
+
+  for (trial = 0; (trial < 3) && ((trial == 0) || (2 * best >= to_beat)); ++trial)
+  {
+    done = 0;
+    t0 = now();
+    do
+    {
+      be->ctr_xcrypt(ctx, buf, bytes);
+      done += bytes;
+      t = now() - t0;
+    } while (t < 1e-3);
+    if (done / t > best)
+    {
+      best = done / t;
+    }
+  }
+  return best;
+}
+
+void aes_backend_tune(void)
+{
+  static const uint8_t key[AES_KEYLEN] = { 0 };
+  static const uint8_t iv[AES_BLOCKLEN] = { 0 };
+  uint8_t* buf = (uint8_t*)calloc(1, class_bytes[AES_BACKEND_CLASSES - 1]);
+  struct AES_ctx ctx;
+  double rate, best;
+  unsigned i;
+  int c;
+
+  for (c = 0; c < AES_BACKEND_CLASSES; ++c)
+  {
+    const struct aes_backend* pick = &backends[NBACKENDS - 1];
+    best = 0;
+    for (i = 0; (buf != NULL) && (i < NBACKENDS); ++i)
+    {
+      if (!backends[i].available())
+      {
+        continue;
+      }
+      AES_init_ctx_iv(&ctx, key, iv);
+      rate = measure(&backends[i], &ctx, buf, class_bytes[c], best);
+      if (rate > best)
+      {
+        best = rate;
+        pick = &backends[i];
+      }
+    }
+    atomic_store(&selected[c], pick);
+  }
+  atomic_store(&forced, 0);
+  free(buf);
+  if (buf != NULL)
+  {
+    cache_write();
+  }
+}
+
+static int force_all(const struct aes_backend* be)
+{
+  int c;
+  if ((be == NULL) || !be->available())
+  {
+    return -1;
+  }
+  for (c = 0; c < AES_BACKEND_CLASSES; ++c)
+  {
+    atomic_store(&selected[c], be);
+  }
+  atomic_store(&forced, 1);
+  return 0;
+}
+
+static void select_auto(void)
+{
+  if (cache_read() < 0)
+  {
+    aes_backend_tune();
+  }
+  atomic_store(&forced, 0);
+}
+
+// Streaming pays off once the buffers no longer fit the last level cache,
+// until the benchmark has measured where it really does.
+static uint32_t default_threshold(void)
+{
+  long llc = sysconf(_SC_LEVEL3_CACHE_SIZE);
+  if (llc <= 0)
+  {
+    llc = sysconf(_SC_LEVEL2_CACHE_SIZE);
+  }
+  return ((llc > 0) && ((unsigned long)llc < UINT32_MAX)) ? (uint32_t)llc : (8u << 20);
+}
+
+static void init(void)
+{
+  const char* env = getenv("AES_BACKEND");
+  atomic_store(&stream_threshold, default_threshold());
+  if ((env == NULL) || (force_all(aes_backend_find(env)) < 0))
+  {
+    select_auto();
+  }
+}
+
+int aes_backend_force(const char* name)
+{
+  pthread_once(&once, init);
+  if (name == NULL)
+  {
+    select_auto();
+    return 0;
+  }
+  return force_all(aes_backend_find(name));
+}
+
+const struct aes_backend* aes_backend_selected(int size_class)
+{
+  pthread_once(&once, init);
+  return atomic_load(&selected[size_class]);
+}
+
+const struct aes_backend* aes_backend_select(uint32_t length)
+{
+  return aes_backend_selected(class_of(length));
+}
+
+static uint32_t block_bytes(uint32_t nblocks)
+{
+  return (nblocks > UINT32_MAX / AES_BLOCKLEN) ? UINT32_MAX : nblocks * AES_BLOCKLEN;
+}
+
+void aes_backend_ecb_encrypt(const struct AES_ctx* ctx, uint8_t* buf, uint32_t nblocks)
+{
+  aes_backend_select(block_bytes(nblocks))->ecb_encrypt(ctx, buf, nblocks);
+}
+
+void aes_backend_ecb_decrypt(const struct AES_ctx* ctx, uint8_t* buf, uint32_t nblocks)
+{
+  aes_backend_select(block_bytes(nblocks))->ecb_decrypt(ctx, buf, nblocks);
+}
+
+void aes_backend_ctr_xcrypt(struct AES_ctx* ctx, uint8_t* buf, uint32_t length)
+{
+  aes_backend_select(length)->ctr_xcrypt(ctx, buf, length);
+}
+
+
+/*****************************************************************************/
+/* Streaming:                                                                */
+/*****************************************************************************/
+// Bytes per tile of the streaming path: small enough to stay in L1 between
+// the copy in, the cipher pass and the copy out.
+#define TILE 4096
+// How far ahead of the tile being enciphered the input prefetch runs.
+#define PREFETCH_AHEAD (2 * TILE)
+#define CACHE_LINE 64
+
+#if defined(__GNUC__)
+  #define PREFETCH(p) __builtin_prefetch((p), 0, 0)
+#else
+  #define PREFETCH(p) ((void)(p))
+#endif
+
+uint32_t aes_backend_stream_threshold(void)
+{
+  pthread_once(&once, init);
+  return atomic_load(&stream_threshold);
+}
+
+void aes_backend_set_stream_threshold(uint32_t bytes)
+{
+  pthread_once(&once, init);
+  atomic_store(&stream_threshold, bytes);
+  atomic_store(&stream_measured, 1);
+  if (!atomic_load(&forced))
+  {
+    cache_write();
+  }
+}
+
+// One in-place pass of the backend over n bytes. ctr is NULL for ECB.
+static void pass(const struct aes_backend* be, const struct AES_ctx* ctx, struct AES_ctx* ctr, int decrypt, uint8_t* buf, uint32_t n)
+{
+  if (ctr != NULL)
+  {
+    be->ctr_xcrypt(ctr, buf, n);
+  }
+  else if (decrypt)
+  {
+    be->ecb_decrypt(ctx, buf, n / AES_BLOCKLEN);
+  }
+  else
+  {
+    be->ecb_encrypt(ctx, buf, n / AES_BLOCKLEN);
+  }
+}
+
+// Non-temporal stores go around the cache, straight to memory, without
+// the read for ownership of a normal store miss. They need an aligned
+// destination; the unaligned head and the tail are copied normally.
+static void store_tile(uint8_t* out, const uint8_t* tile, uint32_t n)
+{
+  uint32_t i = 0;
+#if defined(HAVE_AESNI) && defined(__SSE2__)
+  if (((uintptr_t)out & (AES_BLOCKLEN - 1)) == 0)
+  {
+    for (; i + AES_BLOCKLEN <= n; i += AES_BLOCKLEN)
+    {
+      _mm_stream_si128((__m128i*)(out + i), _mm_load_si128((const __m128i*)(tile + i)));
+    }
+  }
+#endif
+  memcpy(out + i, tile + i, n - i);
+}
+
+static void xcrypt_to(const struct AES_ctx* ctx, struct AES_ctx* ctr, int decrypt, const uint8_t* in, uint8_t* out, uint64_t length)
+{
+  const struct aes_backend* be = aes_backend_select((length < UINT32_MAX) ? (uint32_t)length : UINT32_MAX);
+  _Alignas(CACHE_LINE) uint8_t tile[TILE];
+  const uint8_t* end = in + length;
+  const uint8_t* p;
+  uint32_t n;
+
+  if (length < aes_backend_stream_threshold())
+  {
+    if (out != in)
+    {
+      memcpy(out, in, length);
+    }
+    pass(be, ctx, ctr, decrypt, out, (uint32_t)length);
+    return;
+  }
+
+  // Tile by tile: the input is copied in, with the input PREFETCH_AHEAD
+  // further on already requested, enciphered in L1 and streamed out.
+  for (p = in; (p < end) && (p < in + PREFETCH_AHEAD); p += CACHE_LINE)
+  {
+    PREFETCH(p);
+  }
+  for (; length > 0; length -= n, in += n, out += n)
+  {
+    n = (length < TILE) ? (uint32_t)length : TILE;
+    for (p = in + PREFETCH_AHEAD; (p < end) && (p < in + PREFETCH_AHEAD + n); p += CACHE_LINE)
+    {
+      PREFETCH(p);
+    }
+    memcpy(tile, in, n);
+    pass(be, ctx, ctr, decrypt, tile, n);
+    store_tile(out, tile, n);
+  }
+#if defined(HAVE_AESNI) && defined(__SSE2__)
+  // Streaming stores are weakly ordered; make them visible before return.
+  _mm_sfence();
+#endif
+}
+
+void aes_backend_ecb_encrypt_to(const struct AES_ctx* ctx, const uint8_t* in, uint8_t* out, uint32_t nblocks)
+{
+  xcrypt_to(ctx, NULL, 0, in, out, (uint64_t)nblocks * AES_BLOCKLEN);
+}
+
+void aes_backend_ecb_decrypt_to(const struct AES_ctx* ctx, const uint8_t* in, uint8_t* out, uint32_t nblocks)
+{
+  xcrypt_to(ctx, NULL, 1, in, out, (uint64_t)nblocks * AES_BLOCKLEN);
+}
+
+void aes_backend_ctr_xcrypt_to(struct AES_ctx* ctx, const uint8_t* in, uint8_t* out, uint32_t length)
+{
+  xcrypt_to(ctx, ctx, 0, in, out, length);
+}
+
+#endif // #if defined(ECB) && (ECB == 1) && defined(CTR) && (CTR == 1)
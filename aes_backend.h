@@ -0,0 +1,95 @@
+#ifndef _AES_BACKEND_H_
+#define _AES_BACKEND_H_
+
+// Block engine backends and their run-time selection.
+//
+// A backend is a table of functions for the modes below, all working on a
+// context set up by AES_init_ctx() / AES_init_ctx_iv(), and all producing
+// the same output as the aes.h functions. The registry holds every backend
+// built into the library; some (AES-NI) are only usable on some CPUs.
+//
+// Which backend is fastest depends on the host and on the buffer size, so
+// the choice is made per size class. On first use the selection is taken,
+// in this order, from:
+//   1. aes_backend_force(), or the AES_BACKEND environment variable (a
+//      backend name, applied to every size class);
+//   2. the cache file, if it was written on a CPU of the same model, by a
+//      build with the same key size and compiler;
+//   3. a startup microbenchmark, whose result is written to the cache file
+//      for later processes. Each backend runs CTR for at least 1 ms per size
+//      class, three times unless it is under half the best rate so far; a
+//      single 64 KB buffer on a software engine takes several ms. It comes
+//      to 50-100 ms, most of it in the large class.
+// The cache file is $AES_BACKEND_CACHE, or $HOME/.cache/aes-backend. Set
+// AES_BACKEND_CACHE to an empty string to disable it.
+
+#include <stdint.h>
+#include "aes.h"
+
+#if defined(ECB) && (ECB == 1) && defined(CTR) && (CTR == 1)
+
+// Size classes: buffers up to AES_BACKEND_SMALL_MAX bytes, up to
+// AES_BACKEND_MEDIUM_MAX bytes, and larger.
+#define AES_BACKEND_SMALL_MAX 256
+#define AES_BACKEND_MEDIUM_MAX 16384
+
+enum AES_backend_class
+{
+  AES_BACKEND_SMALL = 0,
+  AES_BACKEND_MEDIUM,
+  AES_BACKEND_LARGE,
+  AES_BACKEND_CLASSES
+};
+
+struct aes_backend
+{
+  const char* name;
+  int (*available)(void);      // nonzero if the CPU can run it
+  void (*ecb_encrypt)(const struct AES_ctx* ctx, uint8_t* buf, uint32_t nblocks);
+  void (*ecb_decrypt)(const struct AES_ctx* ctx, uint8_t* buf, uint32_t nblocks);
+  void (*ctr_xcrypt)(struct AES_ctx* ctx, uint8_t* buf, uint32_t length);  // as AES_CTR_xcrypt_buffer()
+};
+
+// The registry, in order of preference when nothing else decides.
+unsigned aes_backend_count(void);
+const struct aes_backend* aes_backend_get(unsigned index);
+const struct aes_backend* aes_backend_find(const char* name);
+
+// Returns the backend selected for buffers of length bytes, setting up the
+// selection on first use. Safe to call from several threads.
+const struct aes_backend* aes_backend_select(uint32_t length);
+const struct aes_backend* aes_backend_selected(int size_class);
+
+// Forces one backend for every size class; NULL returns to the automatic
+// selection (cache or microbenchmark). Returns -1 if the backend is unknown
+// or not available on this CPU.
+int aes_backend_force(const char* name);
+
+// Runs the microbenchmark now and updates the selection and the cache file.
+void aes_backend_tune(void);
+
+// The selected backend for the buffer size.
+void aes_backend_ecb_encrypt(const struct AES_ctx* ctx, uint8_t* buf, uint32_t nblocks);
+void aes_backend_ecb_decrypt(const struct AES_ctx* ctx, uint8_t* buf, uint32_t nblocks);
+void aes_backend_ctr_xcrypt(struct AES_ctx* ctx, uint8_t* buf, uint32_t length);
+
+// Out-of-place variants for large buffers; in and out must not overlap
+// unless they are equal. At or above the streaming threshold the buffer is
+// processed in L1-sized tiles: the input is prefetched ahead of use, and
+// the output is written with non-temporal stores that bypass the cache, so
+// a multi-GB pass neither evicts the working set nor reads every output
+// line before writing it. Below the threshold they copy and work in place.
+void aes_backend_ecb_encrypt_to(const struct AES_ctx* ctx, const uint8_t* in, uint8_t* out, uint32_t nblocks);
+void aes_backend_ecb_decrypt_to(const struct AES_ctx* ctx, const uint8_t* in, uint8_t* out, uint32_t nblocks);
+void aes_backend_ctr_xcrypt_to(struct AES_ctx* ctx, const uint8_t* in, uint8_t* out, uint32_t length);
+
+// The streaming threshold in bytes, by default the size of the last level
+// cache. The benchmark (bench stream) measures the real crossover and sets
+// it here, which also stores it in the cache file next to the selection
+// (unless the selection was forced). UINT32_MAX turns streaming off.
+uint32_t aes_backend_stream_threshold(void);
+void aes_backend_set_stream_threshold(uint32_t bytes);
+
+#endif // #if defined(ECB) && (ECB == 1) && defined(CTR) && (CTR == 1)
+
+#endif // _AES_BACKEND_H_
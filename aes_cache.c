@@ -0,0 +1,585 @@
+/*
+
+Plaintext chunk cache. See aes_cache.h for the interface.
+
+Every slot carries a sequence counter that is odd while the slot is being
+written (claimed for a chunk and decrypted into). Readers on the hit path
+read the counter, check the key, copy the data and read the counter again;
+if it moved, they look again. Slot buffers are allocated once and never
+freed while the cache exists, so a reader racing with a writer copies a
+torn chunk at worst, and throws it away.
+
+Writers claim slots under the lock of the shard the set belongs to. A slot
+that is odd under a matching key is a decryption in progress: later
+missers on that chunk wait on the shard's condition variable instead of
+decrypting it again. The decryption itself runs outside the lock.
+
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "aes_backend.h"
+#include "aes_cache.h"
+
+#if defined(CTR) && (CTR == 1) && defined(ECB) && (ECB == 1)
+
+// Misses that fit here are tracked on the stack.
+#define PENDING_STACK 16
+
+struct cache_file
+{
+  struct AES_ctx ctx;       // Iv is the counter block of file offset 0
+  int fd;
+  uint64_t length;
+};
+
+struct slot
+{
+  _Atomic uint64_t key;     // (file + 1) << 40 | chunk, 0 when empty
+  _Atomic uint32_t seq;     // odd while being written
+  _Atomic uint32_t tick;    // time of last use, for LRU within the set
+  _Atomic uint32_t length;  // plaintext bytes in data
+  uint8_t* data;
+};
+
+struct shard
+{
+  pthread_mutex_t lock;
+  pthread_cond_t loaded;
+};
+
+struct aes_cache
+{
+  uint32_t chunk_size;
+  uint32_t set_mask;        // sets - 1, sets a power of two
+  struct slot* slots;       // AES_CACHE_WAYS per set
+  uint8_t* data;
+  struct aes_pool* pool;
+  pthread_mutex_t pool_lock;
+  pthread_mutex_t files_lock;
+  _Atomic(struct cache_file*) files[AES_CACHE_MAX_FILES];
+  int nfiles;
+  struct shard shards[AES_CACHE_SHARDS];
+
+  _Atomic uint64_t reads, hits, misses, coalesced, evictions;
+  _Atomic uint64_t hit_ns, hit_reads, miss_ns, miss_reads;
+};
+
+// A chunk of one read that was not a lock-free hit.
+struct pending
+{
+  uint64_t chunk;
+  uint32_t from;            // first byte of the chunk wanted
+  uint32_t n;               // bytes wanted
+  uint8_t* dst;
+  struct slot* slot;        // claimed slot, or NULL
+  int error;                // errno of a failed load
+};
+
+enum { HIT, CLAIMED, BUSY };
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// A cache key is the file number + 1 above CHUNK_BITS bits of chunk index.
+// aes_cache_add_file() refuses files with more chunks than that, and there
+// are at most AES_CACHE_MAX_FILES files, so two chunks never share a key.
+#define CHUNK_BITS 40
+
+#if AES_CACHE_MAX_FILES >= (1 << (64 - CHUNK_BITS))
+  #error "AES_CACHE_MAX_FILES does not fit the cache key"
+#endif
+
+static uint64_t key_of(int file, uint64_t chunk)
+{
+  return ((uint64_t)(file + 1) << CHUNK_BITS) | chunk;
+}
+
+static uint32_t set_of(const struct aes_cache* cache, uint64_t key)
+{
+  uint64_t h = key * 0x9e3779b97f4a7c15ull;
+  h ^= h >> 29;
+  return (uint32_t)h & cache->set_mask;
+}
+
+static void copy_out(uint8_t* dst, const uint8_t* data, uint32_t length, uint32_t from, uint32_t n)
+{
+  if (from < length)
+  {
+    memcpy(dst, data + from, (n < length - from) ? n : length - from);
+  }
+}
+
+// The hit path. Returns 1 after copying the wanted bytes, 0 if the chunk is
+// not in its set, -1 if it is being decrypted.
+static int lookup(struct slot* set, uint64_t key, struct pending* p, uint32_t tick)
+{
+  uint32_t w, s1, length;
+
+  for (w = 0; w < AES_CACHE_WAYS; ++w)
+  {
+    struct slot* s = &set[w];
+    for (;;)
+    {
+      s1 = atomic_load_explicit(&s->seq, memory_order_acquire);
+      if (atomic_load_explicit(&s->key, memory_order_relaxed) != key)
+      {
+        break;
+      }
+      if (s1 & 1)
+      {
+        return -1;
+      }
+      length = atomic_load_explicit(&s->length, memory_order_relaxed);
+      copy_out(p->dst, s->data, length, p->from, p->n);
+      atomic_thread_fence(memory_order_acquire);
+      if (atomic_load_explicit(&s->seq, memory_order_relaxed) == s1)
+      {
+        atomic_store_explicit(&s->tick, tick, memory_order_relaxed);
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+// Under the shard lock: finds the chunk (HIT, copied out), claims the
+// least recently used slot of the set for it (CLAIMED), or finds it in
+// flight or every slot of the set busy (BUSY).
+static int claim_locked(struct aes_cache* cache, struct slot* set, uint64_t key, struct pending* p, uint32_t tick)
+{
+  struct slot *victim = NULL, *empty = NULL;
+  uint32_t w, seq;
+
+  for (w = 0; w < AES_CACHE_WAYS; ++w)
+  {
+    struct slot* s = &set[w];
+    seq = atomic_load_explicit(&s->seq, memory_order_relaxed);
+    if (atomic_load_explicit(&s->key, memory_order_relaxed) == key)
+    {
+      if (seq & 1)
+      {
+        return BUSY;
+      }
+      // Writers hold this lock, so an even slot is stable here.
+      copy_out(p->dst, s->data, atomic_load_explicit(&s->length, memory_order_relaxed), p->from, p->n);
+      atomic_store_explicit(&s->tick, tick, memory_order_relaxed);
+      return HIT;
+    }
+    if (seq & 1)
+    {
+      continue;
+    }
+    if (atomic_load_explicit(&s->key, memory_order_relaxed) == 0)
+    {
+      empty = (empty != NULL) ? empty : s;
+    }
+    else if ((victim == NULL) || ((int32_t)(atomic_load_explicit(&s->tick, memory_order_relaxed) - atomic_load_explicit(&victim->tick, memory_order_relaxed)) < 0))
+    {
+      victim = s;
+    }
+  }
+  victim = (empty != NULL) ? empty : victim;
+  if (victim == NULL)
+  {
+    return BUSY;
+  }
+
+  if (atomic_load_explicit(&victim->key, memory_order_relaxed) != 0)
+  {
+    atomic_fetch_add_explicit(&cache->evictions, 1, memory_order_relaxed);
+  }
+  atomic_store_explicit(&victim->seq, atomic_load_explicit(&victim->seq, memory_order_relaxed) + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&victim->key, key, memory_order_relaxed);
+  atomic_store_explicit(&victim->tick, tick, memory_order_relaxed);
+  p->slot = victim;
+  return CLAIMED;
+}
+
+// Reads and decrypts a claimed chunk into its slot, and copies out the
+// wanted bytes. Runs without the lock: the slot is odd, so nobody else
+// reads or writes it.
+static void load(struct aes_cache* cache, const struct cache_file* f, struct pending* p)
+{
+  const uint64_t offset = p->chunk * cache->chunk_size;
+  const uint32_t n = (f->length - offset < cache->chunk_size) ? (uint32_t)(f->length - offset) : cache->chunk_size;
+  struct slot* s = p->slot;
+  struct AES_ctx ctx;
+  uint32_t done = 0;
+  uint64_t c;
+  ssize_t r;
+  int i;
+
+  while (done < n)
+  {
+    r = pread(f->fd, s->data + done, n - done, (off_t)(offset + done));
+    if ((r < 0) && (errno == EINTR))
+    {
+      continue;
+    }
+    if (r <= 0)
+    {
+      p->error = (r < 0) ? errno : EIO;
+      return;
+    }
+    done += (uint32_t)r;
+  }
+
+  memcpy(&ctx, &f->ctx, sizeof(ctx));
+  for (c = offset / AES_BLOCKLEN, i = AES_BLOCKLEN - 1; (i >= 0) && (c != 0); --i)
+  {
+    c += ctx.Iv[i];
+    ctx.Iv[i] = (uint8_t)c;
+    c >>= 8;
+  }
+  aes_backend_ctr_xcrypt(&ctx, s->data, n);
+  atomic_store_explicit(&s->length, n, memory_order_relaxed);
+  copy_out(p->dst, s->data, n, p->from, p->n);
+}
+
+// Makes a loaded slot visible, or empties it after a failed load, and
+// wakes the callers waiting for it.
+static void publish(struct aes_cache* cache, struct shard* shard, struct pending* p)
+{
+  struct slot* s = p->slot;
+
+  pthread_mutex_lock(&shard->lock);
+  if (p->error != 0)
+  {
+    atomic_store_explicit(&s->key, 0, memory_order_relaxed);
+  }
+  atomic_store_explicit(&s->seq, atomic_load_explicit(&s->seq, memory_order_relaxed) + 1, memory_order_release);
+  pthread_cond_broadcast(&shard->loaded);
+  pthread_mutex_unlock(&shard->lock);
+  atomic_fetch_add_explicit(&cache->misses, 1, memory_order_relaxed);
+}
+
+struct load_job
+{
+  struct aes_cache* cache;
+  const struct cache_file* file;
+  struct pending** claimed;
+};
+
+static void load_task(void* arg, uint32_t index)
+{
+  struct load_job* job = (struct load_job*)arg;
+  load(job->cache, job->file, job->claimed[index]);
+}
+
+/*****************************************************************************/
+/* Public functions:                                                         */
+/*****************************************************************************/
+struct aes_cache* aes_cache_create(uint32_t chunk_size, size_t max_bytes, struct aes_pool* pool)
+{
+  struct aes_cache* cache;
+  size_t sets = 1, i;
+
+  if ((chunk_size == 0) || ((chunk_size % AES_BLOCKLEN) != 0))
+  {
+    errno = EINVAL;
+    return NULL;
+  }
+  while ((sets * 2 * AES_CACHE_WAYS * (size_t)chunk_size <= max_bytes) && (sets < ((size_t)1 << 30)))
+  {
+    sets *= 2;
+  }
+  if ((cache = (struct aes_cache*)calloc(1, sizeof(*cache))) == NULL)
+  {
+    return NULL;
+  }
+  cache->slots = (struct slot*)calloc(sets * AES_CACHE_WAYS, sizeof(struct slot));
+  cache->data = (uint8_t*)malloc(sets * AES_CACHE_WAYS * (size_t)chunk_size);
+  if ((cache->slots == NULL) || (cache->data == NULL))
+  {
+    free(cache->slots);
+    free(cache->data);
+    free(cache);
+    errno = ENOMEM;
+    return NULL;
+  }
+  cache->chunk_size = chunk_size;
+  cache->set_mask = (uint32_t)(sets - 1);
+  cache->pool = pool;
+  for (i = 0; i < sets * AES_CACHE_WAYS; ++i)
+  {
+    cache->slots[i].data = cache->data + i * chunk_size;
+  }
+  for (i = 0; i < AES_CACHE_SHARDS; ++i)
+  {
+    pthread_mutex_init(&cache->shards[i].lock, NULL);
+    pthread_cond_init(&cache->shards[i].loaded, NULL);
+  }
+  pthread_mutex_init(&cache->pool_lock, NULL);
+  pthread_mutex_init(&cache->files_lock, NULL);
+  return cache;
+}
+
+void aes_cache_destroy(struct aes_cache* cache)
+{
+  int i;
+
+  for (i = 0; i < cache->nfiles; ++i)
+  {
+    struct cache_file* f = atomic_load(&cache->files[i]);
+    close(f->fd);
+    free(f);
+  }
+  for (i = 0; i < AES_CACHE_SHARDS; ++i)
+  {
+    pthread_mutex_destroy(&cache->shards[i].lock);
+    pthread_cond_destroy(&cache->shards[i].loaded);
+  }
+  pthread_mutex_destroy(&cache->pool_lock);
+  pthread_mutex_destroy(&cache->files_lock);
+  free(cache->slots);
+  free(cache->data);
+  free(cache);
+}
+
+int aes_cache_add_file(struct aes_cache* cache, const char* path, const uint8_t* key, const uint8_t* iv)
+{
+  struct cache_file* f = (struct cache_file*)malloc(sizeof(*f));
+  struct stat st;
+  int n;
+
+  if (f == NULL)
+  {
+    return -1;
+  }
+  if ((f->fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+  {
+    free(f);
+    return -1;
+  }
+  if (fstat(f->fd, &st) != 0)
+  {
+    n = errno;
+    close(f->fd);
+    free(f);
+    errno = n;
+    return -1;
+  }
+  f->length = (uint64_t)st.st_size;
+  if ((f->length + cache->chunk_size - 1) / cache->chunk_size > ((uint64_t)1 << CHUNK_BITS))
+  {
+    close(f->fd);
+    free(f);
+    errno = EFBIG;
+    return -1;
+  }
+  AES_init_ctx_iv(&f->ctx, key, iv);
+
+  pthread_mutex_lock(&cache->files_lock);
+  n = cache->nfiles;
+  if (n < AES_CACHE_MAX_FILES)
+  {
+    atomic_store(&cache->files[n], f);
+    ++cache->nfiles;
+  }
+  pthread_mutex_unlock(&cache->files_lock);
+  if (n == AES_CACHE_MAX_FILES)
+  {
+    close(f->fd);
+    free(f);
+    errno = EMFILE;
+    return -1;
+  }
+  return n;
+}
+
+long aes_cache_read(struct aes_cache* cache, int file, uint64_t offset, uint8_t* buf, size_t length)
+{
+  const uint64_t t0 = now_ns();
+  const uint32_t tick = (uint32_t)(t0 >> 20);
+  const uint32_t cs = cache->chunk_size;
+  struct pending stack[PENDING_STACK], *pending = stack, *claimed_stack[PENDING_STACK], **claimed = claimed_stack;
+  const struct cache_file* f;
+  uint64_t end, c, first, last, hits = 0, coalesced = 0;
+  uint32_t np = 0, nc = 0, i;
+  int error = 0, r;
+
+  if ((file < 0) || (file >= AES_CACHE_MAX_FILES) || ((f = atomic_load(&cache->files[file])) == NULL))
+  {
+    errno = EBADF;
+    return -1;
+  }
+  atomic_fetch_add_explicit(&cache->reads, 1, memory_order_relaxed);
+  if ((offset >= f->length) || (length == 0))
+  {
+    return 0;
+  }
+  end = (length < f->length - offset) ? offset + length : f->length;
+  first = offset / cs;
+  last = (end - 1) / cs;
+  if (last - first + 1 > PENDING_STACK)
+  {
+    pending = (struct pending*)malloc((size_t)(last - first + 1) * sizeof(*pending));
+    claimed = (struct pending**)malloc((size_t)(last - first + 1) * sizeof(*claimed));
+    if ((pending == NULL) || (claimed == NULL))
+    {
+      free(pending);
+      free(claimed);
+      errno = ENOMEM;
+      return -1;
+    }
+  }
+
+  // Lock-free hits first; everything else is pending.
+  for (c = first; c <= last; ++c)
+  {
+    struct pending* p = &pending[np];
+    const uint64_t start = (c == first) ? offset : c * cs;
+    const uint64_t stop = (c == last) ? end : (c + 1) * cs;
+    p->chunk = c;
+    p->from = (uint32_t)(start - c * cs);
+    p->n = (uint32_t)(stop - start);
+    p->dst = buf + (start - offset);
+    p->slot = NULL;
+    p->error = 0;
+    if (lookup(&cache->slots[(size_t)set_of(cache, key_of(file, c)) * AES_CACHE_WAYS], key_of(file, c), p, tick) == 1)
+    {
+      ++hits;
+    }
+    else
+    {
+      ++np;
+    }
+  }
+
+  // Claim what is still missing. Chunks that another caller is decrypting
+  // are left pending.
+  for (i = 0; i < np; ++i)
+  {
+    const uint64_t key = key_of(file, pending[i].chunk);
+    const uint32_t set = set_of(cache, key);
+    struct shard* shard = &cache->shards[set % AES_CACHE_SHARDS];
+
+    pthread_mutex_lock(&shard->lock);
+    r = claim_locked(cache, &cache->slots[(size_t)set * AES_CACHE_WAYS], key, &pending[i], tick);
+    pthread_mutex_unlock(&shard->lock);
+    if (r == CLAIMED)
+    {
+      claimed[nc++] = &pending[i];
+    }
+    else if (r == HIT)
+    {
+      ++hits;
+      pending[i].chunk = UINT64_MAX;
+    }
+  }
+
+  // Decrypt the claimed chunks, on the pool when there are several and no
+  // other read holds it.
+  if ((nc > 1) && (cache->pool != NULL) && (pthread_mutex_trylock(&cache->pool_lock) == 0))
+  {
+    struct load_job job;
+    job.cache = cache;
+    job.file = f;
+    job.claimed = claimed;
+    aes_pool_run(cache->pool, load_task, &job, nc);
+    pthread_mutex_unlock(&cache->pool_lock);
+  }
+  else
+  {
+    for (i = 0; i < nc; ++i)
+    {
+      load(cache, f, claimed[i]);
+    }
+  }
+  for (i = 0; i < nc; ++i)
+  {
+    const uint32_t set = set_of(cache, key_of(file, claimed[i]->chunk));
+    publish(cache, &cache->shards[set % AES_CACHE_SHARDS], claimed[i]);
+    error = (error != 0) ? error : claimed[i]->error;
+    claimed[i]->chunk = UINT64_MAX;
+  }
+
+  // Wait for the chunks others were decrypting. If one of them failed, or
+  // was already replaced, decrypt it here.
+  for (i = 0; i < np; ++i)
+  {
+    struct pending* p = &pending[i];
+    uint64_t key;
+    uint32_t set;
+    struct shard* shard;
+
+    if (p->chunk == UINT64_MAX)
+    {
+      continue;
+    }
+    key = key_of(file, p->chunk);
+    set = set_of(cache, key);
+    shard = &cache->shards[set % AES_CACHE_SHARDS];
+    pthread_mutex_lock(&shard->lock);
+    while ((r = claim_locked(cache, &cache->slots[(size_t)set * AES_CACHE_WAYS], key, p, tick)) == BUSY)
+    {
+      pthread_cond_wait(&shard->loaded, &shard->lock);
+    }
+    pthread_mutex_unlock(&shard->lock);
+    if (r == HIT)
+    {
+      ++hits;
+      ++coalesced;
+    }
+    else
+    {
+      load(cache, f, p);
+      publish(cache, shard, p);
+      error = (error != 0) ? error : p->error;
+    }
+  }
+
+  if (pending != stack)
+  {
+    free(pending);
+    free(claimed);
+  }
+  atomic_fetch_add_explicit(&cache->hits, hits, memory_order_relaxed);
+  atomic_fetch_add_explicit(&cache->coalesced, coalesced, memory_order_relaxed);
+  if (hits == last - first + 1)
+  {
+    atomic_fetch_add_explicit(&cache->hit_ns, now_ns() - t0, memory_order_relaxed);
+    atomic_fetch_add_explicit(&cache->hit_reads, 1, memory_order_relaxed);
+  }
+  else
+  {
+    atomic_fetch_add_explicit(&cache->miss_ns, now_ns() - t0, memory_order_relaxed);
+    atomic_fetch_add_explicit(&cache->miss_reads, 1, memory_order_relaxed);
+  }
+  if (error != 0)
+  {
+    errno = error;
+    return -1;
+  }
+  return (long)(end - offset);
+}
+
+void aes_cache_stats(struct aes_cache* cache, struct aes_cache_stats* stats)
+{
+  stats->reads = atomic_load_explicit(&cache->reads, memory_order_relaxed);
+  stats->hits = atomic_load_explicit(&cache->hits, memory_order_relaxed);
+  stats->misses = atomic_load_explicit(&cache->misses, memory_order_relaxed);
+  stats->coalesced = atomic_load_explicit(&cache->coalesced, memory_order_relaxed);
+  stats->evictions = atomic_load_explicit(&cache->evictions, memory_order_relaxed);
+  stats->hit_ns = atomic_load_explicit(&cache->hit_ns, memory_order_relaxed);
+  stats->hit_reads = atomic_load_explicit(&cache->hit_reads, memory_order_relaxed);
+  stats->miss_ns = atomic_load_explicit(&cache->miss_ns, memory_order_relaxed);
+  stats->miss_reads = atomic_load_explicit(&cache->miss_reads, memory_order_relaxed);
+}
+
+#endif // #if defined(CTR) && (CTR == 1) && defined(ECB) && (ECB == 1)
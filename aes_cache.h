@@ -0,0 +1,68 @@
+#ifndef _AES_CACHE_H_
+#define _AES_CACHE_H_
+
+// Plaintext chunk cache in front of CTR-encrypted files.
+//
+// Files are read in chunks of chunk_size bytes; a chunk is decrypted with
+// the counter seeked to its offset, the same way aes_lazy.h does pages.
+// Decrypted chunks are kept in a set-associative cache keyed by (file,
+// chunk index): a chunk can only live in the AES_CACHE_WAYS slots of the
+// set its key hashes to, and the least recently used of those is replaced.
+//
+// A hit takes no lock: the slot is copied out under a sequence counter and
+// the copy is retried if a writer got in between. Misses lock one of
+// AES_CACHE_SHARDS stripes. Concurrent misses on the same chunk are
+// coalesced: one caller decrypts it while the others wait for it. A read
+// that misses several chunks decrypts them on the thread pool, if the
+// cache has one and it is not busy with another read.
+//
+// All functions may be called from any number of threads.
+
+#include <stddef.h>
+#include <stdint.h>
+#include "aes.h"
+#include "aes_mt.h"
+
+#if defined(CTR) && (CTR == 1) && defined(ECB) && (ECB == 1)
+
+#define AES_CACHE_WAYS 8
+#define AES_CACHE_SHARDS 64
+#define AES_CACHE_MAX_FILES 256
+
+struct aes_cache;
+
+struct aes_cache_stats
+{
+  uint64_t reads;         // aes_cache_read() calls
+  uint64_t hits;          // chunks found decrypted
+  uint64_t misses;        // chunks decrypted
+  uint64_t coalesced;     // misses that waited for another caller's decryption
+  uint64_t evictions;     // chunks replaced
+  uint64_t hit_ns;        // total time of reads that hit on every chunk
+  uint64_t hit_reads;
+  uint64_t miss_ns;       // total time of reads that missed at least once
+  uint64_t miss_reads;
+};
+
+// Creates a cache of at most max_bytes of plaintext (rounded down to whole
+// sets, and at least one set). chunk_size must be a multiple of
+// AES_BLOCKLEN. pool may be NULL. Returns NULL on failure (errno is set).
+struct aes_cache* aes_cache_create(uint32_t chunk_size, size_t max_bytes, struct aes_pool* pool);
+void aes_cache_destroy(struct aes_cache* cache);
+
+// Opens a CTR-encrypted file (encrypted from the counter block iv at
+// offset 0) and returns its file number, or -1 (errno is set; EMFILE past
+// AES_CACHE_MAX_FILES files, EFBIG for a file of more than 2^40 chunks).
+// The file must not change while the cache is in use.
+int aes_cache_add_file(struct aes_cache* cache, const char* path, const uint8_t* key, const uint8_t* iv);
+
+// Copies up to length bytes of plaintext at offset to buf. Returns the
+// number of bytes copied, which is short only at the end of the file, or
+// -1 if the file could not be read (errno is set).
+long aes_cache_read(struct aes_cache* cache, int file, uint64_t offset, uint8_t* buf, size_t length);
+
+void aes_cache_stats(struct aes_cache* cache, struct aes_cache_stats* stats);
+
+#endif // #if defined(CTR) && (CTR == 1) && defined(ECB) && (ECB == 1)
+
+#endif // _AES_CACHE_H_
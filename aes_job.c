@@ -0,0 +1,406 @@
+/*
+
+Resumable bulk encryption jobs. See aes_job.h for the interface.
+
+The input is processed in chunks of AES_JOB_CHUNK bytes, read with pread,
+run through the selected backend in place and written at the same offset
+of the output. ECB and CTR use the backend directly; CBC encryption is
+sequential and goes through AES_CBC_encrypt_buffer(), while CBC decryption
+decrypts the whole chunk as ECB and XORs in the previous ciphertext blocks.
+In every mode ctx.Iv is the mode state at the current offset.
+
+The checkpoint file is two 128-byte slots. Checkpoint n goes to slot n % 2
+after the output has been synced, and is itself synced before the job goes
+on, so the newest valid slot never names output that is not on disk.
+
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "aes_backend.h"
+#include "aes_job.h"
+
+#if defined(ECB) && (ECB == 1) && defined(CTR) && (CTR == 1)
+
+#define SLOT_MAGIC "aes-job"
+
+struct slot
+{
+  char magic[8];
+  uint64_t seq;
+  uint32_t mode;
+  uint32_t done;
+  uint8_t key_id[8];        // first half of the key check value
+  uint64_t in_size;
+  int64_t in_mtime_ns;
+  uint64_t offset;
+  uint8_t block[16];        // ctx.Iv at offset
+  uint8_t reserved[52];
+  uint32_t crc;             // CRC-32 of everything above
+};
+
+_Static_assert(sizeof(struct slot) == 128, "checkpoint slots are 128 bytes");
+
+struct aes_job
+{
+  struct AES_ctx ctx;
+  enum aes_job_mode mode;
+  int in;
+  int out;
+  int cp;
+  uint64_t length;
+  uint64_t offset;
+  uint64_t resumed;
+  int64_t mtime_ns;
+  uint8_t key_id[8];
+  uint64_t seq;
+  uint64_t interval_ns;
+  uint64_t last_ns;         // time of the last checkpoint
+  uint64_t checkpoints;
+  uint64_t checkpoint_ns;
+  uint8_t* buf;
+  uint8_t* prev;            // CBC decryption: the chunk's ciphertext
+};
+
+static uint32_t crc32(const uint8_t* p, size_t n)
+{
+  uint32_t crc = 0xffffffff;
+  int k;
+
+  while (n-- > 0)
+  {
+    crc ^= *p++;
+    for (k = 0; k < 8; ++k)
+    {
+      crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+    }
+  }
+  return ~crc;
+}
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int read_full(int fd, uint8_t* buf, size_t n, uint64_t offset)
+{
+  size_t done = 0;
+  ssize_t r;
+
+  while (done < n)
+  {
+    r = pread(fd, buf + done, n - done, (off_t)(offset + done));
+    if ((r < 0) && (errno == EINTR))
+    {
+      continue;
+    }
+    if (r <= 0)
+    {
+      errno = (r == 0) ? EIO : errno;
+      return -1;
+    }
+    done += (size_t)r;
+  }
+  return 0;
+}
+
+static int write_full(int fd, const uint8_t* buf, size_t n, uint64_t offset)
+{
+  size_t done = 0;
+  ssize_t r;
+
+  while (done < n)
+  {
+    r = pwrite(fd, buf + done, n - done, (off_t)(offset + done));
+    if ((r < 0) && (errno == EINTR))
+    {
+      continue;
+    }
+    if (r < 0)
+    {
+      return -1;
+    }
+    done += (size_t)r;
+  }
+  return 0;
+}
+
+// The newest slot with a good CRC, or NULL.
+static const struct slot* newest_slot(const struct slot* slots)
+{
+  const struct slot* best = NULL;
+  int i;
+
+  for (i = 0; i < 2; ++i)
+  {
+    if ((memcmp(slots[i].magic, SLOT_MAGIC, sizeof(SLOT_MAGIC)) == 0)
+        && (slots[i].crc == crc32((const uint8_t*)&slots[i], offsetof(struct slot, crc)))
+        && ((best == NULL) || (slots[i].seq > best->seq)))
+    {
+      best = &slots[i];
+    }
+  }
+  return best;
+}
+
+static void process(struct aes_job* job, uint32_t n)
+{
+  switch (job->mode)
+  {
+  case AES_JOB_ECB_ENCRYPT:
+    aes_backend_ecb_encrypt(&job->ctx, job->buf, n / AES_BLOCKLEN);
+    break;
+  case AES_JOB_ECB_DECRYPT:
+    aes_backend_ecb_decrypt(&job->ctx, job->buf, n / AES_BLOCKLEN);
+    break;
+#if defined(CBC) && (CBC == 1)
+  case AES_JOB_CBC_ENCRYPT:
+    AES_CBC_encrypt_buffer(&job->ctx, job->buf, n);
+    break;
+  case AES_JOB_CBC_DECRYPT:
+  {
+    uint32_t i;
+    memcpy(job->prev, job->buf, n);
+    aes_backend_ecb_decrypt(&job->ctx, job->buf, n / AES_BLOCKLEN);
+    for (i = 0; i < AES_BLOCKLEN; ++i)
+    {
+      job->buf[i] ^= job->ctx.Iv[i];
+    }
+    for (i = AES_BLOCKLEN; i < n; ++i)
+    {
+      job->buf[i] ^= job->prev[i - AES_BLOCKLEN];
+    }
+    memcpy(job->ctx.Iv, job->prev + n - AES_BLOCKLEN, AES_BLOCKLEN);
+    break;
+  }
+#endif
+  default:
+    aes_backend_ctr_xcrypt(&job->ctx, job->buf, n);
+    break;
+  }
+}
+
+/*****************************************************************************/
+/* Public functions:                                                         */
+/*****************************************************************************/
+struct aes_job* aes_job_open(const char* in_path, const char* out_path, const char* checkpoint_path,
+                             enum aes_job_mode mode, const uint8_t* key, const uint8_t* iv, uint32_t interval_ms)
+{
+  static const uint8_t zero[AES_BLOCKLEN] = { 0 };
+  struct aes_job* job = (struct aes_job*)calloc(1, sizeof(*job));
+  uint8_t kcv[AES_BLOCKLEN] = { 0 };
+  struct slot slots[2];
+  const struct slot* last;
+  struct stat st;
+  int err;
+
+  if (job == NULL)
+  {
+    return NULL;
+  }
+  job->in = job->out = job->cp = -1;
+  job->mode = mode;
+  if ((mode < AES_JOB_ECB_ENCRYPT) || (mode > AES_JOB_CTR)
+#if !defined(CBC) || (CBC == 0)
+      || (mode == AES_JOB_CBC_ENCRYPT) || (mode == AES_JOB_CBC_DECRYPT)
+#endif
+     )
+  {
+    errno = EINVAL;
+    goto fail;
+  }
+  AES_init_ctx_iv(&job->ctx, key, (iv != NULL) ? iv : zero);
+  AES_ECB_encrypt(&job->ctx, kcv);
+  memcpy(job->key_id, kcv, sizeof(job->key_id));
+  job->interval_ns = (uint64_t)((interval_ms != 0) ? interval_ms : AES_JOB_INTERVAL_MS) * 1000000ull;
+  job->buf = (uint8_t*)malloc(AES_JOB_CHUNK);
+  job->prev = (mode == AES_JOB_CBC_DECRYPT) ? (uint8_t*)malloc(AES_JOB_CHUNK) : NULL;
+  if ((job->buf == NULL) || ((mode == AES_JOB_CBC_DECRYPT) && (job->prev == NULL)))
+  {
+    errno = ENOMEM;
+    goto fail;
+  }
+
+  if (((job->in = open(in_path, O_RDONLY | O_CLOEXEC)) < 0) || (fstat(job->in, &st) != 0))
+  {
+    goto fail;
+  }
+  job->length = (uint64_t)st.st_size;
+  job->mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+  if ((mode != AES_JOB_CTR) && ((job->length % AES_BLOCKLEN) != 0))
+  {
+    errno = EINVAL;
+    goto fail;
+  }
+
+  if ((job->cp = open(checkpoint_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) < 0)
+  {
+    goto fail;
+  }
+  memset(slots, 0, sizeof(slots));
+  if (pread(job->cp, slots, sizeof(slots), 0) < 0)
+  {
+    goto fail;
+  }
+  if ((last = newest_slot(slots)) != NULL)
+  {
+    if ((last->mode != (uint32_t)mode) || (memcmp(last->key_id, job->key_id, sizeof(job->key_id)) != 0)
+        || (last->in_size != job->length) || (last->in_mtime_ns != job->mtime_ns) || (last->offset > job->length))
+    {
+      errno = ESTALE;
+      goto fail;
+    }
+    if (((job->out = open(out_path, O_WRONLY | O_CLOEXEC)) < 0) || (fstat(job->out, &st) != 0))
+    {
+      goto fail;
+    }
+    if ((uint64_t)st.st_size < last->offset)
+    {
+      errno = ESTALE;
+      goto fail;
+    }
+    job->offset = job->resumed = last->offset;
+    memcpy(job->ctx.Iv, last->block, AES_BLOCKLEN);
+    job->seq = last->seq;
+  }
+  else if ((job->out = open(out_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0)
+  {
+    goto fail;
+  }
+  job->last_ns = now_ns();
+  return job;
+
+fail:
+  err = errno;
+  aes_job_close(job);
+  errno = err;
+  return NULL;
+}
+
+int aes_job_run(struct aes_job* job, uint64_t max_bytes)
+{
+  uint64_t stop = job->length;
+  uint32_t n;
+
+  // Whole blocks, so that a checkpoint never falls inside one.
+  max_bytes = (max_bytes + AES_BLOCKLEN - 1) / AES_BLOCKLEN * AES_BLOCKLEN;
+  if ((max_bytes != 0) && (job->length - job->offset > max_bytes))
+  {
+    stop = job->offset + max_bytes;
+  }
+  while (job->offset < stop)
+  {
+    n = (stop - job->offset < AES_JOB_CHUNK) ? (uint32_t)(stop - job->offset) : AES_JOB_CHUNK;
+    if (read_full(job->in, job->buf, n, job->offset) != 0)
+    {
+      return -1;
+    }
+    process(job, n);
+    if (write_full(job->out, job->buf, n, job->offset) != 0)
+    {
+      return -1;
+    }
+    job->offset += n;
+    if ((job->offset < job->length) && (now_ns() - job->last_ns >= job->interval_ns) && (aes_job_checkpoint(job) != 0))
+    {
+      return -1;
+    }
+  }
+  if (job->offset < job->length)
+  {
+    return 0;
+  }
+  // An output longer than the input is left over from an earlier run.
+  if ((ftruncate(job->out, (off_t)job->length) != 0) || (aes_job_checkpoint(job) != 0))
+  {
+    return -1;
+  }
+  return 1;
+}
+
+int aes_job_checkpoint(struct aes_job* job)
+{
+  const uint64_t start = now_ns();
+  struct slot slot;
+
+  if (fdatasync(job->out) != 0)
+  {
+    return -1;
+  }
+  memset(&slot, 0, sizeof(slot));
+  memcpy(slot.magic, SLOT_MAGIC, sizeof(SLOT_MAGIC));
+  slot.seq = job->seq + 1;
+  slot.mode = (uint32_t)job->mode;
+  slot.done = (job->offset == job->length);
+  memcpy(slot.key_id, job->key_id, sizeof(slot.key_id));
+  slot.in_size = job->length;
+  slot.in_mtime_ns = job->mtime_ns;
+  slot.offset = job->offset;
+  memcpy(slot.block, job->ctx.Iv, AES_BLOCKLEN);
+  slot.crc = crc32((const uint8_t*)&slot, offsetof(struct slot, crc));
+  if ((write_full(job->cp, (const uint8_t*)&slot, sizeof(slot), (slot.seq % 2) * sizeof(slot)) != 0) || (fdatasync(job->cp) != 0))
+  {
+    return -1;
+  }
+  job->seq = slot.seq;
+  job->last_ns = now_ns();
+  ++job->checkpoints;
+  job->checkpoint_ns += job->last_ns - start;
+  return 0;
+}
+
+void aes_job_close(struct aes_job* job)
+{
+  if (job->in >= 0)
+  {
+    close(job->in);
+  }
+  if (job->out >= 0)
+  {
+    close(job->out);
+  }
+  if (job->cp >= 0)
+  {
+    close(job->cp);
+  }
+  free(job->buf);
+  free(job->prev);
+  free(job);
+}
+
+uint64_t aes_job_offset(const struct aes_job* job)
+{
+  return job->offset;
+}
+
+uint64_t aes_job_length(const struct aes_job* job)
+{
+  return job->length;
+}
+
+uint64_t aes_job_resumed(const struct aes_job* job)
+{
+  return job->resumed;
+}
+
+uint64_t aes_job_checkpoints(const struct aes_job* job, uint64_t* ns)
+{
+  if (ns != NULL)
+  {
+    *ns = job->checkpoint_ns;
+  }
+  return job->checkpoints;
+}
+
+#endif // #if defined(ECB) && (ECB == 1) && defined(CTR) && (CTR == 1)
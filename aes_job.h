@@ -0,0 +1,77 @@
+#ifndef _AES_JOB_H_
+#define _AES_JOB_H_
+
+// Resumable bulk encryption of one file into another.
+//
+// A job encrypts or decrypts its input file into its output file and, while
+// it runs, keeps a checkpoint file up to date: the mode, the key check value
+// (never the key), the size and modification time of the input, the byte
+// offset reached and the mode state at that offset (the counter block for
+// CTR, the chaining block for CBC). After a crash or a reboot, opening the
+// same job again finds the checkpoint and carries on from that offset, with
+// output identical to an uninterrupted run.
+//
+// Before a checkpoint names an offset, the output up to it is synced to
+// disk. The checkpoint file holds two slots that are written in turn, each
+// with a sequence number and a CRC-32, so a write torn by a crash leaves the
+// previous checkpoint in place. Checkpoints are taken every interval_ms
+// of work, so their cost (mostly the sync of output the kernel was writing
+// back anyway) is spread over that much encryption.
+//
+// ECB and CBC need an input that is a whole number of blocks.
+
+#include <stdint.h>
+#include "aes.h"
+
+#if defined(ECB) && (ECB == 1) && defined(CTR) && (CTR == 1)
+
+#define AES_JOB_INTERVAL_MS 1000
+// Bytes read, processed and written per step.
+#define AES_JOB_CHUNK (1 << 20)
+
+enum aes_job_mode
+{
+  AES_JOB_ECB_ENCRYPT = 1,
+  AES_JOB_ECB_DECRYPT,
+  AES_JOB_CBC_ENCRYPT,      // need CBC
+  AES_JOB_CBC_DECRYPT,
+  AES_JOB_CTR
+};
+
+struct aes_job;
+
+// Opens a job. If checkpoint_path holds a valid checkpoint of the same job
+// (mode, key, input size and modification time), the job resumes from it
+// and iv is not used; a checkpoint of another job makes the call fail with
+// ESTALE, so that it is not overwritten by mistake. Otherwise the job starts
+// at offset 0 and the output is truncated. interval_ms is the time between
+// checkpoints: 0 for AES_JOB_INTERVAL_MS, UINT32_MAX for none but the last.
+// Returns NULL on failure (errno is set).
+struct aes_job* aes_job_open(const char* in_path, const char* out_path, const char* checkpoint_path,
+                             enum aes_job_mode mode, const uint8_t* key, const uint8_t* iv, uint32_t interval_ms);
+
+// Processes max_bytes (rounded up to whole blocks; 0 for no limit) of the
+// input, or what is left of it. Returns 1 when the job is finished (the
+// output is synced and the checkpoint says so), 0 if there is more to do,
+// or -1 on an I/O error (errno is set).
+int aes_job_run(struct aes_job* job, uint64_t max_bytes);
+
+// Takes a checkpoint now, e.g. before stopping a job to resume it later.
+int aes_job_checkpoint(struct aes_job* job);
+
+// Closes the files. No checkpoint is taken, as none would be on a crash.
+void aes_job_close(struct aes_job* job);
+
+// Input bytes done so far, and in total.
+uint64_t aes_job_offset(const struct aes_job* job);
+uint64_t aes_job_length(const struct aes_job* job);
+
+// The offset the job resumed from, 0 if it started afresh.
+uint64_t aes_job_resumed(const struct aes_job* job);
+
+// Checkpoints taken and the time spent taking them.
+uint64_t aes_job_checkpoints(const struct aes_job* job, uint64_t* ns);
+
+#endif // #if defined(ECB) && (ECB == 1) && defined(CTR) && (CTR == 1)
+
+#endif // _AES_JOB_H_
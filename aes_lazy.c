@@ -0,0 +1,380 @@
+/*
+
+Lazily decrypted CTR file mapping. See aes_lazy.h for the interface.
+
+The region is private anonymous memory registered with userfaultfd for
+missing pages. A handler thread reads the fault events; for each one it
+reads the page from the file, decrypts it with the counter seeked to the
+page, and installs it with UFFDIO_COPY, which also wakes the faulting
+thread. Decrypted pages are kept in a FIFO ring; dropping one is an
+MADV_DONTNEED, after which the page is missing again.
+
+A page that cannot be read is never installed. With UFFDIO_POISON the
+page is poisoned, and touching it raises SIGBUS. Kernels without it get
+the page made inaccessible with mprotect() before the faulting thread is
+woken, so its retry raises SIGSEGV instead.
+
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/userfaultfd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "aes_backend.h"
+#include "aes_lazy.h"
+
+#if defined(CTR) && (CTR == 1) && defined(ECB) && (ECB == 1)
+
+struct aes_lazy
+{
+  struct AES_ctx ctx;       // Iv is the counter block of file offset 0
+  int fd;
+  int uffd;
+  int poison;               // UFFDIO_POISON was negotiated
+  int wake[2];              // pipe; closing the write end stops the handler
+  pthread_t handler;
+  uint8_t* base;
+  size_t length;            // file bytes
+  size_t mapped;            // whole pages
+  size_t page;
+  uint8_t* buf;             // one page, the handler's staging buffer
+
+  pthread_mutex_t lock;     // ring and stats, shared with aes_lazy_trim()
+  uint32_t* ring;           // decrypted pages, oldest at head
+  uint32_t cap;
+  uint32_t head;
+  uint32_t count;
+  struct aes_lazy_stats stats;
+};
+
+// Adds n to the 128-bit big-endian counter block iv.
+static void ctr_seek(uint8_t* iv, uint64_t n)
+{
+  int i;
+  for (i = AES_BLOCKLEN - 1; (i >= 0) && (n != 0); --i)
+  {
+    n += iv[i];
+    iv[i] = (uint8_t)n;
+    n >>= 8;
+  }
+}
+
+// Drops the oldest decrypted page. Called with the lock held.
+static void evict_oldest(struct aes_lazy* lazy)
+{
+  madvise(lazy->base + (size_t)lazy->ring[lazy->head] * lazy->page, lazy->page, MADV_DONTNEED);
+  lazy->head = (lazy->head + 1) % lazy->cap;
+  --lazy->count;
+  ++lazy->stats.evictions;
+}
+
+// Fails the access to the page at offset, and every later one.
+static void fail_page(struct aes_lazy* lazy, size_t offset)
+{
+  struct uffdio_range range;
+
+#if defined(UFFDIO_POISON)
+  if (lazy->poison)
+  {
+    struct uffdio_poison poison;
+    poison.range.start = (uintptr_t)(lazy->base + offset);
+    poison.range.len = lazy->page;
+    poison.mode = 0;
+    poison.updated = 0;
+    // EEXIST: a second event for a page that is already poisoned.
+    if ((ioctl(lazy->uffd, UFFDIO_POISON, &poison) == 0) || (errno == EEXIST))
+    {
+      return;
+    }
+  }
+#endif
+  mprotect(lazy->base + offset, lazy->page, PROT_NONE);
+  range.start = (uintptr_t)(lazy->base + offset);
+  range.len = lazy->page;
+  ioctl(lazy->uffd, UFFDIO_WAKE, &range);
+}
+
+// Reads and decrypts the page at index and installs it, or fails the access
+// if the file cannot be read there (an I/O error, or a file cut short).
+static void fill_page(struct aes_lazy* lazy, uint32_t index)
+{
+  const size_t offset = (size_t)index * lazy->page;
+  const size_t n = (lazy->length - offset < lazy->page) ? lazy->length - offset : lazy->page;
+  struct uffdio_copy copy;
+  struct AES_ctx ctx;
+  size_t done = 0;
+  ssize_t r;
+
+  while (done < n)
+  {
+    r = pread(lazy->fd, lazy->buf + done, n - done, (off_t)(offset + done));
+    if ((r < 0) && (errno == EINTR))
+    {
+      continue;
+    }
+    if (r <= 0)
+    {
+      break;
+    }
+    done += (size_t)r;
+  }
+  if (done != n)
+  {
+    pthread_mutex_lock(&lazy->lock);
+    fail_page(lazy, offset);
+    ++lazy->stats.failures;
+    pthread_mutex_unlock(&lazy->lock);
+    return;
+  }
+  memcpy(&ctx, &lazy->ctx, sizeof(ctx));
+  ctr_seek(ctx.Iv, offset / AES_BLOCKLEN);
+  aes_backend_ctr_xcrypt(&ctx, lazy->buf, (uint32_t)n);
+  memset(lazy->buf + n, 0, lazy->page - n);
+
+  pthread_mutex_lock(&lazy->lock);
+  if (lazy->count == lazy->cap)
+  {
+    evict_oldest(lazy);
+  }
+  copy.dst = (uintptr_t)(lazy->base + offset);
+  copy.src = (uintptr_t)lazy->buf;
+  copy.len = lazy->page;
+  copy.mode = 0;
+  copy.copy = 0;
+  // EEXIST: a second event for a page that is already in.
+  if (ioctl(lazy->uffd, UFFDIO_COPY, &copy) == 0)
+  {
+    lazy->ring[(lazy->head + lazy->count) % lazy->cap] = index;
+    ++lazy->count;
+    ++lazy->stats.faults;
+  }
+  pthread_mutex_unlock(&lazy->lock);
+}
+
+static void* handler_main(void* p)
+{
+  struct aes_lazy* lazy = (struct aes_lazy*)p;
+  struct pollfd fds[2];
+  struct uffd_msg msg;
+
+  fds[0].fd = lazy->uffd;
+  fds[0].events = POLLIN;
+  fds[1].fd = lazy->wake[0];
+  fds[1].events = POLLIN;
+  for (;;)
+  {
+    if (poll(fds, 2, -1) < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      break;
+    }
+    if (fds[1].revents != 0)
+    {
+      break;
+    }
+    if (read(lazy->uffd, &msg, sizeof(msg)) != (ssize_t)sizeof(msg))
+    {
+      continue;
+    }
+    if (msg.event == UFFD_EVENT_PAGEFAULT)
+    {
+      fill_page(lazy, (uint32_t)(((uintptr_t)msg.arg.pagefault.address - (uintptr_t)lazy->base) / lazy->page));
+    }
+  }
+  return NULL;
+}
+
+// Faults taken inside the kernel (a read-only region passed to write(2),
+// say) are only handled by a full userfaultfd; UFFD_USER_MODE_ONLY is the
+// fallback for unprivileged processes where the full one is not allowed.
+static int open_uffd(void)
+{
+  int fd = (int)syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+  if ((fd < 0) && (errno == EPERM))
+  {
+    fd = (int)syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY);
+  }
+  return fd;
+}
+
+// Opens lazy->uffd and enables its API, with UFFD_FEATURE_POISON where the
+// kernel has it. A userfaultfd takes only one UFFDIO_API, so a kernel that
+// refuses the feature costs a second descriptor.
+static int setup_uffd(struct aes_lazy* lazy)
+{
+  struct uffdio_api api;
+
+#if defined(UFFD_FEATURE_POISON)
+  if ((lazy->uffd = open_uffd()) < 0)
+  {
+    return -1;
+  }
+  memset(&api, 0, sizeof(api));
+  api.api = UFFD_API;
+  api.features = UFFD_FEATURE_POISON;
+  if (ioctl(lazy->uffd, UFFDIO_API, &api) == 0)
+  {
+    lazy->poison = 1;
+    return 0;
+  }
+  close(lazy->uffd);
+#endif
+  if ((lazy->uffd = open_uffd()) < 0)
+  {
+    return -1;
+  }
+  memset(&api, 0, sizeof(api));
+  api.api = UFFD_API;
+  return ioctl(lazy->uffd, UFFDIO_API, &api);
+}
+
+/*****************************************************************************/
+/* Public functions:                                                         */
+/*****************************************************************************/
+struct aes_lazy* aes_lazy_open(const char* path, const uint8_t* key, const uint8_t* iv, uint32_t max_resident)
+{
+  struct aes_lazy* lazy = (struct aes_lazy*)calloc(1, sizeof(*lazy));
+  struct uffdio_register reg;
+  struct stat st;
+  size_t pages;
+  int err;
+
+  if (lazy == NULL)
+  {
+    return NULL;
+  }
+  lazy->fd = -1;
+  lazy->uffd = -1;
+  lazy->wake[0] = lazy->wake[1] = -1;
+  lazy->base = MAP_FAILED;
+  pthread_mutex_init(&lazy->lock, NULL);
+  AES_init_ctx_iv(&lazy->ctx, key, iv);
+  lazy->page = (size_t)sysconf(_SC_PAGESIZE);
+
+  if (((lazy->fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) || (fstat(lazy->fd, &st) != 0))
+  {
+    goto fail;
+  }
+  lazy->length = (size_t)st.st_size;
+  pages = (lazy->length + lazy->page - 1) / lazy->page;
+  if (pages > UINT32_MAX)
+  {
+    errno = EFBIG;
+    goto fail;
+  }
+  lazy->mapped = ((pages > 0) ? pages : 1) * lazy->page;
+  lazy->cap = ((max_resident == 0) || (max_resident > pages)) ? (uint32_t)((pages > 0) ? pages : 1) : max_resident;
+  lazy->ring = (uint32_t*)malloc((size_t)lazy->cap * sizeof(uint32_t));
+  lazy->buf = (uint8_t*)aligned_alloc(lazy->page, lazy->page);
+  if ((lazy->ring == NULL) || (lazy->buf == NULL))
+  {
+    errno = ENOMEM;
+    goto fail;
+  }
+
+  lazy->base = (uint8_t*)mmap(NULL, lazy->mapped, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if ((lazy->base == MAP_FAILED) || (setup_uffd(lazy) != 0))
+  {
+    goto fail;
+  }
+  memset(&reg, 0, sizeof(reg));
+  reg.range.start = (uintptr_t)lazy->base;
+  reg.range.len = lazy->mapped;
+  reg.mode = UFFDIO_REGISTER_MODE_MISSING;
+  if ((ioctl(lazy->uffd, UFFDIO_REGISTER, &reg) != 0) || (pipe2(lazy->wake, O_CLOEXEC) != 0))
+  {
+    goto fail;
+  }
+  if ((err = pthread_create(&lazy->handler, NULL, handler_main, lazy)) != 0)
+  {
+    errno = err;
+    goto fail;
+  }
+  return lazy;
+
+fail:
+  err = errno;
+  if (lazy->wake[0] >= 0)
+  {
+    close(lazy->wake[0]);
+    close(lazy->wake[1]);
+  }
+  if (lazy->uffd >= 0)
+  {
+    close(lazy->uffd);
+  }
+  if (lazy->base != MAP_FAILED)
+  {
+    munmap(lazy->base, lazy->mapped);
+  }
+  if (lazy->fd >= 0)
+  {
+    close(lazy->fd);
+  }
+  pthread_mutex_destroy(&lazy->lock);
+  free(lazy->ring);
+  free(lazy->buf);
+  free(lazy);
+  errno = err;
+  return NULL;
+}
+
+void aes_lazy_close(struct aes_lazy* lazy)
+{
+  close(lazy->wake[1]);
+  pthread_join(lazy->handler, NULL);
+  close(lazy->wake[0]);
+  close(lazy->uffd);
+  munmap(lazy->base, lazy->mapped);
+  close(lazy->fd);
+  pthread_mutex_destroy(&lazy->lock);
+  free(lazy->ring);
+  free(lazy->buf);
+  free(lazy);
+}
+
+const uint8_t* aes_lazy_data(const struct aes_lazy* lazy)
+{
+  return lazy->base;
+}
+
+size_t aes_lazy_length(const struct aes_lazy* lazy)
+{
+  return lazy->length;
+}
+
+uint32_t aes_lazy_trim(struct aes_lazy* lazy, uint32_t pages)
+{
+  uint32_t n;
+
+  pthread_mutex_lock(&lazy->lock);
+  for (n = 0; (n < pages) && (lazy->count > 0); ++n)
+  {
+    evict_oldest(lazy);
+  }
+  pthread_mutex_unlock(&lazy->lock);
+  return n;
+}
+
+void aes_lazy_stats(struct aes_lazy* lazy, struct aes_lazy_stats* stats)
+{
+  pthread_mutex_lock(&lazy->lock);
+  *stats = lazy->stats;
+  stats->resident = lazy->count;
+  pthread_mutex_unlock(&lazy->lock);
+}
+
+#endif // #if defined(CTR) && (CTR == 1) && defined(ECB) && (ECB == 1)
@@ -0,0 +1,65 @@
+#ifndef _AES_LAZY_H_
+#define _AES_LAZY_H_
+
+// Lazily decrypted mapping of a CTR-encrypted file.
+//
+// aes_lazy_open() reserves a read-only region the size of the file but
+// reads nothing. The first touch of a page faults into a handler thread
+// through userfaultfd(2), which reads that page of the file, seeks the
+// counter to it (the counter block of byte offset o is the initial counter
+// plus o / 16) and decrypts it into place. Only the touched pages are ever
+// read or decrypted.
+//
+// A page that cannot be read (an I/O error, or a file cut short since it
+// was opened) is never filled in with anything else: touching it raises
+// SIGBUS on kernels with UFFDIO_POISON (Linux 6.6) and SIGSEGV on older
+// ones, and so does every later touch. aes_lazy_stats() counts such pages.
+//
+// Decrypted pages are clean: they can always be produced again from the
+// file. When more than max_resident pages are decrypted, the oldest ones
+// are dropped, and aes_lazy_trim() drops more on request. A dropped page
+// faults in again on its next touch. Nothing here watches memory pressure:
+// the resident limit is fixed, and a caller that wants to give pages back
+// under pressure has to call aes_lazy_trim() from its own notification
+// (a PSI trigger, a cgroup memory event).
+//
+// The file is expected to be encrypted with AES_CTR_xcrypt_buffer() from
+// the counter block iv at offset 0, and must not change while it is
+// mapped. Writes to the region fault with SIGSEGV.
+//
+// Linux only. Unprivileged processes need vm.unprivileged_userfaultfd = 1
+// or CAP_SYS_PTRACE, unless the kernel supports UFFD_USER_MODE_ONLY.
+
+#include <stddef.h>
+#include <stdint.h>
+#include "aes.h"
+
+#if defined(CTR) && (CTR == 1) && defined(ECB) && (ECB == 1)
+
+struct aes_lazy;
+
+struct aes_lazy_stats
+{
+  uint64_t faults;      // pages decrypted, including ones decrypted again
+  uint64_t evictions;   // pages dropped
+  uint64_t failures;    // pages that could not be read, whose accesses failed
+  uint32_t resident;    // pages decrypted now
+};
+
+// Maps path. max_resident is the number of decrypted pages to keep, 0 for
+// no limit. Returns NULL on failure (errno is set).
+struct aes_lazy* aes_lazy_open(const char* path, const uint8_t* key, const uint8_t* iv, uint32_t max_resident);
+void aes_lazy_close(struct aes_lazy* lazy);
+
+// The plaintext, valid until aes_lazy_close().
+const uint8_t* aes_lazy_data(const struct aes_lazy* lazy);
+size_t aes_lazy_length(const struct aes_lazy* lazy);
+
+// Drops up to pages decrypted pages, oldest first; returns how many.
+uint32_t aes_lazy_trim(struct aes_lazy* lazy, uint32_t pages);
+
+void aes_lazy_stats(struct aes_lazy* lazy, struct aes_lazy_stats* stats);
+
+#endif // #if defined(CTR) && (CTR == 1) && defined(ECB) && (ECB == 1)
+
+#endif // _AES_LAZY_H_
@@ -0,0 +1,730 @@
+/*
+
+Dual-execution lockstep. See aes_lockstep.h for the interface.
+
+Each replica walks the chunks of the current operation in order and waits
+whenever it is AES_LOCKSTEP_SLOTS chunks ahead of the check. The calling
+thread checks the chunks in order as both replicas finish them, writes the
+agreed output into the buffer and so frees the slot. The mode state a
+third run starts from is kept by the checker from released data only (the
+counter advanced by the blocks released, the last ciphertext block), so a
+replica whose state went wrong cannot lead the arbitration astray.
+
+A replica that was outvoted may have gone wrong in that state rather than
+in its output, and then everything it ran after the chunk disagrees as
+well. So after an arbitration the checker sends each outvoted replica back
+to the next chunk with the released state in place of its own; what it ran
+ahead in the meantime is discarded. Replicas wait at the end of an
+operation until all of it is released, so that they can still be sent back.
+
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "aes_backend.h"
+#include "aes_lockstep.h"
+
+#if defined(ECB) && (ECB == 1) && defined(CTR) && (CTR == 1)
+
+// Bytes the checksum replica processes at a time; a multiple of 32.
+#define TILE 4096
+
+enum mode
+{
+  ECB_ENCRYPT = 0,
+  ECB_DECRYPT,
+  CBC_ENCRYPT,
+  CBC_DECRYPT,
+  CTR_XCRYPT
+};
+
+// One per allocation, so that the replicas share no cache line.
+struct replica
+{
+  struct AES_ctx ctx;          // the replica's copy, made on its own CPU
+  const struct aes_backend* backend;  // NULL: the selection for the chunk size
+  uint8_t* slots;              // AES_LOCKSTEP_SLOTS chunks of output; NULL for the checksum replica
+  uint64_t sums[AES_LOCKSTEP_SLOTS];
+  uint32_t produced;           // chunks of the operation done
+  int resync;                  // go back to chunk produced, from resync_iv
+  uint8_t resync_iv[AES_BLOCKLEN];
+  unsigned id;
+  int cpu;
+  pthread_t thread;
+  struct aes_lockstep* ls;
+  uint8_t tile[TILE];
+};
+
+struct aes_lockstep
+{
+  struct replica* rep[2];
+  unsigned started;            // replica threads running
+  enum aes_lockstep_check check;
+  pthread_mutex_t lock;
+  pthread_cond_t start;
+  pthread_cond_t progress;     // a chunk done or released, or a replica finished
+  uint64_t generation;         // bumped for every operation
+  unsigned busy;               // replicas not yet finished with the operation
+  int stop;
+
+  // The operation.
+  uint8_t mode;
+  const struct AES_ctx* ctx;
+  uint8_t* buf;
+  uint64_t length;
+  uint32_t nchunks;
+  uint32_t released;           // chunks written back; their slots are free
+  int abort;
+
+  uint8_t* spare;              // output of the third run
+  const struct aes_backend* third;
+  struct aes_lockstep_stats stats;
+};
+
+void (*aes_lockstep_fault)(unsigned replica, uint32_t chunk, uint8_t* out, uint32_t length) = NULL;
+void (*aes_lockstep_state_fault)(unsigned replica, uint32_t chunk, uint8_t* iv) = NULL;
+
+/*****************************************************************************/
+/* Private functions:                                                        */
+/*****************************************************************************/
+// 64-bit checksum over four lanes of 64-bit words. A step is a bijection of
+// its lane for a given word, so a lane that took a different word does not
+// come back to the value it would have had.
+struct sum
+{
+  uint64_t lane[4];
+  uint64_t bytes;
+};
+
+static uint64_t rotl(uint64_t x, unsigned r)
+{
+  return (x << r) | (x >> (64 - r));
+}
+
+static void sum_init(struct sum* s)
+{
+  s->lane[0] = 0x243f6a8885a308d3ull;
+  s->lane[1] = 0x13198a2e03707344ull;
+  s->lane[2] = 0xa4093822299f31d0ull;
+  s->lane[3] = 0x082efa98ec4e6c89ull;
+  s->bytes = 0;
+}
+
+// n must be a multiple of 32 but for the last piece of a chunk.
+static void sum_update(struct sum* s, const uint8_t* p, uint32_t n)
+{
+  uint64_t w[4];
+  uint32_t i, k;
+
+  for (i = 0; i < n; i += 32)
+  {
+    if (n - i < 32)
+    {
+      memset(w, 0, sizeof(w));
+    }
+    memcpy(w, p + i, (n - i < 32) ? n - i : 32);
+    for (k = 0; k < 4; ++k)
+    {
+      s->lane[k] = rotl(s->lane[k] ^ w[k], 29) * 0x9e3779b97f4a7c15ull;
+    }
+  }
+  s->bytes += n;
+}
+
+static uint64_t sum_final(const struct sum* s)
+{
+  uint64_t h = s->bytes;
+  unsigned k;
+
+  for (k = 0; k < 4; ++k)
+  {
+    h = rotl(h ^ s->lane[k], 31) * 0xff51afd7ed558ccdull;
+  }
+  return h ^ (h >> 29);
+}
+
+static int same(const uint8_t* a, const uint8_t* b, uint32_t n)
+{
+#if defined(__SSE2__)
+  __m128i d;
+  for (; n >= 64; n -= 64, a += 64, b += 64)
+  {
+    d = _mm_xor_si128(_mm_loadu_si128((const __m128i*)a), _mm_loadu_si128((const __m128i*)b));
+    d = _mm_or_si128(d, _mm_xor_si128(_mm_loadu_si128((const __m128i*)(a + 16)), _mm_loadu_si128((const __m128i*)(b + 16))));
+    d = _mm_or_si128(d, _mm_xor_si128(_mm_loadu_si128((const __m128i*)(a + 32)), _mm_loadu_si128((const __m128i*)(b + 32))));
+    d = _mm_or_si128(d, _mm_xor_si128(_mm_loadu_si128((const __m128i*)(a + 48)), _mm_loadu_si128((const __m128i*)(b + 48))));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(d, _mm_setzero_si128())) != 0xffff)
+    {
+      return 0;
+    }
+  }
+#endif
+  return memcmp(a, b, n) == 0;
+}
+
+#if defined(CBC) && (CBC == 1)
+// CBC on top of a backend's ECB functions. out holds a copy of in, which is
+// still there for the chaining blocks of the decryption.
+static void cbc_encrypt(const struct aes_backend* backend, struct AES_ctx* ctx, uint8_t* out, uint32_t n)
+{
+  uint32_t i, k;
+  for (i = 0; i < n; i += AES_BLOCKLEN)
+  {
+    for (k = 0; k < AES_BLOCKLEN; ++k)
+    {
+      out[i + k] ^= ctx->Iv[k];
+    }
+    backend->ecb_encrypt(ctx, out + i, 1);
+    memcpy(ctx->Iv, out + i, AES_BLOCKLEN);
+  }
+}
+
+static void cbc_decrypt(const struct aes_backend* backend, struct AES_ctx* ctx, const uint8_t* in, uint8_t* out, uint32_t n)
+{
+  uint32_t i;
+  backend->ecb_decrypt(ctx, out, n / AES_BLOCKLEN);
+  for (i = 0; i < n; ++i)
+  {
+    out[i] ^= (i < AES_BLOCKLEN) ? ctx->Iv[i] : in[i - AES_BLOCKLEN];
+  }
+  memcpy(ctx->Iv, in + n - AES_BLOCKLEN, AES_BLOCKLEN);
+}
+#endif // #if defined(CBC) && (CBC == 1)
+
+// Runs n bytes of the operation on out, a copy of in.
+static void engine(const struct aes_backend* backend, uint8_t mode, struct AES_ctx* ctx, const uint8_t* in, uint8_t* out,
+                   uint32_t n)
+{
+  if (backend == NULL)
+  {
+    backend = aes_backend_select(n);
+  }
+#if !(defined(CBC) && (CBC == 1))
+  (void)in;
+#endif
+  switch (mode)
+  {
+  case ECB_ENCRYPT:
+    backend->ecb_encrypt(ctx, out, n / AES_BLOCKLEN);
+    break;
+  case ECB_DECRYPT:
+    backend->ecb_decrypt(ctx, out, n / AES_BLOCKLEN);
+    break;
+#if defined(CBC) && (CBC == 1)
+  case CBC_ENCRYPT:
+    cbc_encrypt(backend, ctx, out, n);
+    break;
+  case CBC_DECRYPT:
+    cbc_decrypt(backend, ctx, in, out, n);
+    break;
+#endif
+  default:
+    backend->ctr_xcrypt(ctx, out, n);
+    break;
+  }
+}
+
+static void fault(unsigned replica, uint32_t chunk, uint8_t* out, uint32_t n)
+{
+  if (aes_lockstep_fault != NULL)
+  {
+    aes_lockstep_fault(replica, chunk, out, n);
+  }
+}
+
+static uint32_t chunk_length(const struct aes_lockstep* ls, uint32_t i)
+{
+  const uint64_t left = ls->length - (uint64_t)i * AES_LOCKSTEP_CHUNK;
+  return (left < AES_LOCKSTEP_CHUNK) ? (uint32_t)left : AES_LOCKSTEP_CHUNK;
+}
+
+static void run_chunk(struct aes_lockstep* ls, struct replica* r, uint32_t i)
+{
+  const uint8_t* in = ls->buf + (uint64_t)i * AES_LOCKSTEP_CHUNK;
+  const uint32_t length = chunk_length(ls, i);
+  const unsigned s = i % AES_LOCKSTEP_SLOTS;
+  struct sum sum;
+  uint32_t t, n;
+
+  sum_init(&sum);
+  if (r->slots != NULL)
+  {
+    uint8_t* out = r->slots + (size_t)s * AES_LOCKSTEP_CHUNK;
+    memcpy(out, in, length);
+    engine(r->backend, ls->mode, &r->ctx, in, out, length);
+    fault(r->id, i, out, length);
+    if (ls->check == AES_LOCKSTEP_CHECKSUM)
+    {
+      sum_update(&sum, out, length);
+      r->sums[s] = sum_final(&sum);
+    }
+    return;
+  }
+  for (t = 0; t < length; t += n)
+  {
+    n = (length - t < TILE) ? length - t : TILE;
+    memcpy(r->tile, in + t, n);
+    engine(r->backend, ls->mode, &r->ctx, in + t, r->tile, n);
+    fault(r->id, i, r->tile, n);
+    sum_update(&sum, r->tile, n);
+  }
+  r->sums[s] = sum_final(&sum);
+}
+
+static void state_fault(struct replica* r, uint32_t i)
+{
+  if (aes_lockstep_state_fault != NULL)
+  {
+    aes_lockstep_state_fault(r->id, i, r->ctx.Iv);
+  }
+}
+
+static void* replica_main(void* p)
+{
+  struct replica* r = (struct replica*)p;
+  struct aes_lockstep* ls = r->ls;
+  uint64_t seen = 0;
+  uint32_t i;
+
+  pthread_mutex_lock(&ls->lock);
+  for (;;)
+  {
+    while ((ls->generation == seen) && !ls->stop)
+    {
+      pthread_cond_wait(&ls->start, &ls->lock);
+    }
+    if (ls->stop)
+    {
+      break;
+    }
+    seen = ls->generation;
+    memcpy(&r->ctx, ls->ctx, sizeof(r->ctx));
+    i = 0;
+    while (!ls->abort && (ls->released < ls->nchunks))
+    {
+      if (r->resync)
+      {
+        i = r->produced;
+        memcpy(r->ctx.Iv, r->resync_iv, AES_BLOCKLEN);
+        r->resync = 0;
+      }
+      if ((i == ls->nchunks) || (i >= ls->released + AES_LOCKSTEP_SLOTS))
+      {
+        pthread_cond_wait(&ls->progress, &ls->lock);
+        continue;
+      }
+      pthread_mutex_unlock(&ls->lock);
+      run_chunk(ls, r, i);
+      state_fault(r, i);
+      pthread_mutex_lock(&ls->lock);
+      // A chunk run before a resync came in is of no use.
+      if (!r->resync)
+      {
+        r->produced = ++i;
+        pthread_cond_broadcast(&ls->progress);
+      }
+    }
+    --ls->busy;
+    pthread_cond_broadcast(&ls->progress);
+  }
+  pthread_mutex_unlock(&ls->lock);
+  return NULL;
+}
+
+// Big-endian addition of blocks to a counter block.
+static void ctr_add(uint8_t* iv, uint32_t blocks)
+{
+  uint32_t carry = blocks;
+  int i;
+  for (i = AES_BLOCKLEN - 1; i >= 0; --i)
+  {
+    carry += iv[i];
+    iv[i] = (uint8_t)carry;
+    carry >>= 8;
+  }
+}
+
+// Returns the agreed output of chunk i, or NULL if no two runs agree. iv is
+// the mode state at the start of the chunk. Sets bit k of *lost if replica
+// k was outvoted.
+static const uint8_t* check_chunk(struct aes_lockstep* ls, uint32_t i, const uint8_t* iv, unsigned* lost)
+{
+  const uint8_t* in = ls->buf + (uint64_t)i * AES_LOCKSTEP_CHUNK;
+  const uint32_t length = chunk_length(ls, i);
+  const unsigned s = i % AES_LOCKSTEP_SLOTS;
+  uint8_t* a = ls->rep[0]->slots + (size_t)s * AES_LOCKSTEP_CHUNK;
+  const uint8_t* b = NULL;
+  struct AES_ctx third;
+  uint8_t outvoted[3] = { 0, 0, 0 };
+  struct sum sum;
+  uint64_t c;
+  uint32_t j, n;
+  unsigned k;
+
+  *lost = 0;
+  if (ls->check == AES_LOCKSTEP_COMPARE)
+  {
+    b = ls->rep[1]->slots + (size_t)s * AES_LOCKSTEP_CHUNK;
+    if (same(a, b, length))
+    {
+      return a;
+    }
+  }
+  else if (ls->rep[0]->sums[s] == ls->rep[1]->sums[s])
+  {
+    return a;
+  }
+
+  ++ls->stats.mismatches;
+  memcpy(&third, ls->ctx, sizeof(third));
+  memcpy(third.Iv, iv, AES_BLOCKLEN);
+  memcpy(ls->spare, in, length);
+  engine(ls->third, ls->mode, &third, in, ls->spare, length);
+  fault(2, i, ls->spare, length);
+
+  if (b == NULL)
+  {
+    sum_init(&sum);
+    sum_update(&sum, ls->spare, length);
+    c = sum_final(&sum);
+    if ((c == ls->rep[0]->sums[s]) || (c == ls->rep[1]->sums[s]))
+    {
+      ++ls->stats.arbitrated;
+      ++ls->stats.outvoted[(c == ls->rep[0]->sums[s]) ? 1 : 0];
+      *lost = (c == ls->rep[0]->sums[s]) ? 2 : 1;
+      return (c == ls->rep[0]->sums[s]) ? a : ls->spare;
+    }
+    ++ls->stats.failed;
+    return NULL;
+  }
+  for (j = 0; j < length; j += n)
+  {
+    n = (length - j < AES_BLOCKLEN) ? length - j : AES_BLOCKLEN;
+    if (memcmp(a + j, b + j, n) == 0)
+    {
+      outvoted[2] |= (memcmp(a + j, ls->spare + j, n) != 0);
+    }
+    else if (memcmp(a + j, ls->spare + j, n) == 0)
+    {
+      outvoted[1] = 1;
+    }
+    else if (memcmp(b + j, ls->spare + j, n) == 0)
+    {
+      outvoted[0] = 1;
+      memcpy(a + j, b + j, n);
+    }
+    else
+    {
+      ++ls->stats.failed;
+      return NULL;
+    }
+  }
+  for (k = 0; k < 3; ++k)
+  {
+    ls->stats.outvoted[k] += outvoted[k];
+  }
+  ++ls->stats.arbitrated;
+  *lost = (unsigned)outvoted[0] | ((unsigned)outvoted[1] << 1);
+  return a;
+}
+
+// Moves iv, the mode state, past a released chunk; in is still the input.
+static void advance(uint8_t mode, uint8_t* iv, const uint8_t* in, const uint8_t* out, uint32_t length)
+{
+  switch (mode)
+  {
+  case CBC_ENCRYPT:
+    memcpy(iv, out + length - AES_BLOCKLEN, AES_BLOCKLEN);
+    break;
+  case CBC_DECRYPT:
+    memcpy(iv, in + length - AES_BLOCKLEN, AES_BLOCKLEN);
+    break;
+  case CTR_XCRYPT:
+    ctr_add(iv, (length + AES_BLOCKLEN - 1) / AES_BLOCKLEN);
+    break;
+  default:
+    break;
+  }
+}
+
+static int run(struct aes_lockstep* ls, uint8_t mode, const struct AES_ctx* ctx, uint8_t* buf, uint64_t length,
+               uint8_t* iv_out)
+{
+  uint8_t iv[AES_BLOCKLEN];
+  const uint8_t* out;
+  uint32_t i, n;
+  unsigned k, lost;
+  int failed = 0;
+
+  if (length == 0)
+  {
+    return 0;
+  }
+  memcpy(iv, ctx->Iv, AES_BLOCKLEN);
+
+  pthread_mutex_lock(&ls->lock);
+  ls->mode = mode;
+  ls->ctx = ctx;
+  ls->buf = buf;
+  ls->length = length;
+  ls->nchunks = (uint32_t)((length + AES_LOCKSTEP_CHUNK - 1) / AES_LOCKSTEP_CHUNK);
+  ls->released = 0;
+  ls->abort = 0;
+  for (k = 0; k < 2; ++k)
+  {
+    ls->rep[k]->produced = 0;
+    ls->rep[k]->resync = 0;
+  }
+  ls->busy = 2;
+  ++ls->generation;
+  pthread_cond_broadcast(&ls->start);
+
+  for (i = 0; i < ls->nchunks; ++i)
+  {
+    while ((ls->rep[0]->produced <= i) || (ls->rep[1]->produced <= i))
+    {
+      pthread_cond_wait(&ls->progress, &ls->lock);
+    }
+    pthread_mutex_unlock(&ls->lock);
+
+    n = chunk_length(ls, i);
+    out = check_chunk(ls, i, iv, &lost);
+    if (out != NULL)
+    {
+      advance(mode, iv, buf + (uint64_t)i * AES_LOCKSTEP_CHUNK, out, n);
+      memcpy(buf + (uint64_t)i * AES_LOCKSTEP_CHUNK, out, n);
+      ls->stats.bytes += n;
+      ++ls->stats.chunks;
+    }
+
+    pthread_mutex_lock(&ls->lock);
+    if (out == NULL)
+    {
+      failed = 1;
+      ls->abort = 1;
+      pthread_cond_broadcast(&ls->progress);
+      break;
+    }
+    // Modes with state: send the outvoted replicas back to chunk i + 1.
+    for (k = 0; k < 2; ++k)
+    {
+      if ((lost & (1u << k)) && (mode != ECB_ENCRYPT) && (mode != ECB_DECRYPT))
+      {
+        ls->rep[k]->produced = i + 1;
+        ls->rep[k]->resync = 1;
+        memcpy(ls->rep[k]->resync_iv, iv, AES_BLOCKLEN);
+      }
+    }
+    ls->released = i + 1;
+    pthread_cond_broadcast(&ls->progress);
+  }
+  while (ls->busy != 0)
+  {
+    pthread_cond_wait(&ls->progress, &ls->lock);
+  }
+  pthread_mutex_unlock(&ls->lock);
+
+  if (failed)
+  {
+    errno = EIO;
+    return -1;
+  }
+  if (iv_out != NULL)
+  {
+    memcpy(iv_out, iv, AES_BLOCKLEN);
+  }
+  return 0;
+}
+
+// The first CPU the process may run on other than avoid, or avoid if there
+// is no other.
+static int pick_cpu(int avoid)
+{
+  cpu_set_t set;
+  int cpu;
+
+  if (sched_getaffinity(0, sizeof(set), &set) == 0)
+  {
+    for (cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+      if (CPU_ISSET(cpu, &set) && (cpu != avoid))
+      {
+        return cpu;
+      }
+    }
+  }
+  return (avoid >= 0) ? avoid : 0;
+}
+
+/*****************************************************************************/
+/* Public functions:                                                         */
+/*****************************************************************************/
+struct aes_lockstep* aes_lockstep_create(int cpu_a, int cpu_b, enum aes_lockstep_check check)
+{
+  struct aes_lockstep* ls = (struct aes_lockstep*)calloc(1, sizeof(*ls));
+  cpu_set_t set;
+  unsigned k;
+  int err = 0;
+
+  if (ls == NULL)
+  {
+    return NULL;
+  }
+  ls->check = check;
+  pthread_mutex_init(&ls->lock, NULL);
+  pthread_cond_init(&ls->start, NULL);
+  pthread_cond_init(&ls->progress, NULL);
+  ls->spare = (uint8_t*)malloc(AES_LOCKSTEP_CHUNK);
+  err = (ls->spare == NULL) ? ENOMEM : 0;
+
+  for (k = 0; (k < 2) && (err == 0); ++k)
+  {
+    struct replica* r;
+    if (posix_memalign((void**)&ls->rep[k], 64, sizeof(struct replica)) != 0)
+    {
+      err = ENOMEM;
+      break;
+    }
+    r = ls->rep[k];
+    memset(r, 0, sizeof(*r));
+    r->ls = ls;
+    r->id = k;
+    r->cpu = (k == 0) ? ((cpu_a >= 0) ? cpu_a : pick_cpu(-1)) : ((cpu_b >= 0) ? cpu_b : pick_cpu(ls->rep[0]->cpu));
+    if ((k == 0) || (check == AES_LOCKSTEP_COMPARE))
+    {
+      if ((r->slots = (uint8_t*)malloc((size_t)AES_LOCKSTEP_SLOTS * AES_LOCKSTEP_CHUNK)) == NULL)
+      {
+        err = ENOMEM;
+      }
+    }
+  }
+  for (k = 0; (k < 2) && (err == 0); ++k)
+  {
+    if (ls->rep[k]->cpu >= CPU_SETSIZE)
+    {
+      err = EINVAL;
+      break;
+    }
+    if (pthread_create(&ls->rep[k]->thread, NULL, replica_main, ls->rep[k]) != 0)
+    {
+      err = EAGAIN;
+      break;
+    }
+    ++ls->started;
+    CPU_ZERO(&set);
+    CPU_SET(ls->rep[k]->cpu, &set);
+    if (pthread_setaffinity_np(ls->rep[k]->thread, sizeof(set), &set) != 0)
+    {
+      err = EINVAL;
+    }
+  }
+  if (err != 0)
+  {
+    aes_lockstep_destroy(ls);
+    errno = err;
+    return NULL;
+  }
+  return ls;
+}
+
+void aes_lockstep_destroy(struct aes_lockstep* ls)
+{
+  unsigned k;
+
+  pthread_mutex_lock(&ls->lock);
+  ls->stop = 1;
+  pthread_cond_broadcast(&ls->start);
+  pthread_mutex_unlock(&ls->lock);
+  for (k = 0; k < ls->started; ++k)
+  {
+    pthread_join(ls->rep[k]->thread, NULL);
+  }
+  for (k = 0; k < 2; ++k)
+  {
+    if (ls->rep[k] != NULL)
+    {
+      free(ls->rep[k]->slots);
+      free(ls->rep[k]);
+    }
+  }
+  pthread_mutex_destroy(&ls->lock);
+  pthread_cond_destroy(&ls->start);
+  pthread_cond_destroy(&ls->progress);
+  free(ls->spare);
+  free(ls);
+}
+
+int aes_lockstep_set_engines(struct aes_lockstep* ls, const char* a, const char* b, const char* third)
+{
+  const char* const names[3] = { a, b, third };
+  const struct aes_backend* backends[3];
+  unsigned k;
+
+  for (k = 0; k < 3; ++k)
+  {
+    backends[k] = (names[k] != NULL) ? aes_backend_find(names[k]) : NULL;
+    if ((names[k] != NULL) && ((backends[k] == NULL) || !backends[k]->available()))
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  }
+  ls->rep[0]->backend = backends[0];
+  ls->rep[1]->backend = backends[1];
+  ls->third = backends[2];
+  return 0;
+}
+
+const char* aes_lockstep_engine(const struct aes_lockstep* ls, unsigned run)
+{
+  const struct aes_backend* backend = (run < 2) ? ls->rep[run]->backend : ls->third;
+  return (backend != NULL) ? backend->name : "selected";
+}
+
+void aes_lockstep_cpus(const struct aes_lockstep* ls, int* cpu_a, int* cpu_b)
+{
+  *cpu_a = ls->rep[0]->cpu;
+  *cpu_b = ls->rep[1]->cpu;
+}
+
+void aes_lockstep_get_stats(const struct aes_lockstep* ls, struct aes_lockstep_stats* stats)
+{
+  *stats = ls->stats;
+}
+
+int aes_lockstep_ecb_encrypt(struct aes_lockstep* ls, const struct AES_ctx* ctx, uint8_t* buf, uint32_t nblocks)
+{
+  return run(ls, ECB_ENCRYPT, ctx, buf, (uint64_t)nblocks * AES_BLOCKLEN, NULL);
+}
+
+int aes_lockstep_ecb_decrypt(struct aes_lockstep* ls, const struct AES_ctx* ctx, uint8_t* buf, uint32_t nblocks)
+{
+  return run(ls, ECB_DECRYPT, ctx, buf, (uint64_t)nblocks * AES_BLOCKLEN, NULL);
+}
+
+#if defined(CBC) && (CBC == 1)
+int aes_lockstep_cbc_encrypt(struct aes_lockstep* ls, struct AES_ctx* ctx, uint8_t* buf, uint32_t length)
+{
+  return run(ls, CBC_ENCRYPT, ctx, buf, length, ctx->Iv);
+}
+
+int aes_lockstep_cbc_decrypt(struct aes_lockstep* ls, struct AES_ctx* ctx, uint8_t* buf, uint32_t length)
+{
+  return run(ls, CBC_DECRYPT, ctx, buf, length, ctx->Iv);
+}
+#endif
+
+int aes_lockstep_ctr_xcrypt(struct aes_lockstep* ls, struct AES_ctx* ctx, uint8_t* buf, uint32_t length)
+{
+  return run(ls, CTR_XCRYPT, ctx, buf, length, ctx->Iv);
+}
+
+#endif // #if defined(ECB) && (ECB == 1) && defined(CTR) && (CTR == 1)
@@ -0,0 +1,123 @@
+#ifndef _AES_LOCKSTEP_H_
+#define _AES_LOCKSTEP_H_
+
+// Dual-execution lockstep for the bulk modes.
+//
+// Against upsets in the registers or the L1 cache of one core, a lockstep
+// runs every bulk operation twice, on two replica threads pinned to
+// different CPUs, each with its own copy of the context (key schedule and
+// mode state). The buffer goes through in chunks: both replicas process
+// chunk i from the caller's input into memory of their own, and only when
+// their results agree does the calling thread write the chunk back into the
+// buffer. The replicas run up to AES_LOCKSTEP_SLOTS chunks ahead of the
+// check, so the check of one chunk overlaps the work on the next ones.
+//
+// The results are checked in one of two ways:
+//   AES_LOCKSTEP_COMPARE   both replicas keep their output, compared with
+//                          SSE2 64 bytes at a time;
+//   AES_LOCKSTEP_CHECKSUM  the second replica works through the chunk in
+//                          L1-sized tiles and folds its output into a
+//                          64-bit checksum, without writing the chunk out,
+//                          and the checksums are compared. That saves the
+//                          memory traffic of a second output, for a weaker
+//                          check and a coarser arbitration.
+//
+// On a mismatch the calling thread runs the chunk a third time, from the
+// input and from the mode state it keeps itself (the counter, the chaining
+// block), and votes: block by block, 2 of 3, with COMPARE; the third
+// checksum against the other two with CHECKSUM. With no majority the call
+// fails. The third run is on the caller's CPU, so pin the calling thread to
+// a third core to have the arbitration spatially separate as well. A
+// replica that was outvoted in CBC or CTR takes the mode state of the
+// released output and runs again from the next chunk, so that an upset in
+// its counter or chaining block costs one arbitration rather than one for
+// every chunk left in the operation.
+//
+// Every run uses the backend selected for the chunk size (aes_backend.h)
+// unless aes_lockstep_set_engines() gives it one of its own; CBC is built
+// on the backend's ECB functions. A lockstep runs one operation at a time;
+// callers that share one between threads must serialize their calls.
+
+#include <stdint.h>
+#include "aes.h"
+
+#if defined(ECB) && (ECB == 1) && defined(CTR) && (CTR == 1)
+
+// Bytes per chunk, and chunks a replica may run ahead of the check.
+#define AES_LOCKSTEP_CHUNK 65536
+#define AES_LOCKSTEP_SLOTS 4
+
+enum aes_lockstep_check
+{
+  AES_LOCKSTEP_COMPARE = 0,
+  AES_LOCKSTEP_CHECKSUM
+};
+
+struct aes_lockstep_stats
+{
+  uint64_t bytes;          // bytes released to callers
+  uint64_t chunks;
+  uint64_t mismatches;     // chunks on which the replicas disagreed
+  uint64_t arbitrated;     // of those, settled by the third run
+  uint64_t failed;         // of those, with no majority
+  uint64_t outvoted[3];    // arbitrated chunks on which run 0, 1 (the replicas)
+                           // or 2 (the third run) was in the minority
+};
+
+struct aes_lockstep;
+
+// Starts the two replica threads, pinned to cpu_a and cpu_b. A negative CPU
+// picks the first (for cpu_a) or second (cpu_b) CPU the process may run on;
+// with only one, both replicas share it and the redundancy is in time only.
+// Returns NULL on failure (errno is set; EINVAL for a CPU that cannot be
+// used).
+struct aes_lockstep* aes_lockstep_create(int cpu_a, int cpu_b, enum aes_lockstep_check check);
+void aes_lockstep_destroy(struct aes_lockstep* ls);
+
+// Design diversity. Two runs of the same engine share its weak points: a
+// corrupted S-box table, for one, makes both produce the same wrong output,
+// which no comparison catches. This gives each run a backend of its own, by
+// name: "aesni" and "ct" for the replicas and "table" for the third run,
+// say, have no table or instruction in common between the replicas and
+// still let the third run tell which of them disagreed (see outvoted in the
+// stats). NULL keeps the selection for the chunk size. The replicas run
+// side by side, so with a core each an operation costs about as much as
+// the slower engine alone. The key schedule is common to all of them; keep
+// it in an AES_seu_ctx (aes_seu.h) against upsets at rest. Returns -1 with
+// errno EINVAL if a backend is unknown or not available on this CPU.
+int aes_lockstep_set_engines(struct aes_lockstep* ls, const char* a, const char* b, const char* third);
+
+// The backend name of run 0, 1 (the replicas) or 2 (the third run), or
+// "selected" for the selection by chunk size.
+const char* aes_lockstep_engine(const struct aes_lockstep* ls, unsigned run);
+
+// The CPUs of the two replicas.
+void aes_lockstep_cpus(const struct aes_lockstep* ls, int* cpu_a, int* cpu_b);
+
+// Totals since the lockstep was created. Read them between operations.
+void aes_lockstep_get_stats(const struct aes_lockstep* ls, struct aes_lockstep_stats* stats);
+
+// Lockstep counterparts of the bulk functions: the same arguments, the same
+// output and, for CBC and CTR, the same ctx->Iv afterwards. They return 0,
+// or -1 with errno set to EIO if a chunk found no majority: the buffer is
+// then not to be trusted and ctx->Iv is left as it was.
+int aes_lockstep_ecb_encrypt(struct aes_lockstep* ls, const struct AES_ctx* ctx, uint8_t* buf, uint32_t nblocks);
+int aes_lockstep_ecb_decrypt(struct aes_lockstep* ls, const struct AES_ctx* ctx, uint8_t* buf, uint32_t nblocks);
+#if defined(CBC) && (CBC == 1)
+int aes_lockstep_cbc_encrypt(struct aes_lockstep* ls, struct AES_ctx* ctx, uint8_t* buf, uint32_t length);
+int aes_lockstep_cbc_decrypt(struct aes_lockstep* ls, struct AES_ctx* ctx, uint8_t* buf, uint32_t length);
+#endif
+int aes_lockstep_ctr_xcrypt(struct aes_lockstep* ls, struct AES_ctx* ctx, uint8_t* buf, uint32_t length);
+
+// Fault injection hook for tests: when set, it is called with every piece
+// of output of replica 0 or 1, or of the third run (2), before it is
+// checked. chunk is the index of the chunk the piece belongs to.
+extern void (*aes_lockstep_fault)(unsigned replica, uint32_t chunk, uint8_t* out, uint32_t length);
+
+// The same for the mode state: called with the counter or chaining block of
+// replica 0 or 1 after it has run chunk, which it will go on from.
+extern void (*aes_lockstep_state_fault)(unsigned replica, uint32_t chunk, uint8_t* iv);
+
+#endif // #if defined(ECB) && (ECB == 1) && defined(CTR) && (CTR == 1)
+
+#endif // _AES_LOCKSTEP_H_
@@ -0,0 +1,928 @@
+/*
+
+Thread pool and multi-threaded mode drivers. See aes_mt.h for the interface.
+
+Workers sleep on a condition variable until the generation counter moves,
+then take indices from a shared atomic counter, so load balancing is
+automatic and uneven tasks do not leave threads idle. The last worker to
+run out of indices wakes the caller.
+
+*/
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "aes_mt.h"
+
+struct aes_pool
+{
+  pthread_t* workers;
+  unsigned nworkers;
+  pthread_mutex_t lock;
+  pthread_cond_t start;
+  pthread_cond_t done;
+  uint64_t generation;      // bumped for every job
+  unsigned busy;            // workers not yet finished with the current job
+  int stop;
+
+  aes_pool_fn fn;
+  void* arg;
+  uint32_t n;
+  unsigned limit;           // threads that may take part, the caller included
+  _Atomic uint32_t next;    // next index to hand out
+  _Atomic unsigned joined;  // workers that have taken part so far
+};
+
+static void work(struct aes_pool* pool)
+{
+  uint32_t i;
+  while ((i = atomic_fetch_add_explicit(&pool->next, 1, memory_order_relaxed)) < pool->n)
+  {
+    pool->fn(pool->arg, i);
+  }
+}
+
+static void* worker_main(void* p)
+{
+  struct aes_pool* pool = (struct aes_pool*)p;
+  uint64_t seen = 0;
+  unsigned limit;
+
+  pthread_mutex_lock(&pool->lock);
+  for (;;)
+  {
+    while ((pool->generation == seen) && !pool->stop)
+    {
+      pthread_cond_wait(&pool->start, &pool->lock);
+    }
+    if (pool->stop)
+    {
+      break;
+    }
+    seen = pool->generation;
+    limit = pool->limit;
+    pthread_mutex_unlock(&pool->lock);
+
+    if (atomic_fetch_add_explicit(&pool->joined, 1, memory_order_relaxed) + 1 < limit)
+    {
+      work(pool);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->busy == 0)
+    {
+      pthread_cond_signal(&pool->done);
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+/*****************************************************************************/
+/* Pool:                                                                     */
+/*****************************************************************************/
+struct aes_pool* aes_pool_create(unsigned threads)
+{
+  struct aes_pool* pool = (struct aes_pool*)calloc(1, sizeof(*pool));
+  unsigned i;
+
+  if (pool == NULL)
+  {
+    return NULL;
+  }
+  if (threads == 0)
+  {
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = (cpus > 0) ? (unsigned)cpus : 1;
+  }
+  pool->workers = (pthread_t*)calloc(threads, sizeof(pthread_t));
+  if (pool->workers == NULL)
+  {
+    free(pool);
+    return NULL;
+  }
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->start, NULL);
+  pthread_cond_init(&pool->done, NULL);
+  atomic_init(&pool->next, 0);
+  atomic_init(&pool->joined, 0);
+
+  for (i = 0; i + 1 < threads; ++i)
+  {
+    if (pthread_create(&pool->workers[i], NULL, worker_main, pool) != 0)
+    {
+      break;
+    }
+    ++pool->nworkers;
+  }
+  if (pool->nworkers + 1 < threads)
+  {
+    aes_pool_destroy(pool);
+    return NULL;
+  }
+  return pool;
+}
+
+void aes_pool_destroy(struct aes_pool* pool)
+{
+  unsigned i;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = 1;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+  for (i = 0; i < pool->nworkers; ++i)
+  {
+    pthread_join(pool->workers[i], NULL);
+  }
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->start);
+  pthread_cond_destroy(&pool->done);
+  free(pool->workers);
+  free(pool);
+}
+
+unsigned aes_pool_threads(const struct aes_pool* pool)
+{
+  return (pool != NULL) ? pool->nworkers + 1 : 1;
+}
+
+void aes_pool_run(struct aes_pool* pool, aes_pool_fn fn, void* arg, uint32_t n)
+{
+  aes_pool_run_threads(pool, fn, arg, n, 0);
+}
+
+void aes_pool_run_threads(struct aes_pool* pool, aes_pool_fn fn, void* arg, uint32_t n, unsigned threads)
+{
+  uint32_t i;
+
+  if ((pool == NULL) || (pool->nworkers == 0) || (n <= 1) || (threads == 1))
+  {
+    for (i = 0; i < n; ++i)
+    {
+      fn(arg, i);
+    }
+    return;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->fn = fn;
+  pool->arg = arg;
+  pool->n = n;
+  pool->limit = ((threads == 0) || (threads > pool->nworkers)) ? pool->nworkers + 1 : threads;
+  atomic_store_explicit(&pool->next, 0, memory_order_relaxed);
+  atomic_store_explicit(&pool->joined, 0, memory_order_relaxed);
+  pool->busy = pool->nworkers;
+  ++pool->generation;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+
+  work(pool);
+
+  pthread_mutex_lock(&pool->lock);
+  while (pool->busy != 0)
+  {
+    pthread_cond_wait(&pool->done, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+/*****************************************************************************/
+/* Tunables:                                                                 */
+/*****************************************************************************/
+static pthread_once_t tunables_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t tunables_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct aes_mt_tunables tunables = { 0, AES_MT_CHUNK, AES_MT_INTERLEAVE, AES_MT_MIN_PARALLEL };
+
+static void clamp(struct aes_mt_tunables* t)
+{
+  t->chunk -= t->chunk % AES_BLOCKLEN;
+  if (t->chunk == 0)
+  {
+    t->chunk = AES_BLOCKLEN;
+  }
+  if (t->interleave == 0)
+  {
+    t->interleave = 1;
+  }
+  if (t->interleave > AES_MT_INTERLEAVE_MAX)
+  {
+    t->interleave = AES_MT_INTERLEAVE_MAX;
+  }
+}
+
+// The profile is only trusted on the host it was written on: a home
+// directory shared between hosts must not carry one host's profile to the
+// others.
+static void host_id(char* out, size_t size)
+{
+  char name[256];
+  if (gethostname(name, sizeof(name)) != 0)
+  {
+    snprintf(name, sizeof(name), "unknown");
+  }
+  name[sizeof(name) - 1] = '\0';
+  snprintf(out, size, "host %s\ncpus %ld\n", name, sysconf(_SC_NPROCESSORS_ONLN));
+}
+
+static int profile_path(char* out, size_t size)
+{
+  const char* path = getenv("AES_MT_PROFILE");
+  const char* home = getenv("HOME");
+
+  if (path != NULL)
+  {
+    return (*path == '\0') ? -1 : ((snprintf(out, size, "%s", path) < (int)size) ? 0 : -1);
+  }
+  if (home == NULL)
+  {
+    return -1;
+  }
+  return (snprintf(out, size, "%s/.cache/aes-mt-profile", home) < (int)size) ? 0 : -1;
+}
+
+static void profile_read(void)
+{
+  struct aes_mt_tunables t = tunables;
+  char path[512], id[320], expect[340], head[340], line[320];
+  unsigned long v;
+  FILE* f;
+  int seen = 0;
+
+  if ((profile_path(path, sizeof(path)) < 0) || ((f = fopen(path, "r")) == NULL))
+  {
+    return;
+  }
+  host_id(id, sizeof(id));
+  snprintf(expect, sizeof(expect), "aes-mt 1\n%s", id);
+  head[0] = '\0';
+  while (fgets(line, sizeof(line), f) != NULL)
+  {
+    if (sscanf(line, "threads %lu", &v) == 1)
+    {
+      t.threads = (unsigned)v;
+      seen |= 1;
+    }
+    else if (sscanf(line, "chunk %lu", &v) == 1)
+    {
+      t.chunk = (uint32_t)v;
+      seen |= 2;
+    }
+    else if (sscanf(line, "interleave %lu", &v) == 1)
+    {
+      t.interleave = (uint32_t)v;
+      seen |= 4;
+    }
+    else if (sscanf(line, "min_parallel %lu", &v) == 1)
+    {
+      t.min_parallel = (uint32_t)v;
+      seen |= 8;
+    }
+    else
+    {
+      strncat(head, line, sizeof(head) - strlen(head) - 1);
+    }
+  }
+  fclose(f);
+
+  // Every line that is not a tunable belongs to the header, which must
+  // match this host.
+  if ((seen == 15) && (strcmp(head, expect) == 0))
+  {
+    clamp(&t);
+    tunables = t;
+  }
+}
+
+#if defined(CTR) && (CTR == 1)
+// Written to a temporary file and renamed, so concurrent readers never see
+// a partial file.
+static int profile_write(const struct aes_mt_tunables* t)
+{
+  char path[512], tmp[540], id[320];
+  FILE* f;
+
+  if (profile_path(path, sizeof(path)) < 0)
+  {
+    return -1;
+  }
+  snprintf(tmp, sizeof(tmp), "%s.%ld", path, (long)getpid());
+  if ((f = fopen(tmp, "w")) == NULL)
+  {
+    return -1;
+  }
+  host_id(id, sizeof(id));
+  fprintf(f, "aes-mt 1\n%sthreads %u\nchunk %lu\ninterleave %lu\nmin_parallel %lu\n", id, t->threads,
+          (unsigned long)t->chunk, (unsigned long)t->interleave, (unsigned long)t->min_parallel);
+  if ((fclose(f) != 0) || (rename(tmp, path) != 0))
+  {
+    remove(tmp);
+    return -1;
+  }
+  return 0;
+}
+#endif // #if defined(CTR) && (CTR == 1)
+
+void aes_mt_get_tunables(struct aes_mt_tunables* t)
+{
+  pthread_once(&tunables_once, profile_read);
+  pthread_mutex_lock(&tunables_lock);
+  *t = tunables;
+  pthread_mutex_unlock(&tunables_lock);
+}
+
+void aes_mt_set_tunables(const struct aes_mt_tunables* t)
+{
+  struct aes_mt_tunables c = *t;
+
+  clamp(&c);
+  pthread_once(&tunables_once, profile_read);
+  pthread_mutex_lock(&tunables_lock);
+  tunables = c;
+  pthread_mutex_unlock(&tunables_lock);
+}
+
+// Tasks for a bulk job of nblocks blocks: one per chunk, or a single one
+// when the job is too small to be worth waking the pool.
+static uint32_t bulk_tasks(const struct aes_mt_tunables* t, uint32_t nblocks, uint32_t* chunk_blocks)
+{
+  const uint32_t cb = t->chunk / AES_BLOCKLEN;
+
+  if ((uint64_t)nblocks * AES_BLOCKLEN < t->min_parallel)
+  {
+    *chunk_blocks = nblocks;
+    return (nblocks > 0) ? 1 : 0;
+  }
+  *chunk_blocks = cb;
+  return (nblocks + cb - 1) / cb;
+}
+
+/*****************************************************************************/
+/* ECB:                                                                      */
+/*****************************************************************************/
+#if defined(ECB) && (ECB == 1)
+
+struct ecb_job
+{
+  const struct AES_ctx* ctx;
+  uint8_t* buf;
+  uint32_t nblocks;
+  uint32_t chunk_blocks;
+  uint32_t interleave;
+  int decrypt;
+};
+
+static void ecb_task(void* arg, uint32_t index)
+{
+  struct ecb_job* job = (struct ecb_job*)arg;
+  const uint32_t first = index * job->chunk_blocks;
+  uint32_t count = (job->nblocks - first < job->chunk_blocks) ? job->nblocks - first : job->chunk_blocks;
+  uint8_t* p = job->buf + (size_t)first * AES_BLOCKLEN;
+  uint32_t n;
+
+  for (; count > 0; count -= n, p += n * AES_BLOCKLEN)
+  {
+    n = (count < job->interleave) ? count : job->interleave;
+    if (job->decrypt)
+    {
+      AES_ECB_decrypt_blocks(job->ctx, p, n);
+    }
+    else
+    {
+      AES_ECB_encrypt_blocks(job->ctx, p, n);
+    }
+  }
+}
+
+static void ecb_run(struct aes_pool* pool, const struct AES_ctx* ctx, uint8_t* buf, uint32_t nblocks, int decrypt)
+{
+  struct aes_mt_tunables t;
+  struct ecb_job job;
+  uint32_t n;
+
+  aes_mt_get_tunables(&t);
+  n = bulk_tasks(&t, nblocks, &job.chunk_blocks);
+  job.ctx = ctx;
+  job.buf = buf;
+  job.nblocks = nblocks;
+  job.interleave = t.interleave;
+  job.decrypt = decrypt;
+  aes_pool_run_threads(pool, ecb_task, &job, n, t.threads);
+}
+
+void aes_mt_ecb_encrypt(struct aes_pool* pool, const struct AES_ctx* ctx, uint8_t* buf, uint32_t nblocks)
+{
+  ecb_run(pool, ctx, buf, nblocks, 0);
+}
+
+void aes_mt_ecb_decrypt(struct aes_pool* pool, const struct AES_ctx* ctx, uint8_t* buf, uint32_t nblocks)
+{
+  ecb_run(pool, ctx, buf, nblocks, 1);
+}
+
+#endif // #if defined(ECB) && (ECB == 1)
+
+/*****************************************************************************/
+/* CBC decryption:                                                           */
+/*****************************************************************************/
+#if defined(CBC) && (CBC == 1) && defined(ECB) && (ECB == 1)
+
+struct cbc_job
+{
+  const struct AES_ctx* ctx;
+  uint8_t* buf;
+  uint32_t nblocks;
+  uint32_t chunk_blocks;
+  uint32_t interleave;
+  uint8_t (*chain)[AES_BLOCKLEN];  // ciphertext block before each chunk
+};
+
+// Plaintext block i is the decryption of ciphertext block i XOR ciphertext
+// block i - 1, so every block decrypts independently once the ciphertext
+// block before it is known. The buffer is decrypted in place: each group of
+// blocks keeps a copy of its ciphertext for the next group, and the block
+// before each chunk was copied by the caller before any task started.
+static void cbc_task(void* arg, uint32_t index)
+{
+  struct cbc_job* job = (struct cbc_job*)arg;
+  const uint32_t first = index * job->chunk_blocks;
+  uint32_t count = (job->nblocks - first < job->chunk_blocks) ? job->nblocks - first : job->chunk_blocks;
+  uint8_t* p = job->buf + (size_t)first * AES_BLOCKLEN;
+  uint8_t cipher[AES_MT_INTERLEAVE_MAX + 1][AES_BLOCKLEN];
+  uint32_t n, b, i;
+
+  memcpy(cipher[0], job->chain[index], AES_BLOCKLEN);
+  for (; count > 0; count -= n, p += n * AES_BLOCKLEN)
+  {
+    n = (count < job->interleave) ? count : job->interleave;
+    memcpy(cipher[1], p, (size_t)n * AES_BLOCKLEN);
+    AES_ECB_decrypt_blocks(job->ctx, p, n);
+    for (b = 0; b < n; ++b)
+    {
+      for (i = 0; i < AES_BLOCKLEN; ++i)
+      {
+        p[b * AES_BLOCKLEN + i] ^= cipher[b][i];
+      }
+    }
+    memcpy(cipher[0], cipher[n], AES_BLOCKLEN);
+  }
+}
+
+void aes_mt_cbc_decrypt(struct aes_pool* pool, struct AES_ctx* ctx, uint8_t* buf, uint32_t length)
+{
+  struct aes_mt_tunables t;
+  struct cbc_job job;
+  uint32_t n, i;
+
+  aes_mt_get_tunables(&t);
+  job.nblocks = length / AES_BLOCKLEN;
+  n = bulk_tasks(&t, job.nblocks, &job.chunk_blocks);
+  if (n == 0)
+  {
+    return;
+  }
+  job.chain = (uint8_t (*)[AES_BLOCKLEN])malloc((size_t)n * AES_BLOCKLEN);
+  if (job.chain == NULL)
+  {
+    AES_CBC_decrypt_buffer(ctx, buf, length);
+    return;
+  }
+  memcpy(job.chain[0], ctx->Iv, AES_BLOCKLEN);
+  for (i = 1; i < n; ++i)
+  {
+    memcpy(job.chain[i], buf + ((size_t)i * job.chunk_blocks - 1) * AES_BLOCKLEN, AES_BLOCKLEN);
+  }
+  memcpy(ctx->Iv, buf + ((size_t)job.nblocks - 1) * AES_BLOCKLEN, AES_BLOCKLEN);
+  job.ctx = ctx;
+  job.buf = buf;
+  job.interleave = t.interleave;
+  aes_pool_run_threads(pool, cbc_task, &job, n, t.threads);
+  free(job.chain);
+}
+
+#endif // #if defined(CBC) && (CBC == 1) && defined(ECB) && (ECB == 1)
+
+/*****************************************************************************/
+/* CTR:                                                                      */
+/*****************************************************************************/
+#if defined(CTR) && (CTR == 1)
+
+struct ctr_job
+{
+  const struct AES_ctx* ctx;
+  uint8_t* buf;
+  uint32_t length;
+  uint32_t chunk_blocks;
+  uint32_t interleave;
+};
+
+// Adds n to the 128-bit big-endian counter block iv.
+static void ctr_add(uint8_t* iv, uint32_t n)
+{
+  uint64_t carry = n;
+  int i;
+  for (i = AES_BLOCKLEN - 1; (i >= 0) && (carry != 0); --i)
+  {
+    carry += iv[i];
+    iv[i] = (uint8_t)carry;
+    carry >>= 8;
+  }
+}
+
+static void ctr_task(void* arg, uint32_t index)
+{
+  struct ctr_job* job = (struct ctr_job*)arg;
+  const uint32_t first = index * job->chunk_blocks;
+  const uint32_t step = job->interleave * AES_BLOCKLEN;
+  const uint64_t left = job->length - (uint64_t)first * AES_BLOCKLEN;
+  const uint64_t chunk = (uint64_t)job->chunk_blocks * AES_BLOCKLEN;
+  uint32_t count = (uint32_t)((left < chunk) ? left : chunk);
+  uint8_t* p = job->buf + (size_t)first * AES_BLOCKLEN;
+  struct AES_ctx ctx = *job->ctx;
+  uint32_t n;
+
+  ctr_add(ctx.Iv, first);
+  for (; count > 0; count -= n, p += n)
+  {
+    n = (count < step) ? count : step;
+    AES_CTR_xcrypt_buffer(&ctx, p, n);
+  }
+}
+
+void aes_mt_ctr_xcrypt(struct aes_pool* pool, struct AES_ctx* ctx, uint8_t* buf, uint32_t length)
+{
+  const uint32_t nblocks = length / AES_BLOCKLEN + ((length % AES_BLOCKLEN) != 0);
+  struct aes_mt_tunables t;
+  struct ctr_job job;
+  uint32_t n;
+
+  aes_mt_get_tunables(&t);
+  n = bulk_tasks(&t, nblocks, &job.chunk_blocks);
+  job.ctx = ctx;
+  job.buf = buf;
+  job.length = length;
+  job.interleave = t.interleave;
+  aes_pool_run_threads(pool, ctr_task, &job, n, t.threads);
+  ctr_add(ctx->Iv, nblocks);
+}
+
+#endif // #if defined(CTR) && (CTR == 1)
+
+/*****************************************************************************/
+/* SIV:                                                                      */
+/*****************************************************************************/
+#if defined(SIV) && (SIV == 1)
+
+struct siv_job
+{
+  const struct AES_siv_ctx* ctx;
+  struct AES_siv_chunk* chunks;
+  uint32_t n;
+  int decrypt;
+  _Atomic uint32_t failed;
+};
+
+static void siv_task(void* arg, uint32_t index)
+{
+  struct siv_job* job = (struct siv_job*)arg;
+  const uint32_t first = index * AES_MT_SIV_GROUP;
+  const uint32_t count = (job->n - first < AES_MT_SIV_GROUP) ? job->n - first : AES_MT_SIV_GROUP;
+
+  if (job->decrypt)
+  {
+    atomic_fetch_add_explicit(&job->failed, AES_SIV_decrypt_chunks(job->ctx, job->chunks + first, count), memory_order_relaxed);
+  }
+  else
+  {
+    AES_SIV_encrypt_chunks(job->ctx, job->chunks + first, count);
+  }
+}
+
+static uint32_t siv_run(struct aes_pool* pool, const struct AES_siv_ctx* ctx, struct AES_siv_chunk* chunks, uint32_t n, int decrypt)
+{
+  struct siv_job job;
+
+  job.ctx = ctx;
+  job.chunks = chunks;
+  job.n = n;
+  job.decrypt = decrypt;
+  atomic_init(&job.failed, 0);
+  aes_pool_run(pool, siv_task, &job, (n + AES_MT_SIV_GROUP - 1) / AES_MT_SIV_GROUP);
+  return atomic_load(&job.failed);
+}
+
+void aes_mt_siv_encrypt(struct aes_pool* pool, const struct AES_siv_ctx* ctx, struct AES_siv_chunk* chunks, uint32_t n)
+{
+  siv_run(pool, ctx, chunks, n, 0);
+}
+
+uint32_t aes_mt_siv_decrypt(struct aes_pool* pool, const struct AES_siv_ctx* ctx, struct AES_siv_chunk* chunks, uint32_t n)
+{
+  return siv_run(pool, ctx, chunks, n, 1);
+}
+
+#endif // #if defined(SIV) && (SIV == 1)
+
+
+
+#if defined(GCM) && (GCM == 1)
+
+struct gcm_job
+{
+  const struct AES_gcm_ctx* ctx;
+  const struct AES_gcm_op* op;
+  uint8_t* buf;
+  uint32_t length;
+  int decrypt;
+  uint8_t (*partials)[AES_BLOCKLEN];
+};
+
+static void gcm_task(void* arg, uint32_t index)
+{
+  struct gcm_job* job = (struct gcm_job*)arg;
+  const uint32_t offset = index * AES_MT_GCM_PIECE;
+  const uint32_t length = (job->length - offset < AES_MT_GCM_PIECE) ? job->length - offset : AES_MT_GCM_PIECE;
+
+  AES_GCM_piece(job->ctx, job->op, offset, job->buf + offset, length, job->decrypt, job->partials[index]);
+}
+
+// Runs the pieces on the pool and writes the full tag, or returns -1 if the
+// partials could not be allocated (nothing has been touched then).
+static int gcm_run(struct aes_pool* pool, const struct AES_gcm_ctx* ctx, const uint8_t* iv, uint32_t iv_len,
+                   const uint8_t* ad, uint32_t ad_len, uint8_t* buf, uint32_t length, int decrypt, uint8_t* tag)
+{
+  const uint32_t n = (length + AES_MT_GCM_PIECE - 1) / AES_MT_GCM_PIECE;
+  struct AES_gcm_op op;
+  struct gcm_job job;
+  uint32_t i;
+
+  job.partials = (uint8_t (*)[AES_BLOCKLEN])malloc((n > 0 ? n : 1) * AES_BLOCKLEN);
+  if (job.partials == NULL)
+  {
+    return -1;
+  }
+  AES_GCM_start(ctx, &op, iv, iv_len, ad, ad_len);
+  job.ctx = ctx;
+  job.op = &op;
+  job.buf = buf;
+  job.length = length;
+  job.decrypt = decrypt;
+  aes_pool_run(pool, gcm_task, &job, n);
+
+  for (i = 0; i < n; ++i)
+  {
+    const uint32_t offset = i * AES_MT_GCM_PIECE;
+    AES_GCM_combine(ctx, &op, job.partials[i], (length - offset < AES_MT_GCM_PIECE) ? length - offset : AES_MT_GCM_PIECE);
+  }
+  AES_GCM_finish(ctx, &op, tag);
+  free(job.partials);
+  return 0;
+}
+
+int aes_mt_gcm_encrypt(struct aes_pool* pool, const struct AES_gcm_ctx* ctx, const uint8_t* iv, uint32_t iv_len,
+                       const uint8_t* ad, uint32_t ad_len, uint8_t* buf, uint32_t length, uint8_t* tag, uint8_t tag_len)
+{
+  uint8_t full[AES_BLOCKLEN];
+
+  if (!AES_GCM_lengths_valid(iv_len, tag_len))
+  {
+    return -1;
+  }
+  if (gcm_run(pool, ctx, iv, iv_len, ad, ad_len, buf, length, 0, full) < 0)
+  {
+    return AES_GCM_encrypt(ctx, iv, iv_len, ad, ad_len, buf, length, tag, tag_len);
+  }
+  memcpy(tag, full, tag_len);
+  return 0;
+}
+
+int aes_mt_gcm_decrypt(struct aes_pool* pool, const struct AES_gcm_ctx* ctx, const uint8_t* iv, uint32_t iv_len,
+                       const uint8_t* ad, uint32_t ad_len, uint8_t* buf, uint32_t length, const uint8_t* tag, uint8_t tag_len)
+{
+  uint8_t full[AES_BLOCKLEN];
+  uint8_t diff = 0, i;
+
+  if (!AES_GCM_lengths_valid(iv_len, tag_len))
+  {
+    return -1;
+  }
+  if (gcm_run(pool, ctx, iv, iv_len, ad, ad_len, buf, length, 1, full) < 0)
+  {
+    return AES_GCM_decrypt(ctx, iv, iv_len, ad, ad_len, buf, length, tag, tag_len);
+  }
+  for (i = 0; i < tag_len; ++i)
+  {
+    diff |= full[i] ^ tag[i];
+  }
+  if (diff != 0)
+  {
+    memset(buf, 0, length);
+    return -1;
+  }
+  return 0;
+}
+
+#endif // #if defined(GCM) && (GCM == 1)
+
+
+
+#if defined(PMAC) && (PMAC == 1)
+
+#define PMAC_PIECE_BLOCKS (AES_MT_PMAC_PIECE / AES_BLOCKLEN)
+
+struct pmac_job
+{
+  const struct AES_pmac_ctx* ctx;
+  const uint8_t* msg;
+  uint32_t nblocks;
+  uint8_t (*sums)[AES_BLOCKLEN];
+};
+
+static void pmac_task(void* arg, uint32_t index)
+{
+  struct pmac_job* job = (struct pmac_job*)arg;
+  const uint32_t first = index * PMAC_PIECE_BLOCKS;
+  const uint32_t count = (job->nblocks - first < PMAC_PIECE_BLOCKS) ? job->nblocks - first : PMAC_PIECE_BLOCKS;
+
+  AES_PMAC_sum(job->ctx, first, job->msg + (size_t)first * AES_BLOCKLEN, count, job->sums[index]);
+}
+
+void aes_mt_pmac(struct aes_pool* pool, const struct AES_pmac_ctx* ctx, const uint8_t* msg, uint32_t length, uint8_t* mac)
+{
+  // All blocks but the last go to the tasks, as in AES_PMAC().
+  const uint32_t m = (length == 0) ? 0 : (length - 1) / AES_BLOCKLEN;
+  const uint32_t n = (m + PMAC_PIECE_BLOCKS - 1) / PMAC_PIECE_BLOCKS;
+  uint8_t sum[AES_BLOCKLEN];
+  struct pmac_job job;
+  uint32_t i, j;
+
+  job.sums = (uint8_t (*)[AES_BLOCKLEN])malloc((n > 0 ? n : 1) * AES_BLOCKLEN);
+  if (job.sums == NULL)
+  {
+    AES_PMAC(ctx, msg, length, mac);
+    return;
+  }
+  job.ctx = ctx;
+  job.msg = msg;
+  job.nblocks = m;
+  aes_pool_run(pool, pmac_task, &job, n);
+
+  memset(sum, 0, AES_BLOCKLEN);
+  for (i = 0; i < n; ++i)
+  {
+    for (j = 0; j < AES_BLOCKLEN; ++j)
+    {
+      sum[j] ^= job.sums[i][j];
+    }
+  }
+  AES_PMAC_finish(ctx, sum, msg + (size_t)m * AES_BLOCKLEN, length - m * AES_BLOCKLEN, mac);
+  free(job.sums);
+}
+
+#endif // #if defined(PMAC) && (PMAC == 1)
+
+
+
+#if defined(CTR) && (CTR == 1)
+
+/*****************************************************************************/
+/* Tuning:                                                                   */
+/*****************************************************************************/
+#define TUNE_SMALL 1024
+#define TUNE_CHUNK_MIN 4096
+#define TUNE_CHUNK_MAX 1048576
+// The probe buffer grows with the pool, which is sized by the caller; past
+// this, the largest chunks no longer reach every thread, which the sweep
+// only needs to find out that they are too large.
+#define TUNE_LENGTH_MAX (64u << 20)
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// Bytes per second of aes_mt_ctr_xcrypt() on length-byte buffers under t:
+// the best of three runs of at least 20 ms each.
+static double measure(struct aes_pool* pool, const struct aes_mt_tunables* t, uint8_t* buf, uint32_t length)
+{
+  static const uint8_t key[AES_KEYLEN] = { 0 };
+  static const uint8_t iv[AES_BLOCKLEN] = { 0 };
+  struct AES_ctx ctx;
+  double best = 0, t0, e;
+  uint64_t done;
+  int trial;
+
+  aes_mt_set_tunables(t);
+  AES_init_ctx_iv(&ctx, key, iv);
+  for (trial = 0; trial < 3; ++trial)
+  {
+    done = 0;
+    t0 = now();
+    do
+    {
+      aes_mt_ctr_xcrypt(pool, &ctx, buf, length);
+      done += length;
+      e = now() - t0;
+    } while (e < 20e-3);
+    if (done / e > best)
+    {
+      best = done / e;
+    }
+  }
+  return best;
+}
+
+int aes_mt_tune(struct aes_pool* pool, struct aes_mt_tunables* result)
+{
+  const unsigned threads = aes_pool_threads(pool);
+  // Enough data for a chunk of the largest size on every thread, within
+  // TUNE_LENGTH_MAX.
+  const uint32_t length = (threads < 4) ? 4 * TUNE_CHUNK_MAX
+                          : ((threads < TUNE_LENGTH_MAX / TUNE_CHUNK_MAX) ? threads * TUNE_CHUNK_MAX : TUNE_LENGTH_MAX);
+  struct aes_mt_tunables t = { 1, AES_MT_CHUNK, AES_MT_INTERLEAVE, 0 };
+  uint8_t* buf = (uint8_t*)calloc(1, length);
+  double rate, best, serial;
+  uint32_t v;
+  unsigned k;
+
+  if (buf == NULL)
+  {
+    return -1;
+  }
+
+  // Interleave, on one thread, so that the engine alone is measured.
+  best = 0;
+  for (v = 1; v <= AES_MT_INTERLEAVE_MAX; v *= 2)
+  {
+    struct aes_mt_tunables c = t;
+    c.interleave = v;
+    if ((rate = measure(pool, &c, buf, TUNE_CHUNK_MIN * 16)) > best)
+    {
+      best = rate;
+      t.interleave = v;
+    }
+  }
+
+  // Thread count: powers of two, and all of them. Memory bandwidth or SMT
+  // siblings often make fewer threads than CPUs the fastest setting.
+  best = 0;
+  for (k = 1; (threads > 1) && (k <= threads); k = (k < threads && 2 * k > threads) ? threads : 2 * k)
+  {
+    struct aes_mt_tunables c = t;
+    c.threads = k;
+    if ((rate = measure(pool, &c, buf, length)) > best)
+    {
+      best = rate;
+      t.threads = k;
+    }
+  }
+
+  // Chunk size: small chunks balance the load, large ones cost fewer task
+  // hand-outs. On one thread it hardly matters.
+  best = 0;
+  for (v = TUNE_CHUNK_MIN; (t.threads > 1) && (v <= TUNE_CHUNK_MAX); v *= 4)
+  {
+    struct aes_mt_tunables c = t;
+    c.chunk = v;
+    if ((rate = measure(pool, &c, buf, length)) > best)
+    {
+      best = rate;
+      t.chunk = v;
+    }
+  }
+
+  // The parallel threshold: the smallest buffer on which waking the pool
+  // beats the calling thread alone.
+  t.min_parallel = UINT32_MAX;
+  for (v = TUNE_SMALL; (t.threads > 1) && (v <= length); v *= 2)
+  {
+    struct aes_mt_tunables c = t;
+    c.min_parallel = UINT32_MAX;
+    serial = measure(pool, &c, buf, v);
+    c.min_parallel = 0;
+    if (measure(pool, &c, buf, v) > serial)
+    {
+      t.min_parallel = v;
+      break;
+    }
+  }
+  free(buf);
+
+  aes_mt_set_tunables(&t);
+  aes_mt_get_tunables(&t);
+  if (result != NULL)
+  {
+    *result = t;
+  }
+  return profile_write(&t);
+}
+
+#endif // #if defined(CTR) && (CTR == 1)
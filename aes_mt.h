@@ -0,0 +1,143 @@
+#ifndef _AES_MT_H_
+#define _AES_MT_H_
+
+// Multi-threaded drivers for the modes in aes.h.
+//
+// struct aes_pool is a fixed set of worker threads that run data-parallel
+// jobs: aes_pool_run() hands out indices 0..n-1 to the workers and to the
+// calling thread until all are taken, and returns when the last one is
+// finished. The drivers below split their input into independent tasks and
+// run them on a pool. A pool runs one job at a time; callers that share a
+// pool between threads must serialize their aes_pool_run() calls.
+//
+// Every driver also accepts pool == NULL and then runs on the calling
+// thread alone, so callers need no separate single-threaded path.
+
+#include <stdint.h>
+#include "aes.h"
+
+struct aes_pool;
+
+typedef void (*aes_pool_fn)(void* arg, uint32_t index);
+
+// Creates a pool for threads threads of execution in total, the caller of
+// aes_pool_run() included, so threads - 1 workers are started. threads == 0
+// means one per online CPU. Returns NULL on failure.
+struct aes_pool* aes_pool_create(unsigned threads);
+void aes_pool_destroy(struct aes_pool* pool);
+unsigned aes_pool_threads(const struct aes_pool* pool);
+
+void aes_pool_run(struct aes_pool* pool, aes_pool_fn fn, void* arg, uint32_t n);
+
+// Like aes_pool_run(), but at most threads threads (the caller included)
+// take indices; the other workers sit the job out. 0 means all of them.
+void aes_pool_run_threads(struct aes_pool* pool, aes_pool_fn fn, void* arg, uint32_t n, unsigned threads);
+
+
+// Tunables of the bulk drivers (ECB, CBC decryption, CTR). Their best values
+// differ a lot between hosts, so they come from a per-host profile written by
+// aes_mt_tune(); without one, the defaults below are used. The profile is
+// read on first use from $AES_MT_PROFILE, or $HOME/.cache/aes-mt-profile,
+// and is ignored if it was written on a host with another name or CPU count.
+// Set AES_MT_PROFILE to an empty string to disable it.
+#define AES_MT_CHUNK 65536
+#define AES_MT_INTERLEAVE 8
+#define AES_MT_INTERLEAVE_MAX 8
+#define AES_MT_MIN_PARALLEL 65536
+
+struct aes_mt_tunables
+{
+  unsigned threads;       // threads of the pool to use, 0 for all of them
+  uint32_t chunk;         // bytes per task, a multiple of AES_BLOCKLEN
+  uint32_t interleave;    // blocks per engine call, 1..AES_MT_INTERLEAVE_MAX
+  uint32_t min_parallel;  // shorter buffers run on the calling thread
+};
+
+void aes_mt_get_tunables(struct aes_mt_tunables* t);
+
+// Replaces the tunables for the whole process; the profile is not written.
+// Out of range values are clamped.
+void aes_mt_set_tunables(const struct aes_mt_tunables* t);
+
+#if defined(CTR) && (CTR == 1)
+// Sweeps the tunables on pool with the CTR driver (interleave, then thread
+// count, then chunk size, then the parallel threshold, each with the others
+// fixed), applies the result and writes the profile. Takes seconds on a slow
+// engine. Returns -1 if the profile could not be written.
+int aes_mt_tune(struct aes_pool* pool, struct aes_mt_tunables* result);
+#endif
+
+
+#if defined(ECB) && (ECB == 1)
+
+// AES_ECB_encrypt_blocks() / AES_ECB_decrypt_blocks() spread over a pool.
+void aes_mt_ecb_encrypt(struct aes_pool* pool, const struct AES_ctx* ctx, uint8_t* buf, uint32_t nblocks);
+void aes_mt_ecb_decrypt(struct aes_pool* pool, const struct AES_ctx* ctx, uint8_t* buf, uint32_t nblocks);
+
+#endif // #if defined(ECB) && (ECB == 1)
+
+
+#if defined(CBC) && (CBC == 1) && defined(ECB) && (ECB == 1)
+
+// AES_CBC_decrypt_buffer() spread over a pool; ctx->Iv ends up as with the
+// serial function. CBC encryption is inherently serial. If the chaining
+// blocks cannot be allocated it falls back to the serial function.
+void aes_mt_cbc_decrypt(struct aes_pool* pool, struct AES_ctx* ctx, uint8_t* buf, uint32_t length);
+
+#endif // #if defined(CBC) && (CBC == 1) && defined(ECB) && (ECB == 1)
+
+
+#if defined(CTR) && (CTR == 1)
+
+// AES_CTR_xcrypt_buffer() spread over a pool; ctx->Iv ends up as with the
+// serial function.
+void aes_mt_ctr_xcrypt(struct aes_pool* pool, struct AES_ctx* ctx, uint8_t* buf, uint32_t length);
+
+#endif // #if defined(CTR) && (CTR == 1)
+
+
+#if defined(SIV) && (SIV == 1)
+
+// Chunks per task: each task runs AES_SIV_encrypt_chunks() on this many
+// consecutive chunks, which keeps the SIV lanes of a thread busy.
+#define AES_MT_SIV_GROUP 8
+
+// AES_SIV_encrypt_chunks() / AES_SIV_decrypt_chunks() spread over a pool.
+void aes_mt_siv_encrypt(struct aes_pool* pool, const struct AES_siv_ctx* ctx, struct AES_siv_chunk* chunks, uint32_t n);
+uint32_t aes_mt_siv_decrypt(struct aes_pool* pool, const struct AES_siv_ctx* ctx, struct AES_siv_chunk* chunks, uint32_t n);
+
+#endif // #if defined(SIV) && (SIV == 1)
+
+
+#if defined(GCM) && (GCM == 1)
+
+// Bytes per task. Each task runs CTR and a partial GHASH over its piece; the
+// caller then folds the partials with powers of H (AES_GCM_combine()), which
+// costs a few dozen field multiplications per piece.
+#define AES_MT_GCM_PIECE 65536
+
+// AES_GCM_encrypt() / AES_GCM_decrypt() spread over a pool. Ciphertext and
+// tag are bit-identical to the serial functions, and so are the return
+// values. If the partials cannot be allocated they fall back to the serial
+// functions.
+int aes_mt_gcm_encrypt(struct aes_pool* pool, const struct AES_gcm_ctx* ctx, const uint8_t* iv, uint32_t iv_len,
+                       const uint8_t* ad, uint32_t ad_len, uint8_t* buf, uint32_t length, uint8_t* tag, uint8_t tag_len);
+int aes_mt_gcm_decrypt(struct aes_pool* pool, const struct AES_gcm_ctx* ctx, const uint8_t* iv, uint32_t iv_len,
+                       const uint8_t* ad, uint32_t ad_len, uint8_t* buf, uint32_t length, const uint8_t* tag, uint8_t tag_len);
+
+#endif // #if defined(GCM) && (GCM == 1)
+
+
+#if defined(PMAC) && (PMAC == 1)
+
+// Bytes per task. Each task returns its share of the PMAC checksum; the
+// shares are XORed together by the caller.
+#define AES_MT_PMAC_PIECE 65536
+
+// AES_PMAC() spread over a pool; the MAC is identical. If the shares cannot
+// be allocated it falls back to AES_PMAC().
+void aes_mt_pmac(struct aes_pool* pool, const struct AES_pmac_ctx* ctx, const uint8_t* msg, uint32_t length, uint8_t* mac);
+
+#endif // #if defined(PMAC) && (PMAC == 1)
+
+#endif // _AES_MT_H_
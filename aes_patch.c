@@ -0,0 +1,410 @@
+/*
+
+Incremental re-encryption of CTR files. See aes_patch.h for the interface.
+
+The merged ranges are walked chunk by chunk, and every chunk they touch is
+one task. A task seeks a copy of the context to the chunk's counter block
+in its current generation and runs the selected backend (aes_backend.h)
+over the gaps between the ranges, which turns the chunk into plaintext;
+then it advances the generation and encrypts the whole chunk under the new
+counter block. The bytes of a partial first block of a gap are XORed with
+one keystream block.
+
+Tags are computed one chunk per task, from the same walk. A chunk's PMAC1
+message is its first counter block, a block holding its generation and
+index, and its bytes, so the two header blocks are MACed as blocks 0 and 1
+and the chunk as blocks 2.. with the split interface, without copying the
+chunk.
+
+*/
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "aes_backend.h"
+#include "aes_patch.h"
+
+#if defined(CTR) && (CTR == 1) && defined(ECB) && (ECB == 1)
+
+// A chunk the ranges touch, and the first range that touches it.
+struct dirty
+{
+  uint64_t chunk;
+  uint32_t range;
+};
+
+struct patch_job
+{
+  const struct AES_ctx* ctx;
+  uint8_t* buf;
+  uint64_t length;
+  uint32_t chunk;
+  const struct aes_patch_range* ranges;
+  uint32_t n;
+  uint64_t* gens;
+  const struct dirty* list;
+  int exhausted;            // some chunk is at the last generation
+};
+
+// Adds n to the big-endian counter block iv, at byte low and the bytes
+// above it: low 15 adds to the whole block, low 7 adds n * 2^64.
+static void ctr_add(uint8_t* iv, uint64_t n, int low)
+{
+  int i;
+  for (i = low; (i >= 0) && (n != 0); --i)
+  {
+    n += iv[i];
+    iv[i] = (uint8_t)n;
+    n >>= 8;
+  }
+}
+
+// The counter block of file offset in generation gen.
+static void ctr_at(uint8_t* ctr, const uint8_t* iv, uint64_t gen, uint64_t offset)
+{
+  memcpy(ctr, iv, AES_BLOCKLEN);
+  ctr_add(ctr, offset / AES_BLOCKLEN, AES_BLOCKLEN - 1);
+  ctr_add(ctr, gen, AES_BLOCKLEN / 2 - 1);
+}
+
+static int by_offset(const void* a, const void* b)
+{
+  const uint64_t x = ((const struct aes_patch_range*)a)->offset;
+  const uint64_t y = ((const struct aes_patch_range*)b)->offset;
+  return (x > y) - (x < y);
+}
+
+// Cuts the ranges at length, drops empty ones, sorts and merges the rest.
+static uint32_t merge(struct aes_patch_range* ranges, uint32_t n, uint64_t length)
+{
+  uint32_t i, kept = 0;
+
+  for (i = 0; i < n; ++i)
+  {
+    if (ranges[i].offset >= length)
+    {
+      continue;
+    }
+    ranges[kept].offset = ranges[i].offset;
+    ranges[kept].length = (ranges[i].length < length - ranges[i].offset) ? ranges[i].length : length - ranges[i].offset;
+    kept += (ranges[kept].length != 0);
+  }
+  if (kept == 0)
+  {
+    return 0;
+  }
+  qsort(ranges, kept, sizeof(ranges[0]), by_offset);
+  for (n = 1, i = 1; i < kept; ++i)
+  {
+    struct aes_patch_range* last = &ranges[n - 1];
+    if (ranges[i].offset <= last->offset + last->length)
+    {
+      const uint64_t end = ranges[i].offset + ranges[i].length;
+      if (end > last->offset + last->length)
+      {
+        last->length = end - last->offset;
+      }
+    }
+    else
+    {
+      ranges[n++] = ranges[i];
+    }
+  }
+  return n;
+}
+
+// Walks the chunks the sorted ranges touch, each once, and returns how many
+// there are. With list, it lists them; with visit, it calls it for each.
+static uint32_t touched(const struct aes_patch_range* ranges, uint32_t n, uint64_t length, uint32_t chunk,
+                        struct dirty* list, void (*visit)(void*, const struct dirty*), void* arg)
+{
+  struct dirty d;
+  uint64_t end, last = UINT64_MAX;
+  uint32_t count = 0;
+
+  for (d.range = 0; (d.range < n) && (ranges[d.range].offset < length); ++d.range)
+  {
+    if (ranges[d.range].length == 0)
+    {
+      continue;
+    }
+    end = (ranges[d.range].length < length - ranges[d.range].offset) ? ranges[d.range].offset + ranges[d.range].length
+                                                                     : length;
+    d.chunk = ranges[d.range].offset / chunk;
+    d.chunk = ((last != UINT64_MAX) && (d.chunk <= last)) ? last + 1 : d.chunk;
+    for (; d.chunk <= (end - 1) / chunk; ++d.chunk)
+    {
+      if (list != NULL)
+      {
+        list[count] = d;
+      }
+      if (visit != NULL)
+      {
+        visit(arg, &d);
+      }
+      ++count;
+      last = d.chunk;
+    }
+  }
+  return count;
+}
+
+// XORs the keystream of offset .. offset + length - 1 in generation gen
+// into buf at offset.
+static void xcrypt_at(const struct AES_ctx* base, uint64_t gen, uint8_t* buf, uint64_t offset, uint32_t length)
+{
+  const uint32_t skip = (uint32_t)(offset % AES_BLOCKLEN);
+  uint8_t* p = buf + offset;
+  struct AES_ctx ctx;
+  uint32_t i, n;
+
+  memcpy(&ctx, base, sizeof(ctx));
+  ctr_at(ctx.Iv, base->Iv, gen, offset);
+  if (skip != 0)
+  {
+    uint8_t ks[AES_BLOCKLEN];
+    memcpy(ks, ctx.Iv, AES_BLOCKLEN);
+    aes_backend_ecb_encrypt(&ctx, ks, 1);
+    n = (AES_BLOCKLEN - skip < length) ? AES_BLOCKLEN - skip : length;
+    for (i = 0; i < n; ++i)
+    {
+      p[i] ^= ks[skip + i];
+    }
+    ctr_add(ctx.Iv, 1, AES_BLOCKLEN - 1);
+    p += n;
+    length -= n;
+  }
+  if (length > 0)
+  {
+    aes_backend_ctr_xcrypt(&ctx, p, length);
+  }
+}
+
+static void patch_chunk(void* arg, const struct dirty* d)
+{
+  const struct patch_job* job = (const struct patch_job*)arg;
+  const uint64_t start = d->chunk * job->chunk;
+  const uint64_t end = (job->length - start < job->chunk) ? job->length : start + job->chunk;
+  uint64_t pos = start, from, to;
+  uint32_t r;
+
+  // The gaps between the ranges still hold ciphertext of the old generation.
+  for (r = d->range; (r < job->n) && (job->ranges[r].offset < end); ++r)
+  {
+    from = (job->ranges[r].offset > start) ? job->ranges[r].offset : start;
+    to = (job->ranges[r].offset + job->ranges[r].length < end) ? job->ranges[r].offset + job->ranges[r].length : end;
+    if (from > pos)
+    {
+      xcrypt_at(job->ctx, job->gens[d->chunk], job->buf, pos, (uint32_t)(from - pos));
+    }
+    pos = (to > pos) ? to : pos;
+  }
+  if (end > pos)
+  {
+    xcrypt_at(job->ctx, job->gens[d->chunk], job->buf, pos, (uint32_t)(end - pos));
+  }
+  ++job->gens[d->chunk];
+  xcrypt_at(job->ctx, job->gens[d->chunk], job->buf, start, (uint32_t)(end - start));
+}
+
+static void patch_task(void* arg, uint32_t index)
+{
+  const struct patch_job* job = (const struct patch_job*)arg;
+  patch_chunk(arg, &job->list[index]);
+}
+
+static void check_gen(void* arg, const struct dirty* d)
+{
+  struct patch_job* job = (struct patch_job*)arg;
+  job->exhausted |= (job->gens[d->chunk] == UINT64_MAX);
+}
+
+int aes_patch_ctr(struct aes_pool* pool, const struct AES_ctx* ctx, uint8_t* buf, uint64_t length, uint32_t chunk,
+                  struct aes_patch_range* ranges, uint32_t n, uint64_t* gens)
+{
+  struct patch_job job;
+  struct dirty* list;
+  uint32_t count;
+
+  if ((chunk == 0) || ((chunk % AES_BLOCKLEN) != 0))
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  n = merge(ranges, n, length);
+  job.ctx = ctx;
+  job.buf = buf;
+  job.length = length;
+  job.chunk = chunk;
+  job.ranges = ranges;
+  job.n = n;
+  job.gens = gens;
+  job.list = NULL;
+  job.exhausted = 0;
+  // A generation must never be used twice, so nothing is touched if one
+  // chunk has run out of them.
+  count = touched(ranges, n, length, chunk, NULL, check_gen, &job);
+  if (job.exhausted)
+  {
+    errno = EOVERFLOW;
+    return -1;
+  }
+
+  list = (count > 1) ? (struct dirty*)malloc(count * sizeof(struct dirty)) : NULL;
+  if (list != NULL)
+  {
+    touched(ranges, n, length, chunk, list, NULL, NULL);
+    job.list = list;
+    aes_pool_run(pool, patch_task, &job, count);
+    free(list);
+  }
+  else
+  {
+    // One chunk, or no memory for the list: patch them here.
+    touched(ranges, n, length, chunk, NULL, patch_chunk, &job);
+  }
+  return (int)n;
+}
+
+int aes_patch_xcrypt_chunk(const struct AES_ctx* ctx, uint8_t* buf, uint64_t length, uint32_t chunk, uint64_t index,
+                           uint64_t gen)
+{
+  uint64_t start;
+
+  if ((chunk == 0) || ((chunk % AES_BLOCKLEN) != 0) || (index >= (length + chunk - 1) / chunk))
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  start = index * chunk;
+  xcrypt_at(ctx, gen, buf, start, (length - start < chunk) ? (uint32_t)(length - start) : chunk);
+  return 0;
+}
+
+#if defined(PMAC) && (PMAC == 1)
+
+struct tag_job
+{
+  const struct AES_pmac_ctx* mac;
+  const uint8_t* iv;
+  const uint8_t* buf;
+  uint64_t length;
+  uint32_t chunk;
+  const uint64_t* gens;
+  const struct dirty* list;  // chunk of each task, NULL for chunk = task
+  uint8_t (*tags)[AES_BLOCKLEN];
+};
+
+static void tag_chunk(const struct AES_pmac_ctx* mac, const uint8_t* iv, const uint8_t* buf, uint64_t length,
+                      uint32_t chunk, uint64_t index, uint64_t gen, uint8_t* tag)
+{
+  const uint64_t offset = index * chunk;
+  const uint32_t n = (length - offset < chunk) ? (uint32_t)(length - offset) : chunk;
+  const uint32_t last = ((n % AES_BLOCKLEN) != 0) ? n % AES_BLOCKLEN : AES_BLOCKLEN;
+  const uint32_t full = (n - last) / AES_BLOCKLEN;
+  uint8_t head[2][AES_BLOCKLEN], sum[AES_BLOCKLEN], body[AES_BLOCKLEN];
+  uint32_t i;
+
+  ctr_at(head[0], iv, gen, offset);
+  for (i = 0; i < 8; ++i)
+  {
+    head[1][i] = (uint8_t)(gen >> (56 - 8 * i));
+    head[1][8 + i] = (uint8_t)(index >> (56 - 8 * i));
+  }
+  AES_PMAC_sum(mac, 0, head[0], 2, sum);
+  AES_PMAC_sum(mac, 2, buf + offset, full, body);
+  for (i = 0; i < AES_BLOCKLEN; ++i)
+  {
+    sum[i] ^= body[i];
+  }
+  AES_PMAC_finish(mac, sum, buf + offset + (uint64_t)full * AES_BLOCKLEN, last, tag);
+}
+
+static void tag_dirty(void* arg, const struct dirty* d)
+{
+  const struct tag_job* job = (const struct tag_job*)arg;
+  tag_chunk(job->mac, job->iv, job->buf, job->length, job->chunk, d->chunk, job->gens[d->chunk], job->tags[d->chunk]);
+}
+
+static void tag_task(void* arg, uint32_t index)
+{
+  const struct tag_job* job = (const struct tag_job*)arg;
+  struct dirty d;
+
+  d.chunk = index;
+  d.range = 0;
+  tag_dirty(arg, (job->list != NULL) ? &job->list[index] : &d);
+}
+
+int aes_patch_tag(struct aes_pool* pool, const struct AES_pmac_ctx* mac, const uint8_t* iv, const uint8_t* buf,
+                  uint64_t length, uint32_t chunk, const uint64_t* gens, const struct aes_patch_range* ranges,
+                  uint32_t n, uint8_t (*tags)[AES_BLOCKLEN])
+{
+  struct tag_job job;
+  struct dirty* list;
+  uint32_t count;
+
+  if ((chunk == 0) || ((chunk % AES_BLOCKLEN) != 0))
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  job.mac = mac;
+  job.iv = iv;
+  job.buf = buf;
+  job.length = length;
+  job.chunk = chunk;
+  job.gens = gens;
+  job.list = NULL;
+  job.tags = tags;
+  if (ranges == NULL)
+  {
+    aes_pool_run(pool, tag_task, &job, (uint32_t)((length + chunk - 1) / chunk));
+    return 0;
+  }
+
+  count = touched(ranges, n, length, chunk, NULL, NULL, NULL);
+  list = (count > 1) ? (struct dirty*)malloc(count * sizeof(struct dirty)) : NULL;
+  if (list != NULL)
+  {
+    touched(ranges, n, length, chunk, list, NULL, NULL);
+    job.list = list;
+    aes_pool_run(pool, tag_task, &job, count);
+    free(list);
+  }
+  else
+  {
+    // One chunk, or no memory for the list: tag them here.
+    touched(ranges, n, length, chunk, NULL, tag_dirty, &job);
+  }
+  return 0;
+}
+
+int aes_patch_verify(const struct AES_pmac_ctx* mac, const uint8_t* iv, const uint8_t* buf, uint64_t length,
+                     uint32_t chunk, uint64_t index, uint64_t gen, const uint8_t* tag)
+{
+  uint8_t expect[AES_BLOCKLEN];
+  uint8_t diff = 0;
+  int i;
+
+  if ((chunk == 0) || ((chunk % AES_BLOCKLEN) != 0) || (index >= (length + chunk - 1) / chunk))
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  tag_chunk(mac, iv, buf, length, chunk, index, gen, expect);
+  for (i = 0; i < AES_BLOCKLEN; ++i)
+  {
+    diff |= expect[i] ^ tag[i];
+  }
+  if (diff != 0)
+  {
+    errno = EBADMSG;
+    return -1;
+  }
+  return 0;
+}
+
+#endif // #if defined(PMAC) && (PMAC == 1)
+
+#endif // #if defined(CTR) && (CTR == 1) && defined(ECB) && (ECB == 1)
@@ -0,0 +1,86 @@
+#ifndef _AES_PATCH_H_
+#define _AES_PATCH_H_
+
+// Incremental re-encryption of CTR-encrypted files.
+//
+// The file is cut into chunks of a fixed size, and every chunk carries a
+// generation number, kept by the caller in an array next to the file. The
+// keystream of chunk i in generation g starts at the counter block
+//   iv + g * 2^64 + (i * chunk) / 16        (128-bit big-endian sum)
+// so no two (generation, position) pairs share a counter block, and a new
+// file with every generation at 0 is plain CTR over the whole file,
+// AES_CTR_xcrypt_buffer() from iv.
+//
+// When a few regions of a large file change, aes_patch_ctr() takes the file
+// image (mapped, or read into memory) in which the dirty ranges hold their
+// new plaintext and all other bytes are still ciphertext. Every chunk the
+// ranges touch gets the next generation and is encrypted again whole, under
+// keystream it has never used; the other chunks are left alone. Old and new
+// ciphertext of a chunk are therefore unrelated, whoever holds both. The
+// chunks run as tasks on a thread pool (aes_mt.h). The cost is that of the
+// touched chunks, twice over (one pass to decrypt the bytes that did not
+// change, one to encrypt the chunk), so the chunk size trades the cost of
+// small writes against the size of the generation and tag arrays.
+//
+// With PMAC, the file can carry a tag per chunk instead of one for the
+// whole file, so a change only costs the tags of the chunks it touches.
+// Tag i is PMAC1 over the chunk's first counter block, a block with its
+// generation and index, and its ciphertext: that ties the tag to the file
+// (its iv), the chunk's position and its generation. Chunks cannot be moved,
+// and an old chunk with its old tag does not verify once the generation has
+// moved on. That only holds if the generations themselves cannot be rolled
+// back along with the file: keep them in trusted storage, or MAC them as a
+// whole and keep that MAC where the file's other metadata is protected.
+
+#include <stdint.h>
+#include "aes.h"
+#include "aes_mt.h"
+
+#if defined(CTR) && (CTR == 1) && defined(ECB) && (ECB == 1)
+
+struct aes_patch_range
+{
+  uint64_t offset;
+  uint64_t length;
+};
+
+// Re-encrypts every chunk of chunk bytes that the n ranges of buf touch
+// (the last chunk is short if length is not a multiple of chunk), and
+// advances its generation in gens, one entry per chunk. ctx->Iv is the
+// counter block of offset 0 in generation 0 and is left as it is. Ranges
+// are cut at length, sorted and merged in place, and the number left is
+// returned, for aes_patch_tag(). chunk must be a nonzero multiple of
+// AES_BLOCKLEN. Returns -1 with errno EINVAL for a bad chunk size, or
+// EOVERFLOW if a touched chunk has used up its generations; buf and gens
+// are untouched then. pool may be NULL.
+int aes_patch_ctr(struct aes_pool* pool, const struct AES_ctx* ctx, uint8_t* buf, uint64_t length, uint32_t chunk,
+                  struct aes_patch_range* ranges, uint32_t n, uint64_t* gens);
+
+// Encrypts or decrypts chunk index of buf in place under generation gen,
+// e.g. to read it. Returns 0, or -1 with errno EINVAL if index or chunk is
+// out of range.
+int aes_patch_xcrypt_chunk(const struct AES_ctx* ctx, uint8_t* buf, uint64_t length, uint32_t chunk, uint64_t index,
+                           uint64_t gen);
+
+#if defined(PMAC) && (PMAC == 1)
+
+// Recomputes tags[i] for every chunk i that the n ranges touch (ranges as
+// left by aes_patch_ctr(), sorted and merged), or for every chunk of the
+// file if ranges is NULL, under the generations in gens. tags holds one
+// AES_BLOCKLEN tag per chunk. iv is the counter block of offset 0. Returns
+// 0, or -1 with errno EINVAL for a bad chunk size.
+int aes_patch_tag(struct aes_pool* pool, const struct AES_pmac_ctx* mac, const uint8_t* iv, const uint8_t* buf,
+                  uint64_t length, uint32_t chunk, const uint64_t* gens, const struct aes_patch_range* ranges,
+                  uint32_t n, uint8_t (*tags)[AES_BLOCKLEN]);
+
+// Checks the tag of chunk index in generation gen, e.g. before decrypting
+// it for a read. Returns 0 if it matches, -1 if not (errno EBADMSG) or if
+// index or chunk is out of range (EINVAL).
+int aes_patch_verify(const struct AES_pmac_ctx* mac, const uint8_t* iv, const uint8_t* buf, uint64_t length,
+                     uint32_t chunk, uint64_t index, uint64_t gen, const uint8_t* tag);
+
+#endif // #if defined(PMAC) && (PMAC == 1)
+
+#endif // #if defined(CTR) && (CTR == 1) && defined(ECB) && (ECB == 1)
+
+#endif // _AES_PATCH_H_
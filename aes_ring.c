@@ -0,0 +1,357 @@
+/*
+
+Shared-memory frame ring. See aes_ring.h for the interface.
+
+Slot state is a 64-bit sequence word per slot. For ring position p the word
+reads 4p while the slot is free for the producer, 4p+1 once the frame is
+filled, 4p+2 once it is encrypted, and 4(p+slots) after the consumer has
+released it, which is the free state of the next lap. A role only ever waits
+for the one value it expects, so no locks are needed, and a full or empty
+ring shows up as a sequence word that lags behind.
+
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "aes_ring.h"
+
+#define CACHELINE 64
+#define RING_MAGIC 0x52534541u // "AESR"
+
+struct ring_shared
+{
+  uint32_t magic;
+  uint32_t slots;
+  uint32_t slot_size;
+  uint32_t flags;
+  uint64_t stride;                                   // bytes per slot
+  uint64_t map_size;
+  _Alignas(CACHELINE) _Atomic uint64_t head;         // next position to produce
+  _Alignas(CACHELINE) _Atomic uint64_t enc;          // next position to encrypt
+  _Alignas(CACHELINE) _Atomic uint64_t tail;         // next position to consume
+};
+
+struct slot
+{
+  _Alignas(CACHELINE) _Atomic uint64_t seq;
+  // The frame header starts on the next cache line so the sequence word,
+  // which all three roles poll, does not share a line with payload writes.
+  _Alignas(CACHELINE) struct aes_ring_frame frame;
+};
+
+struct aes_ring
+{
+  struct ring_shared* shm;
+  uint8_t* slots;
+  uint64_t mask;
+};
+
+static struct slot* slot_at(const struct aes_ring* ring, uint64_t pos)
+{
+  return (struct slot*)(ring->slots + (pos & ring->mask) * ring->shm->stride);
+}
+
+static struct aes_ring* attach(struct ring_shared* shm)
+{
+  struct aes_ring* ring = (struct aes_ring*)malloc(sizeof(*ring));
+  if (ring == NULL)
+  {
+    munmap(shm, shm->map_size);
+    return NULL;
+  }
+  ring->shm = shm;
+  ring->slots = (uint8_t*)shm + ((sizeof(struct ring_shared) + CACHELINE - 1) & ~(size_t)(CACHELINE - 1));
+  ring->mask = shm->slots - 1;
+  return ring;
+}
+
+/*****************************************************************************/
+/* Setup:                                                                    */
+/*****************************************************************************/
+struct aes_ring* aes_ring_create(const char* name, uint32_t slots, uint32_t slot_size, int flags)
+{
+  struct ring_shared* shm;
+  uint64_t stride, header, size, i;
+  void* map;
+  int fd = -1;
+
+  if ((slots == 0) || ((slots & (slots - 1)) != 0) || (slot_size == 0))
+  {
+    errno = EINVAL;
+    return NULL;
+  }
+  stride = (sizeof(struct slot) + slot_size + CACHELINE - 1) & ~(uint64_t)(CACHELINE - 1);
+  header = (sizeof(struct ring_shared) + CACHELINE - 1) & ~(uint64_t)(CACHELINE - 1);
+  size = header + stride * slots;
+
+  if (name == NULL)
+  {
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  }
+  else
+  {
+    fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0)
+    {
+      return NULL;
+    }
+    if (ftruncate(fd, (off_t)size) < 0)
+    {
+      const int err = errno;
+      close(fd);
+      shm_unlink(name);
+      errno = err;
+      return NULL;
+    }
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+  }
+  if (map == MAP_FAILED)
+  {
+    if (name != NULL)
+    {
+      shm_unlink(name);
+    }
+    return NULL;
+  }
+
+  shm = (struct ring_shared*)map;
+  shm->slots = slots;
+  shm->slot_size = slot_size;
+  shm->flags = (uint32_t)flags;
+  shm->stride = stride;
+  shm->map_size = size;
+  atomic_init(&shm->head, 0);
+  atomic_init(&shm->enc, 0);
+  atomic_init(&shm->tail, 0);
+  for (i = 0; i < slots; ++i)
+  {
+    atomic_init(&((struct slot*)((uint8_t*)map + header + i * stride))->seq, 4 * i);
+  }
+  // Openers check the magic last, once everything else is in place.
+  atomic_thread_fence(memory_order_release);
+  shm->magic = RING_MAGIC;
+
+  return attach(shm);
+}
+
+struct aes_ring* aes_ring_open(const char* name)
+{
+  struct ring_shared* shm;
+  uint64_t size;
+  void* map;
+  int fd;
+
+  fd = shm_open(name, O_RDWR, 0);
+  if (fd < 0)
+  {
+    return NULL;
+  }
+  map = mmap(NULL, sizeof(struct ring_shared), PROT_READ, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED)
+  {
+    close(fd);
+    return NULL;
+  }
+  shm = (struct ring_shared*)map;
+  if (shm->magic != RING_MAGIC)
+  {
+    munmap(map, sizeof(struct ring_shared));
+    close(fd);
+    errno = EAGAIN;
+    return NULL;
+  }
+  size = shm->map_size;
+  munmap(map, sizeof(struct ring_shared));
+
+  map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+  {
+    return NULL;
+  }
+  return attach((struct ring_shared*)map);
+}
+
+void aes_ring_close(struct aes_ring* ring)
+{
+  munmap(ring->shm, ring->shm->map_size);
+  free(ring);
+}
+
+int aes_ring_unlink(const char* name)
+{
+  return shm_unlink(name);
+}
+
+uint32_t aes_ring_slot_size(const struct aes_ring* ring)
+{
+  return ring->shm->slot_size;
+}
+
+/*****************************************************************************/
+/* Producer:                                                                 */
+/*****************************************************************************/
+struct aes_ring_frame* aes_ring_produce_begin(struct aes_ring* ring, uint64_t* pos)
+{
+  uint64_t p = atomic_load_explicit(&ring->shm->head, memory_order_relaxed);
+
+  for (;;)
+  {
+    struct slot* s = slot_at(ring, p);
+    const uint64_t seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+
+    if (seq < 4 * p)
+    {
+      return NULL; // the consumer has not released this slot yet: full
+    }
+    if (seq == 4 * p)
+    {
+      if (!(ring->shm->flags & AES_RING_MPSC))
+      {
+        atomic_store_explicit(&ring->shm->head, p + 1, memory_order_relaxed);
+        *pos = p;
+        return &s->frame;
+      }
+      if (atomic_compare_exchange_weak_explicit(&ring->shm->head, &p, p + 1,
+                                                memory_order_relaxed, memory_order_relaxed))
+      {
+        *pos = p;
+        return &s->frame;
+      }
+      continue; // p was reloaded by the failed exchange
+    }
+    // Another producer claimed p already.
+    p = atomic_load_explicit(&ring->shm->head, memory_order_relaxed);
+  }
+}
+
+void aes_ring_produce_commit(struct aes_ring* ring, uint64_t pos, uint32_t length)
+{
+  struct slot* s = slot_at(ring, pos);
+  s->frame.length = (length < ring->shm->slot_size) ? length : ring->shm->slot_size;
+  atomic_store_explicit(&s->seq, 4 * pos + 1, memory_order_release);
+}
+
+/*****************************************************************************/
+/* Encryptor:                                                                */
+/*****************************************************************************/
+uint32_t aes_ring_process(struct aes_ring* ring, aes_ring_fn fn, void* arg, uint32_t max_frames)
+{
+  uint64_t p = atomic_load_explicit(&ring->shm->enc, memory_order_relaxed);
+  uint32_t n;
+
+  for (n = 0; n < max_frames; ++n, ++p)
+  {
+    struct slot* s = slot_at(ring, p);
+    if (atomic_load_explicit(&s->seq, memory_order_acquire) != 4 * p + 1)
+    {
+      break;
+    }
+    // The length is written by the producer, which may be another process:
+    // never let it reach past the slot.
+    if (s->frame.length > ring->shm->slot_size)
+    {
+      s->frame.length = ring->shm->slot_size;
+    }
+    fn(arg, &s->frame);
+    atomic_store_explicit(&s->seq, 4 * p + 2, memory_order_release);
+  }
+  atomic_store_explicit(&ring->shm->enc, p, memory_order_relaxed);
+  return n;
+}
+
+struct ctr_job
+{
+  struct AES_ctx* ctx;
+  uint32_t slot_size;
+};
+
+static void encrypt_ctr(void* arg, struct aes_ring_frame* frame)
+{
+  const struct ctr_job* job = (const struct ctr_job*)arg;
+  // Read the length once: a producer that rewrites it now must not make the
+  // encryption run past the slot.
+  uint32_t length = *(volatile uint32_t*)&frame->length;
+
+  length = (length < job->slot_size) ? length : job->slot_size;
+  memcpy(frame->iv, job->ctx->Iv, AES_BLOCKLEN);
+  AES_CTR_xcrypt_buffer(job->ctx, frame->data, length);
+}
+
+uint32_t aes_ring_encrypt_ctr(struct aes_ring* ring, struct AES_ctx* ctx, uint32_t max_frames)
+{
+  struct ctr_job job;
+  job.ctx = ctx;
+  job.slot_size = ring->shm->slot_size;
+  return aes_ring_process(ring, encrypt_ctr, &job, max_frames);
+}
+
+#if defined(GCM) && (GCM == 1)
+
+struct gcm_job
+{
+  const struct AES_gcm_ctx* ctx;
+  uint8_t* nonce;
+  uint32_t slot_size;
+};
+
+static void encrypt_gcm(void* arg, struct aes_ring_frame* frame)
+{
+  const struct gcm_job* job = (const struct gcm_job*)arg;
+  uint32_t length = *(volatile uint32_t*)&frame->length;
+  int i;
+
+  length = (length < job->slot_size) ? length : job->slot_size;
+  memcpy(frame->iv, job->nonce, AES_RING_NONCELEN);
+  memset(frame->iv + AES_RING_NONCELEN, 0, AES_BLOCKLEN - AES_RING_NONCELEN);
+  AES_GCM_encrypt(job->ctx, frame->iv, AES_RING_NONCELEN, NULL, 0, frame->data, length, frame->tag, AES_BLOCKLEN);
+  for (i = AES_RING_NONCELEN - 1; i >= 0; --i)
+  {
+    if (++job->nonce[i] != 0)
+    {
+      break;
+    }
+  }
+}
+
+uint32_t aes_ring_encrypt_gcm(struct aes_ring* ring, const struct AES_gcm_ctx* ctx, uint8_t* nonce, uint32_t max_frames)
+{
+  struct gcm_job job;
+  job.ctx = ctx;
+  job.nonce = nonce;
+  job.slot_size = ring->shm->slot_size;
+  return aes_ring_process(ring, encrypt_gcm, &job, max_frames);
+}
+
+#endif // #if defined(GCM) && (GCM == 1)
+
+/*****************************************************************************/
+/* Consumer:                                                                 */
+/*****************************************************************************/
+struct aes_ring_frame* aes_ring_consume_begin(struct aes_ring* ring, uint64_t* pos)
+{
+  const uint64_t p = atomic_load_explicit(&ring->shm->tail, memory_order_relaxed);
+  struct slot* s = slot_at(ring, p);
+
+  if (atomic_load_explicit(&s->seq, memory_order_acquire) != 4 * p + 2)
+  {
+    return NULL;
+  }
+  *pos = p;
+  return &s->frame;
+}
+
+void aes_ring_consume_commit(struct aes_ring* ring, uint64_t pos)
+{
+  struct slot* s = slot_at(ring, pos);
+  atomic_store_explicit(&ring->shm->tail, pos + 1, memory_order_relaxed);
+  atomic_store_explicit(&s->seq, 4 * (pos + ring->shm->slots), memory_order_release);
+}
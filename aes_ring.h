@@ -0,0 +1,86 @@
+#ifndef _AES_RING_H_
+#define _AES_RING_H_
+
+// Shared-memory frame ring for a producer -> encryptor -> consumer chain.
+//
+// Frames are written once by the producer, encrypted in place by the
+// encryptor and read in place by the consumer, so a frame is never copied
+// between processes. Each slot carries a sequence word that moves through
+// three states per lap (filled, encrypted, free). Head, encrypt and tail
+// positions sit on their own cache lines. All indices are lock-free C11
+// atomics, so any of the three roles may live in a different process.
+//
+// Producers may be single (SPSC, the default) or multiple (AES_RING_MPSC).
+// The encryptor and the consumer are single.
+//
+// All calls are non-blocking: begin functions return NULL when there is
+// nothing to do (ring full / empty), and the caller decides how to wait.
+//
+// Frames can be encrypted with plain CTR or, with GCM enabled, sealed with
+// a tag each, so that the consumer can tell a frame that was changed in
+// the shared memory after it was encrypted.
+
+#include <stddef.h>
+#include <stdint.h>
+#include "aes.h"
+
+#define AES_RING_MPSC 1  // flag for aes_ring_create(): allow concurrent producers
+
+struct aes_ring_frame
+{
+  uint32_t length;              // payload bytes in data[]
+  uint32_t flags;               // free for application use
+  uint8_t iv[AES_BLOCKLEN];     // CTR: counter block the payload was encrypted from; GCM: nonce
+  uint8_t tag[AES_BLOCKLEN];    // GCM tag; not written by the CTR encryptor
+  uint8_t data[];
+};
+
+struct aes_ring;
+
+// Creates a ring with slots frames of up to slot_size payload bytes each.
+// slots must be a power of two. name is a POSIX shm name ("/frames"); with
+// name == NULL the ring is anonymous and is shared only with fork()ed
+// children. Returns NULL on failure (errno is set).
+struct aes_ring* aes_ring_create(const char* name, uint32_t slots, uint32_t slot_size, int flags);
+struct aes_ring* aes_ring_open(const char* name);
+void aes_ring_close(struct aes_ring* ring);
+int aes_ring_unlink(const char* name);
+
+uint32_t aes_ring_slot_size(const struct aes_ring* ring);
+
+// Producer: reserve a slot, fill frame->data, then commit with its length.
+// A length above the slot size is cut to it, here and again before the frame
+// is processed.
+struct aes_ring_frame* aes_ring_produce_begin(struct aes_ring* ring, uint64_t* pos);
+void aes_ring_produce_commit(struct aes_ring* ring, uint64_t pos, uint32_t length);
+
+// Encryptor: runs fn on up to max_frames filled frames in order and marks
+// them ready for the consumer. Returns the number of frames processed.
+typedef void (*aes_ring_fn)(void* arg, struct aes_ring_frame* frame);
+uint32_t aes_ring_process(struct aes_ring* ring, aes_ring_fn fn, void* arg, uint32_t max_frames);
+
+// CTR encryptor: frame->iv receives the counter the frame starts at and the
+// payload is encrypted in place. ctx->Iv advances over the frame, so frames
+// use disjoint counter ranges. Decrypt by running AES_CTR_xcrypt_buffer()
+// from frame->iv.
+uint32_t aes_ring_encrypt_ctr(struct aes_ring* ring, struct AES_ctx* ctx, uint32_t max_frames);
+
+#if defined(GCM) && (GCM == 1)
+
+#define AES_RING_NONCELEN 12
+
+// GCM encryptor: frame->iv receives the 12-byte nonce of the frame (its last
+// four bytes are zero), the payload is encrypted in place and the 16-byte
+// tag goes to frame->tag. nonce is a 96-bit big-endian counter that advances
+// by one per frame; it must never repeat for the key, across runs too.
+// Open a frame with AES_GCM_decrypt(ctx, frame->iv, AES_RING_NONCELEN,
+// NULL, 0, frame->data, frame->length, frame->tag, AES_BLOCKLEN).
+uint32_t aes_ring_encrypt_gcm(struct aes_ring* ring, const struct AES_gcm_ctx* ctx, uint8_t* nonce, uint32_t max_frames);
+
+#endif // #if defined(GCM) && (GCM == 1)
+
+// Consumer: look at the next encrypted frame in place, then release it.
+struct aes_ring_frame* aes_ring_consume_begin(struct aes_ring* ring, uint64_t* pos);
+void aes_ring_consume_commit(struct aes_ring* ring, uint64_t pos);
+
+#endif // _AES_RING_H_
@@ -0,0 +1,271 @@
+/*
+
+Time-budgeted encryption for real-time loops.
+
+See aes_rt.h for the interface.
+
+*/
+
+
+/*****************************************************************************/
+/* Includes:                                                                 */
+/*****************************************************************************/
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include "aes_rt.h"
+
+// Blocks timed by AES_RT_calibrate(), best of CALIBRATE_RUNS.
+#define CALIBRATE_BLOCKS 64
+#define CALIBRATE_RUNS 3
+
+#define MODES (AES_RT_CTR + 1)
+
+/*****************************************************************************/
+/* Private variables:                                                        */
+/*****************************************************************************/
+// Per mode: where new operations start their estimate, 0 until something
+// measured it, and the cost AES_RT_calibrate() measured, which estimates
+// are not decayed below.
+static _Atomic uint32_t default_block_ns[MODES];
+static _Atomic uint32_t calibrated_ns[MODES];
+// The cost of reading the clock, which every batch pays once.
+static _Atomic uint32_t clock_cost_ns;
+
+/*****************************************************************************/
+/* Private functions:                                                        */
+/*****************************************************************************/
+static uint64_t default_clock(void)
+{
+#if defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#else
+  return (uint64_t)clock() * (1000000000u / CLOCKS_PER_SEC);
+#endif
+}
+
+static uint64_t (*clock_ns)(void) = default_clock;
+
+// Folds the cost of a batch of n blocks into the estimate. A batch that was
+// preempted says nothing about the next one, so one batch can move the
+// estimate up by a quarter at most.
+static void learn(struct AES_rt_op* op, uint64_t ns, uint64_t n)
+{
+  uint64_t per_block = ns / n;
+
+  if (per_block > 2 * (uint64_t)op->block_ns)
+  {
+    per_block = 2 * (uint64_t)op->block_ns;
+  }
+  op->block_ns = (uint32_t)((3 * (uint64_t)op->block_ns + per_block + 3) / 4);
+}
+
+static int mode_built(uint8_t mode)
+{
+  switch (mode)
+  {
+#if defined(ECB) && (ECB == 1)
+  case AES_RT_ECB_ENCRYPT:
+  case AES_RT_ECB_DECRYPT:
+    return 1;
+#endif
+#if defined(CBC) && (CBC == 1)
+  case AES_RT_CBC_ENCRYPT:
+  case AES_RT_CBC_DECRYPT:
+    return 1;
+#endif
+#if defined(CTR) && (CTR == 1)
+  case AES_RT_CTR:
+    return 1;
+#endif
+  default:
+    return 0;
+  }
+}
+
+// Processes the next n blocks, or what is left of the buffer. The buffer
+// functions keep the chaining block or counter in ctx->Iv between calls,
+// so whole-block pieces chain as one call would.
+static void run(struct AES_rt_op* op, uint32_t n)
+{
+  const uint32_t left = op->length - op->done;
+  const uint32_t bytes = ((uint64_t)n * AES_BLOCKLEN < left) ? n * AES_BLOCKLEN : left;
+  uint8_t* p = op->buf + op->done;
+
+  switch (op->mode)
+  {
+#if defined(ECB) && (ECB == 1)
+  case AES_RT_ECB_ENCRYPT:
+  case AES_RT_ECB_DECRYPT:
+  {
+    uint32_t i;
+    for (i = 0; i < bytes; i += AES_BLOCKLEN)
+    {
+      if (op->mode == AES_RT_ECB_ENCRYPT)
+      {
+        AES_ECB_encrypt(op->ctx, p + i);
+      }
+      else
+      {
+        AES_ECB_decrypt(op->ctx, p + i);
+      }
+    }
+    break;
+  }
+#endif
+#if defined(CBC) && (CBC == 1)
+  case AES_RT_CBC_ENCRYPT:
+    AES_CBC_encrypt_buffer(op->ctx, p, bytes);
+    break;
+  case AES_RT_CBC_DECRYPT:
+    AES_CBC_decrypt_buffer(op->ctx, p, bytes);
+    break;
+#endif
+#if defined(CTR) && (CTR == 1)
+  case AES_RT_CTR:
+    AES_CTR_xcrypt_buffer_width(op->ctx, p, bytes, op->counter_bits);
+    break;
+#endif
+  default:
+    break;
+  }
+  op->done += bytes;
+}
+
+// Times CALIBRATE_BLOCKS blocks of mode on scratch data, best of
+// CALIBRATE_RUNS, and the clock read itself. Returns the cost of a block.
+static uint32_t calibrate(uint8_t mode)
+{
+  static const uint8_t key[AES_KEYLEN] = { 0 };
+  uint8_t buf[CALIBRATE_BLOCKS * AES_BLOCKLEN];
+  struct AES_rt_op op;
+  struct AES_ctx ctx;
+  uint64_t t0, t, best = UINT64_MAX, read = UINT64_MAX;
+  int r;
+
+  memset(&ctx, 0, sizeof(ctx));
+  AES_init_ctx(&ctx, key);
+  memset(buf, 0, sizeof(buf));
+  memset(&op, 0, sizeof(op));
+  op.ctx = &ctx;
+  op.buf = buf;
+  op.length = sizeof(buf);
+  op.mode = mode;
+  op.counter_bits = 128;
+  for (r = 0; r < CALIBRATE_RUNS; ++r)
+  {
+    op.done = 0;
+    t0 = clock_ns();
+    run(&op, CALIBRATE_BLOCKS);
+    t = clock_ns();
+    best = (t - t0 < best) ? t - t0 : best;
+    read = (clock_ns() - t < read) ? clock_ns() - t : read;
+  }
+  best = (best / CALIBRATE_BLOCKS > 0) ? best / CALIBRATE_BLOCKS : 1;
+  atomic_store_explicit(&default_block_ns[mode], (uint32_t)best, memory_order_relaxed);
+  atomic_store_explicit(&calibrated_ns[mode], (uint32_t)best, memory_order_relaxed);
+  atomic_store_explicit(&clock_cost_ns, (uint32_t)read, memory_order_relaxed);
+  return (uint32_t)best;
+}
+
+/*****************************************************************************/
+/* Public functions:                                                         */
+/*****************************************************************************/
+int AES_RT_start(struct AES_rt_op* op, struct AES_ctx* ctx, enum AES_RT_mode mode, uint8_t* buf, uint32_t length)
+{
+  if (!mode_built((uint8_t)mode))
+  {
+    return -1;
+  }
+  op->ctx = ctx;
+  op->buf = buf;
+  op->length = length;
+  op->done = 0;
+  op->block_ns = atomic_load_explicit(&default_block_ns[mode], memory_order_relaxed);
+  if (op->block_ns == 0)
+  {
+    // Nothing measured for this mode yet: measure it here rather than run
+    // blind inside a budget.
+    op->block_ns = calibrate((uint8_t)mode);
+  }
+  op->floor_ns = atomic_load_explicit(&calibrated_ns[mode], memory_order_relaxed);
+  op->mode = (uint8_t)mode;
+  op->counter_bits = 128;
+  return 0;
+}
+
+int AES_RT_start_ctr_width(struct AES_rt_op* op, struct AES_ctx* ctx, uint8_t* buf, uint32_t length, uint8_t counter_bits)
+{
+  if (AES_RT_start(op, ctx, AES_RT_CTR, buf, length) != 0)
+  {
+    return -1;
+  }
+  op->counter_bits = counter_bits;
+  return 0;
+}
+
+uint32_t AES_RT_step(struct AES_rt_op* op, uint32_t max_blocks, uint32_t budget_ns)
+{
+  const uint32_t start = op->done;
+  const uint32_t read = atomic_load_explicit(&clock_cost_ns, memory_order_relaxed);
+  uint32_t blocks = (op->length - op->done + AES_BLOCKLEN - 1) / AES_BLOCKLEN;
+  uint64_t t0, t, before, elapsed, n;
+
+  if ((max_blocks != 0) && (max_blocks < blocks))
+  {
+    blocks = max_blocks;
+  }
+  if (budget_ns == 0)
+  {
+    run(op, blocks);
+    return op->done - start;
+  }
+
+  t0 = t = clock_ns();
+  while (blocks > 0)
+  {
+    // A batch costs its blocks and the clock read after it; a block that
+    // is not predicted to fit in what is left, with an eighth to spare for
+    // jitter, is not started.
+    elapsed = t - t0 + read;
+    if (elapsed + op->block_ns + op->block_ns / 8 > budget_ns)
+    {
+      break;
+    }
+    // Half the predicted room, so that the last batches are small ones.
+    n = (budget_ns - elapsed) / op->block_ns / 2;
+    n = (n == 0) ? 1 : ((n < blocks) ? n : blocks);
+    before = t;
+    run(op, (uint32_t)n);
+    t = clock_ns();
+    learn(op, t - before, n);
+    blocks -= (uint32_t)n;
+  }
+  if ((op->done == start) && (blocks > 0))
+  {
+    // Nothing fit. If that was the estimate's fault (it grew in a slow
+    // spell), it has to come down without blocks to measure, but never
+    // below what the mode was calibrated at.
+    op->block_ns -= op->block_ns / 8;
+    op->block_ns = (op->block_ns > op->floor_ns) ? op->block_ns : op->floor_ns;
+  }
+  atomic_store_explicit(&default_block_ns[op->mode], op->block_ns, memory_order_relaxed);
+  return op->done - start;
+}
+
+int AES_RT_finished(const struct AES_rt_op* op)
+{
+  return op->done == op->length;
+}
+
+uint32_t AES_RT_calibrate(enum AES_RT_mode mode)
+{
+  return mode_built((uint8_t)mode) ? calibrate((uint8_t)mode) : 0;
+}
+
+void AES_RT_set_clock(uint64_t (*fn)(void))
+{
+  clock_ns = (fn != NULL) ? fn : default_clock;
+}
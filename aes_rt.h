@@ -0,0 +1,79 @@
+#ifndef _AES_RT_H_
+#define _AES_RT_H_
+
+#include <stdint.h>
+#include "aes.h"
+
+// Time-budgeted encryption for real-time loops.
+//
+// The aes.h buffer functions run to completion however long the buffer is.
+// An AES_rt_op instead holds a buffer operation in progress: each call of
+// AES_RT_step() does as many blocks as fit in its budget and returns, and
+// the next call carries on where it stopped, with the mode state (the CBC
+// chaining block, the CTR counter) kept in the context as it would be after
+// one call over the whole buffer. A long message can so be spread over
+// many ticks of a control loop; the result is the same as one call.
+//
+// The time budget is kept by prediction rather than by interruption: the
+// step keeps a running estimate of the cost of one block and only starts
+// a batch of blocks if the estimate says it will finish in the time left.
+// Batches take half of the predicted room each, so the clock is read a few
+// times per step and a wrong estimate costs at most a small batch. The
+// estimate is kept per mode. The first AES_RT_start() of a mode measures
+// it; call AES_RT_calibrate() outside the loop to do that ahead of time.
+//
+// The context and the buffer belong to the operation until it is done.
+// ECB and CBC buffers must be a multiple of AES_BLOCKLEN, as in aes.h.
+
+enum AES_RT_mode
+{
+  AES_RT_ECB_ENCRYPT = 0,
+  AES_RT_ECB_DECRYPT,
+  AES_RT_CBC_ENCRYPT,
+  AES_RT_CBC_DECRYPT,
+  AES_RT_CTR
+};
+
+struct AES_rt_op
+{
+  struct AES_ctx* ctx;
+  uint8_t* buf;
+  uint32_t length;
+  uint32_t done;           // bytes processed so far
+  uint32_t block_ns;       // estimated cost of one block
+  uint32_t floor_ns;       // calibrated cost of a block in this mode
+  uint8_t mode;
+  uint8_t counter_bits;    // CTR: width of the counter field, as in aes.h
+};
+
+// Starts an operation on length bytes of buf; the context must be set up
+// with AES_init_ctx_iv() for CBC and CTR. Returns -1 if the mode is not
+// built into this library. Calibrates the mode first if nothing measured
+// it yet.
+int AES_RT_start(struct AES_rt_op* op, struct AES_ctx* ctx, enum AES_RT_mode mode, uint8_t* buf, uint32_t length);
+
+// CTR with a counter field of counter_bits (see AES_CTR_xcrypt_buffer_width()).
+int AES_RT_start_ctr_width(struct AES_rt_op* op, struct AES_ctx* ctx, uint8_t* buf, uint32_t length, uint8_t counter_bits);
+
+// Processes up to max_blocks blocks (0: no limit), stopping before the
+// next batch would overrun budget_ns nanoseconds since the call (0: no time
+// limit); no block is started that the estimate says would not finish in
+// the time left. Returns the number of bytes processed by this call, which
+// can be 0 if the budget does not fit a single block. After such a call the
+// estimate is lowered a little, but not below the calibrated cost.
+uint32_t AES_RT_step(struct AES_rt_op* op, uint32_t max_blocks, uint32_t budget_ns);
+
+// Nonzero once the whole buffer is processed.
+int AES_RT_finished(const struct AES_rt_op* op);
+
+// Measures the cost of a block of mode on this host and makes it the
+// estimate new operations of that mode start from. Returns it in
+// nanoseconds, or 0 if the mode is not built into this library.
+uint32_t AES_RT_calibrate(enum AES_RT_mode mode);
+
+// The clock used for budgets, in nanoseconds; CLOCK_MONOTONIC by default.
+// Targets without clock_gettime() set theirs (a cycle counter, say) before
+// the first step.
+void AES_RT_set_clock(uint64_t (*clock_ns)(void));
+
+#endif // _AES_RT_H_
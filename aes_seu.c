@@ -0,0 +1,441 @@
+/*
+
+SEU hardening for AES contexts: TMR-protected key schedules.
+
+See aes_seu.h for the interface.
+
+*/
+
+
+/*****************************************************************************/
+/* Includes:                                                                 */
+/*****************************************************************************/
+#include <string.h>
+#include "aes_seu.h"
+
+#if !defined(ECB) || (ECB == 0)
+  #error "aes_seu.c needs ECB=1 for its block-level checks"
+#endif
+
+// Retries before AES_SEU_CED gives up on a block.
+#define CED_ATTEMPTS 3
+
+/*****************************************************************************/
+/* Private functions:                                                        */
+/*****************************************************************************/
+static uint32_t popcount8(uint8_t x)
+{
+  uint32_t n = 0;
+  while (x)
+  {
+    x &= (uint8_t)(x - 1);
+    ++n;
+  }
+  return n;
+}
+
+// Fletcher-style sum over the 32-bit words of the schedule. Any single bit
+// flip changes the low half, which is all the checksum level relies on.
+static uint64_t schedule_sum(const uint8_t* rk)
+{
+  uint32_t a = 0, b = 0;
+  unsigned i;
+  for (i = 0; i < AES_keyExpSize; i += 4)
+  {
+    a += (uint32_t)rk[i] | ((uint32_t)rk[i + 1] << 8) | ((uint32_t)rk[i + 2] << 16) | ((uint32_t)rk[i + 3] << 24);
+    b += a;
+  }
+  return ((uint64_t)b << 32) | a;
+}
+
+static void ctr_increment(uint8_t* ctr)
+{
+  int bi;
+  for (bi = (AES_BLOCKLEN - 1); bi >= 0; --bi)
+  {
+    if (ctr[bi] == 255)
+    {
+      ctr[bi] = 0;
+      continue;
+    }
+    ctr[bi] += 1;
+    break;
+  }
+}
+
+static void note_fault(struct AES_seu_ctx* ctx)
+{
+  atomic_fetch_add_explicit(&ctx->detected, 1, memory_order_relaxed);
+}
+
+// Brings the key schedule in copy[0] up to what the level asks for.
+static void prepare(struct AES_seu_ctx* ctx, int level)
+{
+  switch (level)
+  {
+  case AES_SEU_PLAIN:
+    break;
+  case AES_SEU_CHECKSUM:
+    if (schedule_sum(ctx->copy[0].RoundKey) != ctx->sum)
+    {
+      // Either the schedule or the stored sum took the hit; the vote decides.
+      AES_SEU_scrub(ctx);
+      ctx->sum = schedule_sum(ctx->copy[0].RoundKey);
+    }
+    break;
+  default:
+    AES_SEU_scrub(ctx);
+    break;
+  }
+}
+
+// CED for one block: encrypt with copy[0], check by decrypting with copy[1].
+// The inverse check runs different code than the encryption, so a fault in
+// either path shows up as a mismatch.
+static int ced_encrypt(struct AES_seu_ctx* ctx, uint8_t* buf)
+{
+  uint8_t in[AES_BLOCKLEN], check[AES_BLOCKLEN];
+  int attempt;
+
+  memcpy(in, buf, AES_BLOCKLEN);
+  for (attempt = 0; attempt < CED_ATTEMPTS; ++attempt)
+  {
+    AES_ECB_encrypt(&ctx->copy[0], buf);
+    memcpy(check, buf, AES_BLOCKLEN);
+    AES_ECB_decrypt(&ctx->copy[1], check);
+    if (memcmp(check, in, AES_BLOCKLEN) == 0)
+    {
+      return 0;
+    }
+    note_fault(ctx);
+    AES_SEU_scrub(ctx);
+    memcpy(buf, in, AES_BLOCKLEN);
+  }
+  return -1;
+}
+
+static int ced_decrypt(struct AES_seu_ctx* ctx, uint8_t* buf)
+{
+  uint8_t in[AES_BLOCKLEN], check[AES_BLOCKLEN];
+  int attempt;
+
+  memcpy(in, buf, AES_BLOCKLEN);
+  for (attempt = 0; attempt < CED_ATTEMPTS; ++attempt)
+  {
+    AES_ECB_decrypt(&ctx->copy[0], buf);
+    memcpy(check, buf, AES_BLOCKLEN);
+    AES_ECB_encrypt(&ctx->copy[1], check);
+    if (memcmp(check, in, AES_BLOCKLEN) == 0)
+    {
+      return 0;
+    }
+    note_fault(ctx);
+    AES_SEU_scrub(ctx);
+    memcpy(buf, in, AES_BLOCKLEN);
+  }
+  return -1;
+}
+
+// CED for one keystream block: the counter is encrypted with two copies.
+static int ced_keystream(struct AES_seu_ctx* ctx, const uint8_t* ctr, uint8_t* ks)
+{
+  uint8_t check[AES_BLOCKLEN];
+  int attempt;
+
+  for (attempt = 0; attempt < CED_ATTEMPTS; ++attempt)
+  {
+    memcpy(ks, ctr, AES_BLOCKLEN);
+    AES_ECB_encrypt(&ctx->copy[0], ks);
+    memcpy(check, ctr, AES_BLOCKLEN);
+    AES_ECB_encrypt(&ctx->copy[1], check);
+    if (memcmp(check, ks, AES_BLOCKLEN) == 0)
+    {
+      return 0;
+    }
+    note_fault(ctx);
+    AES_SEU_scrub(ctx);
+  }
+  return -1;
+}
+
+/*****************************************************************************/
+/* Public functions:                                                         */
+/*****************************************************************************/
+void AES_SEU_init_ctx(struct AES_seu_ctx* ctx, const uint8_t* key)
+{
+  // Expand once and replicate, so all copies start out identical even if
+  // the expansion itself were to be disturbed.
+  AES_init_ctx(&ctx->copy[0], key);
+  memcpy(&ctx->copy[1], &ctx->copy[0], sizeof(struct AES_ctx));
+  memcpy(&ctx->copy[2], &ctx->copy[0], sizeof(struct AES_ctx));
+  ctx->sum = schedule_sum(ctx->copy[0].RoundKey);
+  atomic_init(&ctx->level, AES_SEU_TMR);
+  atomic_init(&ctx->detected, 0);
+  atomic_init(&ctx->corrected, 0);
+}
+
+void AES_SEU_ctx_set_iv(struct AES_seu_ctx* ctx, const uint8_t* iv)
+{
+  AES_ctx_set_iv(&ctx->copy[0], iv);
+  AES_ctx_set_iv(&ctx->copy[1], iv);
+  AES_ctx_set_iv(&ctx->copy[2], iv);
+}
+
+void AES_SEU_set_level(struct AES_seu_ctx* ctx, int level)
+{
+  atomic_store_explicit(&ctx->level, level, memory_order_release);
+}
+
+int AES_SEU_get_level(const struct AES_seu_ctx* ctx)
+{
+  return atomic_load_explicit(&((struct AES_seu_ctx*)ctx)->level, memory_order_acquire);
+}
+
+uint32_t AES_SEU_scrub(struct AES_seu_ctx* ctx)
+{
+  uint8_t* a = ctx->copy[0].RoundKey;
+  uint8_t* b = ctx->copy[1].RoundKey;
+  uint8_t* c = ctx->copy[2].RoundKey;
+  uint32_t repaired = 0;
+  unsigned i;
+
+  for (i = 0; i < AES_keyExpSize; ++i)
+  {
+    // Fast path: all copies agree.
+    if ((a[i] == b[i]) && (b[i] == c[i]))
+    {
+      continue;
+    }
+    {
+      const uint8_t m = (uint8_t)((a[i] & b[i]) | (a[i] & c[i]) | (b[i] & c[i]));
+      repaired += popcount8(a[i] ^ m) + popcount8(b[i] ^ m) + popcount8(c[i] ^ m);
+      a[i] = m;
+      b[i] = m;
+      c[i] = m;
+    }
+  }
+
+  if (repaired != 0)
+  {
+    note_fault(ctx);
+    atomic_fetch_add_explicit(&ctx->corrected, repaired, memory_order_relaxed);
+  }
+  return repaired;
+}
+
+void AES_SEU_wipe(struct AES_seu_ctx* ctx)
+{
+  volatile uint8_t* p = (volatile uint8_t*)ctx->copy;
+  size_t i;
+  for (i = 0; i < sizeof(ctx->copy); ++i)
+  {
+    p[i] = 0;
+  }
+  ctx->sum = 0;
+}
+
+int AES_SEU_ECB_encrypt(struct AES_seu_ctx* ctx, uint8_t* buf)
+{
+  const int level = AES_SEU_get_level(ctx);
+  prepare(ctx, level);
+  if (level == AES_SEU_CED)
+  {
+    return ced_encrypt(ctx, buf);
+  }
+  AES_ECB_encrypt(&ctx->copy[0], buf);
+  return 0;
+}
+
+int AES_SEU_ECB_decrypt(struct AES_seu_ctx* ctx, uint8_t* buf)
+{
+  const int level = AES_SEU_get_level(ctx);
+  prepare(ctx, level);
+  if (level == AES_SEU_CED)
+  {
+    return ced_decrypt(ctx, buf);
+  }
+  AES_ECB_decrypt(&ctx->copy[0], buf);
+  return 0;
+}
+
+#if defined(CBC) && (CBC == 1)
+int AES_SEU_CBC_encrypt_buffer(struct AES_seu_ctx* ctx, uint8_t* buf, uint32_t length)
+{
+  const int level = AES_SEU_get_level(ctx);
+  uint8_t* Iv = ctx->copy[0].Iv;
+  uint32_t i, j;
+
+  prepare(ctx, level);
+  if (level != AES_SEU_CED)
+  {
+    AES_CBC_encrypt_buffer(&ctx->copy[0], buf, length);
+    return 0;
+  }
+  for (i = 0; i < length; i += AES_BLOCKLEN)
+  {
+    for (j = 0; j < AES_BLOCKLEN; ++j)
+    {
+      buf[i + j] ^= Iv[j];
+    }
+    if (ced_encrypt(ctx, buf + i) < 0)
+    {
+      return -1;
+    }
+    Iv = buf + i;
+  }
+  memcpy(ctx->copy[0].Iv, Iv, AES_BLOCKLEN);
+  return 0;
+}
+
+int AES_SEU_CBC_decrypt_buffer(struct AES_seu_ctx* ctx, uint8_t* buf, uint32_t length)
+{
+  const int level = AES_SEU_get_level(ctx);
+  uint8_t storeNextIv[AES_BLOCKLEN];
+  uint32_t i, j;
+
+  prepare(ctx, level);
+  if (level != AES_SEU_CED)
+  {
+    AES_CBC_decrypt_buffer(&ctx->copy[0], buf, length);
+    return 0;
+  }
+  for (i = 0; i < length; i += AES_BLOCKLEN)
+  {
+    memcpy(storeNextIv, buf + i, AES_BLOCKLEN);
+    if (ced_decrypt(ctx, buf + i) < 0)
+    {
+      return -1;
+    }
+    for (j = 0; j < AES_BLOCKLEN; ++j)
+    {
+      buf[i + j] ^= ctx->copy[0].Iv[j];
+    }
+    memcpy(ctx->copy[0].Iv, storeNextIv, AES_BLOCKLEN);
+  }
+  return 0;
+}
+#endif // #if defined(CBC) && (CBC == 1)
+
+#if defined(CTR) && (CTR == 1)
+int AES_SEU_CTR_xcrypt_buffer(struct AES_seu_ctx* ctx, uint8_t* buf, uint32_t length)
+{
+  const int level = AES_SEU_get_level(ctx);
+  uint8_t ks[AES_BLOCKLEN];
+  uint32_t i, j;
+
+  prepare(ctx, level);
+  if (level != AES_SEU_CED)
+  {
+    AES_CTR_xcrypt_buffer(&ctx->copy[0], buf, length);
+    return 0;
+  }
+  for (i = 0; i < length; i += AES_BLOCKLEN)
+  {
+    if (ced_keystream(ctx, ctx->copy[0].Iv, ks) < 0)
+    {
+      return -1;
+    }
+    ctr_increment(ctx->copy[0].Iv);
+    for (j = 0; (j < AES_BLOCKLEN) && (i + j < length); ++j)
+    {
+      buf[i + j] ^= ks[j];
+    }
+  }
+  return 0;
+}
+#endif // #if defined(CTR) && (CTR == 1)
+
+/*****************************************************************************/
+/* Controller:                                                               */
+/*****************************************************************************/
+static uint64_t event_total(struct AES_seu_ctx* const* ctxs, unsigned n)
+{
+  uint64_t total = 0;
+  unsigned i;
+  for (i = 0; i < n; ++i)
+  {
+    total += atomic_load_explicit(&ctxs[i]->detected, memory_order_relaxed);
+    total += atomic_load_explicit(&ctxs[i]->corrected, memory_order_relaxed);
+  }
+  return total;
+}
+
+void AES_SEU_policy_default(struct AES_seu_policy* policy)
+{
+  // raise[i]: leave level i when a window has more events than this.
+  policy->raise[AES_SEU_PLAIN]    = 0;
+  policy->raise[AES_SEU_CHECKSUM] = 2;
+  policy->raise[AES_SEU_TMR]      = 32;
+  policy->raise[AES_SEU_CED]      = UINT32_MAX;
+  // lower[i]: a window with at most this many events is quiet at level i.
+  policy->lower[AES_SEU_PLAIN]    = 0;
+  policy->lower[AES_SEU_CHECKSUM] = 0;
+  policy->lower[AES_SEU_TMR]      = 0;
+  policy->lower[AES_SEU_CED]      = 2;
+  policy->hold = 16;
+  // The checksum costs next to nothing over plain (seu-sim measures it),
+  // and at plain an upset corrupts output until the next scrub: never go
+  // below it. CED doubles the cost and guards the data path, not the key
+  // schedule, so it is kept for rates well past a solar-burst level.
+  policy->min_level = AES_SEU_CHECKSUM;
+  policy->max_level = AES_SEU_CED;
+}
+
+void AES_SEU_controller_init(struct AES_seu_controller* ctrl, const struct AES_seu_policy* policy,
+                             struct AES_seu_ctx* const* ctxs, unsigned n)
+{
+  unsigned i;
+
+  ctrl->policy = *policy;
+  ctrl->level = policy->min_level;
+  ctrl->quiet = 0;
+  ctrl->last = event_total(ctxs, n);
+  ctrl->transitions = 0;
+  for (i = 0; i < n; ++i)
+  {
+    AES_SEU_set_level(ctxs[i], ctrl->level);
+  }
+}
+
+int AES_SEU_controller_update(struct AES_seu_controller* ctrl, struct AES_seu_ctx* const* ctxs, unsigned n)
+{
+  const struct AES_seu_policy* p = &ctrl->policy;
+  const uint64_t total = event_total(ctxs, n);
+  const uint64_t events = total - ctrl->last;
+  int level = ctrl->level;
+  unsigned i;
+
+  ctrl->last = total;
+
+  if ((level < p->max_level) && (events > p->raise[level]))
+  {
+    while ((level < p->max_level) && (events > p->raise[level]))
+    {
+      ++level;
+    }
+    ctrl->quiet = 0;
+  }
+  else if (events <= p->lower[level])
+  {
+    if ((level > p->min_level) && (++ctrl->quiet >= p->hold))
+    {
+      --level;
+      ctrl->quiet = 0;
+    }
+  }
+  else
+  {
+    ctrl->quiet = 0;
+  }
+
+  if (level != ctrl->level)
+  {
+    ctrl->level = level;
+    ++ctrl->transitions;
+    for (i = 0; i < n; ++i)
+    {
+      AES_SEU_set_level(ctxs[i], level);
+    }
+  }
+  return level;
+}
@@ -0,0 +1,115 @@
+#ifndef _AES_SEU_H_
+#define _AES_SEU_H_
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include "aes.h"
+
+// SEU (single event upset) hardening for long-lived key material.
+//
+// The expanded key schedule is the largest piece of state that stays resident
+// for the whole lifetime of a context, so it is the most likely to take an
+// upset. AES_seu_ctx keeps three copies of it (TMR, triple modular redundancy)
+// and votes them bit-wise. A flipped bit in any single copy is outvoted and
+// written back, so faults do not accumulate across copies.
+//
+// Only RoundKey is voted: Iv is per-call state and is allowed to differ
+// between the copies. Operations should use copy[0] after a vote.
+//
+// The copies are always maintained, but how much checking an operation does
+// is set by the context's protection level. The level can be changed at any
+// time, from any thread (see the controller below): every operation reads
+// the level once on entry and finishes at that level.
+//
+// The level and the counters are the only shared state. Operations and
+// AES_SEU_scrub() write the key schedule copies and the stored checksum
+// without locking, so calls on one context must not overlap: run the
+// scrubber on the thread that does the operations (between them), or
+// serialize the two with a lock of your own. Contexts used by a single
+// thread each, as in aesd, need nothing more.
+
+enum AES_SEU_level
+{
+  AES_SEU_PLAIN = 0,     // copy[0] is used as is
+  AES_SEU_CHECKSUM,      // copy[0] is checksummed before use, voted on mismatch
+  AES_SEU_TMR,           // the copies are voted before every use
+  AES_SEU_CED,           // TMR plus concurrent error detection on the data path
+  AES_SEU_LEVELS
+};
+
+struct AES_seu_ctx
+{
+  struct AES_ctx copy[3];
+  uint64_t sum;                  // checksum of the voted key schedule
+  _Atomic int level;
+  _Atomic uint32_t detected;     // fault events noticed (vote, checksum or CED mismatch)
+  _Atomic uint32_t corrected;    // bits repaired by voting
+};
+
+void AES_SEU_init_ctx(struct AES_seu_ctx* ctx, const uint8_t* key);
+void AES_SEU_ctx_set_iv(struct AES_seu_ctx* ctx, const uint8_t* iv);
+void AES_SEU_set_level(struct AES_seu_ctx* ctx, int level);
+int AES_SEU_get_level(const struct AES_seu_ctx* ctx);
+
+// Votes the three key schedules and repairs any copy that disagrees with
+// the majority. Returns the number of bits repaired by this call.
+// Call it periodically as a scrubber: at AES_SEU_PLAIN nothing else looks
+// at the copies, so the scrubber is what feeds the counters. It must not
+// run concurrently with an operation on the same context (see above).
+uint32_t AES_SEU_scrub(struct AES_seu_ctx* ctx);
+
+// Overwrites all copies so the key does not linger in memory.
+void AES_SEU_wipe(struct AES_seu_ctx* ctx);
+
+// Protected counterparts of the aes.h operations. They return 0, or -1 when
+// AES_SEU_CED saw a mismatch that persisted through its retries; the buffer
+// contents are not to be trusted in that case.
+int AES_SEU_ECB_encrypt(struct AES_seu_ctx* ctx, uint8_t* buf);
+int AES_SEU_ECB_decrypt(struct AES_seu_ctx* ctx, uint8_t* buf);
+int AES_SEU_CBC_encrypt_buffer(struct AES_seu_ctx* ctx, uint8_t* buf, uint32_t length);
+int AES_SEU_CBC_decrypt_buffer(struct AES_seu_ctx* ctx, uint8_t* buf, uint32_t length);
+int AES_SEU_CTR_xcrypt_buffer(struct AES_seu_ctx* ctx, uint8_t* buf, uint32_t length);
+
+
+/*****************************************************************************/
+/* Adaptive protection level controller:                                     */
+/*****************************************************************************/
+// The controller turns the observed upset rate into a protection level.
+// Call AES_SEU_controller_update() once per fixed window (for example from
+// the same timer that runs the scrubber). Every window it takes the number of
+// new events (detections plus corrected bits) summed over the watched
+// contexts. If that exceeds raise[level], the level goes up at once, by as
+// many steps as the thresholds call for. The level drops by one only after
+// hold consecutive windows at or below lower[level]. This hysteresis keeps a
+// noisy rate from making the level flap.
+
+struct AES_seu_policy
+{
+  uint32_t raise[AES_SEU_LEVELS];  // events per window that escalate past level i
+  uint32_t lower[AES_SEU_LEVELS];  // events per window that count as quiet at level i
+  uint32_t hold;                   // quiet windows before stepping down one level
+  int min_level;
+  int max_level;
+};
+
+struct AES_seu_controller
+{
+  struct AES_seu_policy policy;
+  int level;
+  uint32_t quiet;                  // consecutive quiet windows so far
+  uint64_t last;                   // event total at the previous update
+  uint32_t transitions;
+};
+
+// Fills in the default policy: checksum when quiet (never plain), TMR from
+// three events per window, CED only past 32.
+void AES_SEU_policy_default(struct AES_seu_policy* policy);
+
+void AES_SEU_controller_init(struct AES_seu_controller* ctrl, const struct AES_seu_policy* policy,
+                             struct AES_seu_ctx* const* ctxs, unsigned n);
+
+// Reads the counters of the n contexts, decides the level for the next
+// window and publishes it to every context. Returns the new level.
+int AES_SEU_controller_update(struct AES_seu_controller* ctrl, struct AES_seu_ctx* const* ctxs, unsigned n);
+
+#endif // _AES_SEU_H_
@@ -0,0 +1,335 @@
+/*
+
+End-to-end test of the aesd local encryption service.
+
+  usage: aesd-test [path-to-aesd]
+
+Starts the daemon (./aesd by default) on a private socket and drives it
+through the client API: every data operation is checked against the
+library, then the daemon is fed buffers and requests it must refuse, and
+must still be serving afterwards. Exits nonzero on the first failure.
+
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include "aes.h"
+#include "aesd.h"
+
+#define SIZE 4096
+
+static const uint8_t key[16] = { 0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c };
+static const uint8_t iv[16]  = { 0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff };
+
+static int failed;
+
+static void check(const char* what, int ok)
+{
+  printf("%-48s %s\n", what, ok ? "ok" : "FAILED");
+  failed |= !ok;
+}
+
+static void fill(uint8_t* p, uint32_t size)
+{
+  uint32_t i;
+  for (i = 0; i < size; ++i)
+  {
+    p[i] = (uint8_t)(i * 7 + 3);
+  }
+}
+
+// Registers fd as a buffer of length bytes by hand, so that the test can
+// pass memfds that aesd_alloc() would never create. Returns the status.
+static int map_raw(int sock, int fd, uint64_t length)
+{
+  struct aesd_request req;
+  struct aesd_reply reply;
+  union
+  {
+    char buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  struct iovec iov;
+  struct msghdr msg;
+  struct cmsghdr* cmsg;
+  int ret;
+
+  memset(&req, 0, sizeof(req));
+  req.op = AESD_OP_MAP;
+  req.tag = 0x5eed;
+  req.length = length;
+  iov.iov_base = &req;
+  iov.iov_len = sizeof(req);
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+  if (sendmsg(sock, &msg, MSG_NOSIGNAL) != (ssize_t)sizeof(req))
+  {
+    return -errno;
+  }
+  ret = aesd_receive(sock, &reply);
+  if (ret < 0)
+  {
+    return ret;
+  }
+  return (reply.tag == req.tag) ? reply.status : -EPROTO;
+}
+
+static int start(const char* daemon, const char* path, pid_t* pid)
+{
+  struct timespec pause = { 0, 10 * 1000 * 1000 };
+  int sock, tries;
+
+  *pid = fork();
+  if (*pid < 0)
+  {
+    return -errno;
+  }
+  if (*pid == 0)
+  {
+    execl(daemon, daemon, path, (char*)NULL);
+    perror(daemon);
+    _exit(127);
+  }
+  for (tries = 0; tries < 300; ++tries)
+  {
+    sock = aesd_connect(path);
+    if (sock >= 0)
+    {
+      return sock;
+    }
+    if (waitpid(*pid, NULL, WNOHANG) == *pid)
+    {
+      break;
+    }
+    nanosleep(&pause, NULL);
+  }
+  return -ECONNREFUSED;
+}
+
+/*****************************************************************************/
+/* Data operations:                                                          */
+/*****************************************************************************/
+static void test_modes(int sock, uint32_t key_id, uint32_t buf_id, uint8_t* buf)
+{
+  static uint8_t expect[SIZE], plain[SIZE];
+  struct AES_ctx ctx;
+  uint8_t next[AES_BLOCKLEN], chain[AES_BLOCKLEN];
+  uint32_t i;
+  int ret;
+
+  fill(plain, SIZE);
+
+  // ECB
+  memcpy(buf, plain, SIZE);
+  memcpy(expect, plain, SIZE);
+  AES_init_ctx(&ctx, key);
+  for (i = 0; i < SIZE; i += AES_BLOCKLEN)
+  {
+    AES_ECB_encrypt(&ctx, expect + i);
+  }
+  ret = aesd_xcrypt(sock, AESD_OP_ECB_ENCRYPT, key_id, buf_id, 0, SIZE, NULL);
+  check("ECB encrypt matches the library", (ret == 0) && (memcmp(buf, expect, SIZE) == 0));
+  ret = aesd_xcrypt(sock, AESD_OP_ECB_DECRYPT, key_id, buf_id, 0, SIZE, NULL);
+  check("ECB decrypt restores the plaintext", (ret == 0) && (memcmp(buf, plain, SIZE) == 0));
+
+  // CBC, in two calls chained through the returned iv
+  memcpy(buf, plain, SIZE);
+  memcpy(expect, plain, SIZE);
+  AES_init_ctx_iv(&ctx, key, iv);
+  AES_CBC_encrypt_buffer(&ctx, expect, SIZE);
+  memcpy(chain, iv, AES_BLOCKLEN);
+  ret = aesd_xcrypt(sock, AESD_OP_CBC_ENCRYPT, key_id, buf_id, 0, SIZE / 2, chain);
+  ret |= aesd_xcrypt(sock, AESD_OP_CBC_ENCRYPT, key_id, buf_id, SIZE / 2, SIZE / 2, chain);
+  check("CBC encrypt in two calls matches the library", (ret == 0) && (memcmp(buf, expect, SIZE) == 0));
+  memcpy(chain, iv, AES_BLOCKLEN);
+  ret = aesd_xcrypt(sock, AESD_OP_CBC_DECRYPT, key_id, buf_id, 0, SIZE, chain);
+  check("CBC decrypt restores the plaintext", (ret == 0) && (memcmp(buf, plain, SIZE) == 0));
+
+  // CTR, split at a block boundary
+  memcpy(buf, plain, SIZE);
+  memcpy(expect, plain, SIZE);
+  AES_init_ctx_iv(&ctx, key, iv);
+  AES_CTR_xcrypt_buffer(&ctx, expect, SIZE);
+  memcpy(next, iv, AES_BLOCKLEN);
+  ret = aesd_xcrypt(sock, AESD_OP_CTR_XCRYPT, key_id, buf_id, 0, 1024, next);
+  ret |= aesd_xcrypt(sock, AESD_OP_CTR_XCRYPT, key_id, buf_id, 1024, SIZE - 1024, next);
+  check("CTR in two calls matches the library", (ret == 0) && (memcmp(buf, expect, SIZE) == 0));
+
+  // Pipelined: replies carry the tags they were submitted with.
+  {
+    struct aesd_request req;
+    struct aesd_reply reply;
+    uint32_t seen = 0;
+    memset(&req, 0, sizeof(req));
+    req.op = AESD_OP_ECB_ENCRYPT;
+    req.key_id = key_id;
+    req.buf_id = buf_id;
+    req.length = AES_BLOCKLEN;
+    for (i = 0; i < 8; ++i)
+    {
+      req.tag = 100 + i;
+      req.offset = i * AES_BLOCKLEN;
+      ret |= aesd_submit(sock, &req);
+    }
+    for (i = 0; i < 8; ++i)
+    {
+      ret |= aesd_receive(sock, &reply);
+      if ((reply.tag >= 100) && (reply.tag < 108) && (reply.status == 0))
+      {
+        seen |= 1u << (reply.tag - 100);
+      }
+    }
+    check("pipelined replies carry their request tags", (ret == 0) && (seen == 0xff));
+  }
+}
+
+/*****************************************************************************/
+/* Refused requests:                                                         */
+/*****************************************************************************/
+static void test_refused(int sock, const char* path, uint32_t key_id, uint32_t buf_id)
+{
+  uint32_t other_key;
+  int fd, other, ret;
+
+  // A memfd that is not sealed could be truncated under the daemon's mapping.
+  fd = memfd_create("aesd-test", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  ret = ((fd >= 0) && (ftruncate(fd, SIZE) == 0)) ? map_raw(sock, fd, SIZE) : -errno;
+  check("unsealed buffer is refused", ret == -EPERM);
+
+  // Sealed, but shorter than the length claimed.
+  ret = (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) == 0) ? map_raw(sock, fd, 4 * SIZE) : -errno;
+  check("buffer shorter than its length is refused", ret == -EINVAL);
+  ret = map_raw(sock, fd, 0);
+  check("empty buffer is refused", ret == -EINVAL);
+  close(fd);
+
+  ret = aesd_xcrypt(sock, AESD_OP_ECB_ENCRYPT, key_id, buf_id, SIZE - AES_BLOCKLEN, 2 * AES_BLOCKLEN, NULL);
+  check("request past the end of the buffer is refused", ret == -ERANGE);
+  ret = aesd_xcrypt(sock, AESD_OP_ECB_ENCRYPT, key_id, buf_id, 0, AES_BLOCKLEN + 1, NULL);
+  check("partial ECB block is refused", ret == -EINVAL);
+  ret = aesd_xcrypt(sock, AESD_OP_ECB_ENCRYPT, key_id + 1, buf_id, 0, AES_BLOCKLEN, NULL);
+  check("unknown key is refused", ret == -ENOENT);
+
+  // Keys belong to the client that loaded them.
+  other = aesd_connect(path);
+  ret = (other >= 0) ? aesd_load_key(other, key, &other_key) : other;
+  if (ret == 0)
+  {
+    ret = aesd_xcrypt(other, AESD_OP_ECB_ENCRYPT, key_id, buf_id, 0, AES_BLOCKLEN, NULL);
+    close(other);
+  }
+  check("another client's key and buffer are refused", ret == -ENOENT);
+}
+
+/*****************************************************************************/
+/* A client that does not read its replies:                                  */
+/*****************************************************************************/
+static void test_stalled(int sock, const char* path, uint32_t key_id, uint32_t buf_id)
+{
+  struct timeval wait = { 5, 0 }, forever = { 0, 0 };
+  struct aesd_request req;
+  struct pollfd pfd;
+  unsigned sent = 0;
+  int slow, ret;
+
+  // Send requests until the daemon stops taking them for good, and never
+  // read a reply. A daemon that blocked on this client's replies would
+  // never answer the request below; give up on it after a few seconds.
+  slow = aesd_connect(path);
+  memset(&req, 0, sizeof(req));
+  req.op = AESD_OP_UNLOAD_KEY;
+  pfd.fd = slow;
+  pfd.events = POLLOUT;
+  while ((slow >= 0) && (sent < 100000))
+  {
+    if (send(slow, &req, sizeof(req), MSG_DONTWAIT | MSG_NOSIGNAL) == (ssize_t)sizeof(req))
+    {
+      req.tag = ++sent;
+    }
+    else if ((errno != EAGAIN) || (poll(&pfd, 1, 200) <= 0))
+    {
+      break;
+    }
+  }
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &wait, sizeof(wait));
+  ret = aesd_xcrypt(sock, AESD_OP_ECB_ENCRYPT, key_id, buf_id, 0, SIZE, NULL);
+  ret |= aesd_xcrypt(sock, AESD_OP_ECB_DECRYPT, key_id, buf_id, 0, SIZE, NULL);
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &forever, sizeof(forever));
+  check("a stalled client does not block the others", (slow >= 0) && (ret == 0));
+  if (slow >= 0)
+  {
+    close(slow);
+  }
+}
+
+int main(int argc, char** argv)
+{
+  const char* daemon = (argc > 1) ? argv[1] : "./aesd";
+  char path[64];
+  uint32_t key_id, buf_id;
+  uint8_t* buf;
+  pid_t pid;
+  int sock, status, ret;
+
+  snprintf(path, sizeof(path), "/tmp/aesd-test.%ld.sock", (long)getpid());
+  sock = start(daemon, path, &pid);
+  if (sock < 0)
+  {
+    fprintf(stderr, "aesd-test: cannot start %s: %s\n", daemon, strerror(-sock));
+    if (pid > 0)
+    {
+      kill(pid, SIGKILL);
+      waitpid(pid, NULL, 0);
+    }
+    return 1;
+  }
+
+  ret = aesd_load_key(sock, key, &key_id);
+  check("load key", ret == 0);
+  ret |= aesd_alloc(sock, SIZE, &buf_id, &buf);
+  check("register buffer", ret == 0);
+  if (ret == 0)
+  {
+    test_modes(sock, key_id, buf_id, buf);
+    test_refused(sock, path, key_id, buf_id);
+    test_stalled(sock, path, key_id, buf_id);
+
+    // Still serving after all of that.
+    fill(buf, SIZE);
+    ret = aesd_xcrypt(sock, AESD_OP_ECB_ENCRYPT, key_id, buf_id, 0, SIZE, NULL);
+    ret |= aesd_xcrypt(sock, AESD_OP_ECB_DECRYPT, key_id, buf_id, 0, SIZE, NULL);
+    check("daemon still serves after refusals", ret == 0);
+    check("free buffer", aesd_free(sock, buf_id, buf, SIZE) == 0);
+    check("unload key", aesd_unload_key(sock, key_id) == 0);
+    check("unloaded key is gone", aesd_unload_key(sock, key_id) == -ENOENT);
+  }
+  close(sock);
+
+  kill(pid, SIGTERM);
+  check("daemon exits cleanly", (waitpid(pid, &status, 0) == pid) && WIFEXITED(status) && (WEXITSTATUS(status) == 0));
+  check("daemon removes its socket", access(path, F_OK) != 0);
+  unlink(path);
+
+  return failed;
+}
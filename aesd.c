@@ -0,0 +1,634 @@
+/*
+
+aesd - local encryption service daemon. See aesd.h for the protocol.
+
+  usage: aesd [socket-path]
+
+The daemon is a single poll() loop. Each pass drains every readable client
+into one batch and sorts the data requests by key. ECB and CTR requests run
+through the block engine aes_backend selects for their size (AES-NI or the
+multi-block software engine); CBC stays on the serial functions. Grouping
+by key means that the TMR key schedule is voted and scrubbed once per key
+and batch instead of once per request. The other saving is in system
+calls: the replies for each client go out in a single sendmmsg().
+
+Client sockets are non-blocking, so a client that stops reading cannot
+stall the others. Replies it has not taken stay queued; the daemon then
+waits for POLLOUT and reads no more requests from that client until the
+queue has drained. A client whose queue overflows is dropped.
+
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "aes.h"
+#include "aes_backend.h"
+#include "aes_seu.h"
+#include "aesd.h"
+
+#define MAX_CLIENTS 64
+#define MAX_KEYS    256
+#define MAX_BUFS    256
+#define MAX_BATCH   256
+
+struct key_slot
+{
+  int owner;                 // client index, -1 when free
+  struct AES_seu_ctx tmr;
+};
+
+struct buf_slot
+{
+  int owner;                 // client index, -1 when free
+  uint8_t* base;
+  size_t size;
+};
+
+struct client
+{
+  int fd;                    // -1 when free
+  int overrun;               // a reply was lost, drop the client
+  unsigned nout;             // replies queued, not yet sent
+  struct aesd_reply out[MAX_BATCH];
+};
+
+struct pending
+{
+  int client;
+  unsigned seq;              // arrival order, keeps the sort stable
+  struct aesd_request req;
+};
+
+static struct key_slot keys[MAX_KEYS];
+static struct buf_slot bufs[MAX_BUFS];
+static struct client clients[MAX_CLIENTS];
+static struct pending batch[MAX_BATCH];
+static unsigned nbatch;
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+  (void)sig;
+  stop = 1;
+}
+
+static void flush_replies(int c);
+
+static void reply(int c, const struct aesd_request* req, int32_t status, uint32_t id, const uint8_t* iv)
+{
+  struct aesd_reply* r;
+
+  if (clients[c].nout == MAX_BATCH)
+  {
+    flush_replies(c);
+    if (clients[c].nout == MAX_BATCH)
+    {
+      clients[c].overrun = 1;
+      return;
+    }
+  }
+  r = &clients[c].out[clients[c].nout++];
+  memset(r, 0, sizeof(*r));
+  r->tag = req->tag;
+  r->status = status;
+  r->id = id;
+  if (iv != NULL)
+  {
+    memcpy(r->iv, iv, AES_BLOCKLEN);
+  }
+}
+
+// Sends what the socket takes without blocking; the rest stays queued.
+static void flush_replies(int c)
+{
+  struct mmsghdr msgs[MAX_BATCH];
+  struct iovec iov[MAX_BATCH];
+  unsigned i, sent = 0;
+
+  for (i = 0; i < clients[c].nout; ++i)
+  {
+    iov[i].iov_base = &clients[c].out[i];
+    iov[i].iov_len = sizeof(struct aesd_reply);
+    memset(&msgs[i], 0, sizeof(msgs[i]));
+    msgs[i].msg_hdr.msg_iov = &iov[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+  while (sent < clients[c].nout)
+  {
+    int n = sendmmsg(clients[c].fd, msgs + sent, clients[c].nout - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n <= 0)
+    {
+      if ((n < 0) && (errno == EINTR))
+      {
+        continue;
+      }
+      if ((n < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+      {
+        memmove(clients[c].out, clients[c].out + sent, (clients[c].nout - sent) * sizeof(struct aesd_reply));
+        clients[c].nout -= sent;
+        return;
+      }
+      break; // the client went away; its hangup is handled by poll()
+    }
+    sent += (unsigned)n;
+  }
+  clients[c].nout = 0;
+}
+
+static struct key_slot* lookup_key(int c, uint32_t id)
+{
+  if ((id == 0) || (id > MAX_KEYS) || (keys[id - 1].owner != c))
+  {
+    return NULL;
+  }
+  return &keys[id - 1];
+}
+
+static struct buf_slot* lookup_buf(int c, uint32_t id)
+{
+  if ((id == 0) || (id > MAX_BUFS) || (bufs[id - 1].owner != c))
+  {
+    return NULL;
+  }
+  return &bufs[id - 1];
+}
+
+static void release_key(struct key_slot* k)
+{
+  AES_SEU_wipe(&k->tmr);
+  k->owner = -1;
+}
+
+static void release_buf(struct buf_slot* b)
+{
+  munmap(b->base, b->size);
+  b->base = NULL;
+  b->owner = -1;
+}
+
+/*****************************************************************************/
+/* Batch execution:                                                          */
+/*****************************************************************************/
+static int by_key(const void* pa, const void* pb)
+{
+  const struct pending* a = (const struct pending*)pa;
+  const struct pending* b = (const struct pending*)pb;
+  if (a->req.key_id != b->req.key_id)
+  {
+    return (a->req.key_id < b->req.key_id) ? -1 : 1;
+  }
+  return (a->seq < b->seq) ? -1 : 1;
+}
+
+static int32_t run_one(struct AES_ctx* ctx, const struct aesd_request* req, struct buf_slot* b)
+{
+  uint8_t* p;
+  uint32_t len;
+
+  if ((req->offset > b->size) || (req->length > b->size - req->offset) || (req->length > UINT32_MAX))
+  {
+    return -ERANGE;
+  }
+  if ((req->op != AESD_OP_CTR_XCRYPT) && ((req->length % AES_BLOCKLEN) != 0))
+  {
+    return -EINVAL;
+  }
+  p = b->base + req->offset;
+  len = (uint32_t)req->length;
+
+  switch (req->op)
+  {
+  case AESD_OP_ECB_ENCRYPT:
+    aes_backend_ecb_encrypt(ctx, p, len / AES_BLOCKLEN);
+    break;
+  case AESD_OP_ECB_DECRYPT:
+    aes_backend_ecb_decrypt(ctx, p, len / AES_BLOCKLEN);
+    break;
+  case AESD_OP_CBC_ENCRYPT:
+    AES_ctx_set_iv(ctx, req->iv);
+    AES_CBC_encrypt_buffer(ctx, p, len);
+    break;
+  case AESD_OP_CBC_DECRYPT:
+    AES_ctx_set_iv(ctx, req->iv);
+    AES_CBC_decrypt_buffer(ctx, p, len);
+    break;
+  case AESD_OP_CTR_XCRYPT:
+    AES_ctx_set_iv(ctx, req->iv);
+    aes_backend_ctr_xcrypt(ctx, p, len);
+    break;
+  default:
+    return -EOPNOTSUPP;
+  }
+  return 0;
+}
+
+static void run_batch(void)
+{
+  unsigned i = 0;
+
+  qsort(batch, nbatch, sizeof(batch[0]), by_key);
+  while (i < nbatch)
+  {
+    const uint32_t key_id = batch[i].req.key_id;
+    int scrubbed = 0;
+
+    for (; (i < nbatch) && (batch[i].req.key_id == key_id); ++i)
+    {
+      const int c = batch[i].client;
+      struct key_slot* k = lookup_key(c, key_id);
+      struct buf_slot* b = lookup_buf(c, batch[i].req.buf_id);
+      int32_t status;
+
+      if ((k == NULL) || (b == NULL))
+      {
+        reply(c, &batch[i].req, -ENOENT, 0, NULL);
+        continue;
+      }
+      if (!scrubbed)
+      {
+        const uint32_t repaired = AES_SEU_scrub(&k->tmr);
+        if (repaired != 0)
+        {
+          fprintf(stderr, "aesd: key %u: repaired %u bit(s) in key schedule\n", key_id, repaired);
+        }
+        scrubbed = 1;
+      }
+      status = run_one(&k->tmr.copy[0], &batch[i].req, b);
+      reply(c, &batch[i].req, status, 0, (status == 0) ? k->tmr.copy[0].Iv : NULL);
+    }
+  }
+  nbatch = 0;
+}
+
+/*****************************************************************************/
+/* Request intake:                                                           */
+/*****************************************************************************/
+static void drop_client(int c)
+{
+  unsigned i;
+
+  // Anything still queued for this client is discarded.
+  for (i = 0; i < nbatch; )
+  {
+    if (batch[i].client == c)
+    {
+      batch[i] = batch[--nbatch];
+      continue;
+    }
+    ++i;
+  }
+  for (i = 0; i < MAX_KEYS; ++i)
+  {
+    if (keys[i].owner == c)
+    {
+      release_key(&keys[i]);
+    }
+  }
+  for (i = 0; i < MAX_BUFS; ++i)
+  {
+    if (bufs[i].owner == c)
+    {
+      release_buf(&bufs[i]);
+    }
+  }
+  close(clients[c].fd);
+  clients[c].fd = -1;
+  clients[c].overrun = 0;
+  clients[c].nout = 0;
+}
+
+static void control(int c, const struct aesd_request* req, int fd)
+{
+  unsigned i;
+
+  switch (req->op)
+  {
+  case AESD_OP_LOAD_KEY:
+    for (i = 0; (i < MAX_KEYS) && (keys[i].owner >= 0); ++i)
+      ;
+    if (i == MAX_KEYS)
+    {
+      reply(c, req, -ENOSPC, 0, NULL);
+      return;
+    }
+    keys[i].owner = c;
+    AES_SEU_init_ctx(&keys[i].tmr, req->key);
+    reply(c, req, 0, i + 1, NULL);
+    return;
+
+  case AESD_OP_UNLOAD_KEY:
+  {
+    struct key_slot* k = lookup_key(c, req->key_id);
+    if (k == NULL)
+    {
+      reply(c, req, -ENOENT, 0, NULL);
+      return;
+    }
+    release_key(k);
+    reply(c, req, 0, 0, NULL);
+    return;
+  }
+
+  case AESD_OP_MAP:
+  {
+    struct stat st;
+    void* base;
+    int seals;
+    if (fd < 0)
+    {
+      reply(c, req, -EBADF, 0, NULL);
+      return;
+    }
+    // Touching a page past the end of the file would raise SIGBUS in the
+    // daemon, so the file must be at least as long as the mapping now, and
+    // sealed so that the client cannot shrink it later.
+    if ((fstat(fd, &st) < 0) || (req->length == 0) || ((uint64_t)st.st_size < req->length))
+    {
+      reply(c, req, -EINVAL, 0, NULL);
+      return;
+    }
+    seals = fcntl(fd, F_GET_SEALS);
+    if ((seals < 0) || ((seals & (F_SEAL_SHRINK | F_SEAL_GROW)) != (F_SEAL_SHRINK | F_SEAL_GROW)))
+    {
+      reply(c, req, -EPERM, 0, NULL);
+      return;
+    }
+    for (i = 0; (i < MAX_BUFS) && (bufs[i].owner >= 0); ++i)
+      ;
+    if (i == MAX_BUFS)
+    {
+      reply(c, req, -ENOSPC, 0, NULL);
+      return;
+    }
+    base = mmap(NULL, req->length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED)
+    {
+      reply(c, req, -errno, 0, NULL);
+      return;
+    }
+    bufs[i].owner = c;
+    bufs[i].base = (uint8_t*)base;
+    bufs[i].size = req->length;
+    reply(c, req, 0, i + 1, NULL);
+    return;
+  }
+
+  case AESD_OP_UNMAP:
+  {
+    struct buf_slot* b = lookup_buf(c, req->buf_id);
+    if (b == NULL)
+    {
+      reply(c, req, -ENOENT, 0, NULL);
+      return;
+    }
+    release_buf(b);
+    reply(c, req, 0, 0, NULL);
+    return;
+  }
+  }
+  reply(c, req, -EOPNOTSUPP, 0, NULL);
+}
+
+// Reads everything the client has queued, up to the batch capacity.
+// Returns -1 when the client hung up.
+static int drain(int c)
+{
+  static unsigned seq;
+
+  while (nbatch < MAX_BATCH)
+  {
+    struct aesd_request req;
+    union
+    {
+      char buf[CMSG_SPACE(sizeof(int))];
+      struct cmsghdr align;
+    } ctl;
+    struct iovec iov;
+    struct msghdr msg;
+    struct cmsghdr* cmsg;
+    ssize_t n;
+    int fd = -1;
+
+    iov.iov_base = &req;
+    iov.iov_len = sizeof(req);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = sizeof(ctl.buf);
+
+    n = recvmsg(clients[c].fd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+    if (n < 0)
+    {
+      return ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) ? 0 : -1;
+    }
+    if (n == 0)
+    {
+      return -1;
+    }
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+      if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS))
+      {
+        memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+      }
+    }
+    if (n != (ssize_t)sizeof(req))
+    {
+      if (fd >= 0)
+      {
+        close(fd);
+      }
+      return -1;
+    }
+
+    if (req.op >= AESD_OP_ECB_ENCRYPT)
+    {
+      batch[nbatch].client = c;
+      batch[nbatch].seq = seq++;
+      batch[nbatch].req = req;
+      ++nbatch;
+    }
+    else
+    {
+      // Requests already queued may still reference what is being released.
+      if ((req.op == AESD_OP_UNLOAD_KEY) || (req.op == AESD_OP_UNMAP))
+      {
+        run_batch();
+      }
+      control(c, &req, fd);
+    }
+    memset(&req, 0, sizeof(req));
+    if (fd >= 0)
+    {
+      close(fd);
+    }
+  }
+  return 0;
+}
+
+static int listen_on(const char* path)
+{
+  struct sockaddr_un addr;
+  int sock;
+
+  if (strlen(path) >= sizeof(addr.sun_path))
+  {
+    fprintf(stderr, "aesd: socket path too long\n");
+    return -1;
+  }
+  sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (sock < 0)
+  {
+    perror("aesd: socket");
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  unlink(path);
+  if ((bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) || (listen(sock, 16) < 0))
+  {
+    perror("aesd: bind");
+    close(sock);
+    return -1;
+  }
+  return sock;
+}
+
+int main(int argc, char** argv)
+{
+  const char* path = (argc > 1) ? argv[1] : AESD_DEFAULT_SOCKET;
+  struct pollfd pfd[1 + MAX_CLIENTS];
+  int map[1 + MAX_CLIENTS];
+  struct sigaction sa;
+  int lsock, i;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_signal;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  for (i = 0; i < MAX_KEYS; ++i)
+  {
+    keys[i].owner = -1;
+  }
+  for (i = 0; i < MAX_BUFS; ++i)
+  {
+    bufs[i].owner = -1;
+  }
+  for (i = 0; i < MAX_CLIENTS; ++i)
+  {
+    clients[i].fd = -1;
+  }
+
+  lsock = listen_on(path);
+  if (lsock < 0)
+  {
+    return 1;
+  }
+  // Settle the backend selection (cache or microbenchmark) before the
+  // first client, rather than inside its first request.
+  aes_backend_select(0);
+
+  while (!stop)
+  {
+    int nfds = 1;
+
+    pfd[0].fd = lsock;
+    pfd[0].events = POLLIN;
+    for (i = 0; i < MAX_CLIENTS; ++i)
+    {
+      if (clients[i].fd >= 0)
+      {
+        pfd[nfds].fd = clients[i].fd;
+        pfd[nfds].events = (clients[i].nout == 0) ? POLLIN : POLLOUT;
+        map[nfds] = i;
+        ++nfds;
+      }
+    }
+    if (poll(pfd, (nfds_t)nfds, -1) < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      perror("aesd: poll");
+      break;
+    }
+
+    for (i = 1; i < nfds; ++i)
+    {
+      const int c = map[i];
+      if (pfd[i].revents & POLLOUT)
+      {
+        flush_replies(c);
+      }
+      else if (pfd[i].revents & (POLLIN | POLLHUP | POLLERR))
+      {
+        // A client with replies still queued was only polled for POLLOUT,
+        // so this is a hangup: nothing more can be delivered to it.
+        if ((clients[c].nout != 0) || (drain(c) < 0))
+        {
+          drop_client(c);
+        }
+      }
+    }
+    run_batch();
+    for (i = 0; i < MAX_CLIENTS; ++i)
+    {
+      if ((clients[i].fd >= 0) && (clients[i].nout != 0))
+      {
+        flush_replies(i);
+      }
+      if ((clients[i].fd >= 0) && clients[i].overrun)
+      {
+        fprintf(stderr, "aesd: client %d does not read its replies, dropped\n", i);
+        drop_client(i);
+      }
+    }
+
+    if (pfd[0].revents & POLLIN)
+    {
+      const int fd = accept4(lsock, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd >= 0)
+      {
+        for (i = 0; (i < MAX_CLIENTS) && (clients[i].fd >= 0); ++i)
+          ;
+        if (i == MAX_CLIENTS)
+        {
+          close(fd);
+        }
+        else
+        {
+          clients[i].fd = fd;
+          clients[i].overrun = 0;
+          clients[i].nout = 0;
+        }
+      }
+    }
+  }
+
+  for (i = 0; i < MAX_CLIENTS; ++i)
+  {
+    if (clients[i].fd >= 0)
+    {
+      drop_client(i);
+    }
+  }
+  close(lsock);
+  unlink(path);
+  return 0;
+}
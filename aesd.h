@@ -0,0 +1,91 @@
+#ifndef _AESD_H_
+#define _AESD_H_
+
+// aesd - local encryption service.
+//
+// aesd holds TMR-protected key schedules (see aes_seu.h) on behalf of local
+// processes and encrypts/decrypts their data in place, inside shared memory
+// buffers the clients register with it. Payload bytes never travel over the
+// socket, so there are no extra copies.
+//
+// Transport is an AF_UNIX SOCK_SEQPACKET socket: one request or reply per
+// message. Buffers are registered by passing a memfd with SCM_RIGHTS; it must
+// be at least the registered size and sealed with F_SEAL_SHRINK | F_SEAL_GROW
+// (aesd_alloc() does both), or the daemon refuses it.
+// Requests that arrive together (from any number of clients) are sorted by
+// key, so each key schedule is voted once per batch rather than once per
+// request; the data is still encrypted request by request.
+// Replies carry the client's tag and may come back in a different order than
+// the requests were submitted.
+//
+// A key may only be used by the client that loaded it, and is wiped when that
+// client unloads it or disconnects.
+
+#include <stddef.h>
+#include <stdint.h>
+#include "aes.h"
+
+#define AESD_DEFAULT_SOCKET "/tmp/aesd.sock"
+
+enum
+{
+  AESD_OP_LOAD_KEY = 1,   // key -> reply.id is the new key id
+  AESD_OP_UNLOAD_KEY,     // key_id
+  AESD_OP_MAP,            // length = buffer size, memfd in SCM_RIGHTS -> reply.id is the buffer id
+  AESD_OP_UNMAP,          // buf_id
+  AESD_OP_ECB_ENCRYPT,    // key_id, buf_id, offset, length (multiple of AES_BLOCKLEN)
+  AESD_OP_ECB_DECRYPT,
+  AESD_OP_CBC_ENCRYPT,    // ... plus iv; reply.iv is the chaining value for the next call
+  AESD_OP_CBC_DECRYPT,
+  AESD_OP_CTR_XCRYPT      // ... plus iv; reply.iv is the next counter block
+};
+
+struct aesd_request
+{
+  uint32_t op;
+  uint32_t tag;           // echoed back in the reply
+  uint32_t key_id;
+  uint32_t buf_id;
+  uint64_t offset;
+  uint64_t length;
+  uint8_t key[AES_KEYLEN];
+  uint8_t iv[AES_BLOCKLEN];
+};
+
+struct aesd_reply
+{
+  uint32_t tag;
+  int32_t status;         // 0 or a negative errno value
+  uint32_t id;
+  uint8_t iv[AES_BLOCKLEN];
+};
+
+/*****************************************************************************/
+/* Client API (aesd_client.c):                                               */
+/*****************************************************************************/
+// All functions return 0 (or a socket fd) on success and a negative errno
+// value on failure. The synchronous calls tag their request and fail with
+// -EPROTO if the reply that comes back carries another tag, as it does when
+// pipelined requests are still outstanding on the socket.
+
+// Connects to the daemon; path may be NULL for AESD_DEFAULT_SOCKET.
+int aesd_connect(const char* path);
+
+int aesd_load_key(int sock, const uint8_t* key, uint32_t* key_id);
+int aesd_unload_key(int sock, uint32_t key_id);
+
+// Creates a shared buffer of size bytes, maps it into this process and
+// registers it with the daemon. Release it with aesd_free().
+int aesd_alloc(int sock, size_t size, uint32_t* buf_id, uint8_t** ptr);
+int aesd_free(int sock, uint32_t buf_id, uint8_t* ptr, size_t size);
+
+// Pipelined use: submit any number of requests, then collect the replies.
+int aesd_submit(int sock, const struct aesd_request* req);
+int aesd_receive(int sock, struct aesd_reply* reply);
+
+// Synchronous convenience wrapper for one data operation. iv may be NULL for
+// ECB; for CBC/CTR it is updated to the value to continue from.
+int aesd_xcrypt(int sock, uint32_t op, uint32_t key_id, uint32_t buf_id,
+                uint64_t offset, uint64_t length, uint8_t* iv);
+
+#endif // _AESD_H_
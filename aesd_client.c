@@ -0,0 +1,244 @@
+/*
+
+Client side of the aesd local encryption service. See aesd.h.
+
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "aesd.h"
+
+// Tags of the synchronous calls; they only have to differ from one call to
+// the next on a socket.
+static uint32_t next_tag;
+
+// Receives the reply to the request tagged tag and returns its status. Any
+// other reply means the replies got out of step with the requests.
+static int receive_for(int sock, uint32_t tag, struct aesd_reply* reply)
+{
+  int ret = aesd_receive(sock, reply);
+  if (ret < 0)
+  {
+    return ret;
+  }
+  if (reply->tag != tag)
+  {
+    return -EPROTO;
+  }
+  return reply->status;
+}
+
+static int call(int sock, struct aesd_request* req, struct aesd_reply* reply)
+{
+  int ret;
+
+  req->tag = ++next_tag;
+  ret = aesd_submit(sock, req);
+  if (ret < 0)
+  {
+    return ret;
+  }
+  return receive_for(sock, req->tag, reply);
+}
+
+int aesd_connect(const char* path)
+{
+  struct sockaddr_un addr;
+  int sock;
+
+  if (path == NULL)
+  {
+    path = AESD_DEFAULT_SOCKET;
+  }
+  if (strlen(path) >= sizeof(addr.sun_path))
+  {
+    return -ENAMETOOLONG;
+  }
+
+  sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (sock < 0)
+  {
+    return -errno;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+  {
+    int err = errno;
+    close(sock);
+    return -err;
+  }
+  return sock;
+}
+
+int aesd_submit(int sock, const struct aesd_request* req)
+{
+  if (send(sock, req, sizeof(*req), MSG_NOSIGNAL) != (ssize_t)sizeof(*req))
+  {
+    return -errno;
+  }
+  return 0;
+}
+
+int aesd_receive(int sock, struct aesd_reply* reply)
+{
+  ssize_t n = recv(sock, reply, sizeof(*reply), 0);
+  if (n == 0)
+  {
+    return -ECONNRESET;
+  }
+  if (n != (ssize_t)sizeof(*reply))
+  {
+    return (n < 0) ? -errno : -EPROTO;
+  }
+  return 0;
+}
+
+int aesd_load_key(int sock, const uint8_t* key, uint32_t* key_id)
+{
+  struct aesd_request req;
+  struct aesd_reply reply;
+  int ret;
+
+  memset(&req, 0, sizeof(req));
+  req.op = AESD_OP_LOAD_KEY;
+  memcpy(req.key, key, AES_KEYLEN);
+  ret = call(sock, &req, &reply);
+  memset(&req, 0, sizeof(req));
+  if (ret == 0)
+  {
+    *key_id = reply.id;
+  }
+  return ret;
+}
+
+int aesd_unload_key(int sock, uint32_t key_id)
+{
+  struct aesd_request req;
+  struct aesd_reply reply;
+
+  memset(&req, 0, sizeof(req));
+  req.op = AESD_OP_UNLOAD_KEY;
+  req.key_id = key_id;
+  return call(sock, &req, &reply);
+}
+
+int aesd_alloc(int sock, size_t size, uint32_t* buf_id, uint8_t** ptr)
+{
+  struct aesd_request req;
+  struct aesd_reply reply;
+  union
+  {
+    char buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  struct iovec iov;
+  struct msghdr msg;
+  struct cmsghdr* cmsg;
+  void* map;
+  int fd, ret;
+
+  fd = memfd_create("aesd", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd < 0)
+  {
+    return -errno;
+  }
+  // The daemon only maps sealed buffers: it must never see the file shrink
+  // under its mapping.
+  if ((ftruncate(fd, (off_t)size) < 0) || (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) < 0))
+  {
+    ret = -errno;
+    close(fd);
+    return ret;
+  }
+  map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED)
+  {
+    ret = -errno;
+    close(fd);
+    return ret;
+  }
+
+  memset(&req, 0, sizeof(req));
+  req.op = AESD_OP_MAP;
+  req.tag = ++next_tag;
+  req.length = size;
+
+  iov.iov_base = &req;
+  iov.iov_len = sizeof(req);
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+  if (sendmsg(sock, &msg, MSG_NOSIGNAL) != (ssize_t)sizeof(req))
+  {
+    ret = -errno;
+  }
+  else
+  {
+    ret = receive_for(sock, req.tag, &reply);
+  }
+  // The daemon holds its own reference to the memory now.
+  close(fd);
+
+  if (ret < 0)
+  {
+    munmap(map, size);
+    return ret;
+  }
+  *buf_id = reply.id;
+  *ptr = (uint8_t*)map;
+  return 0;
+}
+
+int aesd_free(int sock, uint32_t buf_id, uint8_t* ptr, size_t size)
+{
+  struct aesd_request req;
+  struct aesd_reply reply;
+
+  memset(&req, 0, sizeof(req));
+  req.op = AESD_OP_UNMAP;
+  req.buf_id = buf_id;
+  munmap(ptr, size);
+  return call(sock, &req, &reply);
+}
+
+int aesd_xcrypt(int sock, uint32_t op, uint32_t key_id, uint32_t buf_id,
+                uint64_t offset, uint64_t length, uint8_t* iv)
+{
+  struct aesd_request req;
+  struct aesd_reply reply;
+  int ret;
+
+  memset(&req, 0, sizeof(req));
+  req.op = op;
+  req.key_id = key_id;
+  req.buf_id = buf_id;
+  req.offset = offset;
+  req.length = length;
+  if (iv != NULL)
+  {
+    memcpy(req.iv, iv, AES_BLOCKLEN);
+  }
+  ret = call(sock, &req, &reply);
+  if ((ret == 0) && (iv != NULL))
+  {
+    memcpy(iv, reply.iv, AES_BLOCKLEN);
+  }
+  return ret;
+}
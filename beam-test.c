@@ -0,0 +1,871 @@
+/*
+
+Beam-test workload: encrypts a known pattern over and over with every chosen
+engine and logs each deviation from the golden ciphertext, for cross-section
+measurements under irradiation.
+
+  usage: beam-test [-p pattern] [-i input] [-n bytes] [-e engine,...]
+                   [-d seconds] [-l log] [-S]
+         beam-test -D log [-F fluence]
+
+The pattern is the payload of an input.bin-style file (-i, by default
+input.bin: a 32-bit length followed by that many bytes; any other file is
+taken whole), or one of zeros, ones, checker (0x55/0xaa) and random, of -n
+bytes. Its ECB ciphertext is computed once, before the run, and checked on
+every engine; during the run each engine encrypts a fresh copy of the
+pattern and the result is diffed against the golden copy 64 bytes at a time.
+
+Engines are the backends of aes_backend.h (table, batch, ct, aesni) and
+secded, the instrumented engine: AES_ECB_encrypt_secded() with its state
+compared to the golden intermediate states before every round, through the
+AES_secded_fault hook. Its errors carry the first round where the state
+went wrong, and its corrections are logged even though the output is right.
+By default every engine the CPU can run takes its turn.
+
+A mismatch is first checked against the memory under test being the golden
+copy or the input rather than the engine: both are kept twice, with a
+CRC-32 per block to tell the good copy. Upsets of those are logged as such
+and repaired. Upsets of the S-box or the key schedule are the engines'.
+
+The log is a file of 48-byte records, appended with one write() each, so a
+crash of this process loses nothing that was logged; with -S every record
+is also synced to disk, otherwise the heartbeats (every second) are. A torn
+record at the end of the log, from a crash of the host, is cut off when
+the log is opened again. Each record has a CRC-32.
+
+-D prints a log and sums it up per run and engine. With the fluence of the
+run (-F, particles/cm2) it also gives the cross-section of each engine,
+errors / fluence.
+
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "aes.h"
+#include "aes_backend.h"
+
+#define MAX_ENGINES 8
+// ERROR records per engine and pass; the rest of a burst is one BURST record.
+#define MAX_LOGGED 16
+// Round of an error of the instrumented engine that hit after the last check.
+#define ROUND_AFTER 0xff
+#define NR (AES_keyExpSize / AES_BLOCKLEN - 1)
+
+static const uint8_t key[16] = { 0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c };
+
+enum record_type
+{
+  REC_START = 1,        // count: pattern bytes, block: blocks, engine: engines, diff: key check value
+  REC_ENGINE,           // engine, diff: its name
+  REC_ERROR,            // engine, round, bits, count: pass, block, aux: bytes in error (bit mask), diff
+  REC_BURST,            // engine, count: pass, aux: blocks in error in the pass
+  REC_CORRECTED,        // engine, round, count: pass, block, aux: corrections, diff: state diff at round
+  REC_UNCORRECTABLE,    // engine, round, count: pass, block, diff: as REC_CORRECTED
+  REC_GOLDEN,           // block, bits, diff: upset of the golden ciphertext
+  REC_INPUT,            // block, bits, diff: upset of the input
+  REC_HEARTBEAT,        // engine, count: blocks encrypted
+  REC_STOP              // count: seconds
+};
+
+static const char* const type_names[] = { "?", "start", "engine", "error", "burst", "corrected", "uncorrectable",
+                                          "golden", "input", "heartbeat", "stop" };
+
+struct record
+{
+  uint32_t crc;         // CRC-32 of the rest of the record
+  uint8_t type;
+  uint8_t engine;
+  uint8_t round;        // 0: not instrumented, 1 .. NR + 1, or ROUND_AFTER
+  uint8_t bits;         // bits in error
+  uint64_t time_ns;     // CLOCK_REALTIME
+  uint64_t count;
+  uint32_t block;
+  uint32_t aux;
+  uint8_t diff[16];     // output XOR golden
+};
+
+_Static_assert(sizeof(struct record) == 48, "log records are 48 bytes");
+
+struct engine
+{
+  char name[16];
+  const struct aes_backend* backend;    // NULL: the instrumented engine
+  uint64_t blocks;
+};
+
+static struct engine engines[MAX_ENGINES];
+static unsigned nengines;
+static int log_fd = -1;
+static int sync_all;
+static volatile sig_atomic_t stop;
+
+static uint32_t crc32(const uint8_t* p, size_t n)
+{
+  uint32_t crc = 0xffffffff;
+  int k;
+
+  while (n-- > 0)
+  {
+    crc ^= *p++;
+    for (k = 0; k < 8; ++k)
+    {
+      crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+    }
+  }
+  return ~crc;
+}
+
+static uint64_t wall_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static unsigned popcount(const uint8_t* p)
+{
+  unsigned i, n = 0;
+  for (i = 0; i < AES_BLOCKLEN; ++i)
+  {
+    n += (unsigned)__builtin_popcount(p[i]);
+  }
+  return n;
+}
+
+static void xor_block(uint8_t* out, const uint8_t* a, const uint8_t* b)
+{
+  unsigned i;
+  for (i = 0; i < AES_BLOCKLEN; ++i)
+  {
+    out[i] = a[i] ^ b[i];
+  }
+}
+
+static void put(uint8_t type, uint8_t engine, uint8_t round, uint64_t count, uint32_t block, uint32_t aux, const uint8_t* diff)
+{
+  struct record r;
+
+  memset(&r, 0, sizeof(r));
+  r.type = type;
+  r.engine = engine;
+  r.round = round;
+  r.time_ns = wall_ns();
+  r.count = count;
+  r.block = block;
+  r.aux = aux;
+  if (diff != NULL)
+  {
+    memcpy(r.diff, diff, sizeof(r.diff));
+    r.bits = (uint8_t)popcount(diff);
+  }
+  r.crc = crc32((const uint8_t*)&r + 4, sizeof(r) - 4);
+  if (write(log_fd, &r, sizeof(r)) != (ssize_t)sizeof(r))
+  {
+    perror("beam-test: log");
+    exit(1);
+  }
+  if (sync_all || (type == REC_HEARTBEAT) || (type == REC_STOP))
+  {
+    fdatasync(log_fd);
+  }
+}
+
+/*****************************************************************************/
+/* Patterns:                                                                 */
+/*****************************************************************************/
+static uint8_t* load_pattern(const char* kind, const char* path, size_t size, uint32_t* nblocks)
+{
+  uint64_t x = 0x9e3779b97f4a7c15ull;
+  uint8_t* pattern;
+  size_t i;
+
+  if (strcmp(kind, "input") == 0)
+  {
+    FILE* f = fopen(path, "rb");
+    uint32_t header;
+    long n;
+
+    if ((f == NULL) || (fseek(f, 0, SEEK_END) != 0) || ((n = ftell(f)) < 0) || (fseek(f, 0, SEEK_SET) != 0))
+    {
+      perror(path);
+      exit(2);
+    }
+    // input.bin: a 32-bit length, then the bytes.
+    if ((n >= 4) && (fread(&header, 4, 1, f) == 1) && (header > 0) && (header <= (uint64_t)n - 4))
+    {
+      size = header;
+    }
+    else
+    {
+      size = (size_t)n;
+      rewind(f);
+    }
+    pattern = (uint8_t*)calloc(1, size + AES_BLOCKLEN);
+    if ((pattern == NULL) || (fread(pattern, 1, size, f) != size))
+    {
+      fprintf(stderr, "beam-test: cannot read %s\n", path);
+      exit(2);
+    }
+    fclose(f);
+  }
+  else
+  {
+    pattern = (uint8_t*)calloc(1, size + AES_BLOCKLEN);
+    for (i = 0; i < size; ++i)
+    {
+      if (strcmp(kind, "zeros") == 0)
+      {
+        pattern[i] = 0x00;
+      }
+      else if (strcmp(kind, "ones") == 0)
+      {
+        pattern[i] = 0xff;
+      }
+      else if (strcmp(kind, "checker") == 0)
+      {
+        pattern[i] = (i & 1) ? 0xaa : 0x55;
+      }
+      else if (strcmp(kind, "random") == 0)
+      {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        pattern[i] = (uint8_t)x;
+      }
+      else
+      {
+        fprintf(stderr, "beam-test: unknown pattern %s\n", kind);
+        exit(2);
+      }
+    }
+  }
+  *nblocks = (uint32_t)((size + AES_BLOCKLEN - 1) / AES_BLOCKLEN);
+  if (*nblocks == 0)
+  {
+    fprintf(stderr, "beam-test: empty pattern\n");
+    exit(2);
+  }
+  return pattern;
+}
+
+/*****************************************************************************/
+/* Instrumented engine:                                                      */
+/*****************************************************************************/
+#if defined(SECDED) && (SECDED == 1)
+
+// The golden states of the current block, rounds 1 .. NR + 1; when record
+// is set they are written instead of checked.
+static uint8_t* hook_states;
+static int hook_record;
+static uint8_t hook_round;
+static uint8_t hook_diff[AES_BLOCKLEN];
+
+static void observe(uint8_t round, uint8_t* state)
+{
+  uint8_t* golden = hook_states + (size_t)(round - 1) * AES_BLOCKLEN;
+
+  if (hook_record)
+  {
+    memcpy(golden, state, AES_BLOCKLEN);
+  }
+  else if ((hook_round == 0) && (memcmp(state, golden, AES_BLOCKLEN) != 0))
+  {
+    hook_round = round;
+    xor_block(hook_diff, state, golden);
+  }
+}
+
+// Encrypts buf block by block, logging corrections; rounds[b] is the first
+// round at which block b's state was off, or 0.
+static void secded_pass(const struct AES_ctx* ctx, uint8_t* buf, uint32_t nblocks, uint8_t* states, uint8_t* rounds,
+                        uint8_t engine, uint64_t pass)
+{
+  uint32_t b;
+  int n;
+
+  AES_secded_fault = observe;
+  for (b = 0; b < nblocks; ++b)
+  {
+    hook_states = states + (size_t)b * (NR + 1) * AES_BLOCKLEN;
+    hook_round = 0;
+    n = AES_ECB_encrypt_secded(ctx, buf + (size_t)b * AES_BLOCKLEN);
+    rounds[b] = hook_round;
+    if (n > 0)
+    {
+      put(REC_CORRECTED, engine, hook_round, pass, b, (uint32_t)n, hook_diff);
+    }
+    else if (n < 0)
+    {
+      put(REC_UNCORRECTABLE, engine, hook_round, pass, b, 0, hook_diff);
+    }
+  }
+  AES_secded_fault = NULL;
+}
+
+// Records the intermediate states of every block of the pattern.
+static void secded_states(const struct AES_ctx* ctx, const uint8_t* pattern, uint32_t nblocks, uint8_t* states)
+{
+  uint8_t block[AES_BLOCKLEN];
+  uint32_t b;
+
+  AES_secded_fault = observe;
+  hook_record = 1;
+  for (b = 0; b < nblocks; ++b)
+  {
+    hook_states = states + (size_t)b * (NR + 1) * AES_BLOCKLEN;
+    memcpy(block, pattern + (size_t)b * AES_BLOCKLEN, AES_BLOCKLEN);
+    AES_ECB_encrypt_secded(ctx, block);
+  }
+  hook_record = 0;
+  AES_secded_fault = NULL;
+}
+
+#endif // #if defined(SECDED) && (SECDED == 1)
+
+/*****************************************************************************/
+/* Run:                                                                      */
+/*****************************************************************************/
+// The first block at or after from where a and b differ, or n. Four blocks
+// are compared per step.
+static uint32_t next_diff(const uint8_t* a, const uint8_t* b, uint32_t from, uint32_t n)
+{
+  const uint64_t* x;
+  const uint64_t* y;
+
+#if defined(__SSE2__)
+  for (; from + 4 <= n; from += 4)
+  {
+    const __m128i* p = (const __m128i*)(a + (size_t)from * AES_BLOCKLEN);
+    const __m128i* q = (const __m128i*)(b + (size_t)from * AES_BLOCKLEN);
+    __m128i d = _mm_or_si128(_mm_or_si128(_mm_xor_si128(_mm_loadu_si128(p), _mm_loadu_si128(q)),
+                                          _mm_xor_si128(_mm_loadu_si128(p + 1), _mm_loadu_si128(q + 1))),
+                             _mm_or_si128(_mm_xor_si128(_mm_loadu_si128(p + 2), _mm_loadu_si128(q + 2)),
+                                          _mm_xor_si128(_mm_loadu_si128(p + 3), _mm_loadu_si128(q + 3))));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(d, _mm_setzero_si128())) != 0xffff)
+    {
+      break;
+    }
+  }
+#endif
+  for (; from < n; ++from)
+  {
+    x = (const uint64_t*)(a + (size_t)from * AES_BLOCKLEN);
+    y = (const uint64_t*)(b + (size_t)from * AES_BLOCKLEN);
+    if (((x[0] ^ y[0]) | (x[1] ^ y[1])) != 0)
+    {
+      break;
+    }
+  }
+  return from;
+}
+
+static int pick_engines(const char* list)
+{
+  char names[256], *name, *save = NULL;
+  unsigned i;
+
+  if (list == NULL)
+  {
+    for (i = 0; (i < aes_backend_count()) && (nengines < MAX_ENGINES); ++i)
+    {
+      if (aes_backend_get(i)->available())
+      {
+        engines[nengines].backend = aes_backend_get(i);
+        snprintf(engines[nengines++].name, sizeof(engines[0].name), "%s", aes_backend_get(i)->name);
+      }
+    }
+#if defined(SECDED) && (SECDED == 1)
+    snprintf(engines[nengines++].name, sizeof(engines[0].name), "secded");
+#endif
+    return 0;
+  }
+  snprintf(names, sizeof(names), "%s", list);
+  for (name = strtok_r(names, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save))
+  {
+    const struct aes_backend* backend = aes_backend_find(name);
+    if (nengines == MAX_ENGINES)
+    {
+      return -1;
+    }
+#if defined(SECDED) && (SECDED == 1)
+    if (strcmp(name, "secded") == 0)
+    {
+      snprintf(engines[nengines++].name, sizeof(engines[0].name), "secded");
+      continue;
+    }
+#endif
+    if ((backend == NULL) || !backend->available())
+    {
+      fprintf(stderr, "beam-test: engine %s is unknown or not available here\n", name);
+      return -1;
+    }
+    engines[nengines].backend = backend;
+    snprintf(engines[nengines++].name, sizeof(engines[0].name), "%s", name);
+  }
+  return (nengines > 0) ? 0 : -1;
+}
+
+static void on_signal(int sig)
+{
+  (void)sig;
+  stop = 1;
+}
+
+// A buffer under test that is not an engine's: two copies and a CRC-32 per
+// block to tell which copy is right. No cipher state is involved in the
+// check, since an upset of the S-box or the key schedule would spoil that
+// too.
+struct copies
+{
+  uint8_t* data;
+  uint8_t* spare;
+  uint32_t* crc;
+};
+
+static int make_copies(struct copies* c, const uint8_t* data, uint32_t nblocks)
+{
+  uint32_t b;
+
+  c->data = (uint8_t*)malloc((size_t)nblocks * AES_BLOCKLEN);
+  c->spare = (uint8_t*)malloc((size_t)nblocks * AES_BLOCKLEN);
+  c->crc = (uint32_t*)malloc((size_t)nblocks * sizeof(uint32_t));
+  if ((c->data == NULL) || (c->spare == NULL) || (c->crc == NULL))
+  {
+    return -1;
+  }
+  memcpy(c->data, data, (size_t)nblocks * AES_BLOCKLEN);
+  memcpy(c->spare, data, (size_t)nblocks * AES_BLOCKLEN);
+  for (b = 0; b < nblocks; ++b)
+  {
+    c->crc[b] = crc32(data + (size_t)b * AES_BLOCKLEN, AES_BLOCKLEN);
+  }
+  return 0;
+}
+
+static void free_copies(struct copies* c)
+{
+  free(c->data);
+  free(c->spare);
+  free(c->crc);
+}
+
+// Checks block b of both copies, logs an upset of either as type and
+// repairs it. Returns 1 if the data copy, the one in use, was hit.
+static int check_copies(struct copies* c, uint32_t b, uint8_t type, uint8_t engine, uint64_t pass)
+{
+  uint8_t* p = c->data + (size_t)b * AES_BLOCKLEN;
+  uint8_t* q = c->spare + (size_t)b * AES_BLOCKLEN;
+  uint8_t diff[AES_BLOCKLEN];
+  const int p_ok = (crc32(p, AES_BLOCKLEN) == c->crc[b]);
+
+  if (memcmp(p, q, AES_BLOCKLEN) == 0)
+  {
+    if (!p_ok)
+    {
+      // Both copies agree: it was the CRC that took the hit.
+      c->crc[b] = crc32(p, AES_BLOCKLEN);
+    }
+    return 0;
+  }
+  xor_block(diff, p, q);
+  put(type, engine, 0, pass, b, 0, diff);
+  if (p_ok)
+  {
+    memcpy(q, p, AES_BLOCKLEN);
+    return 0;
+  }
+  memcpy(p, q, AES_BLOCKLEN);
+  return 1;
+}
+
+// Logs a block that came out wrong, unless the input or the golden block
+// was hit instead (which is logged and repaired). Returns 1 if it was the
+// engine's error.
+static int judge(struct copies* input, struct copies* golden, const uint8_t* out, uint32_t b, uint8_t engine,
+                 uint8_t round, uint64_t pass, int log_it)
+{
+  const uint8_t* gold = golden->data + (size_t)b * AES_BLOCKLEN;
+  uint8_t diff[AES_BLOCKLEN];
+  uint32_t bytes = 0;
+  unsigned i;
+
+  if (check_copies(input, b, REC_INPUT, engine, pass))
+  {
+    return 0;
+  }
+  if (check_copies(golden, b, REC_GOLDEN, engine, pass) && (memcmp(out, gold, AES_BLOCKLEN) == 0))
+  {
+    return 0;
+  }
+  xor_block(diff, out, gold);
+  for (i = 0; i < AES_BLOCKLEN; ++i)
+  {
+    bytes |= (diff[i] != 0) ? (1u << i) : 0;
+  }
+  if (log_it)
+  {
+    put(REC_ERROR, engine, round, pass, b, bytes, diff);
+  }
+  return 1;
+}
+
+static int run(const char* kind, const char* path, size_t size, const char* list, double duration)
+{
+  struct AES_ctx ctx;
+  uint8_t *pattern, *work, *states = NULL, *rounds = NULL;
+  struct copies input, golden;
+  uint8_t kcv[AES_BLOCKLEN] = { 0 };
+  uint32_t nblocks, b, bad;
+  uint64_t pass = 0;
+  double t0, beat;
+  unsigned e;
+
+  if (pick_engines(list) != 0)
+  {
+    return 2;
+  }
+  pattern = load_pattern(kind, path, size, &nblocks);
+  work = (uint8_t*)aligned_alloc(64, (size_t)nblocks * AES_BLOCKLEN + 64);
+  AES_init_ctx(&ctx, key);
+  AES_ECB_encrypt(&ctx, kcv);
+
+  // Golden ciphertext on the table engine, and every engine checked on it
+  // before the beam is on.
+  memcpy(work, pattern, (size_t)nblocks * AES_BLOCKLEN);
+  for (b = 0; b < nblocks; ++b)
+  {
+    AES_ECB_encrypt(&ctx, work + (size_t)b * AES_BLOCKLEN);
+  }
+  if ((make_copies(&input, pattern, nblocks) != 0) || (make_copies(&golden, work, nblocks) != 0))
+  {
+    fprintf(stderr, "beam-test: out of memory\n");
+    return 2;
+  }
+  free(pattern);
+  pattern = input.data;
+#if defined(SECDED) && (SECDED == 1)
+  states = (uint8_t*)malloc((size_t)nblocks * (NR + 1) * AES_BLOCKLEN);
+  rounds = (uint8_t*)calloc(nblocks, 1);
+  if ((states == NULL) || (rounds == NULL))
+  {
+    fprintf(stderr, "beam-test: out of memory\n");
+    return 2;
+  }
+  secded_states(&ctx, pattern, nblocks, states);
+#endif
+  for (e = 0; e < nengines; ++e)
+  {
+    memcpy(work, pattern, (size_t)nblocks * AES_BLOCKLEN);
+    if (engines[e].backend != NULL)
+    {
+      engines[e].backend->ecb_encrypt(&ctx, work, nblocks);
+    }
+#if defined(SECDED) && (SECDED == 1)
+    else
+    {
+      secded_pass(&ctx, work, nblocks, states, rounds, (uint8_t)e, 0);
+    }
+#endif
+    if (next_diff(work, golden.data, 0, nblocks) != nblocks)
+    {
+      fprintf(stderr, "beam-test: engine %s does not match the golden ciphertext\n", engines[e].name);
+      return 1;
+    }
+  }
+
+  put(REC_START, (uint8_t)nengines, 0, (uint64_t)nblocks * AES_BLOCKLEN, nblocks, 0, kcv);
+  for (e = 0; e < nengines; ++e)
+  {
+    uint8_t name[16] = { 0 };
+    memcpy(name, engines[e].name, strlen(engines[e].name));
+    put(REC_ENGINE, (uint8_t)e, 0, 0, 0, 0, name);
+  }
+  fprintf(stderr, "beam-test: %u blocks, %u engines, running\n", nblocks, nengines);
+
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+  t0 = now();
+  beat = t0 + 1;
+  while (!stop && ((duration <= 0) || (now() - t0 < duration)))
+  {
+    ++pass;
+    for (e = 0; e < nengines; ++e)
+    {
+      memcpy(work, pattern, (size_t)nblocks * AES_BLOCKLEN);
+      if (engines[e].backend != NULL)
+      {
+        engines[e].backend->ecb_encrypt(&ctx, work, nblocks);
+      }
+#if defined(SECDED) && (SECDED == 1)
+      else
+      {
+        secded_pass(&ctx, work, nblocks, states, rounds, (uint8_t)e, pass);
+      }
+#endif
+      engines[e].blocks += nblocks;
+      bad = 0;
+      for (b = next_diff(work, golden.data, 0, nblocks); b < nblocks; b = next_diff(work, golden.data, b + 1, nblocks))
+      {
+        const uint8_t round = (engines[e].backend != NULL) ? 0 : ((rounds[b] != 0) ? rounds[b] : ROUND_AFTER);
+        bad += (uint32_t)judge(&input, &golden, work + (size_t)b * AES_BLOCKLEN, b, (uint8_t)e, round, pass,
+                               bad < MAX_LOGGED);
+      }
+      if (bad > MAX_LOGGED)
+      {
+        put(REC_BURST, (uint8_t)e, 0, pass, 0, bad, NULL);
+      }
+    }
+    if (now() >= beat)
+    {
+      for (e = 0; e < nengines; ++e)
+      {
+        put(REC_HEARTBEAT, (uint8_t)e, 0, engines[e].blocks, 0, 0, NULL);
+      }
+      beat += 1;
+    }
+  }
+  for (e = 0; e < nengines; ++e)
+  {
+    put(REC_HEARTBEAT, (uint8_t)e, 0, engines[e].blocks, 0, 0, NULL);
+  }
+  put(REC_STOP, 0, 0, (uint64_t)(now() - t0), 0, 0, NULL);
+  for (e = 0; e < nengines; ++e)
+  {
+    fprintf(stderr, "beam-test: %-8s %.3g blocks\n", engines[e].name, (double)engines[e].blocks);
+  }
+  free_copies(&input);
+  free_copies(&golden);
+  free(work);
+  free(states);
+  free(rounds);
+  return 0;
+}
+
+/*****************************************************************************/
+/* Dump:                                                                     */
+/*****************************************************************************/
+struct tally
+{
+  char name[17];
+  uint64_t blocks, errors, bursts, corrected, uncorrectable, single, multi;
+  uint64_t by_round[NR + 3];    // 0, 1 .. NR + 1, after
+};
+
+static void summary(struct tally* tallies, unsigned n, uint64_t golden, uint64_t input, double fluence)
+{
+  unsigned e, r;
+
+  if (n == 0)
+  {
+    return;
+  }
+  printf("\n%-8s %12s %8s %8s %8s %8s %8s %8s %12s\n", "engine", "blocks", "errors", "1-bit", "multi", "bursts", "corr",
+         "uncorr", "sigma-cm2");
+  for (e = 0; e < n; ++e)
+  {
+    const struct tally* t = &tallies[e];
+    printf("%-8s %12lu %8lu %8lu %8lu %8lu %8lu %8lu", t->name, (unsigned long)t->blocks, (unsigned long)t->errors,
+           (unsigned long)t->single, (unsigned long)t->multi, (unsigned long)t->bursts, (unsigned long)t->corrected,
+           (unsigned long)t->uncorrectable);
+    if (fluence > 0)
+    {
+      printf(" %12.3e", (double)(t->errors + t->bursts) / fluence);
+    }
+    printf("\n");
+    if (t->by_round[0] < t->errors + t->corrected + t->uncorrectable)
+    {
+      printf("  by round:");
+      for (r = 1; r < NR + 3; ++r)
+      {
+        if (t->by_round[r] > 0)
+        {
+          if (r == NR + 2)
+          {
+            printf(" after=%lu", (unsigned long)t->by_round[r]);
+          }
+          else
+          {
+            printf(" %u=%lu", r, (unsigned long)t->by_round[r]);
+          }
+        }
+      }
+      printf("\n");
+    }
+  }
+  printf("golden ciphertext upsets: %lu, input upsets: %lu\n", (unsigned long)golden, (unsigned long)input);
+}
+
+static int dump(const char* path, double fluence)
+{
+  struct tally tallies[MAX_ENGINES];
+  uint64_t start_ns = 0, golden = 0, input = 0, index = 0;
+  unsigned n = 0, i;
+  struct record r;
+  FILE* f = fopen(path, "rb");
+  size_t got;
+
+  if (f == NULL)
+  {
+    perror(path);
+    return 2;
+  }
+  memset(tallies, 0, sizeof(tallies));
+  while ((got = fread(&r, 1, sizeof(r), f)) == sizeof(r))
+  {
+    struct tally* t = &tallies[r.engine % MAX_ENGINES];
+    ++index;
+    if (r.crc != crc32((const uint8_t*)&r + 4, sizeof(r) - 4))
+    {
+      printf("record %lu: bad CRC, skipped\n", (unsigned long)index - 1);
+      continue;
+    }
+    if (r.type == REC_START)
+    {
+      time_t s = (time_t)(r.time_ns / 1000000000ull);
+      char when[64];
+      summary(tallies, n, golden, input, fluence);
+      memset(tallies, 0, sizeof(tallies));
+      golden = input = 0;
+      n = (r.engine < MAX_ENGINES) ? r.engine : MAX_ENGINES;
+      start_ns = r.time_ns;
+      strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", gmtime(&s));
+      printf("%srun at %s UTC: %lu bytes, %u blocks, key check value ", (index > 1) ? "\n" : "", when,
+             (unsigned long)r.count, r.block);
+      for (i = 0; i < 3; ++i)
+      {
+        printf("%02x", r.diff[i]);
+      }
+      printf("\n");
+      continue;
+    }
+    if ((r.type == REC_ENGINE) && (r.engine < MAX_ENGINES))
+    {
+      memcpy(t->name, r.diff, sizeof(r.diff));
+      continue;
+    }
+    if (r.type == REC_HEARTBEAT)
+    {
+      t->blocks = r.count;
+      continue;
+    }
+    printf("%12.6f %-13s %-8s", (double)(r.time_ns - start_ns) * 1e-9, type_names[(r.type <= REC_STOP) ? r.type : 0],
+           (r.type == REC_STOP) ? "" : t->name);
+    switch (r.type)
+    {
+    case REC_ERROR:
+    case REC_CORRECTED:
+    case REC_UNCORRECTABLE:
+      printf(" pass %lu block %u", (unsigned long)r.count, r.block);
+      if (r.round == ROUND_AFTER)
+      {
+        printf(" after the last round");
+      }
+      else if (r.round > 0)
+      {
+        printf(" round %u", r.round);
+      }
+      printf(" %u bits ", r.bits);
+      for (i = 0; i < AES_BLOCKLEN; ++i)
+      {
+        printf("%02x", r.diff[i]);
+      }
+      t->errors += (r.type == REC_ERROR);
+      t->single += (r.type == REC_ERROR) && (r.bits == 1);
+      t->multi += (r.type == REC_ERROR) && (r.bits > 1);
+      t->corrected += (r.type == REC_CORRECTED);
+      t->uncorrectable += (r.type == REC_UNCORRECTABLE);
+      ++t->by_round[(r.round == ROUND_AFTER) ? NR + 2 : ((r.round <= NR + 1) ? r.round : 0)];
+      break;
+    case REC_BURST:
+      printf(" pass %lu: %u blocks", (unsigned long)r.count, r.aux);
+      ++t->bursts;
+      break;
+    case REC_GOLDEN:
+    case REC_INPUT:
+      printf(" block %u %u bits", r.block, r.bits);
+      golden += (r.type == REC_GOLDEN);
+      input += (r.type == REC_INPUT);
+      break;
+    case REC_STOP:
+      printf(" after %lu s", (unsigned long)r.count);
+      break;
+    }
+    printf("\n");
+  }
+  if (got != 0)
+  {
+    printf("torn record at the end (%lu bytes)\n", (unsigned long)got);
+  }
+  summary(tallies, n, golden, input, fluence);
+  fclose(f);
+  return 0;
+}
+
+int main(int argc, char** argv)
+{
+  const char *kind = "input", *path = "input.bin", *list = NULL, *log_path = "beam.log", *dump_path = NULL;
+  double duration = 0, fluence = 0;
+  size_t size = 65536;
+  struct stat st;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "p:i:n:e:d:l:SD:F:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'p': kind = optarg; break;
+    case 'i': path = optarg; break;
+    case 'n': size = (size_t)strtoul(optarg, NULL, 0); break;
+    case 'e': list = optarg; break;
+    case 'd': duration = atof(optarg); break;
+    case 'l': log_path = optarg; break;
+    case 'S': sync_all = 1; break;
+    case 'D': dump_path = optarg; break;
+    case 'F': fluence = atof(optarg); break;
+    default:
+      fprintf(stderr, "usage: %s [-p pattern] [-i input] [-n bytes] [-e engine,...] [-d seconds] [-l log] [-S]\n"
+                      "       %s -D log [-F fluence]\n", argv[0], argv[0]);
+      return 2;
+    }
+  }
+  if (dump_path != NULL)
+  {
+    return dump(dump_path, fluence);
+  }
+
+  if ((log_fd = open(log_path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0644)) < 0)
+  {
+    perror(log_path);
+    return 2;
+  }
+  // A record torn by a crash of the host would shift every later one.
+  if ((fstat(log_fd, &st) == 0) && (st.st_size % (off_t)sizeof(struct record) != 0))
+  {
+    fprintf(stderr, "beam-test: cutting a torn record off the end of %s\n", log_path);
+    if (ftruncate(log_fd, st.st_size - st.st_size % (off_t)sizeof(struct record)) != 0)
+    {
+      perror(log_path);
+      return 2;
+    }
+  }
+  return run(kind, path, size, list, duration);
+}
@@ -0,0 +1,3089 @@
+/*
+
+Benchmarks for the block engines and modes in aes.c.
+
+  usage: bench [section...]
+
+Without arguments every section runs. Each section prints its own table and
+checks its results against the reference engine; the exit status is nonzero
+if any check failed.
+
+  ctr      CTR with 32-, 64- and 128-bit counters against the block-wise
+           reference, and counters of odd widths across their wrap
+  secded   the SEC-DED protected engine against plain and duplicated
+           encryption, and a fault injection campaign on its state
+  reso     recomputation on rotated operands against plain and duplicated
+           encryption, and stuck-at faults that duplication misses
+  sbox     the table S-box engine against the constant-time circuit
+  ocb      OCB3 against CTR, after the RFC 7253 test vectors
+  siv      AES-SIV on 64 KB chunks: one call per chunk, the chunk engine,
+           and the chunk engine on a thread pool
+  gcm      GCM on one 16 MB message, serially and split over a thread
+           pool, after the SP 800-38D (McGrew-Viega) test vectors
+  pmac     PMAC1 against CMAC on one 16 MB message, serially and on a
+           thread pool, after the PMAC1 test vectors
+  fpe      FF1 and FF3-1 on 16-digit values, one call per value against
+           the batch API, after the SP 800-38G sample vectors
+  backend  every registered block engine backend at the three size
+           classes, the tuned selection and its cache file
+  stream   out-of-place CTR through the cache and with streaming stores,
+           from 1 MB up to a few times the last level cache; stores the
+           crossover as the backend streaming threshold
+  lazy     a lazily decrypted mapping of a 64 MB CTR file with 1% of its
+           pages touched, against decrypting the whole file up front
+  cache    skewed 4 KB random reads of a 64 MB CTR file of 64 KB chunks,
+           through the chunk cache and decrypting every read, and
+           concurrent misses on the same chunks
+  job      resumable file jobs in every mode: interrupted and resumed,
+           and resumed past a torn checkpoint, against one pass; the
+           cost of checkpoints at a few intervals
+  patch    re-encryption of 1000 small dirty ranges of a 32 MB CTR file
+           with 4 KB chunk tags, serially and on a thread pool, against
+           encrypting and tagging the whole file again
+  rt       time-budgeted steps in every mode against one call, and how
+           long steps of a few budgets really take
+  lockstep dual-execution lockstep in every mode and both checks against
+           one pass, with injected faults, and its CTR throughput
+           against single execution
+  diverse  the lockstep with a different backend per run, against a
+           corrupted S-box table that the same engine twice misses, and
+           its CTR throughput against each engine alone
+  tune     sweeps the thread pool tunables of the ECB, CBC and CTR drivers
+           and writes this host's profile, then compares it against the
+           built-in defaults
+
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "aes.h"
+#include "aes_backend.h"
+#include "aes_cache.h"
+#include "aes_job.h"
+#include "aes_lazy.h"
+#include "aes_lockstep.h"
+#include "aes_mt.h"
+#include "aes_patch.h"
+#include "aes_rt.h"
+
+#define ROUNDS (AES_keyExpSize / AES_BLOCKLEN - 1)
+
+static const uint8_t key[16] = { 0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c };
+
+static int failures;
+static uint64_t rng = 0x9e3779b97f4a7c15ull;
+
+static uint64_t next_random(void)
+{
+  rng ^= rng << 13;
+  rng ^= rng >> 7;
+  rng ^= rng << 17;
+  return rng;
+}
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void fill(uint8_t* p, size_t size)
+{
+  size_t i;
+  for (i = 0; i < size; ++i)
+  {
+    p[i] = (uint8_t)next_random();
+  }
+}
+
+static void check(int ok, const char* what)
+{
+  if (!ok)
+  {
+    printf("  CHECK FAILED: %s\n", what);
+    ++failures;
+  }
+}
+
+#if (defined(OCB) && (OCB == 1)) || (defined(SIV) && (SIV == 1)) || (defined(GCM) && (GCM == 1)) || \
+    (defined(PMAC) && (PMAC == 1)) || (defined(FPE) && (FPE == 1))
+static size_t unhex(const char* hex, uint8_t* out)
+{
+  size_t n = 0;
+  unsigned v;
+  for (; (hex[0] != '\0') && (sscanf(hex, "%2x", &v) == 1); hex += 2)
+  {
+    out[n++] = (uint8_t)v;
+  }
+  return n;
+}
+#endif
+
+#if (defined(SIV) && (SIV == 1)) || (defined(GCM) && (GCM == 1)) || (defined(PMAC) && (PMAC == 1))
+static int check_hex(const uint8_t* p, const char* hex)
+{
+  uint8_t want[128];
+  const size_t n = unhex(hex, want);
+  return memcmp(p, want, n) == 0;
+}
+#endif
+
+static void print_rate(const char* name, size_t bytes, double seconds, double base)
+{
+  printf("  %-24s %10.2f MB/s %8.2fx\n", name, (double)bytes / seconds / 1048576.0, seconds / base);
+}
+
+/*****************************************************************************/
+/* CTR:                                                                      */
+/*****************************************************************************/
+#if defined(CTR) && (CTR == 1) && defined(ECB) && (ECB == 1)
+
+#define CTR_BYTES (16u << 20)
+
+// One block at a time through the reference engine. The counter is the low
+// width bits of the block, any number of them: the whole block is
+// incremented byte-wise, then every bit from width up is put back.
+static void ctr_reference(const struct AES_ctx* ctx, uint8_t* iv, uint8_t* buf, size_t length, unsigned width)
+{
+  uint8_t ks[AES_BLOCKLEN], field[AES_BLOCKLEN];
+  size_t off, i;
+  unsigned bit;
+  int b;
+
+  memset(field, 0, AES_BLOCKLEN);
+  for (bit = 0; bit < width; ++bit)
+  {
+    field[AES_BLOCKLEN - 1 - bit / 8] |= (uint8_t)(1u << (bit % 8));
+  }
+  for (off = 0; off < length; off += AES_BLOCKLEN)
+  {
+    memcpy(ks, iv, AES_BLOCKLEN);
+    AES_ECB_encrypt(ctx, ks);
+    for (i = 0; (i < AES_BLOCKLEN) && (off + i < length); ++i)
+    {
+      buf[off + i] ^= ks[i];
+    }
+    memcpy(ks, iv, AES_BLOCKLEN);
+    for (b = AES_BLOCKLEN - 1; b >= 0; --b)
+    {
+      if (++ks[b] != 0)
+      {
+        break;
+      }
+    }
+    for (b = 0; b < AES_BLOCKLEN; ++b)
+    {
+      iv[b] = (uint8_t)((ks[b] & field[b]) | (iv[b] & ~field[b]));
+    }
+  }
+}
+
+static void bench_ctr(void)
+{
+  // Timed are the widths of the usual layouts; the others only checked.
+  static const unsigned widths[] = { 1, 8, 32, 63, 64, 65, 127, 128 };
+  const size_t bytes = CTR_BYTES;
+  uint8_t* plain = (uint8_t*)malloc(bytes);
+  uint8_t* expect = (uint8_t*)malloc(bytes);
+  uint8_t* data = (uint8_t*)malloc(bytes);
+  uint8_t iv[AES_BLOCKLEN], ref_iv[AES_BLOCKLEN];
+  struct AES_ctx ctx;
+  char name[32];
+  double t0, t_ref = 0, t;
+  size_t w, k;
+  int bad;
+
+  fill(plain, bytes);
+  AES_init_ctx(&ctx, key);
+  printf("ctr: %u MB\n", (unsigned)(bytes >> 20));
+  for (w = 0; w < sizeof(widths) / sizeof(widths[0]); ++w)
+  {
+    // Start three blocks short of the wrap (for a 1-bit counter, one), with
+    // every nonce bit set, so that a carry leaking out of the counter field
+    // would show.
+    memset(iv, 0xff, AES_BLOCKLEN);
+    iv[AES_BLOCKLEN - 1] = 0xfd;
+    bad = 0;
+    for (k = 1; k < 100; k += 7)
+    {
+      memcpy(ref_iv, iv, AES_BLOCKLEN);
+      memcpy(expect, plain, k * 5);
+      ctr_reference(&ctx, ref_iv, expect, k * 5, widths[w]);
+      AES_ctx_set_iv(&ctx, iv);
+      memcpy(data, plain, k * 5);
+      AES_CTR_xcrypt_buffer_width(&ctx, data, (uint32_t)(k * 5), (uint8_t)widths[w]);
+      bad |= (memcmp(data, expect, k * 5) != 0) || (memcmp(ctx.Iv, ref_iv, AES_BLOCKLEN) != 0);
+    }
+    snprintf(name, sizeof(name), "CTR counter width %u", widths[w]);
+    check(!bad, name);
+    if ((widths[w] != 32) && (widths[w] != 64) && (widths[w] != 128))
+    {
+      continue;
+    }
+
+    memcpy(ref_iv, iv, AES_BLOCKLEN);
+    memcpy(expect, plain, bytes);
+    t0 = now();
+    ctr_reference(&ctx, ref_iv, expect, bytes, widths[w]);
+    t = now() - t0;
+    if (t_ref == 0)
+    {
+      t_ref = t;
+      print_rate("block-wise reference", bytes, t_ref, t_ref);
+    }
+    AES_ctx_set_iv(&ctx, iv);
+    memcpy(data, plain, bytes);
+    t0 = now();
+    AES_CTR_xcrypt_buffer_width(&ctx, data, (uint32_t)bytes, (uint8_t)widths[w]);
+    t = now() - t0;
+    check(memcmp(data, expect, bytes) == 0, "CTR counter width, long run");
+    snprintf(name, sizeof(name), "%u-bit counter", widths[w]);
+    print_rate(name, bytes, t, t_ref);
+  }
+  printf("\n");
+
+  free(plain);
+  free(expect);
+  free(data);
+}
+
+#endif // #if defined(CTR) && (CTR == 1) && defined(ECB) && (ECB == 1)
+
+/*****************************************************************************/
+/* SEC-DED engine:                                                           */
+/*****************************************************************************/
+#if defined(SECDED) && (SECDED == 1)
+
+#define SECDED_BLOCKS 16384
+#define SECDED_TRIALS 20000
+
+static struct
+{
+  uint8_t round;
+  unsigned n;
+  unsigned bit[2];
+} fault;
+
+static void inject(uint8_t round, uint8_t* state)
+{
+  unsigned i;
+  if (round == fault.round)
+  {
+    for (i = 0; i < fault.n; ++i)
+    {
+      state[fault.bit[i] >> 3] ^= (uint8_t)(1u << (fault.bit[i] & 7));
+    }
+  }
+}
+
+// Runs trials with n flips per trial. When same_column is set, both flips
+// land in one column, which the code can only detect.
+static void campaign(const struct AES_ctx* ctx, unsigned n, int same_column, const char* name)
+{
+  unsigned trial, corrected = 0, detected = 0, silent = 0, benign = 0;
+  uint8_t in[AES_BLOCKLEN], ref[AES_BLOCKLEN], out[AES_BLOCKLEN];
+  int r;
+
+  AES_secded_fault = inject;
+  for (trial = 0; trial < SECDED_TRIALS; ++trial)
+  {
+    fill(in, sizeof(in));
+    memcpy(ref, in, sizeof(in));
+    AES_ECB_encrypt(ctx, ref);
+
+    fault.round = (uint8_t)(1 + next_random() % (ROUNDS + 1));
+    fault.n = n;
+    fault.bit[0] = (unsigned)(next_random() % 128);
+    do
+    {
+      fault.bit[1] = same_column ? (fault.bit[0] & ~31u) | (unsigned)(next_random() % 32)
+                                 : (unsigned)(next_random() % 128);
+    } while ((n > 1) && ((fault.bit[1] == fault.bit[0]) || (!same_column && ((fault.bit[1] >> 5) == (fault.bit[0] >> 5)))));
+
+    memcpy(out, in, sizeof(in));
+    r = AES_ECB_encrypt_secded(ctx, out);
+    if (r < 0)
+    {
+      ++detected;
+    }
+    else if (memcmp(out, ref, sizeof(out)) != 0)
+    {
+      ++silent;
+    }
+    else if (r > 0)
+    {
+      ++corrected;
+    }
+    else
+    {
+      ++benign;
+    }
+  }
+  AES_secded_fault = NULL;
+
+  printf("  %-24s %10u %10u %10u %10u\n", name, corrected, detected, silent, benign);
+  check(silent == 0, "SEC-DED let a fault through");
+  if (same_column)
+  {
+    check(detected == SECDED_TRIALS, "SEC-DED did not detect a double error");
+  }
+  else
+  {
+    check(corrected == SECDED_TRIALS, "SEC-DED did not correct every fault");
+  }
+}
+
+static void bench_secded(void)
+{
+  const size_t bytes = SECDED_BLOCKS * AES_BLOCKLEN;
+  uint8_t* data = (uint8_t*)malloc(bytes);
+  uint8_t* ref = (uint8_t*)malloc(bytes);
+  uint8_t* copy = (uint8_t*)malloc(bytes);
+  struct AES_ctx ctx;
+  double t0, base, t_secded, t_dup;
+  size_t i;
+  int bad = 0;
+
+  AES_init_ctx(&ctx, key);
+  fill(ref, bytes);
+  memcpy(data, ref, bytes);
+
+  t0 = now();
+  for (i = 0; i < bytes; i += AES_BLOCKLEN)
+  {
+    AES_ECB_encrypt(&ctx, ref + i);
+  }
+  base = now() - t0;
+
+  t0 = now();
+  for (i = 0; i < bytes; i += AES_BLOCKLEN)
+  {
+    bad |= (AES_ECB_encrypt_secded(&ctx, data + i) != 0);
+  }
+  t_secded = now() - t0;
+  check(!bad && (memcmp(data, ref, bytes) == 0), "SEC-DED ciphertext differs");
+
+  // Duplication: encrypt twice and compare, which detects but cannot say
+  // which copy is right, so a mismatch costs a third run to vote.
+  fill(data, bytes);
+  t0 = now();
+  for (i = 0; i < bytes; i += AES_BLOCKLEN)
+  {
+    memcpy(copy + i, data + i, AES_BLOCKLEN);
+    AES_ECB_encrypt(&ctx, data + i);
+    AES_ECB_encrypt(&ctx, copy + i);
+    bad |= (memcmp(data + i, copy + i, AES_BLOCKLEN) != 0);
+  }
+  t_dup = now() - t0;
+  check(!bad, "duplicated encryption disagreed without faults");
+
+  printf("secded: %u blocks\n", SECDED_BLOCKS);
+  print_rate("plain", bytes, base, base);
+  print_rate("sec-ded", bytes, t_secded, base);
+  print_rate("duplication", bytes, t_dup, base);
+
+  printf("\n  %-24s %10s %10s %10s %10s\n", "faults per block", "corrected", "detected", "silent", "benign");
+  campaign(&ctx, 1, 0, "1 bit");
+  campaign(&ctx, 2, 0, "2 bits, 2 columns");
+  campaign(&ctx, 2, 1, "2 bits, 1 column");
+  printf("\n");
+
+  free(data);
+  free(ref);
+  free(copy);
+}
+
+#endif // #if defined(SECDED) && (SECDED == 1)
+
+/*****************************************************************************/
+/* Recomputation with rotated operands:                                      */
+/*****************************************************************************/
+#if defined(RESO) && (RESO == 1) && defined(ECB) && (ECB == 1)
+
+#define RESO_BLOCKS 16384
+#define RESO_FAULT_BLOCKS 64
+
+// A stuck-at fault: bit stuck_bit of byte stuck_byte of every block, at
+// stuck_value, wherever the engine keeps the block. It is permanent, so
+// both runs meet it.
+static unsigned stuck_byte, stuck_bit, stuck_value;
+
+static void stuck(uint8_t* block)
+{
+  const uint8_t mask = (uint8_t)(1u << stuck_bit);
+  block[stuck_byte] = stuck_value ? (uint8_t)(block[stuck_byte] | mask) : (uint8_t)(block[stuck_byte] & ~mask);
+}
+
+static void reso_stuck(uint8_t run, uint8_t* block)
+{
+  (void)run;
+  stuck(block);
+}
+
+static void bench_reso(void)
+{
+  const size_t bytes = RESO_BLOCKS * AES_BLOCKLEN;
+  const size_t fault_bytes = RESO_FAULT_BLOCKS * AES_BLOCKLEN;
+  uint8_t* data = (uint8_t*)malloc(bytes);
+  uint8_t* ref = (uint8_t*)malloc(bytes);
+  uint8_t* copy = (uint8_t*)malloc(bytes);
+  unsigned counts[2][3] = { { 0 } };   // duplication, reso: detected, silent, benign
+  struct AES_ctx ctx;
+  double t0, base, t_reso, t_dup;
+  size_t i;
+  int bad = 0;
+
+  AES_init_ctx(&ctx, key);
+  fill(ref, bytes);
+  memcpy(data, ref, bytes);
+
+  // Whole batches and a short last one, both ways.
+  for (i = 1; i <= 9; i += 4)
+  {
+    memcpy(copy, ref, i * AES_BLOCKLEN);
+    AES_ECB_encrypt_blocks(&ctx, copy, (uint32_t)i);
+    bad |= (AES_ECB_encrypt_blocks_reso(&ctx, data, (uint32_t)i) != 0) || (memcmp(data, copy, i * AES_BLOCKLEN) != 0);
+    bad |= (AES_ECB_decrypt_blocks_reso(&ctx, data, (uint32_t)i) != 0) || (memcmp(data, ref, i * AES_BLOCKLEN) != 0);
+  }
+  check(!bad, "RESO differs from the multi-block engine");
+
+  t0 = now();
+  AES_ECB_encrypt_blocks(&ctx, ref, RESO_BLOCKS);
+  base = now() - t0;
+
+  t0 = now();
+  bad |= (AES_ECB_encrypt_blocks_reso(&ctx, data, RESO_BLOCKS) != 0);
+  t_reso = now() - t0;
+  check(!bad && (memcmp(data, ref, bytes) == 0), "RESO ciphertext differs");
+
+  fill(data, bytes);
+  t0 = now();
+  memcpy(copy, data, bytes);
+  AES_ECB_encrypt_blocks(&ctx, data, RESO_BLOCKS);
+  AES_ECB_encrypt_blocks(&ctx, copy, RESO_BLOCKS);
+  bad |= (memcmp(data, copy, bytes) != 0);
+  t_dup = now() - t0;
+  check(!bad, "duplicated encryption disagreed without faults");
+
+  printf("reso: %u blocks\n", RESO_BLOCKS);
+  print_rate("plain", bytes, base, base);
+  print_rate("reso", bytes, t_reso, base);
+  print_rate("duplication", bytes, t_dup, base);
+
+  // Every stuck-at fault of the 128 state bits, on RESO_FAULT_BLOCKS
+  // blocks: duplication runs into it the same way twice, RESO on another
+  // byte of the data in each run.
+  fill(ref, fault_bytes);
+  for (stuck_byte = 0; stuck_byte < AES_BLOCKLEN; ++stuck_byte)
+  {
+    for (stuck_bit = 0; stuck_bit < 8; ++stuck_bit)
+    {
+      for (stuck_value = 0; stuck_value < 2; ++stuck_value)
+      {
+        int r, differ = 0, wrong = 0;
+
+        memcpy(data, ref, fault_bytes);
+        AES_ECB_encrypt_blocks(&ctx, data, RESO_FAULT_BLOCKS);
+        for (i = 0; i < fault_bytes; i += AES_BLOCKLEN)
+        {
+          uint8_t a[AES_BLOCKLEN], b[AES_BLOCKLEN];
+          memcpy(a, ref + i, AES_BLOCKLEN);
+          memcpy(b, ref + i, AES_BLOCKLEN);
+          stuck(a);
+          stuck(b);
+          AES_ECB_encrypt(&ctx, a);
+          AES_ECB_encrypt(&ctx, b);
+          stuck(a);
+          stuck(b);
+          differ |= (memcmp(a, b, AES_BLOCKLEN) != 0);
+          wrong |= (memcmp(a, data + i, AES_BLOCKLEN) != 0);
+        }
+        ++counts[0][differ ? 0 : (wrong ? 1 : 2)];
+
+        memcpy(copy, ref, fault_bytes);
+        AES_reso_fault = reso_stuck;
+        r = AES_ECB_encrypt_blocks_reso(&ctx, copy, RESO_FAULT_BLOCKS);
+        AES_reso_fault = NULL;
+        wrong = (memcmp(copy, data, fault_bytes) != 0);
+        ++counts[1][(r != 0) ? 0 : (wrong ? 1 : 2)];
+      }
+    }
+  }
+  printf("\n  %-24s %10s %10s %10s\n", "stuck-at faults", "detected", "silent", "benign");
+  printf("  %-24s %10u %10u %10u\n", "duplication", counts[0][0], counts[0][1], counts[0][2]);
+  printf("  %-24s %10u %10u %10u\n", "reso", counts[1][0], counts[1][1], counts[1][2]);
+  printf("\n");
+  check(counts[1][1] == 0, "RESO let a stuck-at fault through");
+
+  free(data);
+  free(ref);
+  free(copy);
+}
+
+#endif // #if defined(RESO) && (RESO == 1) && defined(ECB) && (ECB == 1)
+
+/*****************************************************************************/
+/* S-box circuit:                                                            */
+/*****************************************************************************/
+#if defined(ECB) && (ECB == 1)
+
+#define SBOX_BLOCKS 16384
+
+static double time_blocks(void (*fn)(const struct AES_ctx*, uint8_t*), const struct AES_ctx* ctx, uint8_t* buf, size_t bytes)
+{
+  double t0 = now();
+  size_t i;
+  for (i = 0; i < bytes; i += AES_BLOCKLEN)
+  {
+    fn(ctx, buf + i);
+  }
+  return now() - t0;
+}
+
+static void bench_sbox(void)
+{
+  const size_t bytes = SBOX_BLOCKS * AES_BLOCKLEN;
+  uint8_t* plain = (uint8_t*)malloc(bytes);
+  uint8_t* table = (uint8_t*)malloc(bytes);
+  uint8_t* circuit = (uint8_t*)malloc(bytes);
+  struct AES_ctx ctx, ct;
+  double te, tc, td, tdc;
+
+  AES_init_ctx(&ctx, key);
+  AES_init_ctx_ct(&ct, key);
+  check(memcmp(ctx.RoundKey, ct.RoundKey, sizeof(ct.RoundKey)) == 0, "S-box circuit key expansion differs");
+  fill(plain, bytes);
+  memcpy(table, plain, bytes);
+  memcpy(circuit, plain, bytes);
+
+  te = time_blocks(AES_ECB_encrypt, &ctx, table, bytes);
+  tc = time_blocks(AES_ECB_encrypt_ct, &ct, circuit, bytes);
+  check(memcmp(table, circuit, bytes) == 0, "S-box circuit encryption differs");
+  td = time_blocks(AES_ECB_decrypt, &ctx, table, bytes);
+  tdc = time_blocks(AES_ECB_decrypt_ct, &ct, circuit, bytes);
+  check(memcmp(table, plain, bytes) == 0, "table decryption does not round-trip");
+  check(memcmp(circuit, plain, bytes) == 0, "S-box circuit decryption does not round-trip");
+
+  printf("sbox: %u blocks\n", SBOX_BLOCKS);
+  print_rate("table encrypt", bytes, te, te);
+  print_rate("circuit encrypt", bytes, tc, te);
+  print_rate("table decrypt", bytes, td, td);
+  print_rate("circuit decrypt", bytes, tdc, td);
+  printf("\n");
+
+  free(plain);
+  free(table);
+  free(circuit);
+}
+
+#endif // #if defined(ECB) && (ECB == 1)
+
+/*****************************************************************************/
+/* OCB:                                                                      */
+/*****************************************************************************/
+#if defined(OCB) && (OCB == 1)
+
+#define OCB_BYTES (1 << 20)
+
+// RFC 7253 appendix A, with K = 000102030405060708090A0B0C0D0E0F.
+static const struct
+{
+  const char* nonce;
+  const char* ad;
+  const char* plain;
+  const char* cipher;   // ciphertext || tag
+} ocb_vectors[] =
+{
+  { "BBAA99887766554433221100", "", "", "785407BFFFC8AD9EDCC5520AC9111EE6" },
+  { "BBAA99887766554433221101", "0001020304050607", "0001020304050607", "6820B3657B6F615A5725BDA0D3B4EB3A257C9AF1F8F03009" },
+  { "BBAA99887766554433221102", "0001020304050607", "", "81017F8203F081277152FADE694A0A00" },
+  { "BBAA99887766554433221103", "", "0001020304050607", "45DD69F8F5AAE72414054CD1F35D82760B2CD00D2F99BFA9" },
+  { "BBAA99887766554433221104", "000102030405060708090A0B0C0D0E0F", "000102030405060708090A0B0C0D0E0F",
+    "571D535B60B277188BE5147170A9A22C3AD7A4FF3835B8C5701C1CCEC8FC3358" },
+  { "BBAA9988776655443322110F", "",
+    "000102030405060708090A0B0C0D0E0F101112131415161718191A1B1C1D1E1F2021222324252627",
+    "4412923493C57D5DE0D700F753CCE0D1D2D95060122E9F15A5DDBFC5787E50B5CC55EE507BCB084E479AD363AC366B95A98CA5F3000B1479" },
+};
+
+// The iterative check of RFC 7253 appendix A: 384 encryptions over lengths
+// 0..127, then one more over all of their outputs.
+static void ocb_iterative(uint8_t tag_len, const char* expect)
+{
+  uint8_t* c = (uint8_t*)malloc(128 * 3 * (127 + 16) + 16);
+  uint8_t k[AES_KEYLEN], nonce[12], s[128], tag[16], want[16];
+  struct AES_ocb_ctx ctx;
+  size_t len = 0;
+  unsigned i, j, n;
+
+  memset(k, 0, sizeof(k));
+  k[AES_KEYLEN - 1] = (uint8_t)(tag_len * 8);
+  AES_OCB_init_ctx(&ctx, k);
+  memset(s, 0, sizeof(s));
+  memset(nonce, 0, sizeof(nonce));
+
+  for (i = 0; i < 128; ++i)
+  {
+    for (j = 1; j <= 3; ++j)
+    {
+      n = 3 * i + j;
+      nonce[10] = (uint8_t)(n >> 8);
+      nonce[11] = (uint8_t)n;
+      memcpy(c + len, s, (j != 3) ? i : 0);
+      AES_OCB_encrypt(&ctx, nonce, sizeof(nonce), s, (j != 2) ? i : 0, c + len, (j != 3) ? i : 0, tag, tag_len);
+      len += (j != 3) ? i : 0;
+      memcpy(c + len, tag, tag_len);
+      len += tag_len;
+    }
+  }
+  nonce[10] = 385 >> 8;
+  nonce[11] = 385 & 0xff;
+  AES_OCB_encrypt(&ctx, nonce, sizeof(nonce), c, (uint32_t)len, NULL, 0, tag, tag_len);
+  unhex(expect, want);
+  check(memcmp(tag, want, tag_len) == 0, "OCB iterative test vector");
+  free(c);
+}
+
+static void bench_ocb(void)
+{
+  static const uint8_t ocb_key[16] = { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f };
+  const size_t nvec = sizeof(ocb_vectors) / sizeof(ocb_vectors[0]);
+  uint8_t nonce[15], ad[64], buf[64], want[80], tag[16];
+  uint8_t* data = (uint8_t*)malloc(OCB_BYTES);
+  struct AES_ocb_ctx ocb;
+  struct AES_ctx ctx;
+  size_t v, nn, na, np;
+  double t0, t_ctr, t_ocb, t_dec;
+  int bad = 0;
+
+  AES_OCB_init_ctx(&ocb, ocb_key);
+  for (v = 0; v < nvec; ++v)
+  {
+    nn = unhex(ocb_vectors[v].nonce, nonce);
+    na = unhex(ocb_vectors[v].ad, ad);
+    np = unhex(ocb_vectors[v].plain, buf);
+    unhex(ocb_vectors[v].cipher, want);
+    AES_OCB_encrypt(&ocb, nonce, (uint8_t)nn, ad, (uint32_t)na, buf, (uint32_t)np, tag, 16);
+    bad |= (memcmp(buf, want, np) != 0) || (memcmp(tag, want + np, 16) != 0);
+    bad |= (AES_OCB_decrypt(&ocb, nonce, (uint8_t)nn, ad, (uint32_t)na, buf, (uint32_t)np, tag, 16) != 0);
+    unhex(ocb_vectors[v].plain, want);
+    bad |= (memcmp(buf, want, np) != 0);
+    tag[0] ^= 1;
+    bad |= (AES_OCB_decrypt(&ocb, nonce, (uint8_t)nn, ad, (uint32_t)na, buf, (uint32_t)np, tag, 16) != -1);
+  }
+  check(!bad, "OCB test vectors");
+
+  // Out-of-range nonce and tag lengths are refused before buf is touched.
+  memset(nonce, 0, sizeof(nonce));
+  memset(buf, 0x5a, sizeof(buf));
+  bad = (AES_OCB_encrypt(&ocb, nonce, 0, NULL, 0, buf, sizeof(buf), tag, 16) != -1);
+  bad |= (AES_OCB_encrypt(&ocb, nonce, 16, NULL, 0, buf, sizeof(buf), tag, 16) != -1);
+  bad |= (AES_OCB_encrypt(&ocb, nonce, 12, NULL, 0, buf, sizeof(buf), tag, 0) != -1);
+  bad |= (AES_OCB_encrypt(&ocb, nonce, 12, NULL, 0, buf, sizeof(buf), tag, 17) != -1);
+  bad |= (AES_OCB_decrypt(&ocb, nonce, 16, NULL, 0, buf, sizeof(buf), tag, 16) != -1);
+  bad |= (AES_OCB_decrypt(&ocb, nonce, 12, NULL, 0, buf, sizeof(buf), tag, 17) != -1);
+  for (v = 0; v < sizeof(buf); ++v)
+  {
+    bad |= (buf[v] != 0x5a);
+  }
+  check(!bad, "OCB refuses bad nonce and tag lengths");
+  ocb_iterative(16, "67E944D23256C5E0B6C61FA22FDF1EA2");
+  ocb_iterative(12, "77A3D8E73589158D25D01209");
+  ocb_iterative(8, "192C9B7BD90BA06A");
+
+  fill(data, OCB_BYTES);
+  memset(nonce, 0, sizeof(nonce));
+  AES_init_ctx_iv(&ctx, ocb_key, nonce);
+  t0 = now();
+  AES_CTR_xcrypt_buffer(&ctx, data, OCB_BYTES);
+  t_ctr = now() - t0;
+
+  t0 = now();
+  AES_OCB_encrypt(&ocb, nonce, 12, NULL, 0, data, OCB_BYTES, tag, 16);
+  t_ocb = now() - t0;
+  t0 = now();
+  check(AES_OCB_decrypt(&ocb, nonce, 12, NULL, 0, data, OCB_BYTES, tag, 16) == 0, "OCB round trip");
+  t_dec = now() - t0;
+
+  printf("ocb: %u bytes, %u test vectors passed\n", OCB_BYTES, bad ? 0 : (unsigned)nvec + 3);
+  print_rate("ctr", OCB_BYTES, t_ctr, t_ctr);
+  print_rate("ocb encrypt", OCB_BYTES, t_ocb, t_ctr);
+  print_rate("ocb decrypt", OCB_BYTES, t_dec, t_ctr);
+  printf("\n");
+
+  free(data);
+}
+
+#endif // #if defined(OCB) && (OCB == 1)
+
+/*****************************************************************************/
+/* SIV:                                                                      */
+/*****************************************************************************/
+#if defined(SIV) && (SIV == 1)
+
+#define SIV_CHUNK 65536
+#define SIV_CHUNKS 64
+
+// RFC 4493 section 4 and RFC 5297 appendix A.
+static void siv_vectors(void)
+{
+  static const char* cmac_msg = "6BC1BEE22E409F96E93D7E117393172AAE2D8A571E03AC9C9EB76FAC45AF8E51"
+                                "30C81C46A35CE411E5FBC1191A0A52EFF69F2445DF4F9B17AD2B417BE66C3710";
+  uint8_t k[AES_SIV_KEYLEN], msg[64], mac[16], buf[64], siv[16];
+  uint8_t ad1[40], ad2[16], nonce[16];
+  const uint8_t* ad[3];
+  uint32_t ad_len[3];
+  struct AES_siv_ctx siv_ctx;
+  struct AES_ctx ctx;
+  size_t n;
+  int bad = 0;
+
+  AES_init_ctx(&ctx, key);
+  unhex(cmac_msg, msg);
+  AES_CMAC(&ctx, msg, 0, mac);
+  bad |= !check_hex(mac, "BB1D6929E95937287FA37D129B756746");
+  AES_CMAC(&ctx, msg, 16, mac);
+  bad |= !check_hex(mac, "070A16B46B4D4144F79BDD9DD04A287C");
+  AES_CMAC(&ctx, msg, 40, mac);
+  bad |= !check_hex(mac, "DFA66747DE9AE63030CA32611497C827");
+  AES_CMAC(&ctx, msg, 64, mac);
+  bad |= !check_hex(mac, "51F0BEBF7E3B9D92FC49741779363CFE");
+  check(!bad, "CMAC test vectors");
+
+  // A.1: deterministic authenticated encryption.
+  unhex("FFFEFDFCFBFAF9F8F7F6F5F4F3F2F1F0F0F1F2F3F4F5F6F7F8F9FAFBFCFDFEFF", k);
+  AES_SIV_init_ctx(&siv_ctx, k);
+  ad_len[0] = (uint32_t)unhex("101112131415161718191A1B1C1D1E1F2021222324252627", ad1);
+  ad[0] = ad1;
+  n = unhex("112233445566778899AABBCCDDEE", buf);
+  AES_SIV_encrypt(&siv_ctx, ad, ad_len, 1, buf, (uint32_t)n, siv);
+  bad |= !check_hex(siv, "85632D07C6E8F37F950ACD320A2ECC93") || !check_hex(buf, "40C02B9690C4DC04DAEF7F6AFE5C");
+  bad |= (AES_SIV_decrypt(&siv_ctx, ad, ad_len, 1, buf, (uint32_t)n, siv) != 0) || !check_hex(buf, "112233445566778899AABBCCDDEE");
+  siv[15] ^= 1;
+  bad |= (AES_SIV_decrypt(&siv_ctx, ad, ad_len, 1, buf, (uint32_t)n, siv) != -1);
+
+  // A.2: nonce-based, with two associated data strings and the nonce.
+  unhex("7F7E7D7C7B7A79787776757473727170404142434445464748494A4B4C4D4E4F", k);
+  AES_SIV_init_ctx(&siv_ctx, k);
+  ad_len[0] = (uint32_t)unhex("00112233445566778899AABBCCDDEEFFDEADDADADEADDADAFFEEDDCCBBAA99887766554433221100", ad1);
+  ad_len[1] = (uint32_t)unhex("102030405060708090A0", ad2);
+  ad_len[2] = (uint32_t)unhex("09F911029D74E35BD84156C5635688C0", nonce);
+  ad[1] = ad2;
+  ad[2] = nonce;
+  n = unhex("7468697320697320736F6D6520706C61696E7465787420746F20656E6372797074207573696E67205349562D414553", buf);
+  AES_SIV_encrypt(&siv_ctx, ad, ad_len, 3, buf, (uint32_t)n, siv);
+  bad |= !check_hex(siv, "7BDB6E3B432667EB06F4D14BFF2FBD0F")
+      || !check_hex(buf, "CB900F2FDDBE404326601965C889BF17DBA77CEB094FA663B7A3F748BA8AF829EA64AD544A272E9C485B62A3FD5C0D");
+  check(!bad, "SIV test vectors");
+}
+
+static void bench_siv(void)
+{
+  const size_t bytes = (size_t)SIV_CHUNK * SIV_CHUNKS;
+  uint8_t* plain = (uint8_t*)malloc(bytes);
+  uint8_t* serial = (uint8_t*)malloc(bytes);
+  uint8_t* data = (uint8_t*)malloc(bytes);
+  struct AES_siv_chunk chunks[SIV_CHUNKS];
+  uint8_t sivs[SIV_CHUNKS][AES_BLOCKLEN];
+  uint8_t k[AES_SIV_KEYLEN];
+  struct AES_siv_ctx ctx;
+  struct aes_pool* pool;
+  double t0, t_serial, t_chunks, t_pool;
+  uint32_t i;
+  int bad = 0;
+
+  siv_vectors();
+
+  fill(k, sizeof(k));
+  AES_SIV_init_ctx(&ctx, k);
+  fill(plain, bytes);
+  // Make every other chunk a duplicate of the one before it, as in a store
+  // with duplicated data: their ciphertexts must come out identical.
+  for (i = 1; i < SIV_CHUNKS; i += 2)
+  {
+    memcpy(plain + (size_t)i * SIV_CHUNK, plain + (size_t)(i - 1) * SIV_CHUNK, SIV_CHUNK);
+  }
+
+  memcpy(serial, plain, bytes);
+  t0 = now();
+  for (i = 0; i < SIV_CHUNKS; ++i)
+  {
+    AES_SIV_encrypt(&ctx, NULL, NULL, 0, serial + (size_t)i * SIV_CHUNK, SIV_CHUNK, sivs[i]);
+  }
+  t_serial = now() - t0;
+  for (i = 1; i < SIV_CHUNKS; i += 2)
+  {
+    bad |= (memcmp(sivs[i], sivs[i - 1], AES_BLOCKLEN) != 0);
+    bad |= (memcmp(serial + (size_t)i * SIV_CHUNK, serial + (size_t)(i - 1) * SIV_CHUNK, SIV_CHUNK) != 0);
+  }
+  check(!bad, "SIV is not deterministic");
+
+  memcpy(data, plain, bytes);
+  for (i = 0; i < SIV_CHUNKS; ++i)
+  {
+    chunks[i].buf = data + (size_t)i * SIV_CHUNK;
+    chunks[i].length = SIV_CHUNK;
+    chunks[i].ad = NULL;
+    chunks[i].ad_len = 0;
+  }
+  t0 = now();
+  AES_SIV_encrypt_chunks(&ctx, chunks, SIV_CHUNKS);
+  t_chunks = now() - t0;
+  for (i = 0; i < SIV_CHUNKS; ++i)
+  {
+    bad |= (memcmp(chunks[i].siv, sivs[i], AES_BLOCKLEN) != 0);
+  }
+  check(!bad && (memcmp(data, serial, bytes) == 0), "SIV chunk engine differs from AES_SIV_encrypt()");
+
+  pool = aes_pool_create(0);
+  memcpy(data, plain, bytes);
+  t0 = now();
+  aes_mt_siv_encrypt(pool, &ctx, chunks, SIV_CHUNKS);
+  t_pool = now() - t0;
+  check(memcmp(data, serial, bytes) == 0, "SIV on the thread pool differs");
+
+  chunks[3].buf[100] ^= 1;
+  check(aes_mt_siv_decrypt(pool, &ctx, chunks, SIV_CHUNKS) == 1, "SIV decryption did not catch one bad chunk");
+  for (i = 0; i < SIV_CHUNKS; ++i)
+  {
+    bad |= (i != 3) && (memcmp(chunks[i].buf, plain + (size_t)i * SIV_CHUNK, SIV_CHUNK) != 0);
+  }
+  check(!bad && (chunks[3].status == -1), "SIV round trip on the thread pool");
+
+  printf("siv: %u chunks of %u bytes, %u threads\n", SIV_CHUNKS, SIV_CHUNK, aes_pool_threads(pool));
+  print_rate("one call per chunk", bytes, t_serial, t_serial);
+  print_rate("chunk engine", bytes, t_chunks, t_serial);
+  print_rate("chunk engine, pool", bytes, t_pool, t_serial);
+  printf("\n");
+
+  aes_pool_destroy(pool);
+  free(plain);
+  free(serial);
+  free(data);
+}
+
+#endif // #if defined(SIV) && (SIV == 1)
+
+/*****************************************************************************/
+/* GCM:                                                                      */
+/*****************************************************************************/
+#if defined(GCM) && (GCM == 1)
+
+#define GCM_BYTES (16u << 20)
+
+// Test cases 1 to 6 of the GCM specification (AES-128).
+static void gcm_vectors(void)
+{
+  static const char* k3 = "FEFFE9928665731C6D6A8F9467308308";
+  static const char* p3 = "D9313225F88406E5A55909C5AFF5269A86A7A9531534F7DA2E4C303D8A318A72"
+                          "1C3C0C95956809532FCF0E2449A6B525B16AEDF5AA0DE657BA637B391AAFD255";
+  static const char* c3 = "42831EC2217774244B7221B784D0D49CE3AA212F2C02A4E035C17E2329ACA12E"
+                          "21D514B25466931C7D8F6A5AAC84AA051BA30B396A0AAC973D58E091473F5985";
+  static const char* ad4 = "FEEDFACEDEADBEEFFEEDFACEDEADBEEFABADDAD2";
+  static const struct
+  {
+    const char* key;
+    const char* iv;
+    const char* ad;
+    const char* plain;
+    const char* cipher;
+    uint32_t length;
+    const char* tag;
+  } tests[] =
+  {
+    { "00000000000000000000000000000000", "000000000000000000000000", "", "", "", 0,
+      "58E2FCCEFA7E3061367F1D57A4E7455A" },
+    { "00000000000000000000000000000000", "000000000000000000000000", "",
+      "00000000000000000000000000000000", "0388DACE60B6A392F328C2B971B2FE78", 16,
+      "AB6E47D42CEC13BDF53A67B21257BDDF" },
+    { NULL, "CAFEBABEFACEDBADDECAF888", "", NULL, NULL, 64, "4D5C2AF327CD64A62CF35ABD2BA6FAB4" },
+    { NULL, "CAFEBABEFACEDBADDECAF888", NULL, NULL,
+      "42831EC2217774244B7221B784D0D49CE3AA212F2C02A4E035C17E2329ACA12E"
+      "21D514B25466931C7D8F6A5AAC84AA051BA30B396A0AAC973D58E091", 60,
+      "5BC94FBC3221A5DB94FAE95AE7121A47" },
+    { NULL, "CAFEBABEFACEDBAD", NULL, NULL,
+      "61353B4C2806934A777FF51FA22A4755699B2A714FCDC6F83766E5F97B6C7423"
+      "73806900E49F24B22B097544D4896B424989B5E1EBAC0F07C23F4598", 60,
+      "3612D2E79E3B0785561BE14AACA2FCCB" },
+    { NULL, "9313225DF88406E555909C5AFF5269AA6A7A9538534F7DA1E4C303D2A318A728"
+            "C3C0C95156809539FCF0E2429A6B525416AEDBF5A0DE6A57A637B39B", NULL, NULL,
+      "8CE24998625615B603A033ACA13FB894BE9112A5C3A211A8BA262A3CCA7E2CA7"
+      "01E4A9A4FBA43C90CCDCB281D48C7C6FD62875D2ACA417034C34AEE5", 60,
+      "619CC5AEFFFE0BFA462AF43C1699D050" },
+  };
+  uint8_t k[16], iv[64], ad[32], buf[64], tag[16];
+  struct AES_gcm_ctx ctx;
+  uint32_t iv_len, ad_len;
+  size_t i;
+  int bad;
+
+  for (i = 0; i < sizeof(tests) / sizeof(tests[0]); ++i)
+  {
+    unhex(tests[i].key ? tests[i].key : k3, k);
+    AES_GCM_init_ctx(&ctx, k);
+    iv_len = (uint32_t)unhex(tests[i].iv, iv);
+    ad_len = (uint32_t)unhex(tests[i].ad ? tests[i].ad : ad4, ad);
+    unhex(tests[i].plain ? tests[i].plain : p3, buf);
+    AES_GCM_encrypt(&ctx, iv, iv_len, ad, ad_len, buf, tests[i].length, tag, 16);
+    bad = !check_hex(buf, tests[i].cipher ? tests[i].cipher : c3) || !check_hex(tag, tests[i].tag);
+    bad |= (AES_GCM_decrypt(&ctx, iv, iv_len, ad, ad_len, buf, tests[i].length, tag, 16) != 0);
+    bad |= !check_hex(buf, tests[i].plain ? tests[i].plain : p3);
+    tag[0] ^= 1;
+    bad |= (AES_GCM_decrypt(&ctx, iv, iv_len, ad, ad_len, buf, tests[i].length, tag, 16) != -1);
+    if (bad)
+    {
+      printf("gcm: test case %u\n", (unsigned)(i + 1));
+    }
+    check(!bad, "GCM test vectors");
+  }
+}
+
+static void bench_gcm(void)
+{
+  const size_t bytes = GCM_BYTES;
+  uint8_t* plain = (uint8_t*)malloc(bytes);
+  uint8_t* serial = (uint8_t*)malloc(bytes);
+  uint8_t* data = (uint8_t*)malloc(bytes);
+  static const uint8_t iv[12] = { 0xca, 0xfe, 0xba, 0xbe, 0xfa, 0xce, 0xdb, 0xad, 0xde, 0xca, 0xf8, 0x88 };
+  uint8_t ad[20], tag_serial[16], tag[16];
+  struct AES_gcm_ctx ctx;
+  struct AES_ctx ctr;
+  struct aes_pool* pool;
+  double t0, t_ctr, t_serial, t_pool;
+  uint32_t lengths[] = { 0, 1, 65535, 65536, 65537, 3 * 65536 + 17, GCM_BYTES - 5 };
+  size_t i;
+  int bad = 0;
+
+  gcm_vectors();
+
+  AES_GCM_init_ctx(&ctx, key);
+  fill(plain, bytes);
+  fill(ad, sizeof(ad));
+  pool = aes_pool_create(0);
+
+  // Pieces end on AES_MT_GCM_PIECE boundaries; check lengths around them.
+  for (i = 0; i < sizeof(lengths) / sizeof(lengths[0]); ++i)
+  {
+    memcpy(serial, plain, lengths[i]);
+    memcpy(data, plain, lengths[i]);
+    AES_GCM_encrypt(&ctx, iv, sizeof(iv), ad, sizeof(ad), serial, lengths[i], tag_serial, 16);
+    aes_mt_gcm_encrypt(pool, &ctx, iv, sizeof(iv), ad, sizeof(ad), data, lengths[i], tag, 16);
+    bad |= (memcmp(serial, data, lengths[i]) != 0) || (memcmp(tag, tag_serial, 16) != 0);
+    bad |= (aes_mt_gcm_decrypt(pool, &ctx, iv, sizeof(iv), ad, sizeof(ad), data, lengths[i], tag, 16) != 0);
+    bad |= (memcmp(data, plain, lengths[i]) != 0);
+  }
+  check(!bad, "GCM on the thread pool differs from AES_GCM_encrypt()");
+
+  // An empty IV and out-of-range tag lengths are refused before buf is
+  // touched, by the serial and the pooled functions alike.
+  memset(data, 0x5a, 64);
+  bad = (AES_GCM_encrypt(&ctx, iv, 0, NULL, 0, data, 64, tag, 16) != -1);
+  bad |= (AES_GCM_encrypt(&ctx, iv, sizeof(iv), NULL, 0, data, 64, tag, 0) != -1);
+  bad |= (AES_GCM_encrypt(&ctx, iv, sizeof(iv), NULL, 0, data, 64, tag, 17) != -1);
+  bad |= (AES_GCM_decrypt(&ctx, iv, 0, NULL, 0, data, 64, tag, 16) != -1);
+  bad |= (AES_GCM_decrypt(&ctx, iv, sizeof(iv), NULL, 0, data, 64, tag, 0) != -1);
+  bad |= (AES_GCM_decrypt(&ctx, iv, sizeof(iv), NULL, 0, data, 64, tag, 17) != -1);
+  bad |= (aes_mt_gcm_encrypt(pool, &ctx, iv, 0, NULL, 0, data, 64, tag, 16) != -1);
+  bad |= (aes_mt_gcm_encrypt(pool, &ctx, iv, sizeof(iv), NULL, 0, data, 64, tag, 17) != -1);
+  bad |= (aes_mt_gcm_decrypt(pool, &ctx, iv, 0, NULL, 0, data, 64, tag, 16) != -1);
+  bad |= (aes_mt_gcm_decrypt(pool, &ctx, iv, sizeof(iv), NULL, 0, data, 64, tag, 0) != -1);
+  for (i = 0; i < 64; ++i)
+  {
+    bad |= (data[i] != 0x5a);
+  }
+  check(!bad, "GCM refuses bad IV and tag lengths");
+
+  memcpy(data, plain, bytes);
+  AES_init_ctx_iv(&ctr, key, iv);
+  t0 = now();
+  AES_CTR_xcrypt_buffer(&ctr, data, (uint32_t)bytes);
+  t_ctr = now() - t0;
+
+  memcpy(serial, plain, bytes);
+  t0 = now();
+  AES_GCM_encrypt(&ctx, iv, sizeof(iv), ad, sizeof(ad), serial, (uint32_t)bytes, tag_serial, 16);
+  t_serial = now() - t0;
+
+  memcpy(data, plain, bytes);
+  t0 = now();
+  aes_mt_gcm_encrypt(pool, &ctx, iv, sizeof(iv), ad, sizeof(ad), data, (uint32_t)bytes, tag, 16);
+  t_pool = now() - t0;
+  check((memcmp(data, serial, bytes) == 0) && (memcmp(tag, tag_serial, 16) == 0), "GCM on the thread pool differs");
+
+  data[bytes / 2] ^= 1;
+  check(aes_mt_gcm_decrypt(pool, &ctx, iv, sizeof(iv), ad, sizeof(ad), data, (uint32_t)bytes, tag, 16) == -1,
+        "GCM decryption on the thread pool did not catch a flipped bit");
+
+  printf("gcm: %u MB message, %u threads\n", (unsigned)(bytes >> 20), aes_pool_threads(pool));
+  print_rate("ctr", bytes, t_ctr, t_ctr);
+  print_rate("gcm", bytes, t_serial, t_ctr);
+  print_rate("gcm, pool", bytes, t_pool, t_ctr);
+  printf("\n");
+
+  aes_pool_destroy(pool);
+  free(plain);
+  free(serial);
+  free(data);
+}
+
+#endif // #if defined(GCM) && (GCM == 1)
+
+/*****************************************************************************/
+/* PMAC:                                                                     */
+/*****************************************************************************/
+#if defined(PMAC) && (PMAC == 1)
+
+#define PMAC_BYTES (16u << 20)
+
+// PMAC1 with AES-128, key 000102...0f, over the messages 00 01 02 ... of the
+// given lengths, and over 1000 zero bytes.
+static void pmac_vectors(void)
+{
+  static const struct
+  {
+    uint32_t length;
+    const char* mac;
+  } tests[] =
+  {
+    { 0,  "4399572CD6EA5341B8D35876A7098AF7" },
+    { 3,  "256BA5193C1B991B4DF0C51F388A9E27" },
+    { 16, "EBBD822FA458DAF6DFDAD7C27DA76338" },
+    { 20, "0412CA150BBF79058D8C75A58C993F55" },
+    { 32, "E97AC04E9E5E3399CE5355CD7407BC75" },
+    { 34, "5CBA7D5EB24F7C86CCC54604E53D5512" },
+  };
+  uint8_t k[16], msg[1000], mac[16];
+  struct AES_pmac_ctx ctx;
+  size_t i;
+  int bad = 0;
+
+  for (i = 0; i < sizeof(msg); ++i)
+  {
+    msg[i] = (uint8_t)i;
+  }
+  memcpy(k, msg, sizeof(k));
+  AES_PMAC_init_ctx(&ctx, k);
+  for (i = 0; i < sizeof(tests) / sizeof(tests[0]); ++i)
+  {
+    AES_PMAC(&ctx, msg, tests[i].length, mac);
+    bad |= !check_hex(mac, tests[i].mac);
+  }
+  memset(msg, 0, sizeof(msg));
+  AES_PMAC(&ctx, msg, sizeof(msg), mac);
+  bad |= !check_hex(mac, "C2C9FA1D9985F6F0D2AFF915A0E8D910");
+  check(!bad, "PMAC1 test vectors");
+}
+
+static void bench_pmac(void)
+{
+  const size_t bytes = PMAC_BYTES;
+  uint8_t* msg = (uint8_t*)malloc(bytes);
+  uint8_t mac_serial[16], mac[16];
+  uint32_t lengths[] = { 0, 15, 16, 17, 65536, 65552, 65553, 5 * 65536 + 3 };
+  struct AES_pmac_ctx ctx;
+  struct AES_ctx cmac;
+  struct aes_pool* pool;
+  double t0, t_cmac = 0, t_serial, t_pool;
+  size_t i;
+  int bad = 0;
+
+  pmac_vectors();
+
+  AES_PMAC_init_ctx(&ctx, key);
+  fill(msg, bytes);
+  pool = aes_pool_create(0);
+
+  // Pieces end on AES_MT_PMAC_PIECE boundaries; check lengths around them.
+  for (i = 0; i < sizeof(lengths) / sizeof(lengths[0]); ++i)
+  {
+    AES_PMAC(&ctx, msg, lengths[i], mac_serial);
+    aes_mt_pmac(pool, &ctx, msg, lengths[i], mac);
+    bad |= (memcmp(mac, mac_serial, 16) != 0);
+  }
+  check(!bad, "PMAC on the thread pool differs from AES_PMAC()");
+
+#if defined(SIV) && (SIV == 1)
+  AES_init_ctx(&cmac, key);
+  t0 = now();
+  AES_CMAC(&cmac, msg, (uint32_t)bytes, mac);
+  t_cmac = now() - t0;
+#else
+  (void)cmac;
+#endif
+
+  t0 = now();
+  AES_PMAC(&ctx, msg, (uint32_t)bytes, mac_serial);
+  t_serial = now() - t0;
+
+  t0 = now();
+  aes_mt_pmac(pool, &ctx, msg, (uint32_t)bytes, mac);
+  t_pool = now() - t0;
+  check(memcmp(mac, mac_serial, 16) == 0, "PMAC on the thread pool differs");
+
+  printf("pmac: %u MB message, %u threads\n", (unsigned)(bytes >> 20), aes_pool_threads(pool));
+  if (t_cmac > 0)
+  {
+    print_rate("cmac", bytes, t_cmac, t_cmac);
+  }
+  print_rate("pmac", bytes, t_serial, (t_cmac > 0) ? t_cmac : t_serial);
+  print_rate("pmac, pool", bytes, t_pool, (t_cmac > 0) ? t_cmac : t_serial);
+  printf("\n");
+
+  aes_pool_destroy(pool);
+  free(msg);
+}
+
+#endif // #if defined(PMAC) && (PMAC == 1)
+
+/*****************************************************************************/
+/* FPE:                                                                      */
+/*****************************************************************************/
+#if defined(FPE) && (FPE == 1)
+
+#define FPE_DIGITS 16
+#define FPE_VALUES 100000
+
+// Numerals from "0123456789abc...", the notation of the sample vectors.
+static uint32_t numerals(const char* s, uint16_t* x)
+{
+  uint32_t n;
+  for (n = 0; s[n] != '\0'; ++n)
+  {
+    x[n] = (uint16_t)((s[n] <= '9') ? s[n] - '0' : s[n] - 'a' + 10);
+  }
+  return n;
+}
+
+static int same_numerals(const uint16_t* x, const char* s)
+{
+  uint16_t want[AES_FPE_MAXLEN];
+  const uint32_t n = numerals(s, want);
+  return memcmp(x, want, n * sizeof(uint16_t)) == 0;
+}
+
+// FF1 samples 1-3 of the NIST examples and an FF3-1 ACVP vector.
+static void fpe_vectors(void)
+{
+  static const struct
+  {
+    uint32_t radix;
+    const char* tweak;
+    const char* plain;
+    const char* cipher;
+  } ff1[] =
+  {
+    { 10, "", "0123456789", "2433477484" },
+    { 10, "39383736353433323130", "0123456789", "6124200773" },
+    { 36, "3737373770717273373737", "0123456789abcdefghi", "a9tv40mll9kdu509eum" },
+  };
+  uint8_t k[16], tweak[16];
+  uint16_t x[AES_FPE_MAXLEN];
+  struct AES_ff1_ctx ff1_ctx;
+  struct AES_ff3_ctx ff3_ctx;
+  uint32_t n, t;
+  size_t i;
+  int bad = 0;
+
+  unhex("2B7E151628AED2A6ABF7158809CF4F3C", k);
+  for (i = 0; i < sizeof(ff1) / sizeof(ff1[0]); ++i)
+  {
+    AES_FF1_init_ctx(&ff1_ctx, k, ff1[i].radix);
+    t = (uint32_t)unhex(ff1[i].tweak, tweak);
+    n = numerals(ff1[i].plain, x);
+    bad |= (AES_FF1_encrypt(&ff1_ctx, tweak, t, x, n) != 0) || !same_numerals(x, ff1[i].cipher);
+    bad |= (AES_FF1_decrypt(&ff1_ctx, tweak, t, x, n) != 0) || !same_numerals(x, ff1[i].plain);
+  }
+  check(!bad, "FF1 sample vectors");
+
+  unhex("2DE79D232DF5585D68CE47882AE256D6", k);
+  unhex("CBD09280979564", tweak);
+  AES_FF3_init_ctx(&ff3_ctx, k, 10);
+  n = numerals("3992520240", x);
+  bad |= (AES_FF3_encrypt(&ff3_ctx, tweak, x, n) != 0) || !same_numerals(x, "8901801106");
+  bad |= (AES_FF3_decrypt(&ff3_ctx, tweak, x, n) != 0) || !same_numerals(x, "3992520240");
+  check(!bad, "FF3-1 test vector");
+
+  // Out of the domain: radix^n < 10^6, a numeral >= radix.
+  AES_FF1_init_ctx(&ff1_ctx, k, 10);
+  n = numerals("12345", x);
+  bad |= (AES_FF1_encrypt(&ff1_ctx, tweak, 0, x, n) != -1);
+  x[5] = 10;
+  bad |= (AES_FF1_encrypt(&ff1_ctx, tweak, 0, x, 6) != -1);
+  check(!bad, "FPE domain checks");
+}
+
+// A batch with values of many lengths, each length coming back several
+// times and out of order, so that FF1's per-length setup is reused across
+// lanes of different lengths. Two lengths are out of the domain: below
+// 10^6 values and over the 96-bit half limit. Every value must match a
+// single call, the rejects must be left alone, and decryption must undo it.
+static void fpe_mixed(const struct AES_ff1_ctx* ff1, const struct AES_ff3_ctx* ff3, const uint8_t* tweak)
+{
+  static const uint32_t lengths[] = { 16, 6, 28, 5, 7, 56, 16, 19, 6, 57, 9, 28, 13, 16, 7, 40, 56, 6, 23, 19 };
+  enum { COUNT = sizeof(lengths) / sizeof(lengths[0]) };
+  static uint16_t plain[COUNT][AES_FPE_MAXLEN], single[COUNT][AES_FPE_MAXLEN], batch[COUNT][AES_FPE_MAXLEN];
+  struct AES_fpe_value values[COUNT];
+  uint32_t i, j, rejected;
+  int mode, bad = 0;
+
+  for (i = 0; i < COUNT; ++i)
+  {
+    for (j = 0; j < lengths[i]; ++j)
+    {
+      plain[i][j] = (uint16_t)(next_random() % 10);
+    }
+  }
+  for (mode = 0; mode < 2; ++mode)
+  {
+    memcpy(single, plain, sizeof(plain));
+    memcpy(batch, plain, sizeof(plain));
+    for (i = 0, rejected = 0; i < COUNT; ++i)
+    {
+      const int ret = (mode == 0) ? AES_FF1_encrypt(ff1, tweak, AES_FF3_TWEAKLEN, single[i], lengths[i])
+                                  : AES_FF3_encrypt(ff3, tweak, single[i], lengths[i]);
+      rejected += (ret != 0);
+      values[i].x = batch[i];
+      values[i].length = lengths[i];
+    }
+    bad |= (rejected != 2);
+    bad |= (((mode == 0) ? AES_FF1_encrypt_batch(ff1, tweak, AES_FF3_TWEAKLEN, values, COUNT)
+                         : AES_FF3_encrypt_batch(ff3, tweak, values, COUNT)) != rejected);
+    bad |= (memcmp(batch, single, sizeof(batch)) != 0);
+    if (mode == 0)
+    {
+      AES_FF1_decrypt_batch(ff1, tweak, AES_FF3_TWEAKLEN, values, COUNT);
+    }
+    else
+    {
+      AES_FF3_decrypt_batch(ff3, tweak, values, COUNT);
+    }
+    bad |= (memcmp(batch, plain, sizeof(batch)) != 0);
+  }
+  check(!bad, "FPE batch of mixed lengths differs from single calls");
+}
+
+static void bench_fpe(void)
+{
+  uint16_t* plain = (uint16_t*)malloc(FPE_VALUES * FPE_DIGITS * sizeof(uint16_t));
+  uint16_t* single = (uint16_t*)malloc(FPE_VALUES * FPE_DIGITS * sizeof(uint16_t));
+  uint16_t* batch = (uint16_t*)malloc(FPE_VALUES * FPE_DIGITS * sizeof(uint16_t));
+  struct AES_fpe_value* values = (struct AES_fpe_value*)malloc(FPE_VALUES * sizeof(struct AES_fpe_value));
+  static const uint8_t tweak[AES_FF3_TWEAKLEN] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07 };
+  const size_t bytes = FPE_VALUES * FPE_DIGITS * sizeof(uint16_t);
+  struct AES_ff1_ctx ff1;
+  struct AES_ff3_ctx ff3;
+  double t0, t_ff1, t_ff1_batch, t_ff3, t_ff3_batch;
+  uint32_t i;
+
+  fpe_vectors();
+
+  AES_FF1_init_ctx(&ff1, key, 10);
+  AES_FF3_init_ctx(&ff3, key, 10);
+  fpe_mixed(&ff1, &ff3, tweak);
+  for (i = 0; i < FPE_VALUES * FPE_DIGITS; ++i)
+  {
+    plain[i] = (uint16_t)(next_random() % 10);
+  }
+  for (i = 0; i < FPE_VALUES; ++i)
+  {
+    values[i].x = batch + i * FPE_DIGITS;
+    values[i].length = FPE_DIGITS;
+  }
+
+  memcpy(single, plain, bytes);
+  t0 = now();
+  for (i = 0; i < FPE_VALUES; ++i)
+  {
+    AES_FF1_encrypt(&ff1, tweak, sizeof(tweak), single + i * FPE_DIGITS, FPE_DIGITS);
+  }
+  t_ff1 = now() - t0;
+  memcpy(batch, plain, bytes);
+  t0 = now();
+  check(AES_FF1_encrypt_batch(&ff1, tweak, sizeof(tweak), values, FPE_VALUES) == 0, "FF1 batch rejected values");
+  t_ff1_batch = now() - t0;
+  check(memcmp(batch, single, bytes) == 0, "FF1 batch differs from AES_FF1_encrypt()");
+  AES_FF1_decrypt_batch(&ff1, tweak, sizeof(tweak), values, FPE_VALUES);
+  check(memcmp(batch, plain, bytes) == 0, "FF1 batch round trip");
+
+  memcpy(single, plain, bytes);
+  t0 = now();
+  for (i = 0; i < FPE_VALUES; ++i)
+  {
+    AES_FF3_encrypt(&ff3, tweak, single + i * FPE_DIGITS, FPE_DIGITS);
+  }
+  t_ff3 = now() - t0;
+  memcpy(batch, plain, bytes);
+  t0 = now();
+  check(AES_FF3_encrypt_batch(&ff3, tweak, values, FPE_VALUES) == 0, "FF3-1 batch rejected values");
+  t_ff3_batch = now() - t0;
+  check(memcmp(batch, single, bytes) == 0, "FF3-1 batch differs from AES_FF3_encrypt()");
+  AES_FF3_decrypt_batch(&ff3, tweak, values, FPE_VALUES);
+  check(memcmp(batch, plain, bytes) == 0, "FF3-1 batch round trip");
+
+  printf("fpe: %u values of %u digits\n", FPE_VALUES, FPE_DIGITS);
+  printf("  %-26s %12.0f values/s\n", "ff1, one call per value", FPE_VALUES / t_ff1);
+  printf("  %-26s %12.0f values/s\n", "ff1, batch", FPE_VALUES / t_ff1_batch);
+  printf("  %-26s %12.0f values/s\n", "ff3-1, one call per value", FPE_VALUES / t_ff3);
+  printf("  %-26s %12.0f values/s\n", "ff3-1, batch", FPE_VALUES / t_ff3_batch);
+  printf("\n");
+
+  free(plain);
+  free(single);
+  free(batch);
+  free(values);
+}
+
+#endif // #if defined(FPE) && (FPE == 1)
+
+/*****************************************************************************/
+/* Backends:                                                                 */
+/*****************************************************************************/
+#if defined(ECB) && (ECB == 1) && defined(CTR) && (CTR == 1)
+
+#define BACKEND_BYTES (1u << 20)
+
+static void bench_backend(void)
+{
+  static const uint32_t sizes[AES_BACKEND_CLASSES] = { 64, 4096, 65536 };
+  static const char* const classes[AES_BACKEND_CLASSES] = { "small", "medium", "large" };
+  uint8_t* plain = (uint8_t*)malloc(BACKEND_BYTES);
+  uint8_t* expect = (uint8_t*)malloc(BACKEND_BYTES);
+  uint8_t* data = (uint8_t*)malloc(BACKEND_BYTES);
+  uint8_t iv[AES_BLOCKLEN];
+  const struct aes_backend* auto_pick[AES_BACKEND_CLASSES];
+  char cache[64];
+  char* saved;
+  struct AES_ctx ctx;
+  double t0, t;
+  uint32_t done, k;
+  unsigned i;
+  int c, bad;
+  FILE* f;
+
+  fill(plain, BACKEND_BYTES);
+  fill(iv, sizeof(iv));
+  AES_init_ctx(&ctx, key);
+  memcpy(expect, plain, BACKEND_BYTES);
+  AES_ECB_encrypt_blocks(&ctx, expect, BACKEND_BYTES / AES_BLOCKLEN);
+
+  printf("backend: CTR MB/s per buffer size\n");
+  printf("  %-10s %10u %10u %10u\n", "", sizes[0], sizes[1], sizes[2]);
+  for (i = 0; i < aes_backend_count(); ++i)
+  {
+    const struct aes_backend* be = aes_backend_get(i);
+    if (!be->available())
+    {
+      printf("  %-10s not available on this CPU\n", be->name);
+      continue;
+    }
+
+    // Every backend must agree with the reference engine.
+    memcpy(data, plain, BACKEND_BYTES);
+    be->ecb_encrypt(&ctx, data, BACKEND_BYTES / AES_BLOCKLEN);
+    bad = (memcmp(data, expect, BACKEND_BYTES) != 0);
+    be->ecb_decrypt(&ctx, data, BACKEND_BYTES / AES_BLOCKLEN);
+    bad |= (memcmp(data, plain, BACKEND_BYTES) != 0);
+    for (k = 1; k < 200; k += 13)
+    {
+      AES_ctx_set_iv(&ctx, iv);
+      memcpy(data, plain, k);
+      AES_CTR_xcrypt_buffer(&ctx, data, k);
+      AES_ctx_set_iv(&ctx, iv);
+      be->ctr_xcrypt(&ctx, data, k);
+      bad |= (memcmp(data, plain, k) != 0);
+    }
+    check(!bad, "backend differs from the reference engine");
+
+    printf("  %-10s", be->name);
+    for (c = 0; c < AES_BACKEND_CLASSES; ++c)
+    {
+      AES_ctx_set_iv(&ctx, iv);
+      t0 = now();
+      for (done = 0; done < BACKEND_BYTES; done += sizes[c])
+      {
+        be->ctr_xcrypt(&ctx, data, sizes[c]);
+      }
+      t = now() - t0;
+      printf(" %10.2f", (double)done / t / 1048576.0);
+    }
+    printf("\n");
+  }
+
+  // Tune into a private cache file, then check that a forced backend
+  // applies everywhere and that the automatic choice comes back from it.
+  snprintf(cache, sizeof(cache), "/tmp/bench-aes-backend.%ld", (long)getpid());
+  if ((saved = getenv("AES_BACKEND_CACHE")) != NULL)
+  {
+    saved = strdup(saved);
+  }
+  setenv("AES_BACKEND_CACHE", cache, 1);
+  aes_backend_tune();
+  printf("  tuned:");
+  for (c = 0; c < AES_BACKEND_CLASSES; ++c)
+  {
+    auto_pick[c] = aes_backend_selected(c);
+    printf(" %s=%s", classes[c], auto_pick[c]->name);
+  }
+  printf("\n\n");
+  f = fopen(cache, "r");
+  check(f != NULL, "backend cache file was not written");
+  if (f != NULL)
+  {
+    fclose(f);
+  }
+  bad = (aes_backend_force("table") != 0) || (aes_backend_select(1 << 20) != aes_backend_find("table"));
+  bad |= (aes_backend_force("no-such-backend") != -1);
+  aes_backend_force(NULL);
+  for (c = 0; c < AES_BACKEND_CLASSES; ++c)
+  {
+    bad |= (aes_backend_selected(c) != auto_pick[c]);
+  }
+  check(!bad, "backend selection");
+  remove(cache);
+  if (saved != NULL)
+  {
+    setenv("AES_BACKEND_CACHE", saved, 1);
+    free(saved);
+  }
+  else
+  {
+    unsetenv("AES_BACKEND_CACHE");
+  }
+
+  free(plain);
+  free(expect);
+  free(data);
+}
+
+#endif // #if defined(ECB) && (ECB == 1) && defined(CTR) && (CTR == 1)
+
+/*****************************************************************************/
+/* Streaming stores:                                                         */
+/*****************************************************************************/
+#if defined(ECB) && (ECB == 1) && defined(CTR) && (CTR == 1)
+
+#define STREAM_MIN (1u << 20)
+#define STREAM_MAX (1u << 30)
+
+static double stream_pass(uint32_t threshold, const uint8_t* in, uint8_t* out, uint32_t length)
+{
+  struct AES_ctx ctx;
+  double best = 0, t0, t;
+  int trial;
+
+  aes_backend_set_stream_threshold(threshold);
+  AES_init_ctx_iv(&ctx, key, key);
+  for (trial = 0; trial < 2; ++trial)
+  {
+    t0 = now();
+    aes_backend_ctr_xcrypt_to(&ctx, in, out, length);
+    t = now() - t0;
+    best = (trial == 0 || t < best) ? t : best;
+  }
+  return best;
+}
+
+// Streaming output against the in-place functions, with an unaligned
+// destination and lengths that end inside a tile and inside a block.
+static void stream_check(void)
+{
+  static const uint32_t lengths[] = { 0, 15, 4096, 4111, 3 * 4096 + 100 };
+  uint8_t in[3 * 4096 + 100], out[3 * 4096 + 101], expect[3 * 4096 + 100];
+  struct AES_ctx ctx, ref;
+  size_t i;
+  int bad = 0;
+
+  fill(in, sizeof(in));
+  aes_backend_set_stream_threshold(0);
+  for (i = 0; i < sizeof(lengths) / sizeof(lengths[0]); ++i)
+  {
+    AES_init_ctx_iv(&ctx, key, key);
+    AES_init_ctx_iv(&ref, key, key);
+    memcpy(expect, in, lengths[i]);
+    AES_CTR_xcrypt_buffer(&ref, expect, lengths[i]);
+    aes_backend_ctr_xcrypt_to(&ctx, in, out + 1, lengths[i]);
+    bad |= (memcmp(out + 1, expect, lengths[i]) != 0) || (memcmp(ctx.Iv, ref.Iv, AES_BLOCKLEN) != 0);
+
+    memcpy(expect, in, lengths[i] & ~15u);
+    AES_ECB_encrypt_blocks(&ref, expect, lengths[i] / AES_BLOCKLEN);
+    aes_backend_ecb_encrypt_to(&ctx, in, out, lengths[i] / AES_BLOCKLEN);
+    bad |= (memcmp(out, expect, lengths[i] & ~15u) != 0);
+    aes_backend_ecb_decrypt_to(&ctx, out, out, lengths[i] / AES_BLOCKLEN);
+    bad |= (memcmp(out, in, lengths[i] & ~15u) != 0);
+  }
+  check(!bad, "streaming output differs from the in-place functions");
+}
+
+static void bench_stream(void)
+{
+  const long llc = sysconf(_SC_LEVEL3_CACHE_SIZE);
+  uint32_t max = STREAM_MIN, len, crossover = UINT32_MAX;
+  uint8_t *in, *out;
+  double t_cached, t_stream, rate;
+
+  stream_check();
+
+  // Up to four times the last level cache, but no pass longer than about
+  // half a second on the selected backend.
+  in = (uint8_t*)malloc(STREAM_MIN);
+  out = (uint8_t*)malloc(STREAM_MIN);
+  memset(in, 1, STREAM_MIN);
+  memset(out, 0, STREAM_MIN);
+  rate = STREAM_MIN / stream_pass(UINT32_MAX, in, out, STREAM_MIN);
+  free(in);
+  free(out);
+  while ((max < STREAM_MAX) && ((llc <= 0) || (max < 4 * (uint64_t)llc)) && (2.0 * max < rate / 2))
+  {
+    max *= 2;
+  }
+
+  in = (uint8_t*)malloc(max);
+  out = (uint8_t*)malloc(max);
+  if ((in == NULL) || (out == NULL))
+  {
+    check(0, "out of memory");
+    free(in);
+    free(out);
+    return;
+  }
+  memset(in, 1, max);
+  memset(out, 0, max);
+
+  printf("stream: out-of-place CTR on the %s backend, last level cache %ld KB\n",
+         aes_backend_select(UINT32_MAX)->name, (llc > 0) ? llc / 1024 : -1);
+  for (len = STREAM_MIN; len <= max; len *= 2)
+  {
+    char name[32];
+    t_cached = stream_pass(UINT32_MAX, in, out, len);
+    t_stream = stream_pass(0, in, out, len);
+    snprintf(name, sizeof(name), "%6lu KB, cached", (unsigned long)(len >> 10));
+    print_rate(name, len, t_cached, t_cached);
+    snprintf(name, sizeof(name), "%6lu KB, streaming", (unsigned long)(len >> 10));
+    print_rate(name, len, t_stream, t_cached);
+
+    // The threshold is the start of the run of sizes on which streaming
+    // wins up to the largest one measured.
+    if (t_stream >= t_cached)
+    {
+      crossover = UINT32_MAX;
+    }
+    else if (crossover == UINT32_MAX)
+    {
+      crossover = len;
+    }
+  }
+  aes_backend_set_stream_threshold(crossover);
+  if (crossover == UINT32_MAX)
+  {
+    printf("  streaming threshold: off\n\n");
+  }
+  else
+  {
+    printf("  streaming threshold: %lu KB\n\n", (unsigned long)(crossover >> 10));
+  }
+
+  free(in);
+  free(out);
+}
+
+#endif // #if defined(ECB) && (ECB == 1) && defined(CTR) && (CTR == 1)
+
+/*****************************************************************************/
+/* Lazy mapping:                                                             */
+/*****************************************************************************/
+#if defined(ECB) && (ECB == 1) && defined(CTR) && (CTR == 1)
+
+#define LAZY_BYTES (64u << 20)
+
+static sigjmp_buf lazy_jump;
+static volatile uint8_t lazy_sink;
+
+static void lazy_fault(int sig)
+{
+  siglongjmp(lazy_jump, sig);
+}
+
+// Touches one byte of region; returns the signal it raised, or 0.
+static int lazy_touch(const uint8_t* region, size_t offset)
+{
+  struct sigaction sa, old_bus, old_segv;
+  volatile int sig;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = lazy_fault;
+  sigaction(SIGBUS, &sa, &old_bus);
+  sigaction(SIGSEGV, &sa, &old_segv);
+  sig = sigsetjmp(lazy_jump, 1);
+  if (sig == 0)
+  {
+    lazy_sink = region[offset];
+  }
+  sigaction(SIGBUS, &old_bus, NULL);
+  sigaction(SIGSEGV, &old_segv, NULL);
+  return sig;
+}
+
+static void bench_lazy(void)
+{
+  const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  const uint32_t pages = (uint32_t)(LAZY_BYTES / page);
+  uint8_t* plain = (uint8_t*)malloc(LAZY_BYTES);
+  uint8_t* data = (uint8_t*)malloc(LAZY_BYTES);
+  struct aes_lazy_stats stats;
+  struct aes_lazy* lazy;
+  const uint8_t* region;
+  struct AES_ctx ctx;
+  char path[64];
+  double t0, t_full, t_lazy;
+  uint32_t i, p, sum = 0;
+  FILE* f;
+  int bad = 0;
+
+  snprintf(path, sizeof(path), "/tmp/bench-lazy.%ld", (long)getpid());
+  fill(plain, LAZY_BYTES);
+  memcpy(data, plain, LAZY_BYTES);
+  AES_init_ctx_iv(&ctx, key, key);
+  aes_backend_ctr_xcrypt(&ctx, data, LAZY_BYTES);
+  f = fopen(path, "wb");
+  if ((f == NULL) || (fwrite(data, 1, LAZY_BYTES, f) != LAZY_BYTES) || (fclose(f) != 0))
+  {
+    check(0, "could not write the encrypted file");
+    free(plain);
+    free(data);
+    return;
+  }
+
+  // Up front: read the whole file and decrypt it.
+  t0 = now();
+  f = fopen(path, "rb");
+  bad |= (f == NULL) || (fread(data, 1, LAZY_BYTES, f) != LAZY_BYTES);
+  if (f != NULL)
+  {
+    fclose(f);
+  }
+  AES_init_ctx_iv(&ctx, key, key);
+  aes_backend_ctr_xcrypt(&ctx, data, LAZY_BYTES);
+  t_full = now() - t0;
+  check(!bad && (memcmp(data, plain, LAZY_BYTES) == 0), "up front decryption");
+
+  lazy = aes_lazy_open(path, key, key, 0);
+  if (lazy == NULL)
+  {
+    printf("lazy: userfaultfd not available: %s\n\n", strerror(errno));
+    remove(path);
+    free(plain);
+    free(data);
+    return;
+  }
+
+  // Touch 1% of the pages, at random, one byte in each.
+  region = aes_lazy_data(lazy);
+  t0 = now();
+  for (i = 0; i < pages / 100; ++i)
+  {
+    p = (uint32_t)(next_random() % pages);
+    sum += region[(size_t)p * page + (next_random() % page)];
+  }
+  t_lazy = now() - t0;
+  aes_lazy_stats(lazy, &stats);
+  printf("lazy: %u MB file, %u of %u pages touched, %lu decrypted (checksum %u)\n", LAZY_BYTES >> 20,
+         pages / 100, pages, (unsigned long)stats.faults, sum & 0xff);
+  print_rate("up front", LAZY_BYTES, t_full, t_full);
+  print_rate("lazy, 1% touched", LAZY_BYTES, t_lazy, t_full);
+
+  // The whole region, including through a system call that reads it.
+  bad = (aes_lazy_length(lazy) != LAZY_BYTES) || (memcmp(region, plain, LAZY_BYTES) != 0);
+  f = fopen("/dev/null", "wb");
+  bad |= (f == NULL) || (fwrite(region, 1, 1 << 20, f) != (1 << 20));
+  if (f != NULL)
+  {
+    fclose(f);
+  }
+  aes_lazy_close(lazy);
+  check(!bad, "lazily decrypted region differs");
+
+  // With a limit of 16 pages, old ones are dropped and fault in again.
+  lazy = aes_lazy_open(path, key, key, 16);
+  bad = (lazy == NULL);
+  if (lazy != NULL)
+  {
+    region = aes_lazy_data(lazy);
+    for (i = 0; i < 64; ++i)
+    {
+      bad |= (region[(size_t)i * page] != plain[(size_t)i * page]);
+    }
+    bad |= (aes_lazy_trim(lazy, 4) != 4);
+    aes_lazy_stats(lazy, &stats);
+    bad |= (stats.resident != 12) || (stats.evictions != 48 + 4);
+    bad |= (memcmp(region, plain, 64 * page) != 0);
+    aes_lazy_stats(lazy, &stats);
+    bad |= (stats.resident != 16) || (stats.faults != 128);
+    aes_lazy_close(lazy);
+  }
+  check(!bad, "lazy mapping with a page limit");
+
+  // A file cut short after it was mapped: the pages past the new end fail,
+  // every time they are touched, instead of reading as zeros.
+  lazy = aes_lazy_open(path, key, key, 0);
+  bad = (lazy == NULL) || (truncate(path, 8 * page) != 0);
+  if (lazy != NULL)
+  {
+    region = aes_lazy_data(lazy);
+    bad |= (lazy_touch(region, 7 * page) != 0) || (region[7 * page] != plain[7 * page]);
+    bad |= (lazy_touch(region, 8 * page) == 0);
+    bad |= (lazy_touch(region, 8 * page + 1) == 0);
+    aes_lazy_stats(lazy, &stats);
+    bad |= (stats.failures != 1) || (stats.resident != 1);
+    aes_lazy_close(lazy);
+  }
+  check(!bad, "lazy mapping of a file cut short");
+  printf("\n");
+
+  remove(path);
+  free(plain);
+  free(data);
+}
+
+#endif // #if defined(ECB) && (ECB == 1) && defined(CTR) && (CTR == 1)
+
+/*****************************************************************************/
+/* Chunk cache:                                                              */
+/*****************************************************************************/
+#if defined(ECB) && (ECB == 1) && defined(CTR) && (CTR == 1)
+
+#define CACHE_FILE_BYTES (64u << 20)
+#define CACHE_CHUNK 65536
+#define CACHE_READ 4096
+#define CACHE_READS 20000
+#define CACHE_THREADS 4
+
+struct cache_reader
+{
+  struct aes_cache* cache;
+  int file;
+  const uint8_t* plain;
+  uint32_t index;
+  int bad;
+};
+
+// Every reader reads the same 32 chunks, in a different order.
+static void* cache_reader_main(void* p)
+{
+  struct cache_reader* r = (struct cache_reader*)p;
+  uint8_t buf[CACHE_READ];
+  uint32_t i, c;
+
+  for (i = 0; i < 32; ++i)
+  {
+    c = (r->index * 11 + i * 7) % 32;
+    if ((aes_cache_read(r->cache, r->file, (uint64_t)c * CACHE_CHUNK, buf, sizeof(buf)) != (long)sizeof(buf))
+        || (memcmp(buf, r->plain + (size_t)c * CACHE_CHUNK, sizeof(buf)) != 0))
+    {
+      r->bad = 1;
+    }
+  }
+  return NULL;
+}
+
+static void ctr_skip(struct AES_ctx* ctx, uint64_t blocks)
+{
+  int i;
+  for (i = AES_BLOCKLEN - 1; (i >= 0) && (blocks != 0); --i)
+  {
+    blocks += ctx->Iv[i];
+    ctx->Iv[i] = (uint8_t)blocks;
+    blocks >>= 8;
+  }
+}
+
+// Offsets with a skew: 90% of the reads go to 10% of the file.
+static uint64_t cache_offset(void)
+{
+  const uint64_t hot = CACHE_FILE_BYTES / 10;
+  const uint64_t r = next_random();
+  return ((r % 10) != 0) ? (next_random() % (hot - CACHE_READ)) : (next_random() % (CACHE_FILE_BYTES - CACHE_READ));
+}
+
+static void bench_cache(void)
+{
+  uint8_t* plain = (uint8_t*)malloc(CACHE_FILE_BYTES);
+  uint8_t* data = (uint8_t*)malloc(CACHE_FILE_BYTES);
+  uint8_t chunk[2 * CACHE_CHUNK], buf[CACHE_READ];
+  struct cache_reader readers[CACHE_THREADS];
+  pthread_t threads[CACHE_THREADS];
+  struct aes_cache_stats stats;
+  struct aes_cache* cache;
+  struct aes_pool* pool;
+  struct AES_ctx ctx;
+  uint64_t offset, c;
+  size_t n;
+  double t0, t_plain, t_cache;
+  char path[64];
+  FILE* f;
+  int file, i, bad = 0;
+  uint64_t seed;
+
+  snprintf(path, sizeof(path), "/tmp/bench-cache.%ld", (long)getpid());
+  fill(plain, CACHE_FILE_BYTES);
+  memcpy(data, plain, CACHE_FILE_BYTES);
+  AES_init_ctx_iv(&ctx, key, key);
+  aes_backend_ctr_xcrypt(&ctx, data, CACHE_FILE_BYTES);
+  f = fopen(path, "wb");
+  if ((f == NULL) || (fwrite(data, 1, CACHE_FILE_BYTES, f) != CACHE_FILE_BYTES) || (fclose(f) != 0))
+  {
+    check(0, "could not write the encrypted file");
+    free(plain);
+    free(data);
+    return;
+  }
+  free(data);
+
+  pool = aes_pool_create(0);
+  cache = aes_cache_create(CACHE_CHUNK, 16u << 20, pool);
+  file = (cache != NULL) ? aes_cache_add_file(cache, path, key, key) : -1;
+  if (file < 0)
+  {
+    check(0, "could not open the chunk cache");
+    aes_pool_destroy(pool);
+    remove(path);
+    free(plain);
+    return;
+  }
+
+  // Without the cache: read the chunks and decrypt them for every read.
+  seed = rng;
+  f = fopen(path, "rb");
+  t0 = now();
+  for (i = 0; i < CACHE_READS; ++i)
+  {
+    offset = cache_offset();
+    c = offset / CACHE_CHUNK;
+    n = ((offset + CACHE_READ - 1) / CACHE_CHUNK - c + 1) * CACHE_CHUNK;
+    bad |= (fseek(f, (long)(c * CACHE_CHUNK), SEEK_SET) != 0) || (fread(chunk, 1, n, f) != n);
+    AES_ctx_set_iv(&ctx, key);
+    ctr_skip(&ctx, c * (CACHE_CHUNK / AES_BLOCKLEN));
+    aes_backend_ctr_xcrypt(&ctx, chunk, (uint32_t)n);
+    bad |= (memcmp(chunk + (offset % CACHE_CHUNK), plain + offset, CACHE_READ) != 0);
+  }
+  t_plain = now() - t0;
+  fclose(f);
+  check(!bad, "decrypting every read");
+
+  // The same reads through the cache, some of them across a chunk boundary.
+  rng = seed;
+  bad = 0;
+  t0 = now();
+  for (i = 0; i < CACHE_READS; ++i)
+  {
+    offset = cache_offset();
+    bad |= (aes_cache_read(cache, file, offset, buf, CACHE_READ) != CACHE_READ) || (memcmp(buf, plain + offset, CACHE_READ) != 0);
+  }
+  t_cache = now() - t0;
+  check(!bad, "chunk cache reads differ");
+
+  aes_cache_stats(cache, &stats);
+  printf("cache: %u MB file, %u KB chunks, 16 MB cache, %u reads of %u B\n", CACHE_FILE_BYTES >> 20,
+         CACHE_CHUNK >> 10, CACHE_READS, CACHE_READ);
+  print_rate("decrypt every read", (size_t)CACHE_READS * CACHE_READ, t_plain, t_plain);
+  print_rate("chunk cache", (size_t)CACHE_READS * CACHE_READ, t_cache, t_plain);
+  printf("  hit rate %.1f%%, %lu evictions, %.2f us per hit read, %.2f us per miss read\n",
+         100.0 * (double)stats.hits / (double)(stats.hits + stats.misses), (unsigned long)stats.evictions,
+         (stats.hit_reads > 0) ? (double)stats.hit_ns / (double)stats.hit_reads / 1e3 : 0.0,
+         (stats.miss_reads > 0) ? (double)stats.miss_ns / (double)stats.miss_reads / 1e3 : 0.0);
+  aes_cache_destroy(cache);
+
+  // A cold read over many chunks, decrypted on the pool, and concurrent
+  // readers of the same chunks: each chunk is decrypted once.
+  cache = aes_cache_create(CACHE_CHUNK, CACHE_FILE_BYTES, pool);
+  file = aes_cache_add_file(cache, path, key, key);
+  data = (uint8_t*)malloc(4u << 20);
+  bad = (aes_cache_read(cache, file, 32u * CACHE_CHUNK + 5, data, 4u << 20) != (4 << 20))
+        || (memcmp(data, plain + 32u * CACHE_CHUNK + 5, 4u << 20) != 0);
+  bad |= (aes_cache_read(cache, file, CACHE_FILE_BYTES - 10, data, 100) != 10);
+  free(data);
+  for (i = 0; i < CACHE_THREADS; ++i)
+  {
+    readers[i].cache = cache;
+    readers[i].file = file;
+    readers[i].plain = plain;
+    readers[i].index = (uint32_t)i;
+    readers[i].bad = 0;
+    pthread_create(&threads[i], NULL, cache_reader_main, &readers[i]);
+  }
+  for (i = 0; i < CACHE_THREADS; ++i)
+  {
+    pthread_join(threads[i], NULL);
+    bad |= readers[i].bad;
+  }
+  aes_cache_stats(cache, &stats);
+  bad |= (stats.misses != 65 + 1 + 32) || (stats.evictions != 0);
+  check(!bad, "chunk cache with concurrent readers");
+  printf("  concurrent readers: %lu misses coalesced\n\n", (unsigned long)stats.coalesced);
+
+  aes_cache_destroy(cache);
+  aes_pool_destroy(pool);
+  remove(path);
+  free(plain);
+}
+
+#endif // #if defined(ECB) && (ECB == 1) && defined(CTR) && (CTR == 1)
+
+/*****************************************************************************/
+/* Resumable jobs:                                                           */
+/*****************************************************************************/
+#if defined(ECB) && (ECB == 1) && defined(CTR) && (CTR == 1)
+
+// Two and a half chunks, plus a partial block for CTR.
+#define JOB_CHECK_BYTES (5u * AES_JOB_CHUNK / 2)
+#define JOB_BYTES (64u << 20)
+
+static int write_file(const char* path, const uint8_t* data, size_t n)
+{
+  FILE* f = fopen(path, "wb");
+  return (f != NULL) && (fwrite(data, 1, n, f) == n) && (fclose(f) == 0);
+}
+
+static int same_file(const char* path, const uint8_t* data, size_t n, uint8_t* scratch)
+{
+  FILE* f = fopen(path, "rb");
+  size_t got;
+
+  if (f == NULL)
+  {
+    return 0;
+  }
+  got = fread(scratch, 1, n + 1, f);
+  fclose(f);
+  return (got == n) && (memcmp(scratch, data, n) == 0);
+}
+
+static int job_to_end(struct aes_job* job)
+{
+  int r;
+  while ((r = aes_job_run(job, 0)) == 0)
+    ;
+  return r;
+}
+
+// Runs a job on in_path three ways and compares each output with expect:
+// in one go; stopped after 1.5 chunks and resumed; and resumed after the
+// newest of two checkpoints was torn, which falls back to the older one.
+static void job_check(const char* name, enum aes_job_mode mode, const char* in_path, const char* out_path,
+                      const char* cp_path, const uint8_t* expect, size_t n, uint8_t* scratch)
+{
+  static const uint8_t garbage[16] = { 0xde, 0xad, 0xbe, 0xef };
+  struct aes_job* job;
+  uint64_t first = 0;
+  char what[64];
+  FILE* f;
+  int ok;
+
+  remove(cp_path);
+  job = aes_job_open(in_path, out_path, cp_path, mode, key, key, 0);
+  ok = (job != NULL) && (job_to_end(job) == 1) && same_file(out_path, expect, n, scratch);
+  if (job != NULL)
+  {
+    aes_job_close(job);
+  }
+  snprintf(what, sizeof(what), "job %s in one go", name);
+  check(ok, what);
+
+  remove(cp_path);
+  job = aes_job_open(in_path, out_path, cp_path, mode, key, key, 0);
+  ok = (job != NULL) && (aes_job_run(job, 3 * AES_JOB_CHUNK / 2) == 0) && (aes_job_checkpoint(job) == 0);
+  if (job != NULL)
+  {
+    aes_job_close(job);
+  }
+  job = aes_job_open(in_path, out_path, cp_path, mode, key, key, 0);
+  ok = ok && (job != NULL) && (aes_job_resumed(job) == 3 * AES_JOB_CHUNK / 2) && (job_to_end(job) == 1)
+       && same_file(out_path, expect, n, scratch);
+  if (job != NULL)
+  {
+    aes_job_close(job);
+  }
+  snprintf(what, sizeof(what), "job %s stopped and resumed", name);
+  check(ok, what);
+
+  // Checkpoints 1 and 2 go to slots 1 and 0; slot 0 is then torn.
+  remove(cp_path);
+  job = aes_job_open(in_path, out_path, cp_path, mode, key, key, 0);
+  ok = (job != NULL) && (aes_job_run(job, AES_JOB_CHUNK / 2) == 0) && (aes_job_checkpoint(job) == 0);
+  first = (job != NULL) ? aes_job_offset(job) : 0;
+  ok = ok && (aes_job_run(job, AES_JOB_CHUNK) == 0) && (aes_job_checkpoint(job) == 0) && (aes_job_run(job, AES_JOB_CHUNK / 4) == 0);
+  if (job != NULL)
+  {
+    aes_job_close(job);
+  }
+  f = fopen(cp_path, "r+b");
+  ok = ok && (f != NULL) && (fseek(f, 40, SEEK_SET) == 0) && (fwrite(garbage, 1, sizeof(garbage), f) == sizeof(garbage));
+  if (f != NULL)
+  {
+    fclose(f);
+  }
+  job = aes_job_open(in_path, out_path, cp_path, mode, key, key, 0);
+  ok = ok && (job != NULL) && (aes_job_resumed(job) == first) && (job_to_end(job) == 1)
+       && same_file(out_path, expect, n, scratch);
+  if (job != NULL)
+  {
+    aes_job_close(job);
+  }
+  snprintf(what, sizeof(what), "job %s resumed past a torn checkpoint", name);
+  check(ok, what);
+}
+
+static void bench_job(void)
+{
+  static const uint32_t intervals[] = { UINT32_MAX, 1000, 100, 10 };
+  uint8_t* plain = (uint8_t*)malloc(JOB_BYTES);
+  uint8_t* expect = (uint8_t*)malloc(JOB_BYTES);
+  uint8_t* scratch = (uint8_t*)malloc(JOB_BYTES + 1);
+  char in_path[64], out_path[64], cp_path[64], name[48];
+  uint8_t other[16];
+  struct AES_ctx ctx;
+  struct aes_job* job;
+  uint64_t cp_count, cp_ns;
+  double t0, t, base = 0;
+  size_t i;
+
+  snprintf(in_path, sizeof(in_path), "/tmp/bench-job.%ld.in", (long)getpid());
+  snprintf(out_path, sizeof(out_path), "/tmp/bench-job.%ld.out", (long)getpid());
+  snprintf(cp_path, sizeof(cp_path), "/tmp/bench-job.%ld.cp", (long)getpid());
+  fill(plain, JOB_BYTES);
+
+  // Every mode against the single-call functions.
+  if (!write_file(in_path, plain, JOB_CHECK_BYTES + 5))
+  {
+    check(0, "could not write the job input");
+    goto done;
+  }
+  memcpy(expect, plain, JOB_CHECK_BYTES + 5);
+  AES_init_ctx_iv(&ctx, key, key);
+  AES_CTR_xcrypt_buffer(&ctx, expect, JOB_CHECK_BYTES + 5);
+  job_check("ctr", AES_JOB_CTR, in_path, out_path, cp_path, expect, JOB_CHECK_BYTES + 5, scratch);
+
+  write_file(in_path, plain, JOB_CHECK_BYTES);
+  memcpy(expect, plain, JOB_CHECK_BYTES);
+  aes_backend_ecb_encrypt(&ctx, expect, JOB_CHECK_BYTES / AES_BLOCKLEN);
+  job_check("ecb encrypt", AES_JOB_ECB_ENCRYPT, in_path, out_path, cp_path, expect, JOB_CHECK_BYTES, scratch);
+  write_file(in_path, expect, JOB_CHECK_BYTES);
+  job_check("ecb decrypt", AES_JOB_ECB_DECRYPT, in_path, out_path, cp_path, plain, JOB_CHECK_BYTES, scratch);
+#if defined(CBC) && (CBC == 1)
+  write_file(in_path, plain, JOB_CHECK_BYTES);
+  memcpy(expect, plain, JOB_CHECK_BYTES);
+  AES_init_ctx_iv(&ctx, key, key);
+  AES_CBC_encrypt_buffer(&ctx, expect, JOB_CHECK_BYTES);
+  job_check("cbc encrypt", AES_JOB_CBC_ENCRYPT, in_path, out_path, cp_path, expect, JOB_CHECK_BYTES, scratch);
+  write_file(in_path, expect, JOB_CHECK_BYTES);
+  job_check("cbc decrypt", AES_JOB_CBC_DECRYPT, in_path, out_path, cp_path, plain, JOB_CHECK_BYTES, scratch);
+#endif
+
+  // A checkpoint of another job is not taken over.
+  memcpy(other, key, sizeof(other));
+  other[0] ^= 1;
+  job = aes_job_open(in_path, out_path, cp_path, AES_JOB_CBC_DECRYPT, other, key, 0);
+  check((job == NULL) && (errno == ESTALE), "job refuses another job's checkpoint");
+  if (job != NULL)
+  {
+    aes_job_close(job);
+  }
+
+  // Throughput of a CTR job at a few checkpoint intervals.
+  if (!write_file(in_path, plain, JOB_BYTES))
+  {
+    check(0, "could not write the job input");
+    goto done;
+  }
+  printf("job: %u MB CTR file to file\n", JOB_BYTES >> 20);
+  // Warm-up: the first run allocates the output file.
+  remove(cp_path);
+  if ((job = aes_job_open(in_path, out_path, cp_path, AES_JOB_CTR, key, key, UINT32_MAX)) != NULL)
+  {
+    job_to_end(job);
+    aes_job_close(job);
+  }
+  for (i = 0; i < sizeof(intervals) / sizeof(intervals[0]); ++i)
+  {
+    remove(cp_path);
+    t0 = now();
+    job = aes_job_open(in_path, out_path, cp_path, AES_JOB_CTR, key, key, intervals[i]);
+    check((job != NULL) && (job_to_end(job) == 1), "job throughput run");
+    t = now() - t0;
+    if (job == NULL)
+    {
+      continue;
+    }
+    cp_count = aes_job_checkpoints(job, &cp_ns);
+    aes_job_close(job);
+    base = (i == 0) ? t : base;
+    if (intervals[i] == UINT32_MAX)
+    {
+      snprintf(name, sizeof(name), "last checkpoint only");
+    }
+    else
+    {
+      snprintf(name, sizeof(name), "every %u ms, %lu taken", intervals[i], (unsigned long)cp_count);
+    }
+    print_rate(name, JOB_BYTES, t, base);
+    printf("  %.2f ms in checkpoints\n", (double)cp_ns * 1e-6);
+  }
+  printf("\n");
+
+done:
+  remove(in_path);
+  remove(out_path);
+  remove(cp_path);
+  free(plain);
+  free(expect);
+  free(scratch);
+}
+
+#endif // #if defined(ECB) && (ECB == 1) && defined(CTR) && (CTR == 1)
+
+/*****************************************************************************/
+/* Incremental re-encryption:                                                */
+/*****************************************************************************/
+#if defined(ECB) && (ECB == 1) && defined(CTR) && (CTR == 1) && defined(PMAC) && (PMAC == 1)
+
+#define PATCH_BYTES (32u << 20)
+#define PATCH_CHUNK 4096
+#define PATCH_RANGES 1000
+#define PATCH_MAX_RANGE 1024
+
+// The whole file again: CTR over all of it and every chunk's tag.
+static double patch_whole(struct aes_pool* pool, const struct AES_pmac_ctx* mac, uint8_t* buf, const uint64_t* gens,
+                          uint8_t (*tags)[AES_BLOCKLEN])
+{
+  struct AES_ctx ctx;
+  double t0 = now();
+
+  AES_init_ctx_iv(&ctx, key, key);
+  aes_mt_ctr_xcrypt(pool, &ctx, buf, PATCH_BYTES);
+  aes_patch_tag(pool, mac, key, buf, PATCH_BYTES, PATCH_CHUNK, gens, NULL, 0, tags);
+  return now() - t0;
+}
+
+static double patch_ranges(struct aes_pool* pool, const struct AES_pmac_ctx* mac, uint8_t* buf, uint64_t* gens,
+                           uint8_t (*tags)[AES_BLOCKLEN], struct aes_patch_range* ranges, uint32_t n)
+{
+  struct AES_ctx ctx;
+  double t0 = now();
+  int merged;
+
+  AES_init_ctx_iv(&ctx, key, key);
+  merged = aes_patch_ctr(pool, &ctx, buf, PATCH_BYTES, PATCH_CHUNK, ranges, n, gens);
+  aes_patch_tag(pool, mac, key, buf, PATCH_BYTES, PATCH_CHUNK, gens, ranges, (uint32_t)merged, tags);
+  return now() - t0;
+}
+
+static void bench_patch(void)
+{
+  const uint32_t nchunks = PATCH_BYTES / PATCH_CHUNK;
+  uint8_t* plain = (uint8_t*)malloc(PATCH_BYTES);
+  uint8_t* expect = (uint8_t*)malloc(PATCH_BYTES);
+  uint8_t* image = (uint8_t*)malloc(PATCH_BYTES);
+  uint8_t* old = (uint8_t*)malloc(PATCH_BYTES);
+  uint8_t (*tags)[AES_BLOCKLEN] = (uint8_t (*)[AES_BLOCKLEN])malloc(nchunks * AES_BLOCKLEN);
+  uint8_t (*want)[AES_BLOCKLEN] = (uint8_t (*)[AES_BLOCKLEN])malloc(nchunks * AES_BLOCKLEN);
+  uint8_t (*old_tags)[AES_BLOCKLEN] = (uint8_t (*)[AES_BLOCKLEN])malloc(nchunks * AES_BLOCKLEN);
+  uint64_t* gens = (uint64_t*)calloc(nchunks, sizeof(uint64_t));
+  uint64_t* zero = (uint64_t*)calloc(nchunks, sizeof(uint64_t));
+  struct aes_patch_range ranges[PATCH_RANGES + 2], merged[PATCH_RANGES + 2];
+  struct aes_pool* pool = aes_pool_create(0);
+  struct AES_pmac_ctx mac;
+  struct AES_ctx ctx;
+  double t_whole, t_serial, t_pool;
+  uint32_t i, n, dirty, changed, first = UINT32_MAX;
+  uint64_t end;
+  int bad = 0, ret;
+
+  AES_PMAC_init_ctx(&mac, key + 1);
+  fill(plain, PATCH_BYTES);
+  for (i = 0; i < PATCH_RANGES; ++i)
+  {
+    ranges[i].offset = next_random() % PATCH_BYTES;
+    ranges[i].length = 1 + next_random() % PATCH_MAX_RANGE;
+  }
+  // One range inside another and one past the end of the file.
+  ranges[PATCH_RANGES].offset = ranges[0].offset + 1;
+  ranges[PATCH_RANGES].length = 1;
+  ranges[PATCH_RANGES + 1].offset = PATCH_BYTES - 10;
+  ranges[PATCH_RANGES + 1].length = 100;
+
+  // The file before the change: other bytes in the ranges, encrypted as a
+  // whole (every chunk in generation 0) and tagged. The change writes new
+  // plaintext into the ranges.
+  memcpy(image, plain, PATCH_BYTES);
+  for (i = 0; i < PATCH_RANGES + 2; ++i)
+  {
+    end = (ranges[i].offset + ranges[i].length < PATCH_BYTES) ? ranges[i].offset + ranges[i].length : PATCH_BYTES;
+    fill(image + ranges[i].offset, end - ranges[i].offset);
+  }
+  AES_init_ctx_iv(&ctx, key, key);
+  aes_backend_ctr_xcrypt(&ctx, image, PATCH_BYTES);
+  aes_patch_tag(pool, &mac, key, image, PATCH_BYTES, PATCH_CHUNK, gens, NULL, 0, tags);
+  memcpy(old, image, PATCH_BYTES);
+  memcpy(old_tags, tags, nchunks * AES_BLOCKLEN);
+  for (i = 0; i < PATCH_RANGES + 2; ++i)
+  {
+    end = (ranges[i].offset + ranges[i].length < PATCH_BYTES) ? ranges[i].offset + ranges[i].length : PATCH_BYTES;
+    memcpy(image + ranges[i].offset, plain + ranges[i].offset, end - ranges[i].offset);
+  }
+
+  // The new plaintext encrypted whole, as generation 0.
+  memcpy(expect, plain, PATCH_BYTES);
+  AES_init_ctx_iv(&ctx, key, key);
+  aes_backend_ctr_xcrypt(&ctx, expect, PATCH_BYTES);
+
+  memcpy(merged, ranges, sizeof(ranges));
+  AES_init_ctx_iv(&ctx, key, key);
+  ret = aes_patch_ctr(pool, &ctx, image, PATCH_BYTES, PATCH_CHUNK, merged, PATCH_RANGES + 2, gens);
+  check(ret > 0, "aes_patch_ctr");
+  n = (ret > 0) ? (uint32_t)ret : 1;
+  for (i = 1; i < n; ++i)
+  {
+    bad |= (merged[i].offset <= merged[i - 1].offset + merged[i - 1].length);
+  }
+  check(!bad && (merged[n - 1].offset + merged[n - 1].length == PATCH_BYTES), "patch ranges not merged");
+
+  // Touched chunks moved to generation 1 and to keystream they never used,
+  // the others kept generation 0 and their bytes.
+  for (i = 0, changed = 0; i < nchunks; ++i)
+  {
+    const int same = (memcmp(image + (size_t)i * PATCH_CHUNK, expect + (size_t)i * PATCH_CHUNK, PATCH_CHUNK) == 0);
+    bad |= (gens[i] > 1) || (same != (gens[i] == 0));
+    changed += (gens[i] == 1);
+    first = ((gens[i] == 1) && (first == UINT32_MAX)) ? i : first;
+  }
+  check(!bad && (changed > 0), "patched chunks not re-encrypted under a new generation");
+  memcpy(expect, image, PATCH_BYTES);
+  for (i = 0; i < nchunks; ++i)
+  {
+    bad |= (aes_patch_xcrypt_chunk(&ctx, expect, PATCH_BYTES, PATCH_CHUNK, i, gens[i]) != 0);
+  }
+  check(!bad && (memcmp(expect, plain, PATCH_BYTES) == 0), "patched file does not decrypt to the new plaintext");
+
+  check(aes_patch_tag(pool, &mac, key, image, PATCH_BYTES, PATCH_CHUNK, gens, merged, n, tags) == 0, "patch tags");
+  aes_patch_tag(pool, &mac, key, image, PATCH_BYTES, PATCH_CHUNK, gens, NULL, 0, want);
+  check(memcmp(tags, want, nchunks * AES_BLOCKLEN) == 0, "patched tags differ from tagging the whole file");
+  for (i = 0; i < nchunks; ++i)
+  {
+    bad |= (aes_patch_verify(&mac, key, image, PATCH_BYTES, PATCH_CHUNK, i, gens[i], tags[i]) != 0);
+  }
+  check(!bad, "patch tag verification");
+  image[5 * PATCH_CHUNK + 7] ^= 1;
+  errno = 0;
+  check((aes_patch_verify(&mac, key, image, PATCH_BYTES, PATCH_CHUNK, 5, gens[5], tags[5]) == -1) && (errno == EBADMSG),
+        "patch tag of a modified chunk");
+  image[5 * PATCH_CHUNK + 7] ^= 1;
+  check(aes_patch_verify(&mac, key, image, PATCH_BYTES, PATCH_CHUNK, 5, gens[5], tags[6]) == -1,
+        "patch tag of another chunk");
+  // A rolled-back chunk, old bytes and old tag, fails at the current
+  // generation.
+  check(aes_patch_verify(&mac, key, old, PATCH_BYTES, PATCH_CHUNK, first, gens[first], old_tags[first]) == -1,
+        "patch tag of a rolled-back chunk");
+
+  // A chunk out of generations is refused, and nothing is touched.
+  memcpy(expect, image, PATCH_BYTES);
+  gens[first] = UINT64_MAX;
+  memcpy(ranges, merged, n * sizeof(merged[0]));
+  errno = 0;
+  ret = aes_patch_ctr(pool, &ctx, image, PATCH_BYTES, PATCH_CHUNK, ranges, n, gens);
+  check((ret == -1) && (errno == EOVERFLOW) && (memcmp(image, expect, PATCH_BYTES) == 0),
+        "patch of a chunk out of generations");
+  gens[first] = 1;
+  for (i = 0, dirty = 0; i < n; ++i)
+  {
+    dirty += (uint32_t)merged[i].length;
+  }
+
+  printf("patch: %u MB file, %u ranges (%u merged, %u KB), %u of %u chunks re-encrypted\n", PATCH_BYTES >> 20,
+         PATCH_RANGES + 2, n, dirty >> 10, changed, nchunks);
+  t_whole = patch_whole(pool, &mac, expect, zero, want);
+  // Each run treats the ranges as new plaintext and moves their chunks on
+  // by one generation.
+  t_serial = patch_ranges(NULL, &mac, image, gens, tags, merged, n);
+  t_pool = patch_ranges(pool, &mac, image, gens, tags, merged, n);
+  print_rate("whole file", PATCH_BYTES, t_whole, t_whole);
+  print_rate("dirty chunks", PATCH_BYTES, t_serial, t_whole);
+  printf("  %-24s %10.2f MB/s %8.2fx  (%u threads)\n", "dirty chunks, pool", (double)PATCH_BYTES / t_pool / 1048576.0,
+         t_pool / t_whole, aes_pool_threads(pool));
+  printf("\n");
+
+  aes_pool_destroy(pool);
+  free(plain);
+  free(expect);
+  free(image);
+  free(old);
+  free(tags);
+  free(want);
+  free(old_tags);
+  free(gens);
+  free(zero);
+}
+
+#endif // #if defined(ECB) && (ECB == 1) && defined(CTR) && (CTR == 1) && defined(PMAC) && (PMAC == 1)
+
+/*****************************************************************************/
+/* Time-budgeted steps:                                                      */
+/*****************************************************************************/
+#if defined(ECB) && (ECB == 1) && defined(CBC) && (CBC == 1) && defined(CTR) && (CTR == 1)
+
+#define RT_BYTES 65536
+#define RT_STEPS 2000
+
+static int compare_u64(const void* a, const void* b)
+{
+  const uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+  return (x > y) - (x < y);
+}
+
+// Runs op to the end in steps of random block limits and budgets.
+static void rt_to_end(struct AES_rt_op* op)
+{
+  while (!AES_RT_finished(op))
+  {
+    AES_RT_step(op, (uint32_t)(next_random() % 40), (uint32_t)(next_random() % 20000));
+  }
+}
+
+static void bench_rt(void)
+{
+  static const struct
+  {
+    const char* name;
+    enum AES_RT_mode mode;
+  } modes[] =
+  {
+    { "ecb encrypt", AES_RT_ECB_ENCRYPT },
+    { "ecb decrypt", AES_RT_ECB_DECRYPT },
+    { "cbc encrypt", AES_RT_CBC_ENCRYPT },
+    { "cbc decrypt", AES_RT_CBC_DECRYPT },
+    { "ctr", AES_RT_CTR },
+  };
+  static const uint32_t budgets[] = { 2000, 5000, 20000, 100000 };
+  static const uint8_t near_wrap[16] = { 0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7,
+                                         0xf8, 0xf9, 0xfa, 0xfb, 0xff, 0xff, 0xff, 0xf0 };
+  uint8_t* plain = (uint8_t*)malloc(RT_BYTES);
+  uint8_t* expect = (uint8_t*)malloc(RT_BYTES);
+  uint8_t* buf = (uint8_t*)malloc(RT_BYTES);
+  uint64_t* took = (uint64_t*)malloc(RT_STEPS * sizeof(uint64_t));
+  struct AES_ctx ctx;
+  struct AES_rt_op op;
+  uint32_t block_ns, blocks;
+  char what[64];
+  double t0, t_one, t_steps;
+  size_t i, m;
+
+  fill(plain, RT_BYTES);
+  for (m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m)
+  {
+    // CTR gets a length that ends inside a block.
+    const uint32_t length = (modes[m].mode == AES_RT_CTR) ? RT_BYTES - 7 : RT_BYTES;
+    memcpy(expect, plain, length);
+    AES_init_ctx_iv(&ctx, key, key);
+    switch (modes[m].mode)
+    {
+    case AES_RT_ECB_ENCRYPT:
+      for (i = 0; i < length; i += AES_BLOCKLEN)
+      {
+        AES_ECB_encrypt(&ctx, expect + i);
+      }
+      break;
+    case AES_RT_ECB_DECRYPT:
+      for (i = 0; i < length; i += AES_BLOCKLEN)
+      {
+        AES_ECB_decrypt(&ctx, expect + i);
+      }
+      break;
+    case AES_RT_CBC_ENCRYPT: AES_CBC_encrypt_buffer(&ctx, expect, length); break;
+    case AES_RT_CBC_DECRYPT: AES_CBC_decrypt_buffer(&ctx, expect, length); break;
+    case AES_RT_CTR: AES_CTR_xcrypt_buffer(&ctx, expect, length); break;
+    }
+    memcpy(buf, plain, length);
+    AES_init_ctx_iv(&ctx, key, key);
+    AES_RT_start(&op, &ctx, modes[m].mode, buf, length);
+    rt_to_end(&op);
+    snprintf(what, sizeof(what), "rt %s in steps", modes[m].name);
+    check(memcmp(buf, expect, length) == 0, what);
+  }
+
+  // A 32-bit counter field that wraps inside the message.
+  memcpy(expect, plain, RT_BYTES);
+  AES_init_ctx_iv(&ctx, key, near_wrap);
+  AES_CTR_xcrypt_buffer_width(&ctx, expect, RT_BYTES, 32);
+  memcpy(buf, plain, RT_BYTES);
+  AES_init_ctx_iv(&ctx, key, near_wrap);
+  AES_RT_start_ctr_width(&op, &ctx, buf, RT_BYTES, 32);
+  rt_to_end(&op);
+  check(memcmp(buf, expect, RT_BYTES) == 0, "rt ctr with a 32-bit counter in steps");
+
+  block_ns = AES_RT_calibrate(AES_RT_CTR);
+  AES_init_ctx_iv(&ctx, key, key);
+  t0 = now();
+  AES_CTR_xcrypt_buffer(&ctx, buf, RT_BYTES);
+  t_one = now() - t0;
+  printf("rt: CTR, %u ns per block calibrated; steps of a budget until %u steps or %u KB\n", block_ns, RT_STEPS,
+         RT_BYTES >> 10);
+  printf("  %-10s %10s %10s %10s %10s %12s\n", "budget", "median", "p99", "max", "blocks", "MB/s");
+  for (i = 0; i < sizeof(budgets) / sizeof(budgets[0]); ++i)
+  {
+    uint32_t steps = 0;
+    AES_init_ctx_iv(&ctx, key, key);
+    AES_RT_start(&op, &ctx, AES_RT_CTR, buf, RT_BYTES);
+    blocks = 0;
+    t_steps = 0;
+    while ((steps < RT_STEPS) && !AES_RT_finished(&op))
+    {
+      t0 = now();
+      blocks += AES_RT_step(&op, 0, budgets[i]) / AES_BLOCKLEN;
+      took[steps] = (uint64_t)((now() - t0) * 1e9);
+      t_steps += now() - t0;
+      ++steps;
+    }
+    qsort(took, steps, sizeof(uint64_t), compare_u64);
+    printf("  %7.1f us %7.1f us %7.1f us %7.1f us %10.1f %12.2f\n", budgets[i] * 1e-3, took[steps / 2] * 1e-3,
+           took[steps * 99 / 100] * 1e-3, took[steps - 1] * 1e-3, (double)blocks / steps,
+           (double)blocks * AES_BLOCKLEN / t_steps / 1048576.0);
+    // The tail is at the mercy of the scheduler; the median is not.
+    snprintf(what, sizeof(what), "rt median step within a %u ns budget", budgets[i]);
+    check(took[steps / 2] <= budgets[i], what);
+    snprintf(what, sizeof(what), "rt progress within a %u ns budget", budgets[i]);
+    check((budgets[i] < 2 * block_ns) || (blocks > 0), what);
+  }
+  printf("  %-10s %10s %10s %10s %10s %12.2f\n\n", "one call", "", "", "", "", RT_BYTES / t_one / 1048576.0);
+
+  free(plain);
+  free(expect);
+  free(buf);
+  free(took);
+}
+
+#endif // #if defined(ECB) && (ECB == 1) && defined(CBC) && (CBC == 1) && defined(CTR) && (CTR == 1)
+
+/*****************************************************************************/
+/* Lockstep:                                                                 */
+/*****************************************************************************/
+#if defined(ECB) && (ECB == 1) && defined(CBC) && (CBC == 1) && defined(CTR) && (CTR == 1)
+
+#define LOCKSTEP_BYTES (16u << 20)
+// Ends inside a chunk, and inside a block for CTR.
+#define LOCKSTEP_CHECK_BYTES (9 * AES_LOCKSTEP_CHUNK + 48)
+#define LOCKSTEP_FAULT_CHUNK 3
+
+// Bit flips to make: the offset in chunk LOCKSTEP_FAULT_CHUNK, per run
+// (replica 0, 1 and the third run), or -1 for none. Each run flips once.
+static int32_t lockstep_flip[3] = { -1, -1, -1 };
+
+static void lockstep_fault(unsigned replica, uint32_t chunk, uint8_t* out, uint32_t length)
+{
+  if ((chunk == LOCKSTEP_FAULT_CHUNK) && (lockstep_flip[replica] >= 0) && ((uint32_t)lockstep_flip[replica] < length))
+  {
+    out[lockstep_flip[replica]] ^= 0x10;
+    lockstep_flip[replica] = -1;
+  }
+}
+
+// Flips a bit of the counter or chaining block of replica 0 once it has
+// run chunk LOCKSTEP_FAULT_CHUNK, while lockstep_state_flip is set.
+static int lockstep_state_flip;
+
+static void lockstep_state_fault(unsigned replica, uint32_t chunk, uint8_t* iv)
+{
+  if ((replica == 0) && (chunk == LOCKSTEP_FAULT_CHUNK) && lockstep_state_flip)
+  {
+    iv[AES_BLOCKLEN - 5] ^= 0x04;
+    lockstep_state_flip = 0;
+  }
+}
+
+// Runs every mode through ls and checks it against the aes.h functions.
+static void lockstep_modes(struct aes_lockstep* ls, const char* label, const uint8_t* plain, uint8_t* expect, uint8_t* buf)
+{
+  static const char* const mode_names[] = { "ecb encrypt", "ecb decrypt", "cbc encrypt", "cbc decrypt", "ctr" };
+  struct AES_ctx ctx, ref;
+  char what[96];
+  size_t m;
+  int r;
+
+  for (m = 0; m < sizeof(mode_names) / sizeof(mode_names[0]); ++m)
+  {
+    const uint32_t length = (m == 4) ? LOCKSTEP_CHECK_BYTES - 7 : LOCKSTEP_CHECK_BYTES;
+    memcpy(expect, plain, length);
+    memcpy(buf, plain, length);
+    AES_init_ctx_iv(&ref, key, key);
+    AES_init_ctx_iv(&ctx, key, key);
+    switch (m)
+    {
+    case 0:
+      AES_ECB_encrypt_blocks(&ref, expect, length / AES_BLOCKLEN);
+      r = aes_lockstep_ecb_encrypt(ls, &ctx, buf, length / AES_BLOCKLEN);
+      break;
+    case 1:
+      AES_ECB_decrypt_blocks(&ref, expect, length / AES_BLOCKLEN);
+      r = aes_lockstep_ecb_decrypt(ls, &ctx, buf, length / AES_BLOCKLEN);
+      break;
+    case 2:
+      AES_CBC_encrypt_buffer(&ref, expect, length);
+      r = aes_lockstep_cbc_encrypt(ls, &ctx, buf, length);
+      break;
+    case 3:
+      AES_CBC_decrypt_buffer(&ref, expect, length);
+      r = aes_lockstep_cbc_decrypt(ls, &ctx, buf, length);
+      break;
+    default:
+      AES_CTR_xcrypt_buffer(&ref, expect, length);
+      r = aes_lockstep_ctr_xcrypt(ls, &ctx, buf, length);
+      break;
+    }
+    snprintf(what, sizeof(what), "lockstep %s %s", label, mode_names[m]);
+    check((r == 0) && (memcmp(buf, expect, length) == 0) && (memcmp(ctx.Iv, ref.Iv, AES_BLOCKLEN) == 0), what);
+  }
+}
+
+static void bench_lockstep(void)
+{
+  static const char* const check_names[] = { "compare", "checksum" };
+  static const struct
+  {
+    const char* name;
+    int32_t flip[3];
+    int ok[2];                 // expected to succeed with compare, checksum
+    uint8_t outvoted;          // runs then outvoted, a bit each
+  } faults[] =
+  {
+    { "replica 0", { 100, -1, -1 }, { 1, 1 }, 1 },
+    { "replica 1", { -1, 1000, -1 }, { 1, 1 }, 2 },
+    { "both, other blocks", { 100, 1000, -1 }, { 1, 0 }, 3 },
+    { "replica 0 and third", { 100, -1, 2000 }, { 1, 0 }, 5 },
+    { "all three, one block", { 100, 101, 102 }, { 0, 0 }, 0 },
+  };
+  uint8_t* plain = (uint8_t*)malloc(LOCKSTEP_BYTES);
+  uint8_t* expect = (uint8_t*)malloc(LOCKSTEP_BYTES);
+  uint8_t* buf = (uint8_t*)malloc(LOCKSTEP_BYTES);
+  struct aes_lockstep_stats before, after;
+  struct aes_lockstep* ls[2];
+  struct AES_ctx ctx, ref;
+  int cpu_a, cpu_b, r;
+  double t0, t_single, t;
+  char what[96];
+  size_t c, f, i;
+
+  fill(plain, LOCKSTEP_BYTES);
+  for (c = 0; c < 2; ++c)
+  {
+    ls[c] = aes_lockstep_create(-1, -1, (enum aes_lockstep_check)c);
+    check(ls[c] != NULL, "lockstep create");
+    if (ls[c] == NULL)
+    {
+      return;
+    }
+  }
+  aes_lockstep_cpus(ls[0], &cpu_a, &cpu_b);
+
+  for (c = 0; c < 2; ++c)
+  {
+    lockstep_modes(ls[c], check_names[c], plain, expect, buf);
+  }
+
+  // Faults in chunk LOCKSTEP_FAULT_CHUNK of a CTR pass.
+  memcpy(expect, plain, LOCKSTEP_CHECK_BYTES);
+  AES_init_ctx_iv(&ref, key, key);
+  AES_CTR_xcrypt_buffer(&ref, expect, LOCKSTEP_CHECK_BYTES);
+  aes_lockstep_fault = lockstep_fault;
+  for (c = 0; c < 2; ++c)
+  {
+    for (f = 0; f < sizeof(faults) / sizeof(faults[0]); ++f)
+    {
+      memcpy(lockstep_flip, faults[f].flip, sizeof(lockstep_flip));
+      memcpy(buf, plain, LOCKSTEP_CHECK_BYTES);
+      AES_init_ctx_iv(&ctx, key, key);
+      aes_lockstep_get_stats(ls[c], &before);
+      r = aes_lockstep_ctr_xcrypt(ls[c], &ctx, buf, LOCKSTEP_CHECK_BYTES);
+      aes_lockstep_get_stats(ls[c], &after);
+      snprintf(what, sizeof(what), "lockstep %s, fault in %s", check_names[c], faults[f].name);
+      if (faults[f].ok[c])
+      {
+        check((r == 0) && (memcmp(buf, expect, LOCKSTEP_CHECK_BYTES) == 0) &&
+              (after.mismatches == before.mismatches + 1) && (after.arbitrated == before.arbitrated + 1) &&
+              (after.outvoted[0] - before.outvoted[0] == (faults[f].outvoted & 1)) &&
+              (after.outvoted[1] - before.outvoted[1] == ((faults[f].outvoted >> 1) & 1)) &&
+              (after.outvoted[2] - before.outvoted[2] == ((faults[f].outvoted >> 2) & 1)), what);
+      }
+      else
+      {
+        check((r == -1) && (errno == EIO) && (after.failed == before.failed + 1) &&
+              (memcmp(ctx.Iv, key, AES_BLOCKLEN) == 0), what);
+      }
+    }
+  }
+  aes_lockstep_fault = NULL;
+
+  // An upset in the state of replica 0 after the fault chunk makes it go
+  // wrong from the next chunk on; once outvoted there, it must take the
+  // released state and agree again on all later chunks.
+  aes_lockstep_state_fault = lockstep_state_fault;
+  for (c = 0; c < 2; ++c)
+  {
+    for (f = 0; f < 2; ++f)
+    {
+      memcpy(expect, plain, LOCKSTEP_CHECK_BYTES);
+      memcpy(buf, plain, LOCKSTEP_CHECK_BYTES);
+      AES_init_ctx_iv(&ref, key, key);
+      AES_init_ctx_iv(&ctx, key, key);
+      lockstep_state_flip = 1;
+      aes_lockstep_get_stats(ls[c], &before);
+      if (f == 0)
+      {
+        AES_CBC_encrypt_buffer(&ref, expect, LOCKSTEP_CHECK_BYTES);
+        r = aes_lockstep_cbc_encrypt(ls[c], &ctx, buf, LOCKSTEP_CHECK_BYTES);
+      }
+      else
+      {
+        AES_CTR_xcrypt_buffer(&ref, expect, LOCKSTEP_CHECK_BYTES);
+        r = aes_lockstep_ctr_xcrypt(ls[c], &ctx, buf, LOCKSTEP_CHECK_BYTES);
+      }
+      aes_lockstep_get_stats(ls[c], &after);
+      snprintf(what, sizeof(what), "lockstep %s, %s state upset in replica 0", check_names[c], (f == 0) ? "cbc" : "ctr");
+      check((r == 0) && (memcmp(buf, expect, LOCKSTEP_CHECK_BYTES) == 0) && (memcmp(ctx.Iv, ref.Iv, AES_BLOCKLEN) == 0) &&
+            (after.mismatches == before.mismatches + 1) && (after.arbitrated == before.arbitrated + 1) &&
+            (after.outvoted[0] == before.outvoted[0] + 1), what);
+    }
+  }
+  aes_lockstep_state_fault = NULL;
+
+  printf("lockstep: CTR on %u MB, replicas on CPUs %d and %d\n", LOCKSTEP_BYTES >> 20, cpu_a, cpu_b);
+  memcpy(buf, plain, LOCKSTEP_BYTES);
+  AES_init_ctx_iv(&ctx, key, key);
+  aes_backend_ctr_xcrypt(&ctx, buf, LOCKSTEP_BYTES);
+  t0 = now();
+  for (i = 0; i < 4; ++i)
+  {
+    aes_backend_ctr_xcrypt(&ctx, buf, LOCKSTEP_BYTES);
+  }
+  t_single = (now() - t0) / 4;
+  print_rate("single execution", LOCKSTEP_BYTES, t_single, t_single);
+  for (c = 0; c < 2; ++c)
+  {
+    aes_lockstep_ctr_xcrypt(ls[c], &ctx, buf, LOCKSTEP_BYTES);
+    t0 = now();
+    for (i = 0; i < 4; ++i)
+    {
+      aes_lockstep_ctr_xcrypt(ls[c], &ctx, buf, LOCKSTEP_BYTES);
+    }
+    t = (now() - t0) / 4;
+    snprintf(what, sizeof(what), "lockstep, %s", check_names[c]);
+    print_rate(what, LOCKSTEP_BYTES, t, t_single);
+  }
+  printf("\n");
+
+  for (c = 0; c < 2; ++c)
+  {
+    aes_lockstep_destroy(ls[c]);
+  }
+  free(plain);
+  free(expect);
+  free(buf);
+}
+
+#endif // #if defined(ECB) && (ECB == 1) && defined(CBC) && (CBC == 1) && defined(CTR) && (CTR == 1)
+
+/*****************************************************************************/
+/* Design-diverse lockstep:                                                  */
+/*****************************************************************************/
+#if defined(ECB) && (ECB == 1) && defined(CBC) && (CBC == 1) && defined(CTR) && (CTR == 1)
+
+#define DIVERSE_BYTES (1u << 20)
+
+// The S-box table in this executable: the first row of the forward S-box,
+// followed by the rest of a permutation. NULL if it is not there (built
+// with SBOX_CIRCUIT) or /proc is not available.
+static uint8_t* find_sbox(void)
+{
+  static const uint8_t head[16] = { 0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76 };
+  char exe[512], line[1024], perms[8], path[512];
+  unsigned long start, end;
+  uint8_t* found = NULL;
+  ssize_t n;
+  FILE* f;
+
+  n = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+  f = fopen("/proc/self/maps", "r");
+  if ((n <= 0) || (f == NULL))
+  {
+    if (f != NULL)
+    {
+      fclose(f);
+    }
+    return NULL;
+  }
+  exe[n] = '\0';
+  while ((found == NULL) && (fgets(line, sizeof(line), f) != NULL))
+  {
+    const uint8_t* p;
+
+    if ((sscanf(line, "%lx-%lx %7s %*s %*s %*s %511s", &start, &end, perms, path) != 4) ||
+        (perms[0] != 'r') || (strcmp(path, exe) != 0))
+    {
+      continue;
+    }
+    for (p = (const uint8_t*)start; (found == NULL) && (p + 256 <= (const uint8_t*)end); ++p)
+    {
+      uint8_t seen[256];
+      int i;
+
+      if (memcmp(p, head, sizeof(head)) != 0)
+      {
+        continue;
+      }
+      memset(seen, 0, sizeof(seen));
+      for (i = 0; (i < 256) && !seen[p[i]]; ++i)
+      {
+        seen[p[i]] = 1;
+      }
+      if (i == 256)
+      {
+        found = (uint8_t*)p;
+      }
+    }
+  }
+  fclose(f);
+  return found;
+}
+
+// Writes one byte of read-only memory through /proc/self/mem.
+static int poke(uint8_t* addr, uint8_t v)
+{
+  const int fd = open("/proc/self/mem", O_RDWR);
+  int r;
+
+  if (fd < 0)
+  {
+    return -1;
+  }
+  r = (pwrite(fd, &v, 1, (off_t)(uintptr_t)addr) == 1) ? 0 : -1;
+  close(fd);
+  return r;
+}
+
+static void bench_diverse(void)
+{
+  const struct aes_backend* aesni = aes_backend_find("aesni");
+  const char* fast = ((aesni != NULL) && aesni->available()) ? "aesni" : "ct";
+  uint8_t* plain = (uint8_t*)malloc(LOCKSTEP_CHECK_BYTES);
+  uint8_t* expect = (uint8_t*)malloc(LOCKSTEP_CHECK_BYTES);
+  uint8_t* buf = (uint8_t*)malloc(LOCKSTEP_CHECK_BYTES);
+  struct aes_lockstep* same = aes_lockstep_create(-1, -1, AES_LOCKSTEP_COMPARE);
+  struct aes_lockstep* ls = aes_lockstep_create(-1, -1, AES_LOCKSTEP_COMPARE);
+  struct aes_lockstep_stats before, after;
+  struct AES_ctx ctx, ref, start;
+  uint8_t* sbox;
+  double t0, t_table, t_ct, t;
+  char what[96];
+  int r, i;
+
+  check((same != NULL) && (ls != NULL), "diverse lockstep create");
+  if ((same == NULL) || (ls == NULL))
+  {
+    return;
+  }
+  check((aes_lockstep_set_engines(same, "table", "batch", "table") == 0) &&
+        (aes_lockstep_set_engines(ls, "table", "ct", fast) == 0), "diverse lockstep engines");
+  errno = 0;
+  check((aes_lockstep_set_engines(ls, "table", "no such engine", NULL) == -1) && (errno == EINVAL), "diverse lockstep unknown engine");
+  snprintf(what, sizeof(what), "%s/%s/%s", aes_lockstep_engine(ls, 0), aes_lockstep_engine(ls, 1), aes_lockstep_engine(ls, 2));
+  fill(plain, LOCKSTEP_CHECK_BYTES);
+  lockstep_modes(ls, what, plain, expect, buf);
+
+  // One wrong S-box entry: the table engines agree on the wrong output, the
+  // circuit disagrees with them and the third run outvotes the table. The
+  // key schedule is common to all runs, so it is expanded before.
+  printf("diverse lockstep: %s on CTR, S-box entry 0 flipped\n", what);
+  memcpy(expect, plain, LOCKSTEP_CHECK_BYTES);
+  AES_init_ctx_iv(&ref, key, key);
+  start = ref;
+  AES_CTR_xcrypt_buffer(&ref, expect, LOCKSTEP_CHECK_BYTES);
+  sbox = find_sbox();
+  if ((sbox == NULL) || (poke(sbox, sbox[0] ^ 1) != 0))
+  {
+    printf("  skipped: no writable S-box table in this build\n");
+  }
+  else
+  {
+    memcpy(buf, plain, LOCKSTEP_CHECK_BYTES);
+    ctx = start;
+    r = aes_lockstep_ctr_xcrypt(same, &ctx, buf, LOCKSTEP_CHECK_BYTES);
+    printf("  table/batch/table: %s\n", ((r == 0) && (memcmp(buf, expect, LOCKSTEP_CHECK_BYTES) != 0)) ?
+           "wrong output released, undetected" : "detected");
+
+    memcpy(buf, plain, LOCKSTEP_CHECK_BYTES);
+    ctx = start;
+    aes_lockstep_get_stats(ls, &before);
+    r = aes_lockstep_ctr_xcrypt(ls, &ctx, buf, LOCKSTEP_CHECK_BYTES);
+    aes_lockstep_get_stats(ls, &after);
+    poke(sbox, sbox[0] ^ 1);
+    printf("  %s: %llu of %llu chunks outvoted run 0\n", what,
+           (unsigned long long)(after.outvoted[0] - before.outvoted[0]), (unsigned long long)(after.chunks - before.chunks));
+    check((r == 0) && (memcmp(buf, expect, LOCKSTEP_CHECK_BYTES) == 0) && (after.outvoted[0] > before.outvoted[0]) &&
+          (after.outvoted[1] == before.outvoted[1]) && (after.failed == before.failed), "diverse lockstep, corrupted S-box");
+  }
+  free(plain);
+  free(expect);
+  free(buf);
+
+  printf("diverse lockstep: CTR on %u MB\n", DIVERSE_BYTES >> 20);
+  buf = (uint8_t*)malloc(DIVERSE_BYTES);
+  fill(buf, DIVERSE_BYTES);
+  AES_init_ctx_iv(&ctx, key, key);
+  t0 = now();
+  for (i = 0; i < 4; ++i)
+  {
+    aes_backend_find("table")->ctr_xcrypt(&ctx, buf, DIVERSE_BYTES);
+  }
+  t_table = (now() - t0) / 4;
+  t0 = now();
+  for (i = 0; i < 4; ++i)
+  {
+    aes_backend_find("ct")->ctr_xcrypt(&ctx, buf, DIVERSE_BYTES);
+  }
+  t_ct = (now() - t0) / 4;
+  t0 = now();
+  for (i = 0; i < 4; ++i)
+  {
+    aes_lockstep_ctr_xcrypt(ls, &ctx, buf, DIVERSE_BYTES);
+  }
+  t = (now() - t0) / 4;
+  print_rate("table", DIVERSE_BYTES, t_table, (t_table > t_ct) ? t_table : t_ct);
+  print_rate("ct", DIVERSE_BYTES, t_ct, (t_table > t_ct) ? t_table : t_ct);
+  print_rate("lockstep, table and ct", DIVERSE_BYTES, t, (t_table > t_ct) ? t_table : t_ct);
+  printf("\n");
+
+  aes_lockstep_destroy(same);
+  aes_lockstep_destroy(ls);
+  free(buf);
+}
+
+#endif // #if defined(ECB) && (ECB == 1) && defined(CBC) && (CBC == 1) && defined(CTR) && (CTR == 1)
+
+/*****************************************************************************/
+/* Parallel tunables:                                                        */
+/*****************************************************************************/
+#if defined(CTR) && (CTR == 1) && defined(ECB) && (ECB == 1)
+
+#define TUNE_BYTES (4u << 20)
+
+// The drivers against the serial functions under tunables that put chunk
+// boundaries in awkward places.
+static void tune_drivers(struct aes_pool* pool)
+{
+  static const uint32_t lengths[] = { 0, 16, 48, 4096, 100000, 100003 };
+  const struct aes_mt_tunables odd = { 0, 48, 3, 0 };
+  uint8_t* plain = (uint8_t*)malloc(100003);
+  uint8_t* expect = (uint8_t*)malloc(100003);
+  uint8_t* data = (uint8_t*)malloc(100003);
+  struct AES_ctx serial, ctx;
+  uint8_t iv[AES_BLOCKLEN];
+  size_t i;
+  int bad = 0;
+
+  fill(plain, 100003);
+  fill(iv, sizeof(iv));
+  aes_mt_set_tunables(&odd);
+  for (i = 0; i < sizeof(lengths) / sizeof(lengths[0]); ++i)
+  {
+    const uint32_t len = lengths[i], blocks = len / AES_BLOCKLEN;
+
+    AES_init_ctx_iv(&serial, key, iv);
+    AES_init_ctx_iv(&ctx, key, iv);
+    memcpy(expect, plain, len);
+    memcpy(data, plain, len);
+    AES_ECB_encrypt_blocks(&serial, expect, blocks);
+    aes_mt_ecb_encrypt(pool, &ctx, data, blocks);
+    bad |= (memcmp(data, expect, len) != 0);
+    AES_ECB_decrypt_blocks(&serial, expect, blocks);
+    aes_mt_ecb_decrypt(pool, &ctx, data, blocks);
+    bad |= (memcmp(data, expect, len) != 0);
+
+#if defined(CBC) && (CBC == 1)
+    AES_CBC_decrypt_buffer(&serial, expect, blocks * AES_BLOCKLEN);
+    aes_mt_cbc_decrypt(pool, &ctx, data, blocks * AES_BLOCKLEN);
+    bad |= (memcmp(data, expect, len) != 0) || (memcmp(ctx.Iv, serial.Iv, AES_BLOCKLEN) != 0);
+#endif
+
+    // Twice, so the second call starts from the counter the first left.
+    AES_CTR_xcrypt_buffer(&serial, expect, len);
+    AES_CTR_xcrypt_buffer(&serial, expect, len);
+    aes_mt_ctr_xcrypt(pool, &ctx, data, len);
+    aes_mt_ctr_xcrypt(pool, &ctx, data, len);
+    bad |= (memcmp(data, expect, len) != 0) || (memcmp(ctx.Iv, serial.Iv, AES_BLOCKLEN) != 0);
+  }
+  check(!bad, "thread pool drivers differ from the serial functions");
+
+  free(plain);
+  free(expect);
+  free(data);
+}
+
+static double tune_ctr(struct aes_pool* pool, const struct aes_mt_tunables* t, uint8_t* buf, uint32_t length)
+{
+  struct AES_ctx ctx;
+  double t0;
+  uint32_t done;
+
+  aes_mt_set_tunables(t);
+  AES_init_ctx_iv(&ctx, key, key);
+  t0 = now();
+  for (done = 0; done < TUNE_BYTES; done += length)
+  {
+    aes_mt_ctr_xcrypt(pool, &ctx, buf, length);
+  }
+  return now() - t0;
+}
+
+static void bench_tune(void)
+{
+  static const uint32_t lengths[] = { 4096, 65536, TUNE_BYTES };
+  const struct aes_mt_tunables defaults = { 0, AES_MT_CHUNK, AES_MT_INTERLEAVE, AES_MT_MIN_PARALLEL };
+  struct aes_pool* pool = aes_pool_create(0);
+  uint8_t* buf = (uint8_t*)malloc(TUNE_BYTES);
+  struct aes_mt_tunables tuned;
+  double t_default, t_tuned, t0;
+  char name[32];
+  size_t i;
+  int saved;
+
+  tune_drivers(pool);
+  fill(buf, TUNE_BYTES);
+
+  t0 = now();
+  saved = aes_mt_tune(pool, &tuned);
+  printf("tune: %u threads in the pool, swept in %.1f s%s\n", aes_pool_threads(pool), now() - t0,
+         (saved == 0) ? "" : " (profile not written)");
+  printf("  threads %u, chunk %lu, interleave %lu, min_parallel %lu\n", tuned.threads,
+         (unsigned long)tuned.chunk, (unsigned long)tuned.interleave, (unsigned long)tuned.min_parallel);
+
+  for (i = 0; i < sizeof(lengths) / sizeof(lengths[0]); ++i)
+  {
+    t_default = tune_ctr(pool, &defaults, buf, lengths[i]);
+    t_tuned = tune_ctr(pool, &tuned, buf, lengths[i]);
+    snprintf(name, sizeof(name), "ctr %lu B, defaults", (unsigned long)lengths[i]);
+    print_rate(name, TUNE_BYTES, t_default, t_default);
+    snprintf(name, sizeof(name), "ctr %lu B, tuned", (unsigned long)lengths[i]);
+    print_rate(name, TUNE_BYTES, t_tuned, t_default);
+  }
+  printf("\n");
+
+  aes_mt_set_tunables(&tuned);
+  aes_pool_destroy(pool);
+  free(buf);
+}
+
+#endif // #if defined(CTR) && (CTR == 1) && defined(ECB) && (ECB == 1)
+
+/*****************************************************************************/
+/* Main:                                                                     */
+/*****************************************************************************/
+static const struct
+{
+  const char* name;
+  void (*run)(void);
+} sections[] =
+{
+#if defined(CTR) && (CTR == 1) && defined(ECB) && (ECB == 1)
+  { "ctr", bench_ctr },
+#endif
+#if defined(SECDED) && (SECDED == 1)
+  { "secded", bench_secded },
+#endif
+#if defined(RESO) && (RESO == 1) && defined(ECB) && (ECB == 1)
+  { "reso", bench_reso },
+#endif
+#if defined(ECB) && (ECB == 1)
+  { "sbox", bench_sbox },
+#endif
+#if defined(OCB) && (OCB == 1)
+  { "ocb", bench_ocb },
+#endif
+#if defined(SIV) && (SIV == 1)
+  { "siv", bench_siv },
+#endif
+#if defined(GCM) && (GCM == 1)
+  { "gcm", bench_gcm },
+#endif
+#if defined(PMAC) && (PMAC == 1)
+  { "pmac", bench_pmac },
+#endif
+#if defined(FPE) && (FPE == 1)
+  { "fpe", bench_fpe },
+#endif
+#if defined(ECB) && (ECB == 1) && defined(CTR) && (CTR == 1)
+  { "backend", bench_backend },
+#endif
+#if defined(ECB) && (ECB == 1) && defined(CTR) && (CTR == 1)
+  { "stream", bench_stream },
+#endif
+#if defined(ECB) && (ECB == 1) && defined(CTR) && (CTR == 1)
+  { "lazy", bench_lazy },
+#endif
+#if defined(ECB) && (ECB == 1) && defined(CTR) && (CTR == 1)
+  { "cache", bench_cache },
+#endif
+#if defined(ECB) && (ECB == 1) && defined(CTR) && (CTR == 1)
+  { "job", bench_job },
+#endif
+#if defined(ECB) && (ECB == 1) && defined(CTR) && (CTR == 1) && defined(PMAC) && (PMAC == 1)
+  { "patch", bench_patch },
+#endif
+#if defined(ECB) && (ECB == 1) && defined(CBC) && (CBC == 1) && defined(CTR) && (CTR == 1)
+  { "rt", bench_rt },
+#endif
+#if defined(ECB) && (ECB == 1) && defined(CBC) && (CBC == 1) && defined(CTR) && (CTR == 1)
+  { "lockstep", bench_lockstep },
+  { "diverse", bench_diverse },
+#endif
+#if defined(CTR) && (CTR == 1) && defined(ECB) && (ECB == 1)
+  { "tune", bench_tune },
+#endif
+};
+
+int main(int argc, char** argv)
+{
+  const size_t n = sizeof(sections) / sizeof(sections[0]);
+  size_t i;
+  int a;
+
+  for (a = 1; a < argc; ++a)
+  {
+    for (i = 0; (i < n) && (strcmp(argv[a], sections[i].name) != 0); ++i)
+      ;
+    if (i == n)
+    {
+      fprintf(stderr, "bench: unknown section '%s'\n", argv[a]);
+      return 2;
+    }
+  }
+  for (i = 0; i < n; ++i)
+  {
+    for (a = 1; (a < argc) && (strcmp(argv[a], sections[i].name) != 0); ++a)
+      ;
+    if ((argc == 1) || (a < argc))
+    {
+      sections[i].run();
+    }
+  }
+
+  if (failures)
+  {
+    printf("bench: %d check(s) FAILED!\n", failures);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,422 @@
+/*
+
+Frames/s benchmark for the producer -> encryptor -> consumer chain.
+
+  usage: ring-bench [megabytes-per-size]
+
+For each frame size from 64 B to 64 KB, a producer process fills frames, this
+process CTR-encrypts them and a consumer process reads the ciphertext. The
+chain runs over the shared-memory ring (aes_ring.h), once with one producer
+and once with MAX_PRODUCERS of them in MPSC mode, and over two pipes, where
+every frame is copied into and out of the kernel twice. The consumer checks
+the length, number and counter of every frame; a shorter untimed pass per
+size and ring mode also decrypts every frame and compares it with what was
+produced. With GCM, a last pass seals frames of varied lengths, opens every
+one of them, and checks that a changed frame is refused.
+
+*/
+
+#define _GNU_SOURCE
+
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "aes.h"
+#include "aes_ring.h"
+
+#define RING_SLOTS 256
+#define MAX_PRODUCERS 4
+
+static const uint8_t key[16] = { 0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c };
+static const uint8_t iv[16]  = { 0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff };
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void fill(uint8_t* p, uint32_t size, uint64_t n)
+{
+  uint32_t i;
+  for (i = 0; i < size; ++i)
+  {
+    p[i] = (uint8_t)(n + i);
+  }
+}
+
+/*****************************************************************************/
+/* Shared-memory ring:                                                       */
+/*****************************************************************************/
+// Adds n to the big-endian counter block ctr.
+static void ctr_add(uint8_t* ctr, uint64_t n)
+{
+  int i;
+  for (i = AES_BLOCKLEN - 1; (i >= 0) && (n != 0); --i)
+  {
+    n += ctr[i];
+    ctr[i] = (uint8_t)n;
+    n >>= 8;
+  }
+}
+
+// Produces frames first, first + step, ... below frames; each carries its
+// number in flags, so that the consumer can check it whatever the order the
+// producers interleave in.
+static void ring_producer(struct aes_ring* ring, uint32_t size, uint64_t frames, uint64_t first, uint64_t step)
+{
+  uint64_t n, pos;
+  for (n = first; n < frames; n += step)
+  {
+    struct aes_ring_frame* f;
+    while ((f = aes_ring_produce_begin(ring, &pos)) == NULL)
+    {
+      sched_yield();
+    }
+    fill(f->data, size, n);
+    f->flags = (uint32_t)n;
+    aes_ring_produce_commit(ring, pos, size);
+  }
+}
+
+// Checks every frame: its length, that its number was not seen before, and
+// that it starts at the counter where the previous frame ended. With verify,
+// it also decrypts the frame and compares it with what was produced; the
+// timed runs only touch a byte per cache line instead.
+static int ring_consumer(struct aes_ring* ring, uint32_t size, uint64_t frames, int verify)
+{
+  uint8_t* check = (uint8_t*)malloc(size);
+  uint8_t* expect = (uint8_t*)malloc(size);
+  uint8_t* seen = (uint8_t*)calloc(frames, 1);
+  volatile uint8_t sink = 0;
+  uint8_t ctr[AES_BLOCKLEN];
+  uint64_t n, pos;
+  int bad = (check == NULL) || (expect == NULL) || (seen == NULL);
+
+  memcpy(ctr, iv, AES_BLOCKLEN);
+  for (n = 0; (n < frames) && !bad; ++n)
+  {
+    struct aes_ring_frame* f;
+    uint32_t i;
+    while ((f = aes_ring_consume_begin(ring, &pos)) == NULL)
+    {
+      sched_yield();
+    }
+    bad = (f->length != size) || (f->flags >= frames) || seen[f->flags] || (memcmp(f->iv, ctr, AES_BLOCKLEN) != 0);
+    if (!bad)
+    {
+      seen[f->flags] = 1;
+    }
+    if (!bad && verify)
+    {
+      struct AES_ctx ctx;
+      AES_init_ctx_iv(&ctx, key, f->iv);
+      memcpy(check, f->data, size);
+      AES_CTR_xcrypt_buffer(&ctx, check, size);
+      fill(expect, size, f->flags);
+      bad = (memcmp(check, expect, size) != 0);
+    }
+    for (i = 0; i < size; i += 64)
+    {
+      sink ^= f->data[i];
+    }
+    ctr_add(ctr, size / AES_BLOCKLEN);
+    aes_ring_consume_commit(ring, pos);
+  }
+  (void)sink;
+  free(check);
+  free(expect);
+  free(seen);
+  return bad;
+}
+
+static int exited_ok(pid_t pid)
+{
+  int status;
+  return (waitpid(pid, &status, 0) == pid) && WIFEXITED(status) && (WEXITSTATUS(status) == 0);
+}
+
+// Runs frames through the ring with the given number of producers (more
+// than one runs the ring in MPSC mode) and returns the time taken.
+static double run_ring(uint32_t size, uint64_t frames, uint32_t producers, int verify, int* bad)
+{
+  struct aes_ring* ring = aes_ring_create(NULL, RING_SLOTS, size, (producers > 1) ? AES_RING_MPSC : 0);
+  struct AES_ctx ctx;
+  pid_t prod[MAX_PRODUCERS], cons;
+  uint64_t done = 0;
+  double t0, t1;
+  uint32_t k;
+  int ok = 1;
+
+  if (ring == NULL)
+  {
+    perror("aes_ring_create");
+    exit(2);
+  }
+  AES_init_ctx_iv(&ctx, key, iv);
+
+  t0 = now();
+  for (k = 0; k < producers; ++k)
+  {
+    if ((prod[k] = fork()) == 0)
+    {
+      ring_producer(ring, size, frames, k, producers);
+      _exit(0);
+    }
+  }
+  if ((cons = fork()) == 0)
+  {
+    _exit(ring_consumer(ring, size, frames, verify));
+  }
+  while (done < frames)
+  {
+    const uint32_t n = aes_ring_encrypt_ctr(ring, &ctx, 64);
+    if (n == 0)
+    {
+      // A consumer that gave up on a bad frame stops releasing slots, and
+      // the producers would wait for them forever.
+      if (waitpid(cons, NULL, WNOHANG) == cons)
+      {
+        for (k = 0; k < producers; ++k)
+        {
+          kill(prod[k], SIGKILL);
+        }
+        ok = 0;
+        break;
+      }
+      sched_yield();
+    }
+    done += n;
+  }
+  for (k = 0; k < producers; ++k)
+  {
+    ok &= exited_ok(prod[k]);
+  }
+  ok &= (done == frames) && exited_ok(cons);
+  t1 = now();
+
+  *bad |= !ok;
+  aes_ring_close(ring);
+  return t1 - t0;
+}
+
+#if defined(GCM) && (GCM == 1)
+
+#define GCM_SLOT 1024
+#define GCM_FRAMES 100
+
+// One process plays all three roles: it fills the ring, seals the frames,
+// then opens them in order. Frame n is n * 37 % (GCM_SLOT + 1) bytes long,
+// so lengths run from empty to a full slot. Every fifth frame is changed
+// before it is opened, in its payload or its tag, and must be refused.
+static int check_gcm(void)
+{
+  struct aes_ring* ring = aes_ring_create(NULL, 16, GCM_SLOT, 0);
+  uint8_t expect[GCM_SLOT], nonce[AES_RING_NONCELEN], next[AES_RING_NONCELEN];
+  struct AES_gcm_ctx ctx;
+  uint64_t n = 0, m = 0, pos;
+  int bad = 0;
+
+  if (ring == NULL)
+  {
+    perror("aes_ring_create");
+    exit(2);
+  }
+  AES_GCM_init_ctx(&ctx, key);
+  memcpy(nonce, iv, AES_RING_NONCELEN);
+  memcpy(next, iv, AES_RING_NONCELEN);
+  while (m < GCM_FRAMES)
+  {
+    struct aes_ring_frame* f;
+    while ((n < GCM_FRAMES) && ((f = aes_ring_produce_begin(ring, &pos)) != NULL))
+    {
+      const uint32_t length = (uint32_t)(n * 37 % (GCM_SLOT + 1));
+      fill(f->data, length, n);
+      f->flags = (uint32_t)n++;
+      aes_ring_produce_commit(ring, pos, length);
+    }
+    aes_ring_encrypt_gcm(ring, &ctx, nonce, 16);
+    while ((f = aes_ring_consume_begin(ring, &pos)) != NULL)
+    {
+      const int tamper = (m % 5 == 0);
+      int i;
+      bad |= (f->flags != m) || (f->length != m * 37 % (GCM_SLOT + 1));
+      bad |= (memcmp(f->iv, next, AES_RING_NONCELEN) != 0);
+      if (tamper)
+      {
+        if (f->length > 0)
+        {
+          f->data[m % f->length] ^= 0x01;
+        }
+        else
+        {
+          f->tag[m % AES_BLOCKLEN] ^= 0x80;
+        }
+      }
+      fill(expect, f->length, f->flags);
+      if (AES_GCM_decrypt(&ctx, f->iv, AES_RING_NONCELEN, NULL, 0, f->data, f->length, f->tag, AES_BLOCKLEN) != 0)
+      {
+        bad |= !tamper;
+      }
+      else
+      {
+        bad |= tamper || (memcmp(f->data, expect, f->length) != 0);
+      }
+      for (i = AES_RING_NONCELEN - 1; i >= 0; --i)
+      {
+        if (++next[i] != 0)
+        {
+          break;
+        }
+      }
+      aes_ring_consume_commit(ring, pos);
+      ++m;
+    }
+  }
+  bad |= (memcmp(nonce, next, AES_RING_NONCELEN) != 0);
+  aes_ring_close(ring);
+  return bad;
+}
+
+#endif // #if defined(GCM) && (GCM == 1)
+
+/*****************************************************************************/
+/* Pipe baseline:                                                            */
+/*****************************************************************************/
+static int full_io(int fd, uint8_t* p, uint32_t size, int wr)
+{
+  uint32_t off = 0;
+  while (off < size)
+  {
+    const ssize_t n = wr ? write(fd, p + off, size - off) : read(fd, p + off, size - off);
+    if (n <= 0)
+    {
+      return -1;
+    }
+    off += (uint32_t)n;
+  }
+  return 0;
+}
+
+static double run_pipe(uint32_t size, uint64_t frames)
+{
+  uint8_t* buf = (uint8_t*)malloc(size);
+  struct AES_ctx ctx;
+  int in[2], out[2], status;
+  pid_t prod, cons;
+  uint64_t n;
+  double t0, t1;
+
+  if ((pipe(in) < 0) || (pipe(out) < 0))
+  {
+    perror("pipe");
+    exit(2);
+  }
+  AES_init_ctx_iv(&ctx, key, iv);
+
+  t0 = now();
+  if ((prod = fork()) == 0)
+  {
+    close(in[0]);
+    for (n = 0; n < frames; ++n)
+    {
+      fill(buf, size, n);
+      if (full_io(in[1], buf, size, 1) < 0)
+      {
+        _exit(1);
+      }
+    }
+    _exit(0);
+  }
+  if ((cons = fork()) == 0)
+  {
+    volatile uint8_t sink = 0;
+    uint32_t i;
+    close(out[1]);
+    for (n = 0; n < frames; ++n)
+    {
+      if (full_io(out[0], buf, size, 0) < 0)
+      {
+        _exit(1);
+      }
+      for (i = 0; i < size; i += 64)
+      {
+        sink ^= buf[i];
+      }
+    }
+    (void)sink;
+    _exit(0);
+  }
+  close(in[1]);
+  close(out[0]);
+  for (n = 0; n < frames; ++n)
+  {
+    if (full_io(in[0], buf, size, 0) < 0)
+    {
+      break;
+    }
+    AES_CTR_xcrypt_buffer(&ctx, buf, size);
+    if (full_io(out[1], buf, size, 1) < 0)
+    {
+      break;
+    }
+  }
+  close(in[0]);
+  close(out[1]);
+  waitpid(prod, &status, 0);
+  waitpid(cons, &status, 0);
+  t1 = now();
+
+  free(buf);
+  return t1 - t0;
+}
+
+int main(int argc, char** argv)
+{
+  const double megabytes = (argc > 1) ? atof(argv[1]) : 8.0;
+  uint32_t size;
+  int bad = 0;
+
+  printf("%8s %10s %14s %10s %14s %10s %14s %10s\n", "frame", "frames", "ring frames/s", "ring MB/s",
+         "mpsc frames/s", "mpsc MB/s", "pipe frames/s", "pipe MB/s");
+  for (size = 64; size <= 65536; size *= 4)
+  {
+    uint64_t frames = (uint64_t)(megabytes * 1048576.0) / size;
+    double tr, tm, tp;
+
+    if (frames < 256)
+    {
+      frames = 256;
+    }
+    tr = run_ring(size, frames, 1, 0, &bad);
+    tm = run_ring(size, frames, MAX_PRODUCERS, 0, &bad);
+    tp = run_pipe(size, frames);
+    printf("%8u %10llu %14.0f %10.2f %14.0f %10.2f %14.0f %10.2f\n", size, (unsigned long long)frames,
+           (double)frames / tr, (double)frames * size / tr / 1048576.0,
+           (double)frames / tm, (double)frames * size / tm / 1048576.0,
+           (double)frames / tp, (double)frames * size / tp / 1048576.0);
+
+    // Untimed: decrypt and compare every frame of a shorter run, with one
+    // producer and with many.
+    frames = 1048576 / size;
+    frames = (frames < 64) ? 64 : frames;
+    run_ring(size, frames, 1, 1, &bad);
+    run_ring(size, frames, MAX_PRODUCERS, 1, &bad);
+  }
+#if defined(GCM) && (GCM == 1)
+  bad |= check_gcm();
+#endif
+
+  if (bad)
+  {
+    printf("\nring-bench: ciphertext check FAILURE!\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,928 @@
+/*
+
+Flips bits in the memory of a running, unmodified encryptor.
+
+  usage: seu-inject [-t target]... [-r flips-per-s] [-d seconds] [-h hold-ms]
+                    [-w window-ms] [-U] [-s seed] [-l log] [-g golden]
+                    (-p pid | -- command args...)
+
+Targets:
+
+  sbox, rsbox    the S-box tables of aes.c, found by symbol
+  ctx            every expanded key schedule found in writable memory, i.e.
+                 the RoundKey of each AES_ctx, wherever the program keeps it
+  heap, stack    the whole [heap] / [stack] mapping
+  sym:NAME       any data symbol, with its size from the symbol table
+  addr:ADDR:LEN  LEN bytes at ADDR (hex or decimal), e.g. a payload buffer
+
+Without -t the targets are sbox, rsbox and ctx. Flips go to the targets in
+turn, at a random byte and bit of each; with -U a target is picked in
+proportion to its size instead, as uniform upsets over that memory would.
+A flip stays, as an upset in real memory does, unless a hold time (-h) is
+given: then it is flipped back after that long, which keeps one corrupted
+table entry from spoiling the attribution of every flip after it.
+
+Flips are written through /proc/<pid>/mem, which reaches read-only pages
+(the tables live in .rodata) and needs ptrace rights over the process: the
+tool's own child, or root / CAP_SYS_PTRACE. Symbols come from the symbol
+table of /proc/<pid>/exe, so the binary must not be stripped of its local
+symbols for sbox, rsbox and sym: targets. Heap, stack and key schedule
+locations are looked up again as the program runs.
+
+With -p the tool attaches to a running process and only injects; every
+flip goes to the log (-l) with its wall clock time, to be lined up with
+the program's own error reports.
+
+With a command, the tool runs it twice: once undisturbed, to record its
+standard output as the golden output (or the output is taken from -g), and
+once under injection. The second run's output is compared with the golden
+one block by block as it arrives. Where a run of corrupted 16-byte blocks
+starts, the run is put down to the last flip before it, if that flip is
+less than the window (-w) old; a crash is put down the same way. Output
+shows up some time after the flip that spoiled it, so attribution is only
+sharp when flips are further apart than that: keep the rate times the
+window well under one, or use a hold time. The command must produce the
+same output on every run.
+
+*/
+
+#define _GNU_SOURCE
+
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/ptrace.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "aes.h"
+
+#define MAX_TARGETS 16
+#define MAX_REGIONS 64
+// Recent flips kept for attribution.
+#define HISTORY 4096
+// Dynamic targets (heap, stack, ctx) are looked up again this often.
+#define RESCAN_S 0.25
+
+enum kind { SYMBOL, ADDRESS, MAPPING, SCHEDULES };
+
+struct region
+{
+  uint64_t addr;
+  uint64_t len;
+};
+
+struct target
+{
+  char name[64];
+  enum kind kind;
+  char arg[64];             // symbol or mapping name
+  struct region regions[MAX_REGIONS];
+  unsigned nregions;
+  uint64_t bytes;
+  uint64_t largest;         // bytes, at the most
+  uint64_t flips, failed;   // failed: the page was gone
+  uint64_t blocks;          // corrupted output blocks in runs put down to it
+  uint64_t effective;       // flips followed by corruption or a crash
+  uint64_t crashes;
+};
+
+struct flip
+{
+  double t;
+  unsigned target;
+  int effective;
+};
+
+static struct target targets[MAX_TARGETS];
+static unsigned ntargets;
+static double rate = 1000;
+static double duration;
+static double window = 0.05;
+static double hold;
+static int by_size;
+static FILE* log_file;
+
+static struct flip history[HISTORY];
+static uint64_t nflips;
+
+// Flips to undo, oldest first (with a hold time).
+struct revert
+{
+  double due;
+  uint64_t addr;
+  uint8_t mask;
+};
+
+static struct revert reverts[HISTORY];
+static unsigned revert_head, revert_count;
+
+static uint64_t rng = 0x9e3779b97f4a7c15ull;
+
+static uint64_t next_random(void)
+{
+  rng ^= rng << 13;
+  rng ^= rng >> 7;
+  rng ^= rng << 17;
+  return rng;
+}
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static double wall(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/*****************************************************************************/
+/* Symbols and mappings:                                                     */
+/*****************************************************************************/
+// Looks name up in the symbol tables of the executable and returns its
+// run-time address, given the load bias; 0 if it is not there.
+static uint64_t find_symbol(const char* exe, uint64_t bias, const char* name, uint64_t* size)
+{
+  const Elf64_Ehdr* eh;
+  const Elf64_Shdr* sh;
+  struct stat st;
+  uint64_t addr = 0;
+  uint8_t* map;
+  unsigned i, j;
+  int fd;
+
+  if (((fd = open(exe, O_RDONLY | O_CLOEXEC)) < 0) || (fstat(fd, &st) != 0))
+  {
+    return 0;
+  }
+  map = (uint8_t*)mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+  {
+    return 0;
+  }
+  eh = (const Elf64_Ehdr*)map;
+  if ((st.st_size < (off_t)sizeof(*eh)) || (memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0) || (eh->e_ident[EI_CLASS] != ELFCLASS64))
+  {
+    munmap(map, (size_t)st.st_size);
+    return 0;
+  }
+  sh = (const Elf64_Shdr*)(map + eh->e_shoff);
+  for (i = 0; (addr == 0) && (i < eh->e_shnum); ++i)
+  {
+    const Elf64_Sym* sym;
+    const char* strtab;
+    if ((sh[i].sh_type != SHT_SYMTAB) && (sh[i].sh_type != SHT_DYNSYM))
+    {
+      continue;
+    }
+    sym = (const Elf64_Sym*)(map + sh[i].sh_offset);
+    strtab = (const char*)(map + sh[sh[i].sh_link].sh_offset);
+    for (j = 0; j < sh[i].sh_size / sizeof(Elf64_Sym); ++j)
+    {
+      if ((ELF64_ST_TYPE(sym[j].st_info) == STT_OBJECT) && (strcmp(strtab + sym[j].st_name, name) == 0))
+      {
+        addr = ((eh->e_type == ET_DYN) ? bias : 0) + sym[j].st_value;
+        *size = sym[j].st_size;
+        break;
+      }
+    }
+  }
+  munmap(map, (size_t)st.st_size);
+  return addr;
+}
+
+struct mapping
+{
+  uint64_t start, end, offset;
+  char perms[5];
+  char path[256];
+};
+
+// Calls fn for every line of /proc/<pid>/maps until it returns nonzero.
+static void for_each_mapping(pid_t pid, int (*fn)(const struct mapping*, void*), void* arg)
+{
+  char name[64], line[512];
+  struct mapping m;
+  FILE* f;
+
+  snprintf(name, sizeof(name), "/proc/%d/maps", (int)pid);
+  if ((f = fopen(name, "r")) == NULL)
+  {
+    return;
+  }
+  while (fgets(line, sizeof(line), f) != NULL)
+  {
+    m.path[0] = '\0';
+    if (sscanf(line, "%lx-%lx %4s %lx %*s %*s %255s", (unsigned long*)&m.start, (unsigned long*)&m.end, m.perms,
+               (unsigned long*)&m.offset, m.path) < 4)
+    {
+      continue;
+    }
+    if (fn(&m, arg))
+    {
+      break;
+    }
+  }
+  fclose(f);
+}
+
+struct bias_search
+{
+  const char* exe;
+  uint64_t bias;
+};
+
+// The load bias of a position-independent executable is where its first
+// segment (file offset 0, virtual address 0) was mapped.
+static int bias_of(const struct mapping* m, void* arg)
+{
+  struct bias_search* b = (struct bias_search*)arg;
+  if ((m->offset == 0) && (strcmp(m->path, b->exe) == 0))
+  {
+    b->bias = m->start;
+    return 1;
+  }
+  return 0;
+}
+
+static int add_mapping(const struct mapping* m, void* arg)
+{
+  struct target* t = (struct target*)arg;
+  if ((strcmp(m->path, t->arg) == 0) && (t->nregions < MAX_REGIONS))
+  {
+    t->regions[t->nregions].addr = m->start;
+    t->regions[t->nregions].len = m->end - m->start;
+    ++t->nregions;
+  }
+  return 0;
+}
+
+struct schedule_scan
+{
+  int mem;
+  struct target* t;
+};
+
+// A key schedule is AES_keyExpSize bytes that AES_init_ctx() would expand
+// from its first AES_KEYLEN bytes. The words after the first key word
+// that are plain XORs are checked first, so most offsets cost a compare.
+static int is_schedule(const uint8_t* p)
+{
+  const unsigned nk = AES_KEYLEN / 4;
+  struct AES_ctx ctx;
+  uint32_t w[16];
+  unsigned i;
+
+  memcpy(w, p, sizeof(w));
+  for (i = nk + 1; i < nk + 4; ++i)
+  {
+    if (w[i] != (w[i - 1] ^ w[i - nk]))
+    {
+      return 0;
+    }
+  }
+  if (w[0] == 0 && w[1] == 0 && w[nk] == 0)
+  {
+    return 0;
+  }
+  AES_init_ctx(&ctx, p);
+  return memcmp(ctx.RoundKey, p, AES_keyExpSize) == 0;
+}
+
+static int scan_schedules(const struct mapping* m, void* arg)
+{
+  struct schedule_scan* s = (struct schedule_scan*)arg;
+  static uint8_t buf[(1 << 20) + AES_keyExpSize];
+  uint64_t at, n, i;
+  ssize_t r;
+
+  // Writable private memory only: heap, stack, data and anonymous maps.
+  if ((m->perms[0] != 'r') || (m->perms[1] != 'w') || (m->perms[3] != 'p') || (strncmp(m->path, "[v", 2) == 0))
+  {
+    return 0;
+  }
+  for (at = m->start; at < m->end; at += (1 << 20))
+  {
+    n = (m->end - at < sizeof(buf)) ? m->end - at : sizeof(buf);
+    if ((r = pread(s->mem, buf, n, (off_t)at)) < (ssize_t)AES_keyExpSize)
+    {
+      break;
+    }
+    for (i = 0; (i + AES_keyExpSize <= (uint64_t)r) && (i < (1 << 20)); i += 4)
+    {
+      if (is_schedule(buf + i) && (s->t->nregions < MAX_REGIONS))
+      {
+        s->t->regions[s->t->nregions].addr = at + i;
+        s->t->regions[s->t->nregions].len = AES_keyExpSize;
+        ++s->t->nregions;
+        i += AES_keyExpSize - 4;
+      }
+    }
+  }
+  return 0;
+}
+
+// Looks up the regions of every target; static ones only the first time.
+static void resolve(pid_t pid, int mem, int first)
+{
+  char link[64], exe[256];
+  struct bias_search b;
+  ssize_t n;
+  unsigned i, r;
+
+  snprintf(link, sizeof(link), "/proc/%d/exe", (int)pid);
+  if ((n = readlink(link, exe, sizeof(exe) - 1)) < 0)
+  {
+    return;
+  }
+  exe[n] = '\0';
+  b.exe = exe;
+  b.bias = 0;
+  for_each_mapping(pid, bias_of, &b);
+
+  for (i = 0; i < ntargets; ++i)
+  {
+    struct target* t = &targets[i];
+    if (t->kind == SYMBOL && first)
+    {
+      uint64_t size = 0, addr = find_symbol(link, b.bias, t->arg, &size);
+      if ((addr != 0) && (size > 0))
+      {
+        t->regions[0].addr = addr;
+        t->regions[0].len = size;
+        t->nregions = 1;
+      }
+      else
+      {
+        fprintf(stderr, "seu-inject: no symbol %s in %s\n", t->arg, exe);
+      }
+    }
+    else if (t->kind == MAPPING)
+    {
+      t->nregions = 0;
+      for_each_mapping(pid, add_mapping, t);
+    }
+    else if (t->kind == SCHEDULES)
+    {
+      struct schedule_scan s;
+      s.mem = mem;
+      s.t = t;
+      t->nregions = 0;
+      for_each_mapping(pid, scan_schedules, &s);
+    }
+    t->bytes = 0;
+    for (r = 0; r < t->nregions; ++r)
+    {
+      t->bytes += t->regions[r].len;
+    }
+    if (t->bytes > t->largest)
+    {
+      t->largest = t->bytes;
+    }
+  }
+}
+
+/*****************************************************************************/
+/* Injection:                                                                */
+/*****************************************************************************/
+static unsigned pick_target(void)
+{
+  static unsigned turn;
+  uint64_t total = 0, x;
+  unsigned i;
+
+  if (!by_size)
+  {
+    for (i = 0; i < ntargets; ++i)
+    {
+      turn = (turn + 1) % ntargets;
+      if (targets[turn].bytes > 0)
+      {
+        return turn;
+      }
+    }
+    return ntargets;
+  }
+  for (i = 0; i < ntargets; ++i)
+  {
+    total += targets[i].bytes;
+  }
+  if (total == 0)
+  {
+    return ntargets;
+  }
+  x = next_random() % total;
+  for (i = 0; x >= targets[i].bytes; ++i)
+  {
+    x -= targets[i].bytes;
+  }
+  return i;
+}
+
+static void inject(int mem, double t0)
+{
+  const unsigned ti = pick_target();
+  struct target* t;
+  uint64_t x, addr = 0;
+  unsigned r, bit;
+  uint8_t byte;
+
+  if (ti == ntargets)
+  {
+    return;
+  }
+  t = &targets[ti];
+  x = next_random() % t->bytes;
+  for (r = 0; r < t->nregions; ++r)
+  {
+    if (x < t->regions[r].len)
+    {
+      addr = t->regions[r].addr + x;
+      break;
+    }
+    x -= t->regions[r].len;
+  }
+  bit = (unsigned)(next_random() % 8);
+
+  ++t->flips;
+  if ((pread(mem, &byte, 1, (off_t)addr) != 1) || ((byte ^= (uint8_t)(1u << bit)), pwrite(mem, &byte, 1, (off_t)addr) != 1))
+  {
+    ++t->failed;
+    return;
+  }
+  if ((hold > 0) && (revert_count < HISTORY))
+  {
+    struct revert* v = &reverts[(revert_head + revert_count++) % HISTORY];
+    v->due = now() - t0 + hold;
+    v->addr = addr;
+    v->mask = (uint8_t)(1u << bit);
+  }
+  history[nflips % HISTORY].t = now() - t0;
+  history[nflips % HISTORY].target = ti;
+  history[nflips % HISTORY].effective = 0;
+  ++nflips;
+  if (log_file != NULL)
+  {
+    fprintf(log_file, "%.6f %s 0x%lx %u\n", wall(), t->name, (unsigned long)addr, bit);
+  }
+}
+
+// Undoes the flips whose hold time is over, by flipping the bit again:
+// whatever the program has written to the byte since is kept.
+static void revert_due(int mem, double t)
+{
+  uint8_t byte;
+
+  while ((revert_count > 0) && (reverts[revert_head].due <= t))
+  {
+    const struct revert* v = &reverts[revert_head];
+    if (pread(mem, &byte, 1, (off_t)v->addr) == 1)
+    {
+      byte ^= v->mask;
+      if (pwrite(mem, &byte, 1, (off_t)v->addr) != 1)
+      {
+        // The page is gone, and the flip with it.
+      }
+    }
+    revert_head = (revert_head + 1) % HISTORY;
+    --revert_count;
+  }
+}
+
+// The most recent flip at or before time t, if it is inside the window.
+static struct flip* blame(double t)
+{
+  uint64_t i;
+  for (i = nflips; (i > 0) && (nflips - i < HISTORY); --i)
+  {
+    struct flip* f = &history[(i - 1) % HISTORY];
+    if (f->t <= t)
+    {
+      return (t - f->t <= window) ? f : NULL;
+    }
+  }
+  return NULL;
+}
+
+// Starts a run of corrupted blocks at time t; returns the target it is put
+// down to, or ntargets.
+static unsigned blame_run(double t)
+{
+  struct flip* f = blame(t);
+  if (f == NULL)
+  {
+    return ntargets;
+  }
+  if (!f->effective)
+  {
+    f->effective = 1;
+    ++targets[f->target].effective;
+  }
+  return f->target;
+}
+
+/*****************************************************************************/
+/* Runs:                                                                     */
+/*****************************************************************************/
+// Runs the command undisturbed and returns its standard output.
+static uint8_t* golden_run(char** argv, size_t* length)
+{
+  uint8_t* out = NULL;
+  size_t cap = 0;
+  int fds[2], status;
+  pid_t pid;
+  ssize_t r;
+
+  *length = 0;
+  if ((pipe(fds) != 0) || ((pid = fork()) < 0))
+  {
+    return NULL;
+  }
+  if (pid == 0)
+  {
+    dup2(fds[1], STDOUT_FILENO);
+    close(fds[0]);
+    close(fds[1]);
+    execvp(argv[0], argv);
+    _exit(127);
+  }
+  close(fds[1]);
+  for (;;)
+  {
+    if (*length + 65536 > cap)
+    {
+      uint8_t* grown = (uint8_t*)realloc(out, 2 * cap + 65536);
+      if (grown == NULL)
+      {
+        fprintf(stderr, "seu-inject: no memory for the golden output of %s\n", argv[0]);
+        kill(pid, SIGKILL);
+        waitpid(pid, &status, 0);
+        exit(2);
+      }
+      out = grown;
+      cap = 2 * cap + 65536;
+    }
+    if ((r = read(fds[0], out + *length, cap - *length)) <= 0)
+    {
+      break;
+    }
+    *length += (size_t)r;
+  }
+  close(fds[0]);
+  waitpid(pid, &status, 0);
+  if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0))
+  {
+    fprintf(stderr, "seu-inject: the golden run of %s failed\n", argv[0]);
+    exit(2);
+  }
+  return out;
+}
+
+static uint8_t* load_file(const char* path, size_t* length)
+{
+  FILE* f = fopen(path, "rb");
+  uint8_t* out;
+  long n;
+
+  if ((f == NULL) || (fseek(f, 0, SEEK_END) != 0) || ((n = ftell(f)) < 0) || (fseek(f, 0, SEEK_SET) != 0))
+  {
+    perror(path);
+    exit(2);
+  }
+  if ((out = (uint8_t*)malloc((size_t)n + 1)) == NULL)
+  {
+    fprintf(stderr, "seu-inject: no memory for %s\n", path);
+    exit(2);
+  }
+  *length = fread(out, 1, (size_t)n, f);
+  fclose(f);
+  return out;
+}
+
+// Starts the command stopped at its first instruction, so the targets can
+// be resolved before it runs, with its standard output on a pipe.
+static pid_t start(char** argv, int* out)
+{
+  int fds[2], status;
+  pid_t pid;
+
+  if ((pipe(fds) != 0) || ((pid = fork()) < 0))
+  {
+    return -1;
+  }
+  if (pid == 0)
+  {
+    dup2(fds[1], STDOUT_FILENO);
+    close(fds[0]);
+    close(fds[1]);
+    ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+    execvp(argv[0], argv);
+    _exit(127);
+  }
+  close(fds[1]);
+  if ((waitpid(pid, &status, 0) != pid) || !WIFSTOPPED(status))
+  {
+    return -1;
+  }
+  *out = fds[0];
+  return pid;
+}
+
+static int open_mem(pid_t pid)
+{
+  char name[64];
+  snprintf(name, sizeof(name), "/proc/%d/mem", (int)pid);
+  return open(name, O_RDWR | O_CLOEXEC);
+}
+
+// Injects at the configured rate until the process exits, the duration is
+// over or (with out >= 0) its output ends, and compares the output with
+// golden. Returns the wait status, or -1 if the process was left running.
+static int campaign(pid_t pid, int mem, int out, const uint8_t* golden, size_t golden_len, uint64_t* corrupt)
+{
+  const double t0 = now();
+  double next = 0, rescan = RESCAN_S, t, wait;
+  uint8_t buf[65536];
+  uint64_t pos = 0, i;
+  unsigned run = ntargets;
+  int status = -1, done = 0, bad = 0, in_run = 0;
+  struct pollfd pfd;
+  struct timespec ts;
+  ssize_t r;
+
+  pfd.fd = out;
+  pfd.events = POLLIN;
+  *corrupt = 0;
+  while (!done)
+  {
+    t = now() - t0;
+    if ((duration > 0) && (t >= duration))
+    {
+      break;
+    }
+    if (t >= rescan)
+    {
+      resolve(pid, mem, 0);
+      rescan = t + RESCAN_S;
+    }
+    // Catch up on the flips that are due, then wait for output until the
+    // next one.
+    revert_due(mem, t);
+    for (; next <= t; next += 1.0 / rate)
+    {
+      inject(mem, t0);
+    }
+    wait = ((revert_count > 0) && (reverts[revert_head].due < next)) ? reverts[revert_head].due - t : next - t;
+    wait = (wait > 0) ? wait : 0;
+    ts.tv_sec = (time_t)wait;
+    ts.tv_nsec = (long)((wait - (double)ts.tv_sec) * 1e9);
+    if (out < 0)
+    {
+      nanosleep(&ts, NULL);
+      if (kill(pid, 0) != 0)
+      {
+        done = 1;
+      }
+      continue;
+    }
+    if ((ppoll(&pfd, 1, &ts, NULL) <= 0) || ((pfd.revents & (POLLIN | POLLHUP)) == 0))
+    {
+      continue;
+    }
+    if ((r = read(out, buf, sizeof(buf))) <= 0)
+    {
+      done = 1;
+      continue;
+    }
+    // A block is judged at its last byte, so one that arrives in two
+    // reads counts once.
+    t = now() - t0;
+    for (i = 0; i < (uint64_t)r; ++i, ++pos)
+    {
+      bad |= (pos >= golden_len) || (buf[i] != golden[pos]);
+      if ((pos % AES_BLOCKLEN) != AES_BLOCKLEN - 1)
+      {
+        continue;
+      }
+      if (bad)
+      {
+        ++*corrupt;
+        if (!in_run)
+        {
+          in_run = 1;
+          run = blame_run(t);
+        }
+        if (run < ntargets)
+        {
+          ++targets[run].blocks;
+        }
+      }
+      in_run = bad;
+      bad = 0;
+    }
+  }
+
+  if (out >= 0)
+  {
+    if (!done)
+    {
+      kill(pid, SIGKILL);
+    }
+    waitpid(pid, &status, 0);
+    if (WIFSIGNALED(status) && (WTERMSIG(status) != SIGKILL))
+    {
+      struct flip* f = blame(now() - t0);
+      if (f != NULL)
+      {
+        ++targets[f->target].crashes;
+        targets[f->target].effective += !f->effective;
+        f->effective = 1;
+      }
+    }
+    if (done && (pos < golden_len))
+    {
+      *corrupt += (golden_len - pos + AES_BLOCKLEN - 1) / AES_BLOCKLEN;
+    }
+  }
+  return status;
+}
+
+static int add_target(const char* spec)
+{
+  struct target* t = &targets[ntargets];
+  unsigned long addr, len;
+
+  if (ntargets == MAX_TARGETS)
+  {
+    return -1;
+  }
+  memset(t, 0, sizeof(*t));
+  snprintf(t->name, sizeof(t->name), "%s", spec);
+  if ((strcmp(spec, "sbox") == 0) || (strcmp(spec, "rsbox") == 0))
+  {
+    t->kind = SYMBOL;
+    snprintf(t->arg, sizeof(t->arg), "%s", spec);
+  }
+  else if (strncmp(spec, "sym:", 4) == 0)
+  {
+    t->kind = SYMBOL;
+    snprintf(t->arg, sizeof(t->arg), "%s", spec + 4);
+  }
+  else if ((strcmp(spec, "heap") == 0) || (strcmp(spec, "stack") == 0))
+  {
+    t->kind = MAPPING;
+    snprintf(t->arg, sizeof(t->arg), "[%s]", spec);
+  }
+  else if (strcmp(spec, "ctx") == 0)
+  {
+    t->kind = SCHEDULES;
+  }
+  else if ((sscanf(spec, "addr:%li:%li", (long*)&addr, (long*)&len) == 2) && (len > 0))
+  {
+    t->kind = ADDRESS;
+    t->regions[0].addr = addr;
+    t->regions[0].len = len;
+    t->nregions = 1;
+    t->bytes = len;
+  }
+  else
+  {
+    return -1;
+  }
+  ++ntargets;
+  return 0;
+}
+
+int main(int argc, char** argv)
+{
+  const char* golden_path = NULL;
+  uint8_t* golden = NULL;
+  size_t golden_len = 0;
+  uint64_t corrupt = 0, flips = 0, effective = 0;
+  pid_t pid = 0;
+  int opt, mem, out = -1, status;
+  unsigned i;
+
+  while ((opt = getopt(argc, argv, "+t:r:d:h:w:Us:l:g:p:")) != -1)
+  {
+    switch (opt)
+    {
+    case 't':
+      if (add_target(optarg) != 0)
+      {
+        fprintf(stderr, "seu-inject: bad target %s\n", optarg);
+        return 2;
+      }
+      break;
+    case 'r': rate = atof(optarg); break;
+    case 'd': duration = atof(optarg); break;
+    case 'h': hold = atof(optarg) / 1000.0; break;
+    case 'w': window = atof(optarg) / 1000.0; break;
+    case 'U': by_size = 1; break;
+    case 's': rng = strtoull(optarg, NULL, 0) | 1; break;
+    case 'l':
+      if ((log_file = fopen(optarg, "w")) == NULL)
+      {
+        perror(optarg);
+        return 2;
+      }
+      break;
+    case 'g': golden_path = optarg; break;
+    case 'p': pid = (pid_t)atoi(optarg); break;
+    default:
+      fprintf(stderr, "usage: %s [-t target]... [-r flips-per-s] [-d seconds] [-h hold-ms] [-w window-ms] [-U] [-s seed] [-l log] [-g golden] (-p pid | -- command args...)\n", argv[0]);
+      return 2;
+    }
+  }
+  if ((rate <= 0) || ((pid == 0) == (optind == argc)))
+  {
+    fprintf(stderr, "seu-inject: need a positive rate, and either -p or a command\n");
+    return 2;
+  }
+  if (ntargets == 0)
+  {
+    add_target("sbox");
+    add_target("rsbox");
+    add_target("ctx");
+  }
+
+  if (pid == 0)
+  {
+    golden = (golden_path != NULL) ? load_file(golden_path, &golden_len) : golden_run(argv + optind, &golden_len);
+    if ((pid = start(argv + optind, &out)) < 0)
+    {
+      perror(argv[optind]);
+      return 2;
+    }
+  }
+  else if (duration <= 0)
+  {
+    duration = 10;
+  }
+  if ((mem = open_mem(pid)) < 0)
+  {
+    perror("seu-inject: /proc/<pid>/mem");
+    if (out >= 0)
+    {
+      kill(pid, SIGKILL);
+    }
+    return 2;
+  }
+  resolve(pid, mem, 1);
+  if (out >= 0)
+  {
+    ptrace(PTRACE_DETACH, pid, NULL, NULL);
+  }
+
+  status = campaign(pid, mem, out, golden, golden_len, &corrupt);
+  close(mem);
+
+  printf("%-16s %10s %10s %8s %10s %10s %8s %9s\n", "target", "bytes", "flips", "failed", "effective", "bad-blocks", "crashes", "effect-%");
+  for (i = 0; i < ntargets; ++i)
+  {
+    const struct target* t = &targets[i];
+    const uint64_t landed = t->flips - t->failed;
+    printf("%-16s %10lu %10lu %8lu %10lu %10lu %8lu %8.2f%%\n", t->name, (unsigned long)t->largest, (unsigned long)t->flips,
+           (unsigned long)t->failed, (unsigned long)t->effective, (unsigned long)t->blocks, (unsigned long)t->crashes,
+           (landed > 0) ? 100.0 * (double)t->effective / (double)landed : 0.0);
+    flips += landed;
+    effective += t->effective;
+  }
+  if (out >= 0)
+  {
+    printf("\n%lu flips landed, %lu of them with an effect; %lu of %lu output blocks corrupted\n", (unsigned long)flips,
+           (unsigned long)effective, (unsigned long)corrupt, (unsigned long)((golden_len + AES_BLOCKLEN - 1) / AES_BLOCKLEN));
+    if (WIFSIGNALED(status))
+    {
+      printf("the command was killed by signal %d\n", WTERMSIG(status));
+    }
+    else if (WIFEXITED(status))
+    {
+      printf("the command exited with status %d\n", WEXITSTATUS(status));
+    }
+  }
+  else
+  {
+    printf("\n%lu flips landed\n", (unsigned long)flips);
+  }
+
+  if (log_file != NULL)
+  {
+    fclose(log_file);
+  }
+  free(golden);
+  return 0;
+}
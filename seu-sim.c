@@ -0,0 +1,446 @@
+/*
+
+Replays an upset trace against the adaptive protection controller.
+
+  usage: seu-sim [-w window-ms] [-b blocks-per-window] [-H hold]
+                 [-R r0,r1,r2] [-L l1,l2,l3] [-v] [trace-file]
+
+A trace is a text file with one upset per line:
+
+  <time-ms> <copy 0..2> <byte> <bit>
+
+'#' starts a comment. Without a trace file a synthetic one is generated:
+a quiet background of one upset every ten seconds, with a 20 s burst of
+50 upsets/s in the middle.
+
+Time is simulated in fixed windows. In each window a CTR workload runs at the
+current level in small calls spread over the window, the upsets are flipped
+into the key schedule copies at their point in time between those calls, the
+scrubber runs at the end of the window, and the controller decides the level
+for the next window. Every output block is compared against a clean reference,
+so corruption that no level caught is counted as silent. The same trace is
+also replayed at fixed levels, for comparison with the adaptive policy, and
+the last line names the cheapest fixed level that loses no more blocks than
+the policy does: that is the level the policy has to beat.
+
+*/
+
+#define _GNU_SOURCE
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "aes.h"
+#include "aes_seu.h"
+
+struct upset
+{
+  double t_ms;
+  unsigned copy, byte, bit;
+};
+
+struct result
+{
+  uint64_t windows_at[AES_SEU_LEVELS];
+  uint64_t blocks, silent, failed;
+  uint64_t transitions, detected, corrected;
+  double cost;                  // estimated CPU seconds, from the calibration
+};
+
+static const char* level_name[AES_SEU_LEVELS] = { "plain", "checksum", "tmr", "ced" };
+
+static const uint8_t key[16] = { 0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c };
+static const uint8_t iv[16]  = { 0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff };
+
+// Blocks per protected call; the workload of a window is split into these.
+#define CHUNK 4
+
+// Calibration: each run repeats a window's workload for at least
+// CALIBRATE_MS of CPU time, and the median of CALIBRATE_RUNS runs is kept,
+// after CALIBRATE_WARMUP_MS untimed at every level.
+#define CALIBRATE_MS 10
+#define CALIBRATE_RUNS 31
+#define CALIBRATE_WARMUP_MS 50
+
+static unsigned window_ms = 100;
+static unsigned blocks = 64;
+static int verbose;
+
+static uint64_t rng = 0x9e3779b97f4a7c15ull;
+
+static uint64_t next_random(void)
+{
+  rng ^= rng << 13;
+  rng ^= rng >> 7;
+  rng ^= rng << 17;
+  return rng;
+}
+
+static void increment(uint8_t* ctr)
+{
+  int bi;
+  for (bi = AES_BLOCKLEN - 1; (bi >= 0) && (++ctr[bi] == 0); --bi)
+    ;
+}
+
+// CPU time of the calling thread, so that time the process spends
+// descheduled does not count against whichever level was being timed.
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static int by_time(const void* a, const void* b)
+{
+  const double ta = ((const struct upset*)a)->t_ms;
+  const double tb = ((const struct upset*)b)->t_ms;
+  return (ta < tb) ? -1 : (ta > tb);
+}
+
+static size_t load_trace(const char* path, struct upset** out)
+{
+  FILE* f = fopen(path, "r");
+  struct upset* u = NULL;
+  size_t n = 0, cap = 0;
+  char line[256];
+
+  if (f == NULL)
+  {
+    perror(path);
+    exit(2);
+  }
+  while (fgets(line, sizeof(line), f) != NULL)
+  {
+    struct upset e;
+    char* hash = strchr(line, '#');
+    if (hash != NULL)
+    {
+      *hash = '\0';
+    }
+    if (sscanf(line, "%lf %u %u %u", &e.t_ms, &e.copy, &e.byte, &e.bit) != 4)
+    {
+      continue;
+    }
+    if ((e.copy > 2) || (e.byte >= AES_keyExpSize) || (e.bit > 7))
+    {
+      fprintf(stderr, "seu-sim: ignoring out-of-range upset at %.1f ms\n", e.t_ms);
+      continue;
+    }
+    if (n == cap)
+    {
+      cap = cap ? 2 * cap : 256;
+      u = (struct upset*)realloc(u, cap * sizeof(*u));
+    }
+    u[n++] = e;
+  }
+  fclose(f);
+  qsort(u, n, sizeof(*u), by_time);
+  *out = u;
+  return n;
+}
+
+static void add_upsets(struct upset** u, size_t* n, double from_ms, double to_ms, double per_s)
+{
+  double t = from_ms;
+  for (;;)
+  {
+    // Exponential inter-arrival times.
+    const double r = ((double)(next_random() >> 11) + 1.0) / 9007199254740993.0;
+    t += -1000.0 / per_s * log(r);
+    if (t >= to_ms)
+    {
+      return;
+    }
+    *u = (struct upset*)realloc(*u, (*n + 1) * sizeof(**u));
+    (*u)[*n].t_ms = t;
+    (*u)[*n].copy = (unsigned)(next_random() % 3);
+    (*u)[*n].byte = (unsigned)(next_random() % AES_keyExpSize);
+    (*u)[*n].bit = (unsigned)(next_random() % 8);
+    ++*n;
+  }
+}
+
+static size_t synthetic_trace(struct upset** out)
+{
+  struct upset* u = NULL;
+  size_t n = 0;
+  add_upsets(&u, &n, 0.0, 60000.0, 0.1);
+  add_upsets(&u, &n, 60000.0, 80000.0, 50.0);
+  add_upsets(&u, &n, 80000.0, 180000.0, 0.1);
+  qsort(u, n, sizeof(*u), by_time);
+  *out = u;
+  return n;
+}
+
+static int by_value(const void* a, const void* b)
+{
+  const double x = *(const double*)a, y = *(const double*)b;
+  return (x < y) ? -1 : (x > y);
+}
+
+// One window's workload at the level, as replay() runs it, repeated for at
+// least ms of CPU time. Returns the seconds per window.
+static double time_window(struct AES_seu_ctx* ctx, uint8_t* buf, int level, unsigned ms)
+{
+  const double t0 = now();
+  uint64_t reps = 0;
+  uint32_t c, nblk;
+  double t;
+
+  AES_SEU_set_level(ctx, level);
+  do
+  {
+    AES_SEU_ctx_set_iv(ctx, iv);
+    for (c = 0; c < blocks; c += CHUNK)
+    {
+      nblk = (blocks - c < CHUNK) ? blocks - c : CHUNK;
+      AES_SEU_CTR_xcrypt_buffer(ctx, buf + c * AES_BLOCKLEN, nblk * AES_BLOCKLEN);
+    }
+    AES_SEU_scrub(ctx);
+    ++reps;
+    t = now() - t0;
+  } while (t < ms * 1e-3);
+  return t / (double)reps;
+}
+
+// CPU seconds one window's workload takes at each level, with no faults.
+// Every level is warmed up first, and the timed runs take the levels in
+// turn, so that neither a cold start nor a drift in clock speed lands on
+// one level alone.
+static void calibrate(double* cost)
+{
+  uint8_t* buf = (uint8_t*)calloc(blocks, AES_BLOCKLEN);
+  struct AES_seu_ctx ctx;
+  double runs[AES_SEU_LEVELS][CALIBRATE_RUNS];
+  int level, run;
+
+  AES_SEU_init_ctx(&ctx, key);
+  for (level = 0; level < AES_SEU_LEVELS; ++level)
+  {
+    time_window(&ctx, buf, level, CALIBRATE_WARMUP_MS);
+  }
+  for (run = 0; run < CALIBRATE_RUNS; ++run)
+  {
+    for (level = 0; level < AES_SEU_LEVELS; ++level)
+    {
+      runs[level][run] = time_window(&ctx, buf, level, CALIBRATE_MS);
+    }
+  }
+  for (level = 0; level < AES_SEU_LEVELS; ++level)
+  {
+    qsort(runs[level], CALIBRATE_RUNS, sizeof(runs[level][0]), by_value);
+    cost[level] = runs[level][CALIBRATE_RUNS / 2];
+  }
+  free(buf);
+}
+
+// fixed < 0 runs the adaptive controller, otherwise the level is pinned.
+static void replay(const struct upset* u, size_t n, const struct AES_seu_policy* policy, int fixed,
+                   const double* cost, struct result* r)
+{
+  const uint32_t len = blocks * AES_BLOCKLEN;
+  uint8_t* buf = (uint8_t*)malloc(len);
+  uint8_t* ref = (uint8_t*)malloc(len);
+  struct AES_seu_ctx ctx;
+  struct AES_seu_ctx* watched = &ctx;
+  struct AES_seu_controller ctrl;
+  struct AES_ctx clean;
+  uint32_t detected = 0, corrected = 0, d, k;
+  const double end_ms = (n != 0) ? u[n - 1].t_ms + 60000.0 : 0.0;
+  uint8_t ctr[AES_BLOCKLEN];
+  double t_ms;
+  size_t next = 0;
+  uint64_t w = 0;
+  uint32_t i;
+
+  memset(r, 0, sizeof(*r));
+  AES_SEU_init_ctx(&ctx, key);
+  AES_init_ctx(&clean, key);
+  AES_SEU_controller_init(&ctrl, policy, &watched, 1);
+  if (fixed >= 0)
+  {
+    AES_SEU_set_level(&ctx, fixed);
+  }
+
+  for (t_ms = 0.0; t_ms < end_ms; t_ms += window_ms, ++w)
+  {
+    const int level = AES_SEU_get_level(&ctx);
+    uint32_t c;
+
+    // A different counter range per window, so every window sees new data.
+    memset(ref, 0, len);
+    memset(ctr, 0, sizeof(ctr));
+    memcpy(ctr, &w, sizeof(w));
+    AES_ctx_set_iv(&clean, ctr);
+    AES_CTR_xcrypt_buffer(&clean, ref, len);
+    memset(buf, 0, len);
+    AES_SEU_ctx_set_iv(&ctx, ctr);
+
+    // The workload is spread evenly over the window in calls of CHUNK
+    // blocks, and each upset lands before the call whose time slot it is in.
+    for (c = 0; c < blocks; c += CHUNK)
+    {
+      const uint32_t nblk = (blocks - c < CHUNK) ? blocks - c : CHUNK;
+      const double slot_end = t_ms + window_ms * (double)(c + nblk) / (double)blocks;
+
+      for (; (next < n) && (u[next].t_ms < slot_end); ++next)
+      {
+        ctx.copy[u[next].copy].RoundKey[u[next].byte] ^= (uint8_t)(1u << u[next].bit);
+      }
+      r->blocks += nblk;
+      if (AES_SEU_CTR_xcrypt_buffer(&ctx, buf + c * AES_BLOCKLEN, nblk * AES_BLOCKLEN) < 0)
+      {
+        r->failed += nblk;
+        // Resynchronize the counter with the reference after a failed call.
+        memcpy(ctx.copy[0].Iv, ctr, AES_BLOCKLEN);
+        for (i = 0; i < c + nblk; ++i)
+        {
+          increment(ctx.copy[0].Iv);
+        }
+        memcpy(buf + c * AES_BLOCKLEN, ref + c * AES_BLOCKLEN, nblk * AES_BLOCKLEN);
+      }
+    }
+    for (i = 0; i < len; i += AES_BLOCKLEN)
+    {
+      r->silent += (memcmp(buf + i, ref + i, AES_BLOCKLEN) != 0);
+    }
+
+    AES_SEU_scrub(&ctx);
+    r->windows_at[level] += 1;
+    r->cost += cost[level];
+
+    // The context's counters are 32 bits and can wrap over a long trace;
+    // the run's totals add up their per-window deltas instead.
+    d = atomic_load(&ctx.detected);
+    k = atomic_load(&ctx.corrected);
+    r->detected += (uint32_t)(d - detected);
+    r->corrected += (uint32_t)(k - corrected);
+    detected = d;
+    corrected = k;
+
+    if (fixed < 0)
+    {
+      const int next_level = AES_SEU_controller_update(&ctrl, &watched, 1);
+      r->transitions += (next_level != level);
+      if (verbose && (next_level != level))
+      {
+        printf("  %9.1f s: %s -> %s\n", (t_ms + window_ms) / 1000.0, level_name[level], level_name[next_level]);
+      }
+    }
+  }
+
+  free(buf);
+  free(ref);
+}
+
+static void print_result(const char* name, const struct result* r, const double* cost)
+{
+  uint64_t windows = 0;
+  int level;
+
+  for (level = 0; level < AES_SEU_LEVELS; ++level)
+  {
+    windows += r->windows_at[level];
+  }
+  printf("%-10s", name);
+  for (level = 0; level < AES_SEU_LEVELS; ++level)
+  {
+    printf(" %8.1f%%", windows ? 100.0 * (double)r->windows_at[level] / (double)windows : 0.0);
+  }
+  printf(" %6llu %8llu %8llu %10llu %8llu %7.2fx\n", (unsigned long long)r->transitions,
+         (unsigned long long)r->detected, (unsigned long long)r->corrected, (unsigned long long)r->silent, (unsigned long long)r->failed,
+         r->cost / ((double)windows * cost[AES_SEU_PLAIN]));
+}
+
+static void parse_list(const char* s, uint32_t* v, int first)
+{
+  int i = first;
+  while ((i < AES_SEU_LEVELS) && (*s != '\0'))
+  {
+    char* end;
+    v[i++] = (uint32_t)strtoul(s, &end, 10);
+    s = (*end == ',') ? end + 1 : end;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  struct AES_seu_policy policy;
+  struct upset* u;
+  struct result r;
+  double cost[AES_SEU_LEVELS];
+  double best_cost = 0.0;
+  size_t n;
+  int opt, level, best = -1;
+
+  AES_SEU_policy_default(&policy);
+  while ((opt = getopt(argc, argv, "w:b:H:R:L:v")) != -1)
+  {
+    switch (opt)
+    {
+    case 'w': window_ms = (unsigned)atoi(optarg); break;
+    case 'b': blocks = (unsigned)atoi(optarg); break;
+    case 'H': policy.hold = (uint32_t)atoi(optarg); break;
+    case 'R': parse_list(optarg, policy.raise, AES_SEU_PLAIN); break;
+    case 'L': parse_list(optarg, policy.lower, AES_SEU_CHECKSUM); break;
+    case 'v': verbose = 1; break;
+    default:
+      fprintf(stderr, "usage: %s [-w window-ms] [-b blocks] [-H hold] [-R r0,r1,r2] [-L l1,l2,l3] [-v] [trace]\n", argv[0]);
+      return 2;
+    }
+  }
+  if ((window_ms == 0) || (blocks == 0))
+  {
+    fprintf(stderr, "seu-sim: window and block count must be positive\n");
+    return 2;
+  }
+  n = (optind < argc) ? load_trace(argv[optind], &u) : synthetic_trace(&u);
+
+  calibrate(cost);
+  printf("%zu upsets, %u ms windows, %u blocks per window\n", n, window_ms, blocks);
+  printf("policy: raise %u/%u/%u, lower %u/%u/%u, hold %u windows\n\n",
+         policy.raise[0], policy.raise[1], policy.raise[2],
+         policy.lower[1], policy.lower[2], policy.lower[3], policy.hold);
+
+  if (verbose)
+  {
+    printf("adaptive transitions:\n");
+  }
+  replay(u, n, &policy, -1, cost, &r);
+  if (verbose)
+  {
+    printf("\n");
+  }
+  printf("%-10s %9s %9s %9s %9s %6s %8s %8s %10s %8s %8s\n", "policy", "plain", "checksum", "tmr", "ced",
+         "trans", "detected", "fixed", "silent-blk", "fail-blk", "cost");
+  print_result("adaptive", &r, cost);
+  for (level = 0; level < AES_SEU_LEVELS; ++level)
+  {
+    struct result f;
+    replay(u, n, &policy, level, cost, &f);
+    print_result(level_name[level], &f, cost);
+    // The policy has to beat the cheapest level that loses no more blocks.
+    if ((f.silent + f.failed <= r.silent + r.failed) && ((best < 0) || (f.cost < best_cost)))
+    {
+      best = level;
+      best_cost = f.cost;
+    }
+  }
+  if (best >= 0)
+  {
+    printf("\ncheapest fixed level losing no more blocks than adaptive: %s, adaptive costs %+.1f%% against it\n",
+           level_name[best], 100.0 * (r.cost / best_cost - 1.0));
+  }
+  else
+  {
+    printf("\nadaptive loses fewer blocks than every fixed level\n");
+  }
+
+  free(u);
+  return 0;
+}
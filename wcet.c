@@ -0,0 +1,400 @@
+/*
+
+WCET harness: times the backends one block at a time over millions of
+inputs and reports the distribution of the cost of a block, for worst-case
+execution time figures.
+
+  usage: wcet [-e engine,...] [-o op,...] [-n samples] [-c cpu] [-x kbytes]
+              [-s seed] [-w samples.csv]
+
+Engines are the backends of aes_backend.h (table, batch, ct, aesni), by
+default every one the CPU can run. Ops are enc and dec (one ECB block) and
+ctr (one block of CTR, the counter update included); by default all three.
+
+A worst case measured on some inputs only holds for the others if the time
+does not depend on the data. So each sample takes, at random, either a
+fixed input (the zero block; for ctr the all-ones counter, whose increment
+carries through every byte) or a random one, and the two classes are
+compared with Welch's t-test on the samples below the 99th percentile, as
+dudect does. |t| above 4.5 marks the engine and op as data-dependent: its
+figures then say little about inputs that were not tried.
+
+The timer is the TSC on x86 (reference cycles, fenced with lfence on both
+sides), CLOCK_MONOTONIC in nanoseconds elsewhere. The cost of reading it is
+measured first and taken off every sample. Per engine and op the report
+gives the min, median, p99, p99.999 and max, and the jitter, p99.999 - min,
+the spread a schedule has to allow for. The max is what was seen, timer
+interrupts included; p99.999 needs 10^5 samples at least to mean anything
+(the default is 10^6). Pin the harness to an idle, isolated CPU with -c to
+keep the tail to the engine's own. -x walks a buffer of that many KB
+between samples, for cold-cache figures. -w writes every sample, as
+engine,op,class,time lines.
+
+In the default build ct is the constant-time engine: its S-box is a logic
+circuit rather than table lookups, and the CTR counter update is the same
+length whatever the counter holds. Building the library with
+-DSBOX_CIRCUIT=1 makes the table and batch engines table-free as well:
+  make clean && make wcet CFLAGS="-Wall -Werror -DSBOX_CIRCUIT=1"
+
+*/
+
+#define _GNU_SOURCE
+
+#include <math.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "aes.h"
+#include "aes_backend.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+  #include <x86intrin.h>
+  #define HAVE_TSC 1
+#endif
+
+#define MAX_ENGINES 8
+#define T_THRESHOLD 4.5
+// Blocks run before the samples of each engine and op, to warm up.
+#define WARMUP 10000
+// Inputs made at a time, ahead of timing them.
+#define CHUNK 4096
+
+enum op
+{
+  OP_ENC = 0,
+  OP_DEC,
+  OP_CTR,
+  OPS
+};
+
+static const char* const op_names[OPS] = { "enc", "dec", "ctr" };
+
+static const uint8_t key[16] = { 0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c };
+
+struct stats
+{
+  uint32_t min, p50, p99, p99999, max;
+  double t;
+};
+
+static const struct aes_backend* engines[MAX_ENGINES];
+static unsigned nengines;
+static int ops[OPS];
+static uint64_t seed = 0x2545f4914f6cdd1dull;
+static uint8_t* evict;
+static size_t evict_size;
+
+static uint64_t next_random(void)
+{
+  seed ^= seed >> 12;
+  seed ^= seed << 25;
+  seed ^= seed >> 27;
+  return seed * 0x2545f4914f6cdd1dull;
+}
+
+static inline uint64_t tick(void)
+{
+#if defined(HAVE_TSC)
+  uint64_t t;
+  _mm_lfence();
+  t = __rdtsc();
+  _mm_lfence();
+  return t;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+// The least a timed region costs with nothing in it.
+static uint64_t timer_overhead(void)
+{
+  uint64_t best = UINT64_MAX, t0, t1;
+  int i;
+
+  for (i = 0; i < 100000; ++i)
+  {
+    t0 = tick();
+    t1 = tick();
+    best = (t1 - t0 < best) ? t1 - t0 : best;
+  }
+  return best;
+}
+
+static int compare_u32(const void* a, const void* b)
+{
+  const uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+  return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of sorted samples.
+static uint32_t percentile(const uint32_t* sorted, uint32_t n, double p)
+{
+  uint64_t rank = (uint64_t)ceil(p * n / 100.0);
+  return sorted[(rank > 0) ? rank - 1 : 0];
+}
+
+// Times n blocks of op on backend b into samples, each with its class. The
+// inputs are made a chunk ahead, so that the code run between samples is the
+// same for both classes.
+static void measure(const struct aes_backend* b, enum op op, uint32_t* samples, uint8_t* classes, uint32_t n,
+                    uint64_t overhead)
+{
+  static uint8_t inputs[CHUNK][AES_BLOCKLEN];
+  static uint8_t chunk_classes[CHUNK];
+  uint8_t block[AES_BLOCKLEN];
+  struct AES_ctx ctx;
+  uint64_t t0, t1, r[2];
+  uint32_t k, c, m;
+  size_t j;
+
+  AES_init_ctx_iv(&ctx, key, key);
+  for (k = 0; k < WARMUP + n; k += m)
+  {
+    m = (WARMUP + n - k < CHUNK) ? WARMUP + n - k : CHUNK;
+    for (c = 0; c < m; ++c)
+    {
+      chunk_classes[c] = (uint8_t)(next_random() & 1);
+      if (chunk_classes[c] == 0)
+      {
+        memset(inputs[c], (op == OP_CTR) ? 0xff : 0, AES_BLOCKLEN);
+      }
+      else
+      {
+        r[0] = next_random();
+        r[1] = next_random();
+        memcpy(inputs[c], r, AES_BLOCKLEN);
+      }
+    }
+    for (c = 0; c < m; ++c)
+    {
+      if (op == OP_CTR)
+      {
+        memcpy(ctx.Iv, inputs[c], AES_BLOCKLEN);
+        memset(block, 0, sizeof(block));
+      }
+      else
+      {
+        memcpy(block, inputs[c], AES_BLOCKLEN);
+      }
+      for (j = 0; j < evict_size; j += 64)
+      {
+        ++evict[j];
+      }
+
+      t0 = tick();
+      switch (op)
+      {
+      case OP_ENC: b->ecb_encrypt(&ctx, block, 1); break;
+      case OP_DEC: b->ecb_decrypt(&ctx, block, 1); break;
+      default:     b->ctr_xcrypt(&ctx, block, AES_BLOCKLEN); break;
+      }
+      t1 = tick();
+
+      if (k + c >= WARMUP)
+      {
+        t1 -= t0;
+        t1 = (t1 > overhead) ? t1 - overhead : 0;
+        samples[k + c - WARMUP] = (t1 < UINT32_MAX) ? (uint32_t)t1 : UINT32_MAX;
+        classes[k + c - WARMUP] = chunk_classes[c];
+      }
+    }
+  }
+}
+
+// Welch's t between the two classes, over the samples up to crop.
+static double welch_t(const uint32_t* samples, const uint8_t* classes, uint32_t n, uint32_t crop)
+{
+  double count[2] = { 0, 0 }, mean[2] = { 0, 0 }, m2[2] = { 0, 0 }, d, var;
+  uint32_t i;
+  uint8_t c;
+
+  for (i = 0; i < n; ++i)
+  {
+    if (samples[i] > crop)
+    {
+      continue;
+    }
+    c = classes[i];
+    count[c] += 1;
+    d = samples[i] - mean[c];
+    mean[c] += d / count[c];
+    m2[c] += d * (samples[i] - mean[c]);
+  }
+  if ((count[0] < 2) || (count[1] < 2))
+  {
+    return 0;
+  }
+  var = m2[0] / (count[0] - 1) / count[0] + m2[1] / (count[1] - 1) / count[1];
+  return (var > 0) ? (mean[0] - mean[1]) / sqrt(var) : 0;
+}
+
+static void summarize(uint32_t* samples, const uint8_t* classes, uint32_t* sorted, uint32_t n, struct stats* s)
+{
+  memcpy(sorted, samples, (size_t)n * sizeof(*sorted));
+  qsort(sorted, n, sizeof(*sorted), compare_u32);
+  s->min = sorted[0];
+  s->p50 = percentile(sorted, n, 50);
+  s->p99 = percentile(sorted, n, 99);
+  s->p99999 = percentile(sorted, n, 99.999);
+  s->max = sorted[n - 1];
+  s->t = welch_t(samples, classes, n, s->p99);
+}
+
+static int parse_engines(const char* list)
+{
+  char names[128], *name, *save = NULL;
+  unsigned i;
+
+  if (list == NULL)
+  {
+    for (i = 0; (i < aes_backend_count()) && (nengines < MAX_ENGINES); ++i)
+    {
+      if (aes_backend_get(i)->available())
+      {
+        engines[nengines++] = aes_backend_get(i);
+      }
+    }
+    return 0;
+  }
+  snprintf(names, sizeof(names), "%s", list);
+  for (name = strtok_r(names, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save))
+  {
+    const struct aes_backend* backend = aes_backend_find(name);
+    if ((backend == NULL) || !backend->available() || (nengines == MAX_ENGINES))
+    {
+      fprintf(stderr, "wcet: engine %s is unknown or not available here\n", name);
+      return -1;
+    }
+    engines[nengines++] = backend;
+  }
+  return 0;
+}
+
+static int parse_ops(const char* list)
+{
+  char names[64], *name, *save = NULL;
+  int o;
+
+  if (list == NULL)
+  {
+    for (o = 0; o < OPS; ++o)
+    {
+      ops[o] = 1;
+    }
+    return 0;
+  }
+  snprintf(names, sizeof(names), "%s", list);
+  for (name = strtok_r(names, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save))
+  {
+    for (o = 0; (o < OPS) && (strcmp(name, op_names[o]) != 0); ++o)
+      ;
+    if (o == OPS)
+    {
+      fprintf(stderr, "wcet: unknown op %s\n", name);
+      return -1;
+    }
+    ops[o] = 1;
+  }
+  return 0;
+}
+
+int main(int argc, char** argv)
+{
+  const char *engine_list = NULL, *op_list = NULL, *csv_path = NULL;
+  uint32_t n = 1000000, *samples, *sorted, i;
+  uint8_t* classes;
+  uint64_t overhead;
+  FILE* csv = NULL;
+  struct stats s;
+  unsigned e;
+  int opt, cpu = -1, o;
+
+  while ((opt = getopt(argc, argv, "e:o:n:c:x:s:w:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'e': engine_list = optarg; break;
+    case 'o': op_list = optarg; break;
+    case 'n': n = (uint32_t)strtoul(optarg, NULL, 0); break;
+    case 'c': cpu = atoi(optarg); break;
+    case 'x': evict_size = (size_t)strtoul(optarg, NULL, 0) * 1024; break;
+    case 's': seed = strtoull(optarg, NULL, 0) | 1; break;
+    case 'w': csv_path = optarg; break;
+    default:
+      fprintf(stderr, "usage: %s [-e engine,...] [-o op,...] [-n samples] [-c cpu] [-x kbytes] [-s seed] [-w samples.csv]\n",
+              argv[0]);
+      return 2;
+    }
+  }
+  if ((n == 0) || (parse_engines(engine_list) != 0) || (parse_ops(op_list) != 0))
+  {
+    return 2;
+  }
+  if (cpu >= 0)
+  {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0)
+    {
+      perror("sched_setaffinity");
+      return 2;
+    }
+  }
+  samples = malloc((size_t)n * sizeof(*samples));
+  sorted = malloc((size_t)n * sizeof(*sorted));
+  classes = malloc(n);
+  evict = (evict_size > 0) ? calloc(1, evict_size) : NULL;
+  if ((samples == NULL) || (sorted == NULL) || (classes == NULL) || ((evict_size > 0) && (evict == NULL)))
+  {
+    fprintf(stderr, "wcet: out of memory\n");
+    return 2;
+  }
+  if ((csv_path != NULL) && ((csv = fopen(csv_path, "w")) == NULL))
+  {
+    perror(csv_path);
+    return 2;
+  }
+
+  overhead = timer_overhead();
+#if defined(HAVE_TSC)
+  printf("wcet: %u samples per line, in TSC cycles; timer overhead %u taken off\n", n, (unsigned)overhead);
+#else
+  printf("wcet: %u samples per line, in ns; timer overhead %u taken off\n", n, (unsigned)overhead);
+#endif
+  printf("%-8s %-4s %8s %8s %8s %9s %10s %9s %8s\n", "engine", "op", "min", "median", "p99", "p99.999", "max", "jitter", "t");
+  for (e = 0; e < nengines; ++e)
+  {
+    for (o = 0; o < OPS; ++o)
+    {
+      if (!ops[o])
+      {
+        continue;
+      }
+      measure(engines[e], (enum op)o, samples, classes, n, overhead);
+      summarize(samples, classes, sorted, n, &s);
+      printf("%-8s %-4s %8u %8u %8u %9u %10u %9u %8.2f%s\n", engines[e]->name, op_names[o], s.min, s.p50, s.p99,
+             s.p99999, s.max, s.p99999 - s.min, s.t, (fabs(s.t) > T_THRESHOLD) ? "  data-dependent" : "");
+      fflush(stdout);
+      for (i = 0; (csv != NULL) && (i < n); ++i)
+      {
+        fprintf(csv, "%s,%s,%s,%u\n", engines[e]->name, op_names[o], classes[i] ? "random" : "fixed", samples[i]);
+      }
+    }
+  }
+  if ((csv != NULL) && (fclose(csv) != 0))
+  {
+    perror(csv_path);
+    return 2;
+  }
+  free(evict);
+  free(classes);
+  free(sorted);
+  free(samples);
+  return 0;
+}